@@ -89,6 +89,113 @@ SOFTWARE.
 typedef void (*voidProcp)();
 
 static void miRegionOp();
+
+/*
+ * Arrays of rectangles are allocated with miAllocRects() and released with
+ * miFreeRects().  Each array is preceded by a BOX whose x1 gives its size
+ * class, and arrays of up to 8 << (NPOOLCLASSES-1) rectangles are kept on
+ * per-thread free lists when released, since regions are created and
+ * combined many times for every update.  A region may also be given space
+ * for a few rectangles by its owner (see XInitRegion), which is used
+ * whenever the region is small enough and is never freed.
+ */
+
+#define NPOOLCLASSES 8
+#define POOLDEPTH 8
+
+#if defined(_MSC_VER)
+#define POOL_THREAD __declspec(thread)
+#elif defined(__GNUC__)
+#define POOL_THREAD __thread
+#endif
+
+#ifdef POOL_THREAD
+static POOL_THREAD BOX *pool[NPOOLCLASSES][POOLDEPTH];
+static POOL_THREAD int poolCount[NPOOLCLASSES];
+#endif
+
+/* Allocate an array for at least *size rectangles, setting *size to the
+   number actually allocated */
+static BOX *
+miAllocRects(size)
+    long *size;
+{
+    BOX *p;
+    long n = 8;
+    int c = 0;
+
+    while (n < *size && c < NPOOLCLASSES) {
+	n <<= 1;
+	c++;
+    }
+    if (c == NPOOLCLASSES)
+	n = *size;
+#ifdef POOL_THREAD
+    else if (poolCount[c] > 0) {
+	*size = n;
+	return pool[c][--poolCount[c]] + 1;
+    }
+#endif
+    if (! (p = (BOX *) Xmalloc((unsigned) (sizeof(BOX) * (n + 1)))))
+	return (BOX *) NULL;
+    p->x1 = c;
+    *size = n;
+    return p + 1;
+}
+
+static void
+miFreeRects(reg, rects)
+    Region reg;
+    BOX *rects;
+{
+    BOX *p;
+
+    if (!rects || rects == reg->inlineRects)
+	return;
+    p = rects - 1;
+#ifdef POOL_THREAD
+    if (p->x1 < NPOOLCLASSES && poolCount[p->x1] < POOLDEPTH) {
+	pool[p->x1][poolCount[p->x1]++] = p;
+	return;
+    }
+#endif
+    Xfree((char *) p);
+}
+
+/* Make room for at least size rectangles, keeping the existing ones */
+static int
+miGrowRects(reg, size)
+    Region reg;
+    long size;
+{
+    BOX *rects;
+
+    if (size <= reg->size)
+	return 1;
+    if (reg->rects != reg->inlineRects && (reg->rects - 1)->x1 == NPOOLCLASSES)
+    {
+	/* Too large for the pool, so let the heap extend it in place */
+	if (! (rects = (BOX *) Xrealloc((char *) (reg->rects - 1),
+				(unsigned) (sizeof(BOX) * (size + 1)))))
+	    return 0;
+	reg->rects = rects + 1;
+	reg->size = size;
+	return 1;
+    }
+    if (size <= reg->inlineSize)
+	rects = reg->inlineRects;
+    else if (! (rects = miAllocRects(&size)))
+	return 0;
+    if (rects != reg->rects) {
+	memcpy((char *) rects, (char *) reg->rects,
+	       (int) (reg->numRects * sizeof(BOX)));
+	miFreeRects(reg, reg->rects);
+    }
+    reg->rects = rects;
+    reg->size = size;
+    return 1;
+}
+
 /*	Create a new empty region	*/
 Region
 XCreateRegion()
@@ -97,7 +204,8 @@ XCreateRegion()
 
     if (! (temp = ( Region )Xmalloc( (unsigned) sizeof( REGION ))))
 	return (Region) NULL;
-    if (! (temp->rects = ( BOX * )Xmalloc( (unsigned) sizeof( BOX )))) {
+    temp->size = 1;
+    if (! (temp->rects = miAllocRects(&temp->size))) {
 	Xfree((char *) temp);
 	return (Region) NULL;
     }
@@ -106,10 +214,51 @@ XCreateRegion()
     temp->extents.y1 = 0;
     temp->extents.x2 = 0;
     temp->extents.y2 = 0;
-    temp->size = 1;
+    temp->inlineRects = NULL;
+    temp->inlineSize = 0;
     return( temp );
 }
 
+/*	Set up a region in storage supplied by the caller, using inlineRects
+	for up to inlineSize rectangles before allocating any	*/
+void
+XInitRegion(r, inlineRects, inlineSize)
+    Region r;
+    BOX *inlineRects;
+    long inlineSize;
+{
+    r->rects = inlineRects;
+    r->size = inlineSize;
+    r->numRects = 0;
+    r->extents.x1 = 0;
+    r->extents.y1 = 0;
+    r->extents.x2 = 0;
+    r->extents.y2 = 0;
+    r->inlineRects = inlineRects;
+    r->inlineSize = inlineSize;
+}
+
+/*	Free anything allocated for a region set up by XInitRegion	*/
+void
+XReleaseRegion(r)
+    Region r;
+{
+    miFreeRects(r, r->rects);
+    r->rects = r->inlineRects;
+    r->size = r->inlineSize;
+    r->numRects = 0;
+}
+
+/*	Make room in a region for size rectangles, discarding its contents	*/
+int
+XReserveRegion(r, size)
+    Region r;
+    long size;
+{
+    r->numRects = 0;
+    return miGrowRects(r, size);
+}
+
 int
 XClipBox( r, rect )
     Region r;
@@ -132,6 +281,8 @@ XUnionRectWithRegion(rect, source, dest)
     if (!rect->width || !rect->height)
 	return 0;
     region.rects = &region.extents;
+    region.inlineRects = &region.extents;
+    region.inlineSize = 1;
     region.numRects = 1;
     region.extents.x1 = rect->x;
     region.extents.y1 = rect->y;
@@ -244,7 +395,7 @@ int
 XDestroyRegion( r )
     Region r;
 {
-    Xfree( (char *) r->rects );
+    miFreeRects(r, r->rects);
     Xfree( (char *) r );
     return 1;
 }
@@ -489,18 +640,9 @@ miRegionCopy(dstrgn, rgn)
     {  
         if (dstrgn->size < rgn->numRects)
         {
-            if (dstrgn->rects)
-            {
-		BOX *prevRects = dstrgn->rects;
-		
-                if (! (dstrgn->rects = (BOX *)
-		       Xrealloc((char *) dstrgn->rects,
-				(unsigned) rgn->numRects * (sizeof(BOX))))) {
-		    Xfree(prevRects);
-		    return;
-		}
-            }
-            dstrgn->size = rgn->numRects;
+            dstrgn->numRects = 0;
+            if (! miGrowRects(dstrgn, rgn->numRects))
+		return;
 	}
         dstrgn->numRects = rgn->numRects;
         dstrgn->extents.x1 = rgn->extents.x1;
@@ -873,8 +1015,8 @@ miRegionOp(newReg, reg1, reg2, overlapFunc,  nonOverlap1Func, nonOverlap2Func)
      */
     newReg->size = max(reg1->numRects,reg2->numRects) * 2;
 
-    if (! (newReg->rects = (BoxPtr)
-	   Xmalloc ((unsigned) (sizeof(BoxRec) * newReg->size)))) {
+    if (! (newReg->rects = miAllocRects(&newReg->size))) {
+	newReg->rects = oldRects;
 	newReg->size = 0;
 	return;
     }
@@ -1052,36 +1194,36 @@ miRegionOp(newReg, reg1, reg2, overlapFunc,  nonOverlap1Func, nonOverlap2Func)
     }
 
     /*
-     * A bit of cleanup. To keep regions from growing without bound,
-     * we shrink the array of rectangles to match the new number of
-     * rectangles in the region. This never goes to 0, however...
-     *
-     * Only do this stuff if the number of rectangles allocated is more than
-     * twice the number of rectangles in the region (a simple optimization...).
+     * A bit of cleanup. The old rectangles are no longer needed, so if the
+     * new ones fit in the space supplied by the region's owner then they
+     * are moved there. Otherwise, to keep regions from growing without
+     * bound, the array is replaced by a smaller one if the number of
+     * rectangles allocated is more than twice the number in the region.
      */
-    if (newReg->numRects < (newReg->size >> 1))
+    miFreeRects(newReg, oldRects);
+    if (newReg->inlineRects && newReg->numRects <= newReg->inlineSize)
+    {
+	BoxPtr prev_rects = newReg->rects;
+	memcpy((char *) newReg->inlineRects, (char *) prev_rects,
+	       (int) (newReg->numRects * sizeof(BoxRec)));
+	newReg->rects = newReg->inlineRects;
+	newReg->size = newReg->inlineSize;
+	miFreeRects(newReg, prev_rects);
+    }
+    else if (newReg->numRects < (newReg->size >> 1))
     {
-	if (REGION_NOT_EMPTY(newReg))
+	BoxPtr prev_rects = newReg->rects;
+	long size = newReg->numRects;
+	if ((newReg->rects = miAllocRects(&size)) != NULL)
 	{
-	    BoxPtr prev_rects = newReg->rects;
-	    newReg->size = newReg->numRects;
-	    newReg->rects = (BoxPtr) Xrealloc ((char *) newReg->rects,
-				   (unsigned) (sizeof(BoxRec) * newReg->size));
-	    if (! newReg->rects)
-		newReg->rects = prev_rects;
+	    memcpy((char *) newReg->rects, (char *) prev_rects,
+		   (int) (newReg->numRects * sizeof(BoxRec)));
+	    newReg->size = size;
+	    miFreeRects(newReg, prev_rects);
 	}
 	else
-	{
-	    /*
-	     * No point in doing the extra work involved in an Xrealloc if
-	     * the region is empty
-	     */
-	    newReg->size = 1;
-	    Xfree((char *) newReg->rects);
-	    newReg->rects = (BoxPtr) Xmalloc(sizeof(BoxRec));
-	}
+	    newReg->rects = prev_rects;
     }
-    Xfree ((char *) oldRects);
     return;
 }
 
@@ -78,6 +78,8 @@ typedef struct _XRegion {
     long numRects;
     BOX *rects;
     BOX extents;
+    BOX *inlineRects;		/* space supplied by the owner, never freed */
+    long inlineSize;
 } REGION;
 
 /* Xutil.h contains the declaration: 
@@ -113,11 +115,9 @@ typedef struct _XRegion {
  */
 #define MEMCHECK(reg, rect, firstrect){\
         if ((reg)->numRects >= ((reg)->size - 1)){\
-          (firstrect) = (BOX *) Xrealloc \
-          ((char *)(firstrect), (unsigned) (2 * (sizeof(BOX)) * ((reg)->size)));\
-          if ((firstrect) == 0)\
+          if (! miGrowRects((reg), 2 * (reg)->size))\
             return(0);\
-          (reg)->size *= 2;\
+          (firstrect) = (reg)->rects;\
           (rect) = &(firstrect)[(reg)->numRects];\
          }\
        }
@@ -187,4 +187,37 @@ typedef struct _POINTBLOCK {
     struct _POINTBLOCK *next;
 } POINTBLOCK;
 
+/*
+ * Regions kept in storage supplied by the caller, as rfb::Region does
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern void XInitRegion(
+#if NeedFunctionPrototypes
+    REGION*		/* r */,
+    BOX*		/* inlineRects */,
+    long		/* inlineSize */
+#endif
+);
+
+extern void XReleaseRegion(
+#if NeedFunctionPrototypes
+    REGION*		/* r */
+#endif
+);
+
+extern int XReserveRegion(
+#if NeedFunctionPrototypes
+    REGION*		/* r */,
+    long		/* size */
+#endif
+);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -134,6 +134,14 @@ namespace network {
     //   resources to be tidied up.
     virtual void processSocketEvent(network::Socket* sock) = 0;
 
+    // processSocketWriteEvent() tells the server that a Socket which has
+    //   output queued in a non-blocking OutStream can be written to again.
+    //   As with processSocketEvent(), the implementation can call shutdown()
+    //   on the Socket.  By default it just flushes the OutStream.
+    virtual void processSocketWriteEvent(network::Socket* sock) {
+      sock->outStream().flush();
+    }
+
     // checkTimeouts() allows the server to check socket timeouts, etc.  The
     //   return value is the number of milliseconds to wait before
     //   checkTimeouts() should be called again.  If this number is zero then
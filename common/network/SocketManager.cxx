@@ -0,0 +1,331 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- SocketManager.cxx
+
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#ifdef __linux__
+#include <sys/epoll.h>
+#define HAVE_EPOLL
+#else
+#include <poll.h>
+#endif
+
+#include <network/SocketManager.h>
+#include <rfb/util.h>
+#include <rfb/Timer.h>
+#include <rfb/LogWriter.h>
+
+using namespace network;
+
+static rfb::LogWriter vlog("SocketManager");
+
+// The most events to collect from each wait, and the most connections to
+// accept from one listener at once
+static const int maxEvents = 256;
+static const int maxAccepts = 32;
+
+static void setNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    throw SocketException("unable to make socket non-blocking", errno);
+}
+
+
+// -=- SocketManager
+
+SocketManager::SocketManager() : epollFd(-1) {
+#ifdef HAVE_EPOLL
+  epollFd = epoll_create(maxEvents);
+  if (epollFd < 0)
+    throw SocketException("unable to create epoll instance", errno);
+  fcntl(epollFd, F_SETFD, FD_CLOEXEC);
+#endif
+}
+
+SocketManager::~SocketManager() {
+  while (!connections.empty())
+    remSocket(connections.begin()->second.sock);
+  while (!listeners.empty())
+    remListener(listeners.begin()->second.sock);
+  if (epollFd >= 0)
+    close(epollFd);
+}
+
+
+void SocketManager::watch(int fd, bool connection) {
+#ifdef HAVE_EPOLL
+  // Connections are edge-triggered, so being writable is only reported
+  // after a write has found the socket full
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  if (connection)
+    ev.events |= EPOLLOUT | EPOLLET;
+  ev.data.fd = fd;
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    throw SocketException("unable to add socket to epoll", errno);
+#endif
+}
+
+
+void SocketManager::addListener(SocketListener* sock, SocketServer* srvr) {
+  // Listeners are level-triggered, so that any connections left after
+  // accepting maxAccepts of them are picked up by the next wait
+  try {
+    setNonBlocking(sock->getFd());
+    watch(sock->getFd(), false);
+  } catch (rdr::Exception& e) {
+    delete sock;
+    vlog.error(e.str());
+    throw;
+  }
+
+  ListenInfo li;
+  li.sock = sock;
+  li.server = srvr;
+  listeners[sock->getFd()] = li;
+}
+
+void SocketManager::remListener(SocketListener* sock) {
+  std::map<int,ListenInfo>::iterator i;
+  for (i=listeners.begin(); i!=listeners.end(); i++) {
+    if (i->second.sock == sock) {
+#ifdef HAVE_EPOLL
+      epoll_ctl(epollFd, EPOLL_CTL_DEL, i->first, 0);
+#endif
+      delete sock;
+      listeners.erase(i);
+      return;
+    }
+  }
+  throw rdr::Exception("Listener not registered");
+}
+
+
+void SocketManager::addSocket(Socket* sock, SocketServer* srvr, bool outgoing) {
+  try {
+    setNonBlocking(sock->getFd());
+    watch(sock->getFd(), true);
+  } catch (rdr::Exception& e) {
+    delete sock;
+    vlog.error("Unable to add connection: %s", e.str());
+    return;
+  }
+
+  ConnInfo ci;
+  ci.sock = sock;
+  ci.server = srvr;
+  ci.ready = false;
+  connections[sock->getFd()] = ci;
+  srvr->addSocket(sock, outgoing);
+
+  // Data may have arrived before the socket was watched, in which case there
+  // will be no edge to report it
+  connections[sock->getFd()].ready = true;
+  ready.push_back(sock->getFd());
+}
+
+void SocketManager::remSocket(Socket* sock) {
+  std::map<int,ConnInfo>::iterator i = connections.find(sock->getFd());
+  if (i == connections.end() || i->second.sock != sock)
+    throw rdr::Exception("Socket not registered");
+
+  i->second.server->removeSocket(sock);
+#ifdef HAVE_EPOLL
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, i->first, 0);
+#endif
+  connections.erase(i);
+  delete sock;
+}
+
+
+int SocketManager::checkTimeouts() {
+  int timeout = rfb::Timer::checkTimeouts();
+
+  std::map<int,ListenInfo>::iterator i;
+  for (i=listeners.begin(); i!=listeners.end(); i++)
+    rfb::soonestTimeout(&timeout, i->second.server->checkTimeouts());
+
+  std::list<Socket*> shutdownSocks;
+  std::map<int,ConnInfo>::iterator j;
+  for (j=connections.begin(); j!=connections.end(); j++) {
+    if (j->second.sock->isShutdown())
+      shutdownSocks.push_back(j->second.sock);
+  }
+
+  std::list<Socket*>::iterator k;
+  for (k=shutdownSocks.begin(); k!=shutdownSocks.end(); k++)
+    remSocket(*k);
+
+  return timeout;
+}
+
+
+void SocketManager::acceptConnections(int fd) {
+  ListenInfo li = listeners[fd];
+  for (int i = 0; i < maxAccepts; i++) {
+    Socket* new_sock;
+    try {
+      new_sock = li.sock->accept();
+    } catch (rdr::SystemException& e) {
+      if (e.err != EAGAIN && e.err != EWOULDBLOCK && e.err != EINTR)
+        vlog.error(e.str());
+      return;
+    }
+    // A connection refused by the listener's filter gives no socket
+    if (new_sock)
+      addSocket(new_sock, li.server, false);
+  }
+}
+
+// stillReadable() returns true if the socket has data left to read, or has
+// been closed by the other end, either of which its server must deal with.
+
+bool SocketManager::stillReadable(Socket* sock) {
+  try {
+    return sock->inStream().checkNoWait(1);
+  } catch (rdr::Exception&) {
+    return true;
+  }
+}
+
+
+void SocketManager::processEvents(int timeoutms) {
+  int timeout = checkTimeouts();
+  if (timeout == 0)
+    timeout = -1;
+  if (timeoutms != -1 && (timeout == -1 || timeoutms < timeout))
+    timeout = timeoutms;
+  if (!ready.empty())
+    timeout = 0;
+
+  // - Wait for events, collecting the fds which are readable or writable
+  std::vector<int> readable, writable;
+#ifdef HAVE_EPOLL
+  struct epoll_event events[maxEvents];
+  int n = epoll_wait(epollFd, events, maxEvents, timeout);
+  if (n < 0 && errno != EINTR)
+    throw SocketException("epoll_wait", errno);
+  for (int e = 0; e < n; e++) {
+    if (events[e].events & EPOLLOUT)
+      writable.push_back(events[e].data.fd);
+    if (events[e].events & ~EPOLLOUT)
+      readable.push_back(events[e].data.fd);
+  }
+#else
+  std::vector<struct pollfd> fds;
+  struct pollfd pfd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  std::map<int,ListenInfo>::iterator li;
+  for (li=listeners.begin(); li!=listeners.end(); li++) {
+    pfd.fd = li->first;
+    fds.push_back(pfd);
+  }
+  std::map<int,ConnInfo>::iterator ci;
+  for (ci=connections.begin(); ci!=connections.end(); ci++) {
+    pfd.fd = ci->first;
+    pfd.events = POLLIN;
+    if (ci->second.sock->outStream().bufferUsage())
+      pfd.events |= POLLOUT;
+    fds.push_back(pfd);
+  }
+  int n = poll(fds.empty() ? 0 : &fds[0], fds.size(), timeout);
+  if (n < 0 && errno != EINTR)
+    throw SocketException("poll", errno);
+  for (size_t f = 0; n > 0 && f < fds.size(); f++) {
+    if (fds[f].revents & POLLOUT)
+      writable.push_back(fds[f].fd);
+    if (fds[f].revents & ~POLLOUT)
+      readable.push_back(fds[f].fd);
+  }
+#endif
+
+  // - Send queued output to sockets which can take it
+  std::vector<int>::iterator w;
+  for (w = writable.begin(); w != writable.end(); w++) {
+    std::map<int,ConnInfo>::iterator i = connections.find(*w);
+    if (i == connections.end())
+      continue;
+    ConnInfo ci = i->second;
+    if (ci.sock->isShutdown() || !ci.sock->outStream().bufferUsage())
+      continue;
+    try {
+      ci.server->processSocketWriteEvent(ci.sock);
+    } catch (rdr::Exception& e) {
+      vlog.error(e.str());
+      ci.sock->shutdown();
+    }
+    if (ci.sock->isShutdown())
+      remSocket(ci.sock);
+  }
+
+  // - Accept new connections, and queue sockets with data
+  std::vector<int>::iterator r;
+  for (r = readable.begin(); r != readable.end(); r++) {
+    if (listeners.count(*r)) {
+      acceptConnections(*r);
+      continue;
+    }
+    std::map<int,ConnInfo>::iterator i = connections.find(*r);
+    if (i != connections.end() && !i->second.ready) {
+      i->second.ready = true;
+      ready.push_back(*r);
+    }
+  }
+
+  // - Give each queued socket one turn.  Since connected sockets are
+  //   edge-triggered, any which still have data are queued again.
+  int turns = ready.size();
+  while (turns-- > 0) {
+    int fd = ready.front();
+    ready.pop_front();
+    std::map<int,ConnInfo>::iterator i = connections.find(fd);
+    if (i == connections.end())
+      continue;
+    ConnInfo ci = i->second;
+    i->second.ready = false;
+
+    // The server may have refused the socket as soon as it was added
+    if (ci.sock->isShutdown()) {
+      remSocket(ci.sock);
+      continue;
+    }
+
+    try {
+      ci.server->processSocketEvent(ci.sock);
+    } catch (rdr::Exception& e) {
+      vlog.error(e.str());
+      ci.sock->shutdown();
+    }
+    if (ci.sock->isShutdown()) {
+      remSocket(ci.sock);
+      continue;
+    }
+    if (stillReadable(ci.sock)) {
+      connections[fd].ready = true;
+      ready.push_back(fd);
+    }
+  }
+}
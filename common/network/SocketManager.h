@@ -0,0 +1,93 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- SocketManager.h
+
+// Socket manager class for Unix, doing what rfb::win32::SocketManager does
+// on Windows.  Listening sockets and connected sockets are added along with
+// the network::SocketServer which serves them.  Incoming connections are
+// accepted and added to the listener's SocketServer, and the SocketServer's
+// processSocketEvent() is called whenever one of its sockets has data to
+// read.  processSocketWriteEvent() is called when a socket with output
+// queued in its OutStream can be written to.  On Linux epoll is used,
+// edge-triggered for connected sockets, so the cost of waiting does not grow
+// with the number of sockets.  Elsewhere poll() is used instead.  Sockets
+// are made non-blocking, which FdInStream and FdOutStream already cope with.
+
+#ifndef __NETWORK_SOCKET_MANAGER_H__
+#define __NETWORK_SOCKET_MANAGER_H__
+
+#include <list>
+#include <map>
+#include <network/Socket.h>
+
+namespace network {
+
+  class SocketManager {
+  public:
+    SocketManager();
+    virtual ~SocketManager();
+
+    // Add a listening socket.  Incoming connections will be added to the
+    // supplied SocketServer.  The SocketManager takes ownership of the
+    // listener.
+    void addListener(SocketListener* sock, SocketServer* srvr);
+
+    // Remove and delete a listening socket.
+    void remListener(SocketListener* sock);
+
+    // Add an already-connected socket, which is also added to the supplied
+    // SocketServer.  The SocketManager takes ownership of the socket, which
+    // is deleted once it has been shut down.
+    void addSocket(Socket* sock, SocketServer* srvr, bool outgoing=true);
+
+    // processEvents() waits for socket events and handles them.  It waits
+    // for no longer than the SocketServers' checkTimeouts() and any running
+    // rfb::Timers allow, nor than timeoutms milliseconds unless that is -1,
+    // and dispatches the Timers when they are due.  Sockets which still have
+    // data to read afterwards are handled again on the next call, in turn
+    // with any others, so that no one client can hold up the rest.
+    void processEvents(int timeoutms=-1);
+
+    int numSockets() { return connections.size(); }
+
+  protected:
+    int checkTimeouts();
+    void remSocket(Socket* sock);
+    void acceptConnections(int fd);
+    void watch(int fd, bool connection);
+    bool stillReadable(Socket* sock);
+
+    struct ConnInfo {
+      Socket* sock;
+      SocketServer* server;
+      bool ready;
+    };
+    struct ListenInfo {
+      SocketListener* sock;
+      SocketServer* server;
+    };
+    std::map<int, ListenInfo> listeners;
+    std::map<int, ConnInfo> connections;
+    std::list<int> ready;
+    int epollFd;
+  };
+
+}
+
+#endif
@@ -31,6 +31,7 @@
 #include <netdb.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <signal.h>
 #include <fcntl.h>
@@ -298,8 +299,9 @@ TcpListener::TcpListener(int port, bool localhostOnly, int sock, bool close_)
     throw SocketException("unable to bind listening socket", e);
   }
 
-  // - Set it to be a listening socket
-  if (listen(fd, 5) < 0) {
+  // - Set it to be a listening socket, with room to queue a burst of
+  //   connections, such as many viewers reconnecting at once
+  if (listen(fd, SOMAXCONN) < 0) {
     int e = errorNumber;
     closesocket(fd);
     throw SocketException("unable to set socket to listening mode", e);
@@ -0,0 +1,260 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// socketstress - loopback stress test for SocketManager.
+//
+// Opens a number of TCP connections to an echo server over the loopback
+// interface, all handled by one SocketManager in one thread.  Each client
+// keeps one small timestamped message in flight, sending the next as soon
+// as the echo of the last arrives, so the message rate shows how much work
+// the manager does per event.  A fraction of the messages ask the server to
+// close the connection, after which the client opens a new one, so that
+// accepting and removing sockets is exercised along with reading them.  The
+// server closes first so that the TIME_WAIT state is kept against the
+// listening port rather than using up the clients' ephemeral ports.  At the end it prints:
+//
+//   clients,seconds,messages,messagesPerSec,meanLatencyUs,maxLatencyUs,
+//   reconnects,errors
+//
+// Usage: socketstress [-clients N] [-time SECONDS] [-churn PERCENT]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <vector>
+#include <network/TcpSocket.h>
+#include <network/SocketManager.h>
+#include <rdr/types.h>
+
+using namespace network;
+
+static const int msgSize = 64;
+static const rdr::U8 msgFill = 0x5a;
+static const rdr::U8 msgClose = 0xc1;
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// A small linear congruential generator, so that every run sees the same
+// sequence of reconnects
+static unsigned int seed = 1;
+static int rnd(int n)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) % n;
+}
+
+
+// -=- EchoServer - the server end, writing back whatever it reads
+
+class EchoServer : public SocketServer {
+public:
+  virtual void addSocket(Socket* sock, bool outgoing) {}
+  virtual void removeSocket(Socket* sock) {}
+  virtual void processSocketEvent(Socket* sock) {
+    rdr::U8 buf[msgSize];
+    try {
+      while (sock->inStream().checkNoWait(msgSize)) {
+        sock->inStream().readBytes(buf, msgSize);
+        if (buf[msgSize-1] == msgClose) {
+          sock->shutdown();
+          return;
+        }
+        sock->outStream().writeBytes(buf, msgSize);
+      }
+      sock->outStream().flush();
+    } catch (rdr::EndOfStream&) {
+      sock->shutdown();
+    }
+  }
+  virtual int checkTimeouts() { return 0; }
+};
+
+
+// -=- LoadServer - the client ends, sending messages and timing the echoes
+
+class LoadServer : public SocketServer {
+public:
+  LoadServer(int churn_)
+    : churn(churn_), running(false), connections(0), messages(0),
+      reconnects(0), errors(0), totalLatency(0), maxLatency(0) {}
+
+  virtual void addSocket(Socket* sock, bool outgoing) {
+    connections++;
+    if (running)
+      send(sock, msgFill);
+    else
+      waiting.push_back(sock);
+  }
+  virtual void removeSocket(Socket* sock) {
+    connections--;
+  }
+  virtual void processSocketEvent(Socket* sock) {
+    rdr::U8 buf[msgSize];
+    try {
+      while (sock->inStream().checkNoWait(msgSize)) {
+        sock->inStream().readBytes(buf, msgSize);
+        received(buf);
+        if (!running)
+          return;
+        if (rnd(100) < churn) {
+          reconnects++;
+          send(sock, msgClose);
+          return;
+        }
+        send(sock, msgFill);
+      }
+    } catch (rdr::EndOfStream&) {
+      sock->shutdown();
+    } catch (rdr::Exception&) {
+      errors++;
+      sock->shutdown();
+    }
+  }
+  virtual int checkTimeouts() { return 0; }
+
+  // start() sends the first message on each of the sockets added so far
+  void start() {
+    running = true;
+    for (size_t i = 0; i < waiting.size(); i++)
+      send(waiting[i], msgFill);
+    waiting.clear();
+  }
+
+  int churn;
+  bool running;
+  int connections;
+  long messages, reconnects, errors;
+  double totalLatency, maxLatency;
+
+protected:
+  std::vector<Socket*> waiting;
+
+  void send(Socket* sock, rdr::U8 last) {
+    rdr::U8 buf[msgSize];
+    double t = now();
+    memset(buf, msgFill, msgSize);
+    buf[msgSize-1] = last;
+    memcpy(buf, &t, sizeof(t));
+    sock->outStream().writeBytes(buf, msgSize);
+    sock->outStream().flush();
+  }
+  void received(const rdr::U8* buf) {
+    double t;
+    memcpy(&t, buf, sizeof(t));
+    for (int i = sizeof(t); i < msgSize - 1; i++) {
+      if (buf[i] != msgFill) {
+        errors++;
+        return;
+      }
+    }
+    double latency = now() - t;
+    messages++;
+    totalLatency += latency;
+    if (latency > maxLatency)
+      maxLatency = latency;
+  }
+};
+
+
+static void usage(const char* prog)
+{
+  fprintf(stderr, "usage: %s [-clients N] [-time SECONDS] [-churn PERCENT]\n",
+          prog);
+  exit(1);
+}
+
+int main(int argc, char** argv)
+{
+  int clients = 1000;
+  double duration = 5;
+  int churn = 1;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-clients") == 0 && i + 1 < argc) {
+      clients = atoi(argv[++i]);
+      if (clients <= 0)
+        usage(argv[0]);
+    } else if (strcmp(argv[i], "-time") == 0 && i + 1 < argc) {
+      duration = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-churn") == 0 && i + 1 < argc) {
+      churn = atoi(argv[++i]);
+    } else {
+      usage(argv[0]);
+    }
+  }
+
+  // Both ends of every connection are in this process
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 &&
+      rl.rlim_cur < (rlim_t)clients * 2 + 64) {
+    rl.rlim_cur = clients * 2 + 64;
+    if (rl.rlim_max != RLIM_INFINITY && rl.rlim_cur > rl.rlim_max)
+      rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  try {
+    SocketManager manager;
+    EchoServer echo;
+    LoadServer load(churn);
+
+    TcpListener* listener = new TcpListener(0, true);
+    int port = listener->getMyPort();
+    manager.addListener(listener, &echo);
+
+    // Connect the clients, accepting as we go so that the listen queue
+    // does not fill.  No messages are sent until all are connected.
+    double start = now();
+    for (int i = 0; i < clients; i++) {
+      manager.addSocket(new TcpSocket("127.0.0.1", port), &load);
+      if (i % 64 == 63)
+        manager.processEvents(0);
+    }
+    fprintf(stderr, "%d clients connected in %.2fs\n", clients, now() - start);
+
+    start = now();
+    load.start();
+    while (now() - start < duration) {
+      manager.processEvents(100);
+      int missing = clients - load.connections;
+      for (int i = 0; i < missing; i++)
+        manager.addSocket(new TcpSocket("127.0.0.1", port), &load);
+    }
+    double elapsed = now() - start;
+    load.running = false;
+
+    printf("clients,seconds,messages,messagesPerSec,meanLatencyUs,"
+           "maxLatencyUs,reconnects,errors\n");
+    printf("%d,%.2f,%ld,%.0f,%.1f,%.1f,%ld,%ld\n", clients, elapsed,
+           load.messages, load.messages / elapsed,
+           load.messages ? load.totalLatency / load.messages * 1000000 : 0,
+           load.maxLatency * 1000000, load.reconnects, load.errors);
+    return load.errors ? 1 : 0;
+  } catch (rdr::Exception& e) {
+    fprintf(stderr, "socketstress: %s\n", e.str());
+    return 1;
+  }
+}
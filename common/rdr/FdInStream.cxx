@@ -34,6 +34,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <poll.h>
 #endif
 
 // XXX should use autoconf HAVE_SYS_SELECT_H
@@ -179,7 +180,8 @@ static void gettimeofday(struct timeval* tv, void*)
 // never attempts to read() unless select() indicates that the fd is readable -
 // this means it can be used on an fd which has been set non-blocking.  It also
 // has to cope with the annoying possibility of both select() and read()
-// returning EINTR.
+// returning EINTR.  Other than on Windows, poll() is used instead of select(),
+// since select() cannot handle fds beyond FD_SETSIZE.
 //
 
 int FdInStream::readWithTimeoutOrCallback(void* buf, int len, bool wait)
@@ -191,6 +193,7 @@ int FdInStream::readWithTimeoutOrCallback(void* buf, int len, bool wait)
   int n;
   while (true) {
     do {
+#ifdef _WIN32
       fd_set fds;
       struct timeval tv;
       struct timeval* tvp = &tv;
@@ -207,6 +210,13 @@ int FdInStream::readWithTimeoutOrCallback(void* buf, int len, bool wait)
       FD_ZERO(&fds);
       FD_SET(fd, &fds);
       n = select(fd+1, &fds, 0, 0, tvp);
+#else
+      struct pollfd pfd;
+      pfd.fd = fd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      n = poll(&pfd, 1, wait ? timeoutms : 0);
+#endif
     } while (n < 0 && errno == EINTR);
 
     if (n > 0) break;
@@ -25,11 +25,17 @@
 #define errno WSAGetLastError()
 #undef EINTR
 #define EINTR WSAEINTR
+#undef EWOULDBLOCK
+#define EWOULDBLOCK WSAEWOULDBLOCK
+#undef EAGAIN
+#define EAGAIN WSAEWOULDBLOCK
 #else
 #include <sys/types.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <poll.h>
 #endif
 
 #include <rdr/FdOutStream.h>
@@ -42,10 +48,10 @@ enum { DEFAULT_BUF_SIZE = 16384,
        MIN_BULK_SIZE = 1024 };
 
 FdOutStream::FdOutStream(int fd_, int timeoutms_, int bufSize_)
-  : fd(fd_), timeoutms(timeoutms_),
-    bufSize(bufSize_ ? bufSize_ : DEFAULT_BUF_SIZE), offset(0)
+  : fd(fd_), timeoutms(timeoutms_), blocking(true),
+    bufSize(bufSize_ ? bufSize_ : DEFAULT_BUF_SIZE), maxQueued(0), offset(0)
 {
-  ptr = start = new U8[bufSize];
+  ptr = start = sentUpTo = new U8[bufSize];
   end = start + bufSize;
 }
 
@@ -62,9 +68,28 @@ void FdOutStream::setTimeout(int timeoutms_) {
   timeoutms = timeoutms_;
 }
 
+void FdOutStream::setBlocking(bool blocking_, int maxQueued_)
+{
+  blocking = blocking_;
+  maxQueued = maxQueued_;
+  if (blocking)
+    return;
+
+  // Writes never wait for a non-blocking fd, so leaving it that way does no
+  // harm if blocking mode is chosen again later
+#ifdef _WIN32
+  u_long one = 1;
+  ioctlsocket(fd, FIONBIO, &one);
+#else
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    throw SystemException("fcntl", errno);
+#endif
+}
+
 void FdOutStream::writeBytes(const void* data, int length)
 {
-  if (length < MIN_BULK_SIZE) {
+  if (length < MIN_BULK_SIZE || !blocking) {
     OutStream::writeBytes(data, length);
     return;
   }
@@ -81,21 +106,57 @@ void FdOutStream::writeBytes(const void* data, int length)
   }
 }
 
+int FdOutStream::writeDirect(const void* data, int length)
+{
+  if (sentUpTo < ptr)
+    return 0;
+  int n;
+  if (blocking)
+    n = writeWithTimeout(data, length);
+  else
+    n = writeNoWait(data, length);
+  offset += n;
+  return n;
+}
+
 int FdOutStream::length()
 {
   return offset + ptr - start;
 }
 
+int FdOutStream::bufferUsage()
+{
+  return ptr - sentUpTo;
+}
+
 void FdOutStream::flush()
 {
-  U8* sentUpTo = start;
   while (sentUpTo < ptr) {
-    int n = writeWithTimeout((const void*) sentUpTo, ptr - sentUpTo);
+    int n;
+    if (blocking)
+      n = writeWithTimeout((const void*) sentUpTo, ptr - sentUpTo);
+    else
+      n = writeNoWait((const void*) sentUpTo, ptr - sentUpTo);
+    if (n == 0)
+      return;
     sentUpTo += n;
-    offset += n;
   }
 
-  ptr = start;
+  offset += ptr - start;
+  ptr = sentUpTo = start;
+}
+
+// compact() moves any data still queued to the start of the buffer.
+
+void FdOutStream::compact()
+{
+  if (sentUpTo == start)
+    return;
+  int queued = ptr - sentUpTo;
+  memmove(start, sentUpTo, queued);
+  offset += sentUpTo - start;
+  sentUpTo = start;
+  ptr = start + queued;
 }
 
 
@@ -106,6 +167,32 @@ int FdOutStream::overrun(int itemSize, int nItems)
 
   flush();
 
+  // In non-blocking mode there may still be data queued.  Make room after
+  // it by growing the buffer, unless the queue would then be too long, in
+  // which case wait for enough of it to be written.
+  if (end - ptr < itemSize)
+    compact();
+  while (end - ptr < itemSize) {
+    int queued = ptr - sentUpTo;
+    if (queued + itemSize <= maxQueued) {
+      int newSize = bufSize * 2;
+      while (newSize < queued + itemSize)
+        newSize *= 2;
+      if (newSize > maxQueued)
+        newSize = maxQueued;
+      U8* newStart = new U8[newSize];
+      memcpy(newStart, start, queued);
+      delete [] start;
+      start = sentUpTo = newStart;
+      ptr = start + queued;
+      end = start + newSize;
+      bufSize = newSize;
+    } else {
+      sentUpTo += writeWithTimeout((const void*) sentUpTo, queued);
+      compact();
+    }
+  }
+
   if (itemSize * nItems > end - ptr)
     nItems = (end - ptr) / itemSize;
 
@@ -119,7 +206,8 @@ int FdOutStream::overrun(int itemSize, int nItems)
 // bytes written.  It never attempts to write() unless select() indicates that
 // the fd is writable - this means it can be used on an fd which has been set
 // non-blocking.  It also has to cope with the annoying possibility of both
-// select() and write() returning EINTR.
+// select() and write() returning EINTR.  Other than on Windows, poll() is used
+// instead of select(), since select() cannot handle fds beyond FD_SETSIZE.
 //
 
 int FdOutStream::writeWithTimeout(const void* data, int length)
@@ -129,6 +217,7 @@ int FdOutStream::writeWithTimeout(const void* data, int length)
   do {
 
     do {
+#ifdef _WIN32
       fd_set fds;
       struct timeval tv;
       struct timeval* tvp = &tv;
@@ -151,6 +240,13 @@ int FdOutStream::writeWithTimeout(const void* data, int length)
       n = select(fd+1, 0, &fds, 0, tvp);
 #ifdef _WIN32_WCE
       u_long one = 0; ioctlsocket(fd, FIONBIO, &one);
+#endif
+#else
+      struct pollfd pfd;
+      pfd.fd = fd;
+      pfd.events = POLLOUT;
+      pfd.revents = 0;
+      n = poll(&pfd, 1, timeoutms);
 #endif
     } while (n < 0 && errno == EINTR);
 
@@ -171,3 +267,26 @@ int FdOutStream::writeWithTimeout(const void* data, int length)
 
   return n;
 }
+
+//
+// writeNoWait() writes up to the given length in bytes from the given buffer
+// to the file descriptor, which must be non-blocking.  It returns the number
+// of bytes written, which is zero if the fd cannot take any more just now.
+//
+
+int FdOutStream::writeNoWait(const void* data, int length)
+{
+  int n;
+
+  do {
+    n = ::write(fd, data, length);
+  } while (n < 0 && errno == EINTR);
+
+  if (n < 0) {
+    if (errno == EWOULDBLOCK || errno == EAGAIN)
+      return 0;
+    throw SystemException("write",errno);
+  }
+
+  return n;
+}
@@ -37,18 +37,40 @@ namespace rdr {
     void setTimeout(int timeoutms);
     int getFd() { return fd; }
 
+    // setBlocking(false) makes the fd non-blocking, and makes flush() write
+    // only as much as the fd will take without waiting.  The rest stays
+    // queued, so flush() must be called again once the fd is writable.  The
+    // queue grows as needed up to maxQueued bytes, beyond which writing to
+    // the stream waits for the fd as it would in blocking mode.
+    void setBlocking(bool blocking, int maxQueued=0);
+
     void flush();
     int length();
     void writeBytes(const void* data, int length);
 
+    // writeDirect() writes data straight to the fd, without copying it into
+    // the buffer, and returns the number of bytes written.  In non-blocking
+    // mode that may be fewer than asked, or none.  Nothing is written while
+    // earlier output is still queued, so flush() should be called first.
+    int writeDirect(const void* data, int length);
+
+    // bufferUsage() returns the number of bytes written to the stream which
+    // have not yet been written to the fd.
+    int bufferUsage();
+
   private:
     int overrun(int itemSize, int nItems);
     int writeWithTimeout(const void* data, int length);
+    int writeNoWait(const void* data, int length);
+    void compact();
     int fd;
     int timeoutms;
+    bool blocking;
     int bufSize;
+    int maxQueued;
     int offset;
     U8* start;
+    U8* sentUpTo;
   };
 
 }
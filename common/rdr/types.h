@@ -27,6 +27,11 @@ namespace rdr {
   typedef signed char S8;
   typedef signed short S16;
   typedef signed int S32;
+#ifdef _WIN32
+  typedef unsigned __int64 U64;
+#else
+  typedef unsigned long long U64;
+#endif
 
   class U8Array {
   public:
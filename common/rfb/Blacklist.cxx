@@ -15,6 +15,10 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
  * USA.
  */
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
 #include <rfb/Blacklist.h>
 #include <rfb/Configuration.h>
 
@@ -28,42 +32,321 @@ IntParameter Blacklist::initialTimeout("BlacklistTimeout",
                               "The initial timeout applied when a host is first black-listed.  "
                               "The host cannot re-attempt a connection until the timeout expires.",
                               10);
+IntParameter Blacklist::maxEntries("BlacklistSize",
+                              "The number of hosts to remember connection attempts from.  Those "
+                              "least recently seen are forgotten first, but black-listed hosts are "
+                              "only forgotten before their timeout expires if there is no room for a "
+                              "new host.",
+                              65536, 16);
+IntParameter Blacklist::prefixLength("BlacklistPrefix",
+                              "The number of leading bits of an IPv4 address which identify a host "
+                              "for black-listing.  Use 24 to treat each /24 network as one host.",
+                              32, 1, 32);
+IntParameter Blacklist::prefixLength6("BlacklistPrefix6",
+                              "The number of leading bits of an IPv6 address which identify a host "
+                              "for black-listing.  A single host is usually given a whole /64 "
+                              "network, so by default each /64 network is treated as one host.",
+                              64, 1, 128);
+IntParameter Blacklist::rate("BlacklistRate",
+                              "The number of connection attempts allowed from any individual host "
+                              "each minute, once BlacklistBurst attempts have been made (zero "
+                              "means no limit)",
+                              0, 0);
+IntParameter Blacklist::burst("BlacklistBurst",
+                              "The number of connection attempts allowed at once from any "
+                              "individual host when BlacklistRate is set",
+                              10, 1);
+
+// Timeouts stop doubling at a day, so that they cannot overflow
+static const unsigned int maxBlockTimeout = 24 * 60 * 60;
+
 
+// -=- Address parsing
 
-Blacklist::Blacklist() {
+// parseIPv4() reads a dotted-quad IPv4 address, returning false if name is
+// anything else.
+
+static bool parseIPv4(const char* name, rdr::U8 addr[4])
+{
+  for (int i = 0; i < 4; i++) {
+    int value = 0, digits = 0;
+    while (*name >= '0' && *name <= '9' && digits < 3) {
+      value = value * 10 + (*name++ - '0');
+      digits++;
+    }
+    if (!digits || value > 255)
+      return false;
+    addr[i] = value;
+    if (i < 3 && *name++ != '.')
+      return false;
+  }
+  return *name == 0;
 }
 
-Blacklist::~Blacklist() {
-  // Free the map keys
-  BlacklistMap::iterator i;
-  for (i=blm.begin(); i!=blm.end(); i++) {
-    strFree((char*)(*i).first);
+static int hexDigit(char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// parseIPv6() reads an IPv6 address in any of the usual forms, including
+// "::" and a trailing dotted quad, and ignoring any "%" zone, returning
+// false if name is anything else.
+
+static bool parseIPv6(const char* name, rdr::U8 addr[16])
+{
+  char buf[64];
+  int len = strcspn(name, "%");
+  if (len >= (int)sizeof(buf))
+    return false;
+  memcpy(buf, name, len);
+  buf[len] = 0;
+
+  rdr::U16 words[8];
+  int n = 0, gap = -1;
+  const char* p = buf;
+  if (p[0] == ':') {
+    if (p[1] != ':')
+      return false;
+    gap = 0;
+    p += 2;
+  }
+  while (*p) {
+    if (n == 8)
+      return false;
+    // A dotted quad may take the place of the last two words
+    if (strchr(p, '.') && !strchr(p, ':')) {
+      rdr::U8 v4[4];
+      if (n > 6 || !parseIPv4(p, v4))
+        return false;
+      words[n++] = (v4[0] << 8) | v4[1];
+      words[n++] = (v4[2] << 8) | v4[3];
+      break;
+    }
+    int value = 0, digits = 0;
+    while (hexDigit(*p) >= 0 && digits < 4) {
+      value = value * 16 + hexDigit(*p++);
+      digits++;
+    }
+    if (!digits)
+      return false;
+    words[n++] = value;
+    if (*p == ':') {
+      p++;
+      if (*p == ':') {
+        if (gap >= 0)
+          return false;
+        gap = n;
+        p++;
+      } else if (!*p) {
+        return false;
+      }
+    } else if (*p) {
+      return false;
+    }
+  }
+  if (gap < 0 ? n != 8 : n > 7)
+    return false;
+
+  int zeros = 8 - n;
+  for (int i = 0, w = 0; i < 8; i++) {
+    rdr::U16 word;
+    if (gap >= 0 && i >= gap && i < gap + zeros)
+      word = 0;
+    else
+      word = words[w++];
+    addr[i * 2] = word >> 8;
+    addr[i * 2 + 1] = word & 0xff;
+  }
+  return true;
+}
+
+// maskAddress() clears all but the first prefix bits of an address.
+
+static void maskAddress(rdr::U8* addr, int len, int prefix)
+{
+  for (int i = 0; i < len; i++) {
+    int bits = prefix - i * 8;
+    if (bits <= 0)
+      addr[i] = 0;
+    else if (bits < 8)
+      addr[i] &= 0xff << (8 - bits);
+  }
+}
+
+static bool keysEqual(const rdr::U8* a, const rdr::U8* b)
+{
+  return memcmp(a, b, 17) == 0;
+}
+
+
+// -=- BlacklistTable
+
+Blacklist::BlacklistTable::BlacklistTable() : slots(0), nSlots(0), count(0) {
+}
+
+Blacklist::BlacklistTable::~BlacklistTable() {
+  delete [] slots;
+}
+
+Blacklist::BlacklistInfo* Blacklist::BlacklistTable::find(const Key& key,
+                                                          rdr::U32 hash) {
+  if (!nSlots)
+    return 0;
+  int mask = nSlots - 1;
+  for (int i = hash & mask; slots[i].used; i = (i + 1) & mask) {
+    if (slots[i].hash == hash &&
+        keysEqual(&slots[i].key.family, &key.family))
+      return &slots[i];
+  }
+  return 0;
+}
+
+Blacklist::BlacklistInfo* Blacklist::BlacklistTable::insert(const Key& key,
+                                                            rdr::U32 hash) {
+  // Keep the table no more than half full, so that probes are short
+  if ((count + 1) * 2 > nSlots)
+    grow();
+  int mask = nSlots - 1;
+  int i = hash & mask;
+  while (slots[i].used)
+    i = (i + 1) & mask;
+  BlacklistInfo* bi = &slots[i];
+  bi->used = true;
+  bi->key = key;
+  bi->hash = hash;
+  bi->marks = 1;
+  bi->blockUntil = 0;
+  bi->blockTimeout = initialTimeout;
+  bi->tokens = burst;
+  bi->lastAttempt.tv_sec = 0;
+  bi->lastAttempt.tv_usec = 0;
+  count++;
+  return bi;
+}
+
+void Blacklist::BlacklistTable::erase(BlacklistInfo* entry) {
+  // Move later entries in the same run back into the gap, unless that
+  // would put them before the slot they hash to
+  int mask = nSlots - 1;
+  int gap = entry - slots;
+  for (int i = (gap + 1) & mask; slots[i].used; i = (i + 1) & mask) {
+    int home = slots[i].hash & mask;
+    bool stays = (gap <= i) ? (gap < home && home <= i)
+                            : (gap < home || home <= i);
+    if (stays)
+      continue;
+    slots[gap] = slots[i];
+    gap = i;
   }
+  slots[gap].used = false;
+  count--;
+}
+
+void Blacklist::BlacklistTable::clear() {
+  delete [] slots;
+  slots = 0;
+  nSlots = 0;
+  count = 0;
+}
+
+// keepBlocked() discards all the entries but those for hosts which are
+// black-listed at the given time.
+
+void Blacklist::BlacklistTable::keepBlocked(time_t now) {
+  std::vector<BlacklistInfo> blocked;
+  for (int i = 0; i < nSlots; i++) {
+    if (slots[i].used && slots[i].marks >= threshold &&
+        slots[i].blockUntil > now)
+      blocked.push_back(slots[i]);
+  }
+  clear();
+  for (size_t i = 0; i < blocked.size(); i++)
+    *insert(blocked[i].key, blocked[i].hash) = blocked[i];
+}
+
+// eraseSoonestBlocked() discards the entry whose block expires soonest, or
+// one which isn't blocking a host at all.
+
+void Blacklist::BlacklistTable::eraseSoonestBlocked() {
+  BlacklistInfo* soonest = 0;
+  for (int i = 0; i < nSlots; i++) {
+    if (!slots[i].used)
+      continue;
+    if (!soonest || slots[i].blockUntil < soonest->blockUntil)
+      soonest = &slots[i];
+  }
+  if (soonest)
+    erase(soonest);
+}
+
+void Blacklist::BlacklistTable::grow() {
+  BlacklistInfo* oldSlots = slots;
+  int oldNSlots = nSlots;
+  nSlots = nSlots ? nSlots * 2 : 64;
+  slots = new BlacklistInfo[nSlots];
+  for (int i = 0; i < nSlots; i++)
+    slots[i].used = false;
+  int mask = nSlots - 1;
+  for (int i = 0; i < oldNSlots; i++) {
+    if (!oldSlots[i].used)
+      continue;
+    int j = oldSlots[i].hash & mask;
+    while (slots[j].used)
+      j = (j + 1) & mask;
+    slots[j] = oldSlots[i];
+  }
+  delete [] oldSlots;
+}
+
+
+// -=- Blacklist
+
+Blacklist::Blacklist() : current(0) {
+  // Vary the hash, so that addresses cannot be chosen to collide
+  timeval now;
+  Timer::getTime(&now);
+  hashSeed = (rdr::U32)now.tv_usec ^ ((rdr::U32)now.tv_sec << 12) ^
+    (rdr::U32)(size_t)this;
+}
+
+Blacklist::~Blacklist() {
 }
 
 bool Blacklist::isBlackmarked(const char* name) {
-  BlacklistMap::iterator i = blm.find(name);
-  if (i == blm.end()) {
-    // Entry is not already black-marked.
-    // Create the entry unmarked, unblocked,
-    // with suitable defaults set.
-    BlacklistInfo bi;
-    bi.marks = 1;
-    bi.blockUntil = 0;
-    bi.blockTimeout = initialTimeout;
-    blm[strDup(name)] = bi;
-    i = blm.find(name);
+  Key key;
+  makeKey(name, &key);
+  timeval now;
+  Timer::getTime(&now);
+
+#ifdef __RFB_THREADING_IMPL
+  Lock l(mutex);
+#endif
+  BlacklistInfo* bi = findEntry(key, true, now.tv_sec);
+
+  // Refill the entry's token bucket, and refuse the attempt if it is empty
+  if (rate > 0) {
+    double elapsed = ((now.tv_sec - bi->lastAttempt.tv_sec) +
+                      (now.tv_usec - bi->lastAttempt.tv_usec) / 1000000.0);
+    bi->tokens += elapsed * rate / 60;
+    if (bi->tokens > burst)
+      bi->tokens = burst;
+    bi->lastAttempt = now;
+    if (bi->tokens < 1)
+      return true;
+    bi->tokens -= 1;
   }
 
   // Entry exists - has it reached the threshold yet?
-  if ((*i).second.marks >= threshold) {
-    // Yes - entry is blocked - has the timeout expired?        
-    time_t now = time(0);
-    if (now >= (*i).second.blockUntil) {
+  if (bi->marks >= threshold) {
+    // Yes - entry is blocked - has the timeout expired?
+    if (now.tv_sec >= bi->blockUntil) {
       // Timeout has expired.  Reset timeout and allow
       // a re-try.
-      (*i).second.blockUntil = now + (*i).second.blockTimeout;
-      (*i).second.blockTimeout = (*i).second.blockTimeout * 2;
+      bi->blockUntil = now.tv_sec + bi->blockTimeout;
+      bi->blockTimeout = __rfbmin(bi->blockTimeout * 2, maxBlockTimeout);
       return false;
     }
     // Blocked and timeout still in effect - reject!
@@ -73,14 +356,109 @@ bool Blacklist::isBlackmarked(const char* name) {
   // We haven't reached the threshold yet.
   // Increment the black-mark counter but allow
   // the entry to pass.
-  (*i).second.marks++;
+  bi->marks++;
   return false;
 }
 
 void Blacklist::clearBlackmark(const char* name) {
-  BlacklistMap::iterator i = blm.find(name);
-  if (i != blm.end()) {
-    strFree((char*)(*i).first);
-    blm.erase(i);
+  Key key;
+  makeKey(name, &key);
+  timeval now;
+  Timer::getTime(&now);
+
+#ifdef __RFB_THREADING_IMPL
+  Lock l(mutex);
+#endif
+  BlacklistInfo* bi = findEntry(key, false, now.tv_sec);
+  if (!bi)
+    return;
+  // Keep the entry if it is limiting the rate of attempts
+  if (rate > 0) {
+    bi->marks = 1;
+    bi->blockUntil = 0;
+    bi->blockTimeout = initialTimeout;
+  } else {
+    tables[current].erase(bi);
+  }
+}
+
+// makeKey() turns a name into the key for its entry.
+
+void Blacklist::makeKey(const char* name, Key* key) {
+  memset(key, 0, sizeof(*key));
+  if (parseIPv4(name, key->addr)) {
+    key->family = 4;
+    maskAddress(key->addr, 4, prefixLength);
+    return;
   }
+  if (parseIPv6(name, key->addr)) {
+    static const rdr::U8 v4Mapped[12] = { 0,0,0,0, 0,0,0,0, 0,0,0xff,0xff };
+    if (memcmp(key->addr, v4Mapped, 12) == 0) {
+      memmove(key->addr, key->addr + 12, 4);
+      memset(key->addr + 4, 0, 12);
+      key->family = 4;
+      maskAddress(key->addr, 4, prefixLength);
+    } else {
+      key->family = 6;
+      maskAddress(key->addr, 16, prefixLength6);
+    }
+    return;
+  }
+
+  // Anything else is identified by four differently-seeded hashes of it
+  for (int i = 0; i < 4; i++) {
+    rdr::U32 h = 2166136261U + i;
+    for (const char* p = name; *p; p++)
+      h = (h ^ (rdr::U8)*p) * 16777619U;
+    memcpy(key->addr + i * 4, &h, 4);
+  }
+}
+
+// hashKey() is FNV-1a, seeded per Blacklist.
+
+rdr::U32 Blacklist::hashKey(const Key& key) {
+  const rdr::U8* p = &key.family;
+  rdr::U32 h = 2166136261U ^ hashSeed;
+  for (int i = 0; i < 17; i++)
+    h = (h ^ p[i]) * 16777619U;
+  return h ^ (h >> 15);
+}
+
+// findEntry() finds the entry for a key, creating it if necessary and
+// required.  An entry found in the older table is moved to the current one.
+// If the current table is full, the older one is emptied of all but the
+// hosts still black-listed, and becomes the current one.  If that leaves no
+// room either, the host whose block expires soonest is forgotten.  It only
+// returns null if the entry doesn't exist and create is false.
+
+Blacklist::BlacklistInfo* Blacklist::findEntry(const Key& key, bool create,
+                                               time_t now) {
+  rdr::U32 hash = hashKey(key);
+  BlacklistInfo* bi = tables[current].find(key, hash);
+  if (bi)
+    return bi;
+
+  BlacklistInfo old;
+  BlacklistInfo* oldBi = tables[1 - current].find(key, hash);
+  if (oldBi) {
+    old = *oldBi;
+    tables[1 - current].erase(oldBi);
+  } else if (!create) {
+    return 0;
+  }
+
+  // Moving an entry from the older table always leaves room in it
+  int limit = __rfbmax(1, maxEntries / 2);
+  if (tables[current].size() >= limit) {
+    tables[1 - current].keepBlocked(now);
+    current = 1 - current;
+    // Only black-listed hosts are left, so let the first of them go
+    if (tables[current].size() >= limit)
+      tables[current].eraseSoonestBlocked();
+  }
+
+  bi = tables[current].insert(key, hash);
+  if (oldBi)
+    *bi = old;
+  return bi;
 }
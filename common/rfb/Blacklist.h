@@ -15,10 +15,9 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
  * USA.
  */
-
 //
 // Blacklist.h - Handling of black-listed entities.
-// Just keeps a table mapping strings to timing information, including
+// Just keeps a table mapping addresses to timing information, including
 // how many times the entry has been black-listed and when to next
 // put it on probation (e.g. allow a connection in from the host, and
 // re-blacklist it if that fails). 
@@ -27,11 +26,12 @@
 #ifndef __RFB_BLACKLIST_H__
 #define __RFB_BLACKLIST_H__
 
-#include <string.h>
 #include <time.h>
-#include <map>
 
+#include <rdr/types.h>
 #include <rfb/Configuration.h>
+#include <rfb/Threading.h>
+#include <rfb/Timer.h>
 #include <rfb/util.h>
 
 namespace rfb {
@@ -48,16 +48,32 @@ namespace rfb {
   // Timeout means that after that many seconds, the next call to isBlackmarked
   // will return false.  At the same time, the timeout is doubled, so that the
   // next calls will fail, until the timeout expires again or clearBlackmark is
-  // called.
+  // called.  The timeout is never doubled beyond a day.
   //
-  // When clearBlackMark is called, the corresponding entry is completely
-  // removed, causing the next isBlackmarked call to return false.
-
-  // KNOWN BUG:  Client can keep making rejected requests, thus increasing
-  // their timeout.  If client does this for 30 years, timeout may wrap round
-  // to a very small value again.
-
-  // THIS CLASS IS NOT THREAD-SAFE!
+  // When clearBlackMark is called, the corresponding entry is reset, causing
+  // the next isBlackmarked call to return false.
+  //
+  // Names are IPv4 or IPv6 addresses, which are stored in binary form.
+  // Addresses may be grouped by network, so that all the hosts in (say) a
+  // /24 share one entry.  Other names are stored as a hash.
+  //
+  // Each entry can also limit how often connections are attempted, as a
+  // token bucket which allows BlacklistBurst attempts at once and is
+  // refilled at BlacklistRate attempts a minute.  isBlackmarked returns true
+  // for attempts beyond that rate, without counting them as black marks.
+  //
+  // Entries are kept in two hash tables, for recently and less recently
+  // used entries.  When the first is full, the entries in the second are
+  // discarded, apart from those for hosts still black-listed, and the second
+  // takes the first's place.  So no more than BlacklistSize entries are
+  // kept, and a host cannot get out of being black-listed by making
+  // attempts from many other addresses.  If the first table is still full of
+  // black-listed hosts, the one whose timeout expires soonest is forgotten to
+  // make room, so that new hosts are never shut out.  Finding an entry takes
+  // constant time, apart from then.
+  //
+  // Where threading is supported, the Blacklist may be shared between
+  // threads.
 
   class Blacklist {
   public:
@@ -69,23 +85,61 @@ namespace rfb {
 
     static IntParameter threshold;
     static IntParameter initialTimeout;
+    static IntParameter maxEntries;
+    static IntParameter prefixLength;
+    static IntParameter prefixLength6;
+    static IntParameter rate;
+    static IntParameter burst;
 
   protected:
-    struct ltStr {
-      bool operator()(const char* s1, const char* s2) const {
-        return strcmp(s1, s2) < 0;
-      };
+    struct Key {
+      rdr::U8 family;
+      rdr::U8 addr[16];
     };
     struct BlacklistInfo {
+      bool used;
+      Key key;
+      rdr::U32 hash;
       int marks;
       time_t blockUntil;
       unsigned int blockTimeout;
+      double tokens;
+      timeval lastAttempt;
     };
-    typedef std::map<const char*,BlacklistInfo,ltStr> BlacklistMap;
-    BlacklistMap blm;
+
+    // BlacklistTable is an open-addressed hash table of BlacklistInfo,
+    // which grows as needed up to a maximum number of entries.
+    class BlacklistTable {
+    public:
+      BlacklistTable();
+      ~BlacklistTable();
+      BlacklistInfo* find(const Key& key, rdr::U32 hash);
+      BlacklistInfo* insert(const Key& key, rdr::U32 hash);
+      void erase(BlacklistInfo* entry);
+      void clear();
+      void keepBlocked(time_t now);
+      void eraseSoonestBlocked();
+      int size() const { return count; }
+      int capacity() const { return nSlots; }
+    protected:
+      void grow();
+      BlacklistInfo* slots;
+      int nSlots;
+      int count;
+    };
+
+    void makeKey(const char* name, Key* key);
+    rdr::U32 hashKey(const Key& key);
+    BlacklistInfo* findEntry(const Key& key, bool create, time_t now);
+
+    BlacklistTable tables[2];
+    int current;
+    rdr::U32 hashSeed;
+#ifdef __RFB_THREADING_IMPL
+    Mutex mutex;
+#endif
   };
 
 }
 
 #endif
-
@@ -22,6 +22,7 @@
 #include <rfb/CMsgWriterV3.h>
 #include <rfb/CSecurity.h>
 #include <rfb/secTypes.h>
+#include <rfb/fenceTypes.h>
 #include <rfb/CConnection.h>
 #include <rfb/util.h>
 
@@ -274,3 +275,18 @@ void CConnection::serverInit()
   state_ = RFBSTATE_NORMAL;
   vlog.debug("initialisation done");
 }
+
+void CConnection::fence(rdr::U32 flags, int len, const char* data)
+{
+  CMsgHandler::fence(flags, len, data);
+
+  if (!(flags & fenceFlagRequest))
+    return;
+
+  writer_->writeFence(0, len, data);
+}
+
+void CConnection::cachedTileMissing(const Rect& r)
+{
+  writer_->writeFramebufferUpdateRequest(r, false);
+}
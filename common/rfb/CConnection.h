@@ -116,6 +116,16 @@ namespace rfb {
     // derived class must call on to CConnection::serverInit().
     virtual void serverInit();
 
+    // fence() returns fence requests to the server.  Since CConnection knows
+    // nothing about how the derived class processes messages it can't honour
+    // any of the flags, so they are cleared.
+    virtual void fence(rdr::U32 flags, int len, const char* data);
+
+    // cachedTileMissing() asks the server to send the given rectangle again
+    // with a non-incremental update request.  A derived class which keeps
+    // track of its update requests may want to do this itself.
+    virtual void cachedTileMissing(const Rect& r);
+
 
     // Other methods
 
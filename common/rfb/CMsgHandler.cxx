@@ -84,6 +84,14 @@ void CMsgHandler::serverCutText(const char* str, int len)
 {
 }
 
+void CMsgHandler::fence(rdr::U32 flags, int len, const char* data)
+{
+}
+
+void CMsgHandler::endOfContinuousUpdates()
+{
+}
+
 void CMsgHandler::fillRect(const Rect& r, Pixel pix)
 {
 }
@@ -96,4 +104,12 @@ void CMsgHandler::copyRect(const Rect& r, int srcX, int srcY)
 {
 }
 
+void CMsgHandler::getImage(void* pixels, const Rect& r)
+{
+  throw Exception("CMsgHandler::getImage called");
+}
+
+void CMsgHandler::cachedTileMissing(const Rect& r)
+{
+}
 
@@ -59,10 +59,26 @@ namespace rfb {
     virtual void bell();
     virtual void serverCutText(const char* str, int len);
 
+    // fence() is called for each Fence message.  A fence with
+    // fenceFlagRequest set must be sent back to the server.
+    // endOfContinuousUpdates() is called when the server shows that it
+    // supports continuous updates, and again each time it stops sending them.
+    virtual void fence(rdr::U32 flags, int len, const char* data);
+    virtual void endOfContinuousUpdates();
+
     virtual void fillRect(const Rect& r, Pixel pix);
     virtual void imageRect(const Rect& r, void* pixels);
     virtual void copyRect(const Rect& r, int srcX, int srcY);
 
+    // getImage() reads back a rectangle of the client's framebuffer.  It is
+    // only called when cp.tileCacheSize is non-zero, to fill the tile cache.
+    virtual void getImage(void* pixels, const Rect& r);
+
+    // cachedTileMissing() is called in place of imageRect() when the server
+    // refers to a tile which isn't in the tile cache.  The rectangle's
+    // contents are then unknown, and should be requested again.
+    virtual void cachedTileMissing(const Rect& r);
+
     ConnParams cp;
   };
 }
@@ -19,14 +19,16 @@
 #include <rdr/InStream.h>
 #include <rfb/Exception.h>
 #include <rfb/util.h>
+#include <rfb/fenceTypes.h>
 #include <rfb/CMsgHandler.h>
 #include <rfb/CMsgReader.h>
+#include <rfb/TileCache.h>
 
 using namespace rfb;
 
 CMsgReader::CMsgReader(CMsgHandler* handler_, rdr::InStream* is_)
   : imageBufIdealSize(0), handler(handler_), is(is_),
-    imageBuf(0), imageBufSize(0)
+    imageBuf(0), imageBufSize(0), tileCache(0)
 {
   for (unsigned int i = 0; i <= encodingMax; i++) {
     decoders[i] = 0;
@@ -39,6 +41,7 @@ CMsgReader::~CMsgReader()
     delete decoders[i];
   }
   delete [] imageBuf;
+  delete tileCache;
 }
 
 void CMsgReader::readSetColourMapEntries()
@@ -72,6 +75,26 @@ void CMsgReader::readServerCutText()
   handler->serverCutText(ca.buf, len);
 }
 
+void CMsgReader::readFence()
+{
+  is->skip(3);
+  rdr::U32 flags = is->readU32();
+  int len = is->readU8();
+  if (len > fenceMaxDataLen) {
+    fprintf(stderr, "Ignoring fence with too large payload\n");
+    is->skip(len);
+    return;
+  }
+  char data[fenceMaxDataLen];
+  is->readBytes(data, len);
+  handler->fence(flags, len, data);
+}
+
+void CMsgReader::readEndOfContinuousUpdates()
+{
+  handler->endOfContinuousUpdates();
+}
+
 void CMsgReader::readFramebufferUpdateStart()
 {
   handler->framebufferUpdateStart();
@@ -134,6 +157,59 @@ void CMsgReader::readSetCursor(int width, int height, const Point& hotspot)
   handler->setCursor(width, height, hotspot, data.buf, mask.buf);
 }
 
+void CMsgReader::readCachedTile(const Rect& r)
+{
+  TileCache::Key key;
+  key.hi = is->readU32();
+  key.lo = is->readU32();
+  TileCache* tc = getTileCache(r);
+  int slot = tc->lookup(key);
+  if (slot < 0) {
+    // The caches have got out of step, so have the tile sent again
+    handler->cachedTileMissing(r);
+    return;
+  }
+  handler->imageRect(r, tc->data(slot));
+}
+
+void CMsgReader::readCacheStore(const Rect& r)
+{
+  TileCache::Key key;
+  key.hi = is->readU32();
+  key.lo = is->readU32();
+  TileCache* tc = getTileCache(r);
+  handler->getImage(tc->data(tc->insert(key)), r);
+}
+
+// getTileCache() returns the tile cache, emptying it first if the pixel
+// format or the size of cache offered to the server has changed since it
+// was last used.  The server empties its copy at the same point.
+
+TileCache* CMsgReader::getTileCache(const Rect& r)
+{
+  unsigned int encoding
+    = TileCache::encodingForSize(handler->cp.tileCacheSize);
+  if (!encoding)
+    throw Exception("CMsgReader: unexpected tile cache rectangle");
+  if (r.width() > TileCache::maxTileSize ||
+      r.height() > TileCache::maxTileSize)
+    throw Exception("CMsgReader: cached tile too large");
+
+  int size = TileCache::sizeForEncoding(encoding);
+  if (tileCache && (tileCache->maxTiles() != size ||
+                    !tileCachePF.equal(handler->cp.pf()))) {
+    delete tileCache;
+    tileCache = 0;
+  }
+  if (!tileCache) {
+    tileCachePF = handler->cp.pf();
+    tileCache = new TileCache(size, (TileCache::maxTileSize *
+                                     TileCache::maxTileSize *
+                                     tileCachePF.bpp / 8));
+  }
+  return tileCache;
+}
+
 rdr::U8* CMsgReader::getImageBuf(int required, int requested, int* nPixels)
 {
   int requiredBytes = required * (handler->cp.pf().bpp / 8);
@@ -26,11 +26,13 @@
 #include <rdr/types.h>
 #include <rfb/encodings.h>
 #include <rfb/Decoder.h>
+#include <rfb/PixelFormat.h>
 
 namespace rdr { class InStream; }
 
 namespace rfb {
   class CMsgHandler;
+  class TileCache;
   struct Rect;
 
   class CMsgReader {
@@ -52,6 +54,8 @@ namespace rfb {
     virtual void readSetColourMapEntries();
     virtual void readBell();
     virtual void readServerCutText();
+    virtual void readFence();
+    virtual void readEndOfContinuousUpdates();
 
     virtual void readFramebufferUpdateStart();
     virtual void readFramebufferUpdateEnd();
@@ -61,6 +65,10 @@ namespace rfb {
 
     virtual void readSetCursor(int width, int height, const Point& hotspot);
 
+    virtual void readCachedTile(const Rect& r);
+    virtual void readCacheStore(const Rect& r);
+    TileCache* getTileCache(const Rect& r);
+
     CMsgReader(CMsgHandler* handler, rdr::InStream* is);
 
     CMsgHandler* handler;
@@ -68,6 +76,8 @@ namespace rfb {
     Decoder* decoders[encodingMax+1];
     rdr::U8* imageBuf;
     int imageBufSize;
+    TileCache* tileCache;
+    PixelFormat tileCachePF;
   };
 }
 #endif
@@ -57,6 +57,8 @@ void CMsgReaderV3::readMsg()
     case msgTypeSetColourMapEntries: readSetColourMapEntries(); break;
     case msgTypeBell:                readBell(); break;
     case msgTypeServerCutText:       readServerCutText(); break;
+    case msgTypeServerFence:         readFence(); break;
+    case msgTypeEndOfContinuousUpdates: readEndOfContinuousUpdates(); break;
     default:
       fprintf(stderr, "unknown message type %d\n", type);
       throw Exception("unknown message type");
@@ -77,6 +79,12 @@ void CMsgReaderV3::readMsg()
     case pseudoEncodingCursor:
       readSetCursor(w, h, Point(x,y));
       break;
+    case pseudoEncodingCachedTile:
+      readCachedTile(Rect(x, y, x+w, y+h));
+      break;
+    case pseudoEncodingCacheStore:
+      readCacheStore(Rect(x, y, x+w, y+h));
+      break;
     default:
       readRect(Rect(x, y, x+w, y+h), encoding);
       break;
@@ -18,10 +18,13 @@
 #include <stdio.h>
 #include <rdr/OutStream.h>
 #include <rfb/msgTypes.h>
+#include <rfb/fenceTypes.h>
+#include <rfb/Exception.h>
 #include <rfb/PixelFormat.h>
 #include <rfb/Rect.h>
 #include <rfb/ConnParams.h>
 #include <rfb/Decoder.h>
+#include <rfb/TileCache.h>
 #include <rfb/CMsgWriter.h>
 
 using namespace rfb;
@@ -54,16 +57,27 @@ void CMsgWriter::writeSetEncodings(int nEncodings, rdr::U32* encodings)
 }
 
 // Ask for encodings based on which decoders are supported.  Assumes higher
-// encoding numbers are more desirable.
+// encoding numbers are more desirable, except that a lossy encoding is only
+// asked for if it is the preferred one.
 
 void CMsgWriter::writeSetEncodings(int preferredEncoding, bool useCopyRect)
 {
   int nEncodings = 0;
-  rdr::U32 encodings[encodingMax+2];
+  rdr::U32 encodings[encodingMax+7];
   if (cp->supportsLocalCursor)
     encodings[nEncodings++] = pseudoEncodingCursor;
   if (cp->supportsDesktopResize)
     encodings[nEncodings++] = pseudoEncodingDesktopSize;
+  if (cp->supportsFence)
+    encodings[nEncodings++] = pseudoEncodingFence;
+  if (cp->supportsContinuousUpdates)
+    encodings[nEncodings++] = pseudoEncodingContinuousUpdates;
+  if (cp->qualityLevel >= 0 && cp->qualityLevel <= 9)
+    encodings[nEncodings++] = pseudoEncodingQualityLevel0 + cp->qualityLevel;
+  if (TileCache::encodingForSize(cp->tileCacheSize))
+    encodings[nEncodings++] = TileCache::encodingForSize(cp->tileCacheSize);
+  if (cp->scale > 1 && cp->scale <= 8)
+    encodings[nEncodings++] = pseudoEncodingScale1 + cp->scale - 1;
   if (Decoder::supported(preferredEncoding)) {
     encodings[nEncodings++] = preferredEncoding;
   }
@@ -71,7 +85,8 @@ void CMsgWriter::writeSetEncodings(int preferredEncoding, bool useCopyRect)
     encodings[nEncodings++] = encodingCopyRect;
   }
   for (int i = encodingMax; i >= 0; i--) {
-    if (i != preferredEncoding && Decoder::supported(i)) {
+    if (i != preferredEncoding && i != encodingZYWRLE &&
+        Decoder::supported(i)) {
       encodings[nEncodings++] = i;
     }
   }
@@ -89,6 +104,37 @@ void CMsgWriter::writeFramebufferUpdateRequest(const Rect& r, bool incremental)
   endMsg();
 }
 
+void CMsgWriter::writeEnableContinuousUpdates(bool enable, const Rect& r)
+{
+  if (!cp->supportsContinuousUpdates)
+    throw Exception("Server does not support continuous updates");
+
+  startMsg(msgTypeEnableContinuousUpdates);
+  os->writeU8(enable);
+  os->writeU16(r.tl.x);
+  os->writeU16(r.tl.y);
+  os->writeU16(r.width());
+  os->writeU16(r.height());
+  endMsg();
+}
+
+void CMsgWriter::writeFence(rdr::U32 flags, int len, const char* data)
+{
+  if (!cp->supportsFence)
+    throw Exception("Server does not support fences");
+  if (len > fenceMaxDataLen)
+    throw Exception("Too large fence payload");
+  if ((flags & ~fenceFlagsSupported) != 0)
+    throw Exception("Unknown fence flags");
+
+  startMsg(msgTypeClientFence);
+  os->pad(3);
+  os->writeU32(flags);
+  os->writeU8(len);
+  os->writeBytes(data, len);
+  endMsg();
+}
+
 
 void CMsgWriter::keyEvent(rdr::U32 key, bool down)
 {
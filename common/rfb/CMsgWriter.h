@@ -47,6 +47,12 @@ namespace rfb {
     virtual void writeSetEncodings(int preferredEncoding, bool useCopyRect);
     virtual void writeFramebufferUpdateRequest(const Rect& r,bool incremental);
 
+    // writeEnableContinuousUpdates() and writeFence() may only be used once
+    // the server has shown that it supports them, by sending an
+    // EndOfContinuousUpdates message or a fence respectively.
+    virtual void writeEnableContinuousUpdates(bool enable, const Rect& r);
+    virtual void writeFence(rdr::U32 flags, int len, const char* data);
+
     // InputHandler implementation
     virtual void keyEvent(rdr::U32 key, bool down);
     virtual void pointerEvent(const Point& pos, int buttonMask);
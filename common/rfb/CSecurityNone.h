@@ -23,6 +23,7 @@
 #define __CSECURITYNONE_H__
 
 #include <rfb/CSecurity.h>
+#include <rfb/secTypes.h>
 
 namespace rfb {
 
@@ -15,27 +15,361 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
  * USA.
  */
+#include <math.h>
 #include <stdio.h>
+#include <string.h>
+#include <map>
 #include <vector>
 #include <rdr/types.h>
 #include <rfb/Exception.h>
 #include <rfb/ComparingUpdateTracker.h>
+#include <rfb/ServerCore.h>
+#include <rfb/Threading.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define COMPARE_SSE2
+#endif
 
 using namespace rfb;
 
+#define BLOCK_SIZE 16
+
+// Rectangles are split into bands of this many rows to be compared in
+// parallel, if there are at least MIN_PARALLEL_AREA pixels to compare.
+#define BAND_HEIGHT (BLOCK_SIZE * 4)
+#define MIN_PARALLEL_AREA (256 * 256)
+
+// Changed rectangles at least MIN_SCROLL_SIZE pixels in each direction are
+// checked for scrolling, up to MAX_SCROLL_AREA pixels in all on each
+// comparison.  A scroll is only accepted if at least MIN_SCROLL_LINES of the
+// changed rows or columns agree on it.
+#define MIN_SCROLL_SIZE 64
+#define MAX_SCROLL_AREA (1024 * 1024)
+#define MIN_SCROLL_LINES 8
+
+
+// findRowChange() compares len bytes of two rows.  If they differ then it
+// returns true, with first and last set to the offsets of the first and last
+// bytes which differ.
+
+#ifdef COMPARE_SSE2
+static inline int diffMask(const rdr::U8* a, const rdr::U8* b) {
+  __m128i x = _mm_loadu_si128((const __m128i*)a);
+  __m128i y = _mm_loadu_si128((const __m128i*)b);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xffff;
+}
+#endif
+
+static inline bool findRowChange(const rdr::U8* a, const rdr::U8* b, int len,
+                                 int* first, int* last)
+{
+  int i = 0;
+#ifdef COMPARE_SSE2
+  // Most rows are unchanged, so check them a cache line at a time
+  for (; i + 64 <= len; i += 64) {
+    __m128i eq = _mm_and_si128(
+      _mm_and_si128(
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)),
+                       _mm_loadu_si128((const __m128i*)(b + i))),
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i + 16)),
+                       _mm_loadu_si128((const __m128i*)(b + i + 16)))),
+      _mm_and_si128(
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i + 32)),
+                       _mm_loadu_si128((const __m128i*)(b + i + 32))),
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i + 48)),
+                       _mm_loadu_si128((const __m128i*)(b + i + 48)))));
+    if (_mm_movemask_epi8(eq) != 0xffff)
+      break;
+  }
+  int mask = 0;
+  while (i + 16 <= len && !(mask = diffMask(a + i, b + i)))
+    i += 16;
+  while (mask && !(mask & 1)) {
+    mask >>= 1;
+    i++;
+  }
+#else
+  if (memcmp(a, b, len) == 0)
+    return false;
+#endif
+  while (i < len && a[i] == b[i])
+    i++;
+  if (i == len)
+    return false;
+  *first = i;
+
+  int j = len;
+#ifdef COMPARE_SSE2
+  while (j - 16 >= i) {
+    j -= 16;
+    int mask = diffMask(a + j, b + j);
+    if (mask) {
+      j += 15;
+      while (!(mask & 0x8000)) {
+        mask <<= 1;
+        j--;
+      }
+      *last = j;
+      return true;
+    }
+  }
+#endif
+  do {
+    j--;
+  } while (a[j] == b[j]);
+  *last = j;
+  return true;
+}
+
+
+// hashRound() and friends implement a hash in the style of xxHash64, which
+// is used to detect changes when only a hash of each block is kept.
+
+static const rdr::U64 PRIME64_1 = ((rdr::U64)0x9E3779B1U << 32) | 0x85EBCA87U;
+static const rdr::U64 PRIME64_2 = ((rdr::U64)0xC2B2AE3DU << 32) | 0x27D4EB4FU;
+static const rdr::U64 PRIME64_3 = ((rdr::U64)0x165667B1U << 32) | 0x9E3779F9U;
+static const rdr::U64 PRIME64_4 = ((rdr::U64)0x85EBCA77U << 32) | 0xC2B2AE63U;
+
+static inline rdr::U64 rotl64(rdr::U64 x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline rdr::U64 hashRound(rdr::U64 acc, rdr::U64 v) {
+  return rotl64(acc + v * PRIME64_2, 31) * PRIME64_1;
+}
+
+static inline rdr::U64 hashMerge(rdr::U64 h, rdr::U64 v) {
+  return (h ^ hashRound(0, v)) * PRIME64_1 + PRIME64_4;
+}
+
+static inline rdr::U64 hashFinal(rdr::U64 h) {
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+static inline rdr::U64 read64(const rdr::U8* p) {
+  rdr::U64 v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+
+// lineHashes() hashes each row of r in pb, or each column if columns is set,
+// for matching lines which have scrolled.
+
+static void lineHashes(PixelBuffer* pb, const Rect& r, bool columns,
+                       std::vector<rdr::U64>* hashes)
+{
+  int bytesPerPixel = pb->getPF().bpp/8;
+  int stride;
+  const rdr::U8* data = pb->getPixelsR(r, &stride);
+  int strideBytes = stride * bytesPerPixel;
+  int rowBytes = r.width() * bytesPerPixel;
+
+  if (!columns) {
+    hashes->resize(r.height());
+    for (int y = 0; y < r.height(); y++) {
+      const rdr::U8* p = data;
+      const rdr::U8* end = data + rowBytes;
+      rdr::U64 h = PRIME64_1;
+      for (; p + 8 <= end; p += 8)
+        h = hashMerge(h, read64(p));
+      if (p < end) {
+        rdr::U8 tail[8];
+        memset(tail, 0, 8);
+        memcpy(tail, p, end - p);
+        h = hashMerge(h, read64(tail));
+      }
+      (*hashes)[y] = hashFinal(h);
+      data += strideBytes;
+    }
+  } else {
+    // Work along the rows, so that memory is read in order
+    hashes->assign(r.width(), PRIME64_1);
+    for (int y = 0; y < r.height(); y++) {
+      const rdr::U8* p = data;
+      for (int x = 0; x < r.width(); x++) {
+        rdr::U64 v = 0;
+        memcpy(&v, p, bytesPerPixel);
+        (*hashes)[x] = hashMerge((*hashes)[x], v);
+        p += bytesPerPixel;
+      }
+      data += strideBytes;
+    }
+    for (int x = 0; x < r.width(); x++)
+      (*hashes)[x] = hashFinal((*hashes)[x]);
+  }
+}
+
+
+#ifdef __RFB_THREADING_IMPL
+
+// -=- ComparePool
+//   A set of threads which compare bands of the framebuffer in parallel.
+
+namespace rfb {
+
+  class ComparePool {
+  public:
+    ComparePool(ComparingUpdateTracker* tracker, int nThreads);
+    ~ComparePool();
+
+    // compare() compares each band and adds the changed areas to newChanged.
+    void compare(const std::vector<Rect>& bands, Region* newChanged);
+
+    // work() is run by each thread, comparing bands until the pool is
+    // destroyed.
+    void work();
+
+  protected:
+    class CompareThread : public Thread {
+    public:
+      CompareThread(ComparePool* pool_) : Thread("CompareThread"), pool(pool_) {}
+      virtual void run() { pool->work(); }
+    protected:
+      ComparePool* pool;
+    };
+
+    ComparingUpdateTracker* tracker;
+    std::vector<Thread*> threads;
+    Mutex mutex;
+    Condition workReady;
+    Condition workDone;
+    const std::vector<Rect>* bands;
+    std::vector<std::vector<Rect> > results;
+    size_t nextBand;
+    int bandsLeft;
+    bool stopping;
+  };
+
+};
+
+ComparePool::ComparePool(ComparingUpdateTracker* tracker_, int nThreads)
+  : tracker(tracker_), workReady(mutex), workDone(mutex), bands(0),
+    nextBand(0), bandsLeft(0), stopping(false)
+{
+  for (int i = 0; i < nThreads; i++) {
+    threads.push_back(new CompareThread(this));
+    threads.back()->start();
+  }
+}
+
+ComparePool::~ComparePool()
+{
+  {
+    Lock l(mutex);
+    stopping = true;
+    workReady.signal(-1);
+  }
+  std::vector<Thread*>::iterator i;
+  for (i = threads.begin(); i != threads.end(); i++) {
+    (*i)->join();
+    delete *i;
+  }
+}
+
+void ComparePool::compare(const std::vector<Rect>& bands_,
+                          Region* newChanged)
+{
+  {
+    Lock l(mutex);
+    bands = &bands_;
+    results.clear();
+    results.resize(bands_.size());
+    nextBand = 0;
+    bandsLeft = bands_.size();
+    workReady.signal(-1);
+    while (bandsLeft > 0)
+      workDone.wait();
+    bands = 0;
+  }
+
+  std::vector<std::vector<Rect> >::const_iterator i;
+  for (i = results.begin(); i != results.end(); i++) {
+    if (i->empty()) continue;
+    Region temp;
+    temp.setOrderedRects(*i);
+    newChanged->assign_union(temp);
+  }
+}
+
+void ComparePool::work()
+{
+  while (true) {
+    Rect r;
+    std::vector<Rect>* result;
+    {
+      Lock l(mutex);
+      while (!stopping && (!bands || nextBand >= bands->size()))
+        workReady.wait();
+      if (stopping)
+        return;
+      r = (*bands)[nextBand];
+      result = &results[nextBand];
+      nextBand++;
+    }
+
+    tracker->compareRect(r, result);
+
+    {
+      Lock l(mutex);
+      if (--bandsLeft == 0)
+        workDone.signal();
+    }
+  }
+}
+
+// numCompareThreads() returns the number of threads to compare with.
+static int numCompareThreads() {
+  int n = rfb::Server::compareThreads;
+#ifdef _WIN32
+  if (n == 0) {
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    n = si.dwNumberOfProcessors;
+  }
+#elif defined(_SC_NPROCESSORS_ONLN)
+  if (n == 0)
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  return n;
+}
+
+#endif
+
+
 ComparingUpdateTracker::ComparingUpdateTracker(PixelBuffer* buffer)
-  : fb(buffer), oldFb(fb->getPF(), 0, 0), firstCompare(true)
+  : fb(buffer), oldFb(fb->getPF(), 0, 0), firstCompare(true), pool(0),
+    useHashes(rfb::Server::compareHashes),
+    hashBlockSize(rfb::Server::compareHashBlockSize), hashBlocksAcross(0),
+    hashes(0), compareCount(0)
 {
     changed.assign_union(fb->getRect());
+
+    heatTilesAcross = (fb->width() + heatTileSize - 1) / heatTileSize;
+    heatTilesDown = (fb->height() + heatTileSize - 1) / heatTileSize;
+    heat = new float[heatTilesAcross * heatTilesDown];
+    for (int i = 0; i < heatTilesAcross * heatTilesDown; i++)
+      heat[i] = 0;
+    Timer::getTime(&heatTime);
 }
 
 ComparingUpdateTracker::~ComparingUpdateTracker()
 {
+#ifdef __RFB_THREADING_IMPL
+  delete pool;
+#endif
+  delete [] hashes;
+  delete [] heat;
 }
 
 
-#define BLOCK_SIZE 16
-
 void ComparingUpdateTracker::compare()
 {
   std::vector<Rect> rects;
@@ -44,32 +378,98 @@ void ComparingUpdateTracker::compare()
   if (firstCompare) {
     // NB: We leave the change region untouched on this iteration,
     // since in effect the entire framebuffer has changed.
-    oldFb.setSize(fb->width(), fb->height());
-    for (int y=0; y<fb->height(); y+=BLOCK_SIZE) {
-      Rect pos(0, y, fb->width(), __rfbmin(fb->height(), y+BLOCK_SIZE));
-      int srcStride;
-      const rdr::U8* srcData = fb->getPixelsR(pos, &srcStride);
-      oldFb.imageRect(pos, srcData, srcStride);
+    if (useHashes) {
+      int bs = hashBlockSize;
+      hashBlocksAcross = (fb->width() + bs - 1) / bs;
+      hashes = new rdr::U64[hashBlocksAcross * ((fb->height() + bs - 1) / bs)];
+      rdr::U64* h = hashes;
+      for (int y = 0; y < fb->height(); y += bs) {
+        for (int x = 0; x < fb->width(); x += bs)
+          *h++ = hashRect(Rect(x, y, x+bs, y+bs).intersect(fb->getRect()));
+      }
+    } else {
+      oldFb.setSize(fb->width(), fb->height());
+      for (int y=0; y<fb->height(); y+=BLOCK_SIZE) {
+        Rect pos(0, y, fb->width(), __rfbmin(fb->height(), y+BLOCK_SIZE));
+        int srcStride;
+        const rdr::U8* srcData = fb->getPixelsR(pos, &srcStride);
+        oldFb.imageRect(pos, srcData, srcStride);
+      }
     }
     firstCompare = false;
   } else {
-    copied.get_rects(&rects, copy_delta.x<=0, copy_delta.y<=0);
-    for (i = rects.begin(); i != rects.end(); i++)
-      oldFb.copyRect(*i, copy_delta);
+    std::list<CopyGroup>::iterator g;
+    if (!useHashes) {
+      if (rfb::Server::detectScrolling)
+        detectScrolling();
 
-    Region to_check = changed.union_(copied);
+      for (g = copied.begin(); g != copied.end(); g++) {
+        g->region.get_rects(&rects, g->delta.x<=0, g->delta.y<=0);
+        for (i = rects.begin(); i != rects.end(); i++)
+          oldFb.copyRect(*i, g->delta);
+      }
+    }
+
+    Region to_check = changed.union_(get_copied());
     to_check.get_rects(&rects);
 
     Region newChanged;
+    bool compared = false;
+    if (useHashes) {
+      // There's nothing to check the copies against, so they are trusted
+      compareHashes(rects, &newChanged);
+      newChanged.assign_subtract(get_copied().subtract(changed));
+      compared = true;
+    }
+#ifdef __RFB_THREADING_IMPL
+    int area = 0;
     for (i = rects.begin(); i != rects.end(); i++)
-      compareRect(*i, &newChanged);
+      area += i->area();
+    if (!compared && area >= MIN_PARALLEL_AREA) {
+      if (!pool) {
+        int nThreads = numCompareThreads();
+        if (nThreads > 1)
+          pool = new ComparePool(this, nThreads);
+      }
+      if (pool) {
+        std::vector<Rect> bands;
+        for (i = rects.begin(); i != rects.end(); i++) {
+          for (int y = i->tl.y; y < i->br.y; y += BAND_HEIGHT)
+            bands.push_back(Rect(i->tl.x, y, i->br.x,
+                                 __rfbmin(i->br.y, y + BAND_HEIGHT)));
+        }
+        pool->compare(bands, &newChanged);
+        compared = true;
+      }
+    }
+#endif
+    if (!compared) {
+      std::vector<Rect> changedBlocks;
+      for (i = rects.begin(); i != rects.end(); i++) {
+        changedBlocks.clear();
+        compareRect(*i, &changedBlocks);
+        if (!changedBlocks.empty()) {
+          Region temp;
+          temp.setOrderedRects(changedBlocks);
+          newChanged.assign_union(temp);
+        }
+      }
+    }
 
-    copied.assign_subtract(newChanged);
-    changed = newChanged;
+    for (g = copied.begin(); g != copied.end();) {
+      g->region.assign_subtract(newChanged);
+      if (g->region.is_empty())
+        g = copied.erase(g);
+      else
+        g++;
+    }
+    updateHeat(newChanged);
+    changed.swap(newChanged);
   }
 }
 
-void ComparingUpdateTracker::compareRect(const Rect& r, Region* newChanged)
+void ComparingUpdateTracker::compareRect(const Rect& r,
+                                         std::vector<Rect>* changedBlocks)
 {
   if (!r.enclosed_by(fb->getRect())) {
     fprintf(stderr,"ComparingUpdateTracker: rect outside fb (%d,%d-%d,%d)\n", r.tl.x, r.tl.y, r.br.x, r.br.y);
@@ -81,8 +481,6 @@ void ComparingUpdateTracker::compareRect(const Rect& r, Region* newChanged)
   rdr::U8* oldData = oldFb.getPixelsRW(r, &oldStride);
   int oldStrideBytes = oldStride * bytesPerPixel;
 
-  std::vector<Rect> changedBlocks;
-
   for (int blockTop = r.tl.y; blockTop < r.br.y; blockTop += BLOCK_SIZE)
   {
     // Get a strip of the source buffer
@@ -102,32 +500,86 @@ void ComparingUpdateTracker::compareRect(const Rect& r, Region* newChanged)
       int blockRight = __rfbmin(blockLeft+BLOCK_SIZE, r.br.x);
       int blockWidthInBytes = (blockRight-blockLeft) * bytesPerPixel;
 
+      // Find the bounding box of the changed bytes in the block
+      int top = blockBottom, bottom = blockTop;
+      int left = blockWidthInBytes, right = 0;
       for (int y = blockTop; y < blockBottom; y++)
       {
-        if (memcmp(oldPtr, newPtr, blockWidthInBytes) != 0)
-        {
-          // A block has changed - copy the remainder to the oldFb
-          changedBlocks.push_back(Rect(blockLeft, blockTop,
-                                       blockRight, blockBottom));
-          for (int y2 = y; y2 < blockBottom; y2++)
-          {
-            memcpy(oldPtr, newPtr, blockWidthInBytes);
-            newPtr += newStrideBytes;
-            oldPtr += oldStrideBytes;
-          }
-          break;
+        int first, last;
+        if (findRowChange(oldPtr, newPtr, blockWidthInBytes, &first, &last)) {
+          if (top > y) top = y;
+          bottom = y + 1;
+          if (left > first) left = first;
+          if (right < last + 1) right = last + 1;
         }
 
         newPtr += newStrideBytes;
         oldPtr += oldStrideBytes;
       }
 
+      if (top < bottom)
+      {
+        // Round to whole pixels and copy them to the oldFb
+        left -= left % bytesPerPixel;
+        right += bytesPerPixel - 1 - (right - 1) % bytesPerPixel;
+        changedBlocks->push_back(Rect(blockLeft + left / bytesPerPixel, top,
+                                      blockLeft + right / bytesPerPixel,
+                                      bottom));
+
+        newPtr = newBlockPtr + (top - blockTop) * newStrideBytes + left;
+        oldPtr = oldBlockPtr + (top - blockTop) * oldStrideBytes + left;
+        for (int y = top; y < bottom; y++)
+        {
+          memcpy(oldPtr, newPtr, right - left);
+          newPtr += newStrideBytes;
+          oldPtr += oldStrideBytes;
+        }
+      }
+
       oldBlockPtr += blockWidthInBytes;
       newBlockPtr += blockWidthInBytes;
     }
 
     oldData += oldStrideBytes * BLOCK_SIZE;
   }
+}
+
+// compareHashes() checks every block which overlaps rects, not just the parts
+// in rects, since the hash covers the whole block.  A changed block is added
+// to changed in full, because part of it outside rects may have changed
+// without being reported yet.
+
+void ComparingUpdateTracker::compareHashes(const std::vector<Rect>& rects,
+                                           Region* newChanged)
+{
+  int bs = hashBlockSize;
+  int recheck = rfb::Server::compareHashRecheck;
+  bool changedAnyway = (recheck > 0 && ++compareCount % recheck == 0);
+
+  Region blocks;
+  std::vector<Rect>::const_iterator i;
+  for (i = rects.begin(); i != rects.end(); i++) {
+    blocks.assign_union(Rect(i->tl.x / bs * bs, i->tl.y / bs * bs,
+                             (i->br.x + bs - 1) / bs * bs,
+                             (i->br.y + bs - 1) / bs * bs));
+  }
+
+  std::vector<Rect> blockRects;
+  std::vector<Rect> changedBlocks;
+  blocks.get_rects(&blockRects);
+  for (i = blockRects.begin(); i != blockRects.end(); i++) {
+    for (int y = i->tl.y; y < i->br.y; y += bs) {
+      for (int x = i->tl.x; x < i->br.x; x += bs) {
+        Rect block = Rect(x, y, x+bs, y+bs).intersect(fb->getRect());
+        rdr::U64* h = &hashes[(y / bs) * hashBlocksAcross + x / bs];
+        rdr::U64 newHash = hashRect(block);
+        if (newHash != *h || changedAnyway) {
+          *h = newHash;
+          changedBlocks.push_back(block);
+        }
+      }
+    }
+  }
 
   if (!changedBlocks.empty()) {
     Region temp;
@@ -135,3 +587,232 @@ void ComparingUpdateTracker::compareRect(const Rect& r, Region* newChanged)
     newChanged->assign_union(temp);
   }
 }
+
+rdr::U64 ComparingUpdateTracker::hashRect(const Rect& r)
+{
+  int bytesPerPixel = fb->getPF().bpp/8;
+  int stride;
+  const rdr::U8* data = fb->getPixelsR(r, &stride);
+  int strideBytes = stride * bytesPerPixel;
+  int rowBytes = r.width() * bytesPerPixel;
+
+  rdr::U64 v1 = PRIME64_1 + PRIME64_2;
+  rdr::U64 v2 = PRIME64_2;
+  rdr::U64 v3 = 0;
+  rdr::U64 v4 = 0 - PRIME64_1;
+
+  for (int y = r.tl.y; y < r.br.y; y++) {
+    const rdr::U8* p = data;
+    const rdr::U8* end = data + rowBytes;
+    for (; p + 32 <= end; p += 32) {
+      v1 = hashRound(v1, read64(p));
+      v2 = hashRound(v2, read64(p + 8));
+      v3 = hashRound(v3, read64(p + 16));
+      v4 = hashRound(v4, read64(p + 24));
+    }
+    if (p < end) {
+      rdr::U8 tail[32];
+      memset(tail, 0, 32);
+      memcpy(tail, p, end - p);
+      v1 = hashRound(v1, read64(tail));
+      v2 = hashRound(v2, read64(tail + 8));
+      v3 = hashRound(v3, read64(tail + 16));
+      v4 = hashRound(v4, read64(tail + 24));
+    }
+    data += strideBytes;
+  }
+
+  rdr::U64 h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+  h = hashMerge(h, v1);
+  h = hashMerge(h, v2);
+  h = hashMerge(h, v3);
+  h = hashMerge(h, v4);
+  return hashFinal(h);
+}
+
+// detectScrolling() looks for changed rectangles whose rows or columns match
+// those of the old framebuffer at an offset, and adds them as copies.  Each
+// copy reads the old framebuffer, as the copy groups already do, so it is
+// added straight to the groups.  compare() then checks the copies along
+// with everything else.  Each rectangle checked is hashed up to four times,
+// so rectangles which would take the total past MAX_SCROLL_AREA are skipped.
+
+void ComparingUpdateTracker::detectScrolling()
+{
+  std::vector<Rect> rects;
+  changed.get_rects(&rects);
+
+  int areaLeft = MAX_SCROLL_AREA;
+  std::vector<Rect>::const_iterator i;
+  for (i = rects.begin(); i != rects.end(); i++) {
+    if (i->width() < MIN_SCROLL_SIZE || i->height() < MIN_SCROLL_SIZE ||
+        (int)i->area() > areaLeft)
+      continue;
+    areaLeft -= i->area();
+
+    Region dest;
+    Point delta;
+    if (!findScroll(*i, false, &dest, &delta) &&
+        !findScroll(*i, true, &dest, &delta))
+      continue;
+
+    std::list<CopyGroup>::iterator g;
+    for (g = copied.begin(); g != copied.end();) {
+      g->region.assign_subtract(dest);
+      if (g->region.is_empty())
+        g = copied.erase(g);
+      else
+        g++;
+    }
+    for (g = copied.begin(); g != copied.end(); g++) {
+      if (g->delta.equals(delta)) {
+        g->region.assign_union(dest);
+        break;
+      }
+    }
+    if (g == copied.end())
+      copied.push_back(CopyGroup(dest, delta));
+    orderCopies();
+  }
+}
+
+// findScroll() matches the rows of r, or its columns if columns is set,
+// against the old framebuffer.  Lines which occur more than once in the old
+// framebuffer are ignored, and each of the rest votes for the offset it has
+// moved by.  If enough agree then dest is set to the lines which moved by
+// that offset, and delta to the offset.
+
+bool ComparingUpdateTracker::findScroll(const Rect& r, bool columns,
+                                        Region* dest, Point* delta)
+{
+  std::vector<rdr::U64> newHashes, oldHashes;
+  lineHashes(fb, r, columns, &newHashes);
+  lineHashes(&oldFb, r, columns, &oldHashes);
+  int n = newHashes.size();
+
+  std::map<rdr::U64, int> oldLines;
+  int line;
+  for (line = 0; line < n; line++) {
+    std::pair<std::map<rdr::U64, int>::iterator, bool> ins
+      = oldLines.insert(std::make_pair(oldHashes[line], line));
+    if (!ins.second)
+      ins.first->second = -1;
+  }
+
+  std::map<int, int> votes;
+  int changedLines = 0;
+  for (line = 0; line < n; line++) {
+    if (newHashes[line] == oldHashes[line]) continue;
+    changedLines++;
+    std::map<rdr::U64, int>::const_iterator old
+      = oldLines.find(newHashes[line]);
+    if (old != oldLines.end() && old->second >= 0)
+      votes[line - old->second]++;
+  }
+
+  int offset = 0, bestVotes = 0;
+  std::map<int, int>::const_iterator v;
+  for (v = votes.begin(); v != votes.end(); v++) {
+    if (v->second > bestVotes) {
+      offset = v->first;
+      bestVotes = v->second;
+    }
+  }
+  if (bestVotes < MIN_SCROLL_LINES || bestVotes * 4 < changedLines)
+    return false;
+
+  std::vector<Rect> lines;
+  for (line = __rfbmax(0, offset); line < __rfbmin(n, n + offset); line++) {
+    if (newHashes[line] != oldHashes[line - offset] ||
+        newHashes[line] == oldHashes[line])
+      continue;
+    if (columns)
+      lines.push_back(Rect(r.tl.x + line, r.tl.y, r.tl.x + line + 1, r.br.y));
+    else
+      lines.push_back(Rect(r.tl.x, r.tl.y + line, r.br.x, r.tl.y + line + 1));
+  }
+  dest->setOrderedRects(lines);
+  *delta = columns ? Point(offset, 0) : Point(0, offset);
+  return true;
+}
+
+
+// -=- Heat map
+
+// heatScale() returns the factor by which the tiles' counts must be
+// multiplied to give current rates of change, allowing for the decay since
+// the heat map was last updated.  A count which decays with time constant
+// tau, and which is incremented n times a second, settles at n * tau.
+
+double ComparingUpdateTracker::heatScale() const
+{
+  double halfLife = rfb::Server::heatMapHalfLife / 1000.0;
+  double elapsed = Timer::msSince(heatTime) / 1000.0;
+  return pow(0.5, elapsed / halfLife) * log(2.0) / halfLife;
+}
+
+void ComparingUpdateTracker::updateHeat(const Region& changed)
+{
+  double decay = pow(0.5, (double)Timer::msSince(heatTime) /
+                          rfb::Server::heatMapHalfLife);
+  Timer::getTime(&heatTime);
+
+  int nTiles = heatTilesAcross * heatTilesDown;
+  std::vector<bool> hit(nTiles);
+
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator i;
+  changed.get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); i++) {
+    int x2 = (i->br.x + heatTileSize - 1) / heatTileSize;
+    int y2 = (i->br.y + heatTileSize - 1) / heatTileSize;
+    for (int y = i->tl.y / heatTileSize; y < y2; y++) {
+      for (int x = i->tl.x / heatTileSize; x < x2; x++)
+        hit[y * heatTilesAcross + x] = true;
+    }
+  }
+
+  for (int t = 0; t < nTiles; t++)
+    heat[t] = (float)(heat[t] * decay + (hit[t] ? 1 : 0));
+}
+
+double ComparingUpdateTracker::changeRate(const Rect& r_) const
+{
+  Rect r = r_.intersect(fb->getRect());
+  if (r.is_empty())
+    return 0;
+
+  float hottest = 0;
+  int x2 = (r.br.x + heatTileSize - 1) / heatTileSize;
+  int y2 = (r.br.y + heatTileSize - 1) / heatTileSize;
+  for (int y = r.tl.y / heatTileSize; y < y2; y++) {
+    for (int x = r.tl.x / heatTileSize; x < x2; x++)
+      hottest = __rfbmax(hottest, heat[y * heatTilesAcross + x]);
+  }
+  return hottest * heatScale();
+}
+
+Region ComparingUpdateTracker::hotRegion(double minRate) const
+{
+  float minHeat = (float)(minRate / heatScale());
+  std::vector<Rect> rects;
+
+  // Join hot tiles into runs along each row
+  for (int y = 0; y < heatTilesDown; y++) {
+    const float* row = &heat[y * heatTilesAcross];
+    for (int x = 0; x < heatTilesAcross; x++) {
+      if (row[x] < minHeat)
+        continue;
+      int start = x;
+      while (x < heatTilesAcross && row[x] >= minHeat)
+        x++;
+      rects.push_back(Rect(start * heatTileSize, y * heatTileSize,
+                           x * heatTileSize, (y+1) * heatTileSize)
+                      .intersect(fb->getRect()));
+    }
+  }
+
+  Region hot;
+  hot.setOrderedRects(rects);
+  return hot;
+}
@@ -19,24 +19,75 @@
 #ifndef __RFB_COMPARINGUPDATETRACKER_H__
 #define __RFB_COMPARINGUPDATETRACKER_H__
 
+#include <vector>
 #include <rfb/UpdateTracker.h>
+#include <rfb/Timer.h>
 
 namespace rfb {
 
+  class ComparePool;
+
   class ComparingUpdateTracker : public SimpleUpdateTracker {
   public:
     ComparingUpdateTracker(PixelBuffer* buffer);
     ~ComparingUpdateTracker();
 
     // compare() does the comparison and reduces its changed and copied regions
-    // as appropriate.
+    // as appropriate.  Where threads are available, large regions are split
+    // into horizontal bands which are compared in parallel.
 
     virtual void compare();
+
+    // The heat map records how often each tile of the framebuffer has been
+    // found to change, so that areas such as video can be told apart from
+    // areas which change rarely.  Each tile's count of changes decays
+    // exponentially, with a half-life of HeatMapHalfLife milliseconds, and
+    // is reported as an estimate of the number of changes per second.
+
+    static const int heatTileSize = 64;
+
+    // changeRate() returns the highest rate of change of the tiles within r
+    double changeRate(const Rect& r) const;
+
+    // hotRegion() returns the tiles changing at least minRate times a second
+    Region hotRegion(double minRate) const;
+
   private:
-    void compareRect(const Rect& r, Region* newchanged);
+    // compareRect() brings the old framebuffer up to date within r, adding
+    // the bounding box of the changed pixels in each block to changed.
+    void compareRect(const Rect& r, std::vector<Rect>* changed);
+    friend class ComparePool;
+
+    // compareHashes() is used instead of compareRect() when only a hash of
+    // each block is kept.  It adds each block in rects whose hash has changed
+    // to changed.
+    void compareHashes(const std::vector<Rect>& rects, Region* changed);
+    rdr::U64 hashRect(const Rect& r);
+
+    // detectScrolling() finds areas of the changed region which have
+    // scrolled, and turns them into copies.
+    void detectScrolling();
+    bool findScroll(const Rect& r, bool columns, Region* dest, Point* delta);
+
+    // updateHeat() decays the heat map and adds the tiles within changed
+    void updateHeat(const Region& changed);
+    double heatScale() const;
+
     PixelBuffer* fb;
     ManagedPixelBuffer oldFb;
     bool firstCompare;
+    ComparePool* pool;
+
+    bool useHashes;
+    int hashBlockSize;
+    int hashBlocksAcross;
+    rdr::U64* hashes;
+    int compareCount;
+
+    int heatTilesAcross;
+    int heatTilesDown;
+    float* heat;
+    timeval heatTime;
   };
 
 }
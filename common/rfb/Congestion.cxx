@@ -0,0 +1,131 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#include <rfb/Congestion.h>
+#include <rfb/LogWriter.h>
+
+using namespace rfb;
+
+static LogWriter vlog("Congestion");
+
+static const unsigned int initialWindow = 16384;
+static const unsigned int minimumWindow = 4096;
+static const unsigned int maximumWindow = 4*1024*1024;
+
+// The round trip time may exceed the lowest seen by this many milliseconds,
+// or by half the lowest if that is more, before it counts as congestion.
+static const int delayAllowance = 20;
+
+// The shortest time over which to measure how fast the send queue drains
+static const int queueSampleTime = 50;
+
+Congestion::Congestion()
+  : ackedOffset(0), lastRTT(0), baseRTT(0), window(initialWindow),
+    seenCongestion(false), drainRate(0), queueing(false), queueWritten(0)
+{
+}
+
+void Congestion::sentPing(unsigned int offset)
+{
+  Ping ping;
+  Timer::getTime(&ping.sent);
+  ping.offset = offset;
+  ping.inFlight = offset - ackedOffset;
+  pings.push_back(ping);
+}
+
+void Congestion::gotPong()
+{
+  if (pings.empty())
+    return;
+
+  Ping ping = pings.front();
+  pings.pop_front();
+
+  lastRTT = Timer::msSince(ping.sent);
+  if (lastRTT < 1) lastRTT = 1;
+  if (!baseRTT || lastRTT < baseRTT)
+    baseRTT = lastRTT;
+  ackedOffset = ping.offset;
+
+  // The data in flight when the fence was sent took a round trip to be
+  // received
+  sampleDrainRate((unsigned int)((double)ping.inFlight * 1000 / lastRTT));
+
+  int allowance = baseRTT / 2;
+  if (allowance < delayAllowance) allowance = delayAllowance;
+
+  if (lastRTT - baseRTT > allowance) {
+    seenCongestion = true;
+    window -= window / 4;
+    if (window < minimumWindow)
+      window = minimumWindow;
+    vlog.debug("RTT %d ms (base %d ms), window cut to %u",
+               lastRTT, baseRTT, window);
+  } else if (ping.inFlight >= window / 2) {
+    // Grow quickly until the first sign of congestion, then cautiously
+    if (seenCongestion)
+      window += minimumWindow;
+    else
+      window *= 2;
+    if (window > maximumWindow)
+      window = maximumWindow;
+  }
+}
+
+void Congestion::updateQueue(unsigned int written, unsigned int queued)
+{
+  if (!queued) {
+    queueing = false;
+    return;
+  }
+
+  if (!queueing) {
+    queueing = true;
+    Timer::getTime(&queueTime);
+    queueWritten = written;
+    return;
+  }
+
+  int elapsed = Timer::msSince(queueTime);
+  if (elapsed < queueSampleTime)
+    return;
+  sampleDrainRate((unsigned int)((double)(written - queueWritten) * 1000 /
+                                 elapsed));
+  Timer::getTime(&queueTime);
+  queueWritten = written;
+}
+
+// sampleDrainRate() updates the estimate of how fast the client receives
+// data.  A sample taken with little data to send says little about how fast
+// it could have been received, so rises are taken at once but falls only
+// slowly.
+
+void Congestion::sampleDrainRate(unsigned int rate)
+{
+  if (rate > drainRate)
+    drainRate = rate;
+  else
+    drainRate -= (drainRate - rate) / 8;
+}
+
+bool Congestion::isCongested(unsigned int offset)
+{
+  if (pings.empty())
+    return false;
+  return offset - ackedOffset >= window;
+}
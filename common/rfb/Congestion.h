@@ -0,0 +1,91 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// Congestion - estimates how much data can be in flight to a client.
+//
+// The server sends a fence after each update and the client returns it once
+// it has processed everything before it, so the time until it comes back is
+// the round trip time including the client's decoding.  The lowest such time
+// seen is taken to be the time with no queueing.  Congestion keeps a window
+// of bytes which may be sent but not yet acknowledged by a returned fence,
+// doubling it while the window is in use and the round trip time stays close
+// to the lowest, and cutting it back when the round trip time grows, which
+// means data is queueing somewhere between the server and the client's
+// screen.
+//
+
+#ifndef __RFB_CONGESTION_H__
+#define __RFB_CONGESTION_H__
+
+#include <list>
+#include <rfb/Timer.h>
+
+namespace rfb {
+
+  class Congestion {
+  public:
+    Congestion();
+
+    // sentPing() is called when a fence is sent, giving the number of bytes
+    // sent on the connection so far, including the fence.
+    void sentPing(unsigned int offset);
+
+    // gotPong() is called when the oldest outstanding fence is returned.
+    void gotPong();
+
+    // isCongested() returns true if no more updates should be sent until
+    // another fence is returned, given the number of bytes sent so far.
+    bool isCongested(unsigned int offset);
+
+    int getRTT()          { return lastRTT; }
+    int getBaseRTT()      { return baseRTT; }
+    unsigned int getWindow() { return window; }
+
+    // updateQueue() is called with the number of bytes written to the
+    // socket so far and the number still queued to be written.  While data
+    // is queued the network is what limits the connection, so how fast the
+    // first number grows also shows how fast the client can receive data.
+    void updateQueue(unsigned int written, unsigned int queued);
+
+    // getDrainRate() returns an estimate of how many bytes a second the
+    // client can receive, or zero if there is no estimate yet.
+    unsigned int getDrainRate() { return drainRate; }
+
+  private:
+    void sampleDrainRate(unsigned int rate);
+
+    struct Ping {
+      timeval sent;
+      unsigned int offset;
+      unsigned int inFlight;
+    };
+
+    std::list<Ping> pings;
+    unsigned int ackedOffset;
+    int lastRTT;
+    int baseRTT;
+    unsigned int window;
+    bool seenCongestion;
+    unsigned int drainRate;
+    bool queueing;
+    timeval queueTime;
+    unsigned int queueWritten;
+  };
+
+}
+#endif
@@ -21,6 +21,7 @@
 #include <rfb/encodings.h>
 #include <rfb/Encoder.h>
 #include <rfb/ConnParams.h>
+#include <rfb/TileCache.h>
 #include <rfb/util.h>
 
 using namespace rfb;
@@ -28,8 +29,9 @@ using namespace rfb;
 ConnParams::ConnParams()
   : majorVersion(0), minorVersion(0), width(0), height(0), useCopyRect(false),
     supportsLocalCursor(false), supportsDesktopResize(true),
-    name_(0), nEncodings_(0), encodings_(0),
-    currentEncoding_(encodingRaw), verStrPos(0)
+    supportsFence(false), supportsContinuousUpdates(false),
+    qualityLevel(-1), tileCacheSize(0), scale(1), name_(0), nEncodings_(0),
+    encodings_(0), currentEncoding_(encodingRaw), verStrPos(0)
 {
   setName("");
 }
@@ -88,6 +90,11 @@ void ConnParams::setEncodings(int nEncodings, const rdr::U32* encodings)
   useCopyRect = false;
   supportsLocalCursor = false;
   supportsDesktopResize = false;
+  supportsFence = false;
+  supportsContinuousUpdates = false;
+  qualityLevel = -1;
+  tileCacheSize = 0;
+  scale = 1;
   currentEncoding_ = encodingRaw;
 
   for (int i = nEncodings-1; i >= 0; i--) {
@@ -99,6 +106,19 @@ void ConnParams::setEncodings(int nEncodings, const rdr::U32* encodings)
       supportsLocalCursor = true;
     else if (encodings[i] == pseudoEncodingDesktopSize)
       supportsDesktopResize = true;
+    else if (encodings[i] == pseudoEncodingFence)
+      supportsFence = true;
+    else if (encodings[i] == pseudoEncodingContinuousUpdates)
+      supportsContinuousUpdates = true;
+    else if (encodings[i] >= pseudoEncodingQualityLevel0 &&
+             encodings[i] <= pseudoEncodingQualityLevel9)
+      qualityLevel = encodings[i] - pseudoEncodingQualityLevel0;
+    else if (encodings[i] >= pseudoEncodingTileCache0 &&
+             encodings[i] <= pseudoEncodingTileCache15)
+      tileCacheSize = TileCache::sizeForEncoding(encodings[i]);
+    else if (encodings[i] >= pseudoEncodingScale1 &&
+             encodings[i] <= pseudoEncodingScale8)
+      scale = encodings[i] - pseudoEncodingScale1 + 1;
     else if (encodings[i] <= encodingMax && Encoder::supported(encodings[i]))
       currentEncoding_ = encodings[i];
   }
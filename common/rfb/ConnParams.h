@@ -71,6 +71,20 @@ namespace rfb {
 
     bool supportsLocalCursor;
     bool supportsDesktopResize;
+    bool supportsFence;
+    bool supportsContinuousUpdates;
+
+    // qualityLevel is the client's preferred image quality for lossy
+    // encodings, from 0 (lowest) to 9, or -1 if it has no preference.
+    int qualityLevel;
+
+    // tileCacheSize is the number of tiles the client can hold in its tile
+    // cache, or 0 if it doesn't support the tile cache pseudo-encodings.
+    int tileCacheSize;
+
+    // scale is the factor by which the client would like the server to scale
+    // its framebuffer down, from 1 (not at all) to 8.
+    int scale;
 
   private:
 
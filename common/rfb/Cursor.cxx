@@ -19,6 +19,12 @@
 #include <rfb/Cursor.h>
 #include <rfb/LogWriter.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CURSOR_SSE2
+#endif
+
 using namespace rfb;
 
 static LogWriter vlog("Cursor");
@@ -177,3 +183,71 @@ void Cursor::crop()
   data = newData;
   mask.buf = newMask;
 }
+
+
+void RenderedCursor::setCursor(const Cursor* cursor_)
+{
+  cursor = cursor_;
+  int bytesPerPixel = cursor->getPF().bpp / 8;
+  int maskStride = (cursor->width() + 7) / 8;
+  delete [] byteMask.buf;
+  byteMask.buf = new rdr::U8[cursor->area() * bytesPerPixel];
+
+  rdr::U8* out = byteMask.buf;
+  for (int y = 0; y < cursor->height(); y++) {
+    const rdr::U8* maskRow = cursor->mask.buf + y * maskStride;
+    for (int x = 0; x < cursor->width(); x++) {
+      rdr::U8 b = (maskRow[x / 8] & (0x80 >> (x % 8))) ? 0xff : 0;
+      for (int i = 0; i < bytesPerPixel; i++)
+        *out++ = b;
+    }
+  }
+}
+
+// blendRow() takes each byte from the cursor where the mask is set, and from
+// the framebuffer where it isn't.
+
+static inline void blendRow(rdr::U8* out, const rdr::U8* fb,
+                            const rdr::U8* cursor, const rdr::U8* mask,
+                            int len)
+{
+  int i = 0;
+#ifdef CURSOR_SSE2
+  for (; i + 16 <= len; i += 16) {
+    __m128i m = _mm_loadu_si128((const __m128i*)(mask + i));
+    __m128i c = _mm_loadu_si128((const __m128i*)(cursor + i));
+    __m128i f = _mm_loadu_si128((const __m128i*)(fb + i));
+    _mm_storeu_si128((__m128i*)(out + i),
+                     _mm_or_si128(_mm_and_si128(m, c),
+                                  _mm_andnot_si128(m, f)));
+  }
+#endif
+  for (; i < len; i++)
+    out[i] = (cursor[i] & mask[i]) | (fb[i] & ~mask[i]);
+}
+
+void RenderedCursor::render(PixelBuffer* fb, const Point& pos, const Rect& r)
+{
+  setSize(r.width(), r.height());
+  if (r.is_empty())
+    return;
+
+  int bytesPerPixel = getPF().bpp / 8;
+  int rowBytes = r.width() * bytesPerPixel;
+  int cursorRowBytes = cursor->width() * bytesPerPixel;
+  int offset = ((r.tl.y - pos.y) * cursor->width() + r.tl.x - pos.x) *
+    bytesPerPixel;
+  const rdr::U8* cursorData = cursor->data + offset;
+  const rdr::U8* maskData = byteMask.buf + offset;
+
+  int fbStride;
+  const rdr::U8* fbData = fb->getPixelsR(r, &fbStride);
+  int fbRowBytes = fbStride * bytesPerPixel;
+
+  for (int y = 0; y < r.height(); y++) {
+    blendRow(data + y * rowBytes, fbData, cursorData, maskData, rowBytes);
+    fbData += fbRowBytes;
+    cursorData += cursorRowBytes;
+    maskData += cursorRowBytes;
+  }
+}
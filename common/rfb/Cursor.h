@@ -52,5 +52,30 @@ namespace rfb {
     void crop();
   };
 
+  // -=- RenderedCursor
+  //   The cursor drawn over the part of the framebuffer beneath it, for
+  //   clients which cannot draw the cursor themselves.  The cursor's mask is
+  //   expanded to one byte for each byte of pixel data when the cursor
+  //   changes, so that each row can then be drawn with a few bitwise
+  //   operations, several pixels at a time.
+
+  class RenderedCursor : public ManagedPixelBuffer {
+  public:
+    RenderedCursor() : cursor(0) {}
+
+    // setCursor() prepares the given cursor for drawing.  It must be called
+    // again whenever the cursor or its pixel format changes.
+    void setCursor(const Cursor* cursor);
+
+    // render() draws the cursor, with its top-left corner at pos, over the
+    // framebuffer within r, which must lie within both the cursor and the
+    // framebuffer.  The rendered cursor is resized to r.
+    void render(PixelBuffer* fb, const Point& pos, const Rect& r);
+
+  protected:
+    const Cursor* cursor;
+    rdr::U8Array byteMask;
+  };
+
 }
 #endif
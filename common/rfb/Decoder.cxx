@@ -65,4 +65,5 @@ DecoderInit::DecoderInit()
   Decoder::registerDecoder(encodingRRE, RREDecoder::create);
   Decoder::registerDecoder(encodingHextile, HextileDecoder::create);
   Decoder::registerDecoder(encodingZRLE, ZRLEDecoder::create);
+  Decoder::registerDecoder(encodingZYWRLE, ZRLEDecoder::createZYWRLE);
 }
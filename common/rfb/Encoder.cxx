@@ -29,6 +29,16 @@ Encoder::~Encoder()
 {
 }
 
+int Encoder::maxRectBytes()
+{
+  return 0;
+}
+
+bool Encoder::lossy()
+{
+  return false;
+}
+
 EncoderCreateFnType Encoder::createFns[encodingMax+1] = { 0 };
 
 bool Encoder::supported(unsigned int encoding)
@@ -72,4 +82,5 @@ EncoderInit::EncoderInit()
   Encoder::registerEncoder(encodingRRE, RREEncoder::create);
   Encoder::registerEncoder(encodingHextile, HextileEncoder::create);
   Encoder::registerEncoder(encodingZRLE, ZRLEEncoder::create);
+  Encoder::registerEncoder(encodingZYWRLE, ZRLEEncoder::createZYWRLE);
 }
@@ -36,6 +36,14 @@ namespace rfb {
     // rectangle which was updated.
     virtual bool writeRect(const Rect& r, ImageGetter* ig, Rect* actual)=0;
 
+    // maxRectBytes() returns the raw size in bytes of the largest rectangle
+    // which writeRect() is sure to write in full, or 0 if there is no limit.
+    virtual int maxRectBytes();
+
+    // lossy() returns true if the client may not be sent exactly the pixels
+    // given to writeRect().
+    virtual bool lossy();
+
     static bool supported(unsigned int encoding);
     static Encoder* createEncoder(unsigned int encoding, SMsgWriter* writer);
     static void registerEncoder(unsigned int encoding,
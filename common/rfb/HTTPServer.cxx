@@ -34,6 +34,19 @@ static LogWriter vlog("HTTPServer");
 const int clientWaitTimeMillis = 20000;
 const int idleTimeoutSecs = 5 * 60;
 
+// How long to keep an idle connection open for another request
+const int keepAliveTimeoutSecs = 15;
+
+// How much response to queue for a client which is slow to receive it
+const int maxSendQueue = 65536;
+
+// How much of the body to queue when the socket will take no more
+const int bodyChunkSize = 16384;
+
+// Limits on the files kept in memory
+const int maxCachedFileSize = 4 * 1024 * 1024;
+const int maxCacheSize = 16 * 1024 * 1024;
+
 
 //
 // -=- LineReader
@@ -82,52 +95,87 @@ protected:
 };
 
 
+//
+// -=- HTTPServer::Body
+//     The content of a file and the headers which describe it.
+//
+
+struct rfb::HTTPServer::Body {
+  CharArray name;
+  time_t lastModified;
+  int length;
+  U8* data;
+  CharArray etag;
+  CharArray headers;
+  bool cached;
+  int users;
+
+  Body() : lastModified(-1), length(0), data(0), cached(false), users(0) {}
+  ~Body() { delete [] data; }
+};
+
+
 //
 // -=- HTTPServer::Session
 //     Manages the internal state for an HTTP session.
-//     processHTTP returns true when request has completed,
-//     indicating that socket & session data can be deleted.
+//     processHTTP returns true when the session has finished and its
+//     output has been written, indicating that socket & session data can
+//     be deleted.
 //
 
 class rfb::HTTPServer::Session {
 public:
   Session(network::Socket& s, rfb::HTTPServer& srv)
-    : contentType(0), contentLength(-1), lastModified(-1),
-      line(s.inStream(), 256), sock(s),
-      server(srv), state(ReadRequestLine), lastActive(time(0)) {
+    : line(s.inStream(), 256), sock(s), server(srv),
+      state(ReadRequestLine), keepAlive(false), requests(0),
+      ifModifiedSince(-1), body(0), bodyPos(0), lastActive(time(0)) {
   }
   ~Session() {
+    if (body)
+      server.releaseBody(body);
   }
 
   void writeResponse(int result, const char* text);
   bool writeResponse(int code);
 
   bool processHTTP();
+  bool processWrite();
 
   network::Socket* getSock() const {return &sock;}
 
   int checkIdleTimeout();
 protected:
+  void readHeader();
+  bool isNotModified();
+  bool writeBody();
+  bool finishResponse();
+
   CharArray uri;
-  const char* contentType;
-  int contentLength;
-  time_t lastModified;
   LineReader line;
   network::Socket& sock;
   rfb::HTTPServer& server;
-  enum {ReadRequestLine, ReadHeaders, WriteResponse} state;
+  enum {ReadRequestLine, ReadHeaders, WriteBody, Closing} state;
   enum {GetRequest, HeadRequest} request;
+  bool keepAlive;
+  int requests;
+  time_t ifModifiedSince;
+  CharArray ifNoneMatch;
+  Body* body;
+  int bodyPos;
   time_t lastActive;
 };
 
 
 // - Internal helper routines
 
-void
-copyStream(InStream& is, OutStream& os) {
+// readStream() reads the rest of a stream into memory.
+
+static void readStream(InStream& is, MemOutStream& os) {
   try {
     while (1) {
-      os.writeU8(is.readU8());
+      int n = is.check(1, 4096);
+      os.writeBytes(is.getptr(), n);
+      is.setptr(is.getptr() + n);
     }
   } catch (rdr::EndOfStream) {
   }
@@ -138,6 +186,47 @@ void writeLine(OutStream& os, const char* text) {
   os.writeBytes("\r\n", 2);
 }
 
+static void formatHTTPDate(char* buffer, int len, const char* header,
+                           time_t t) {
+  char format[64];
+  sprintf(format, "%s: %%a, %%d %%b %%Y %%H:%%M:%%S GMT", header);
+  strftime(buffer, len, format, gmtime(&t));
+}
+
+// parseHTTPDate() reads a date in the RFC 1123 form used by HTTP, returning
+// -1 if it cannot.
+
+static time_t parseHTTPDate(const char* text) {
+  static const char* months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  char month[4];
+  int day, year, hour, min, sec;
+  if (sscanf(text, "%*3s, %d %3s %d %d:%d:%d", &day, month, &year,
+             &hour, &min, &sec) != 6)
+    return -1;
+  const char* m = strstr(months, month);
+  if (!m || strlen(month) != 3 || (m - months) % 3 != 0)
+    return -1;
+  int mon = (m - months) / 3 + 1;
+
+  // Count the days since 1970 - there is no portable timegm()
+  int y = year - (mon <= 2);
+  int era = (y >= 0 ? y : y - 399) / 400;
+  int yoe = y - era * 400;
+  int doy = (153 * (mon + (mon > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  long days = era * 146097L + doe - 719468L;
+  return (time_t)(days * 86400L + hour * 3600L + min * 60L + sec);
+}
+
+// hashData() is FNV-1a, used to make ETags.
+
+static U32 hashData(const U8* data, int length) {
+  U32 h = 2166136261U;
+  for (int i = 0; i < length; i++)
+    h = (h ^ data[i]) * 16777619U;
+  return h;
+}
+
 
 // - Write an HTTP-compliant response to the client
 
@@ -151,46 +240,46 @@ HTTPServer::Session::writeResponse(int result, const char* text) {
   OutStream& os=sock.outStream();
   writeLine(os, buffer);
   writeLine(os, "Server: RealVNC/4.0");
-  time_t now = time(0);
-  struct tm* tm = gmtime(&now);
-  strftime(buffer, 1024, "Date: %a, %d %b %Y %H:%M:%S GMT", tm);
-  writeLine(os, buffer);
-  if (lastModified == (time_t)-1 || lastModified == 0)
-    lastModified = now;
-  tm = gmtime(&lastModified);
-  strftime(buffer, 1024, "Last-Modified: %a, %d %b %Y %H:%M:%S GMT", tm);
+  formatHTTPDate(buffer, 1024, "Date", time(0));
   writeLine(os, buffer);
-  if (contentLength != -1) {
-    sprintf(buffer,"Content-Length: %d",contentLength);
-    writeLine(os, buffer);
-  }
-  writeLine(os, "Connection: close");
-  os.writeBytes("Content-Type: ", 14);
-  if (result == 200) {
-    if (!contentType)
-      contentType = guessContentType(uri.buf, "text/html");
-    os.writeBytes(contentType, strlen(contentType));
+  writeLine(os, keepAlive ? "Connection: keep-alive" : "Connection: close");
+
+  if (result == 304) {
+    if (body->etag.buf) {
+      sprintf(buffer, "ETag: %s", body->etag.buf);
+      writeLine(os, buffer);
+    }
+    writeLine(os, "");
+  } else if (result == 200) {
+    os.writeBytes(body->headers.buf, strlen(body->headers.buf));
+    writeLine(os, "");
   } else {
-    os.writeBytes("text/html", 9);
-  }
-  os.writeBytes("\r\n", 2);
-  writeLine(os, "");
-  if (result != 200) {
-    writeLine(os, "<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">");
-    writeLine(os, "<HTML><HEAD>");
+    MemOutStream page;
+    writeLine(page, "<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">");
+    writeLine(page, "<HTML><HEAD>");
     sprintf(buffer, "<TITLE>%d %s</TITLE>", result, text);
+    writeLine(page, buffer);
+    writeLine(page, "</HEAD><BODY><H1>");
+    writeLine(page, text);
+    writeLine(page, "</H1></BODY></HTML>");
+    writeLine(os, "Content-Type: text/html");
+    sprintf(buffer, "Content-Length: %d", page.length());
     writeLine(os, buffer);
-    writeLine(os, "</HEAD><BODY><H1>");
-    writeLine(os, text);
-    writeLine(os, "</H1></BODY></HTML>");
-    sock.outStream().flush();
+    writeLine(os, "");
+    os.writeBytes(page.data(), page.length());
   }
+  sock.outStream().flush();
 }
 
 bool
 HTTPServer::Session::writeResponse(int code) {
+  // After an error, only a missing file leaves the connection usable
+  if (code >= 400 && code != 404)
+    keepAlive = false;
+
   switch (code) {
   case 200: writeResponse(code, "OK"); break;
+  case 304: writeResponse(code, "Not Modified"); break;
   case 400: writeResponse(code, "Bad Request"); break;
   case 404: writeResponse(code, "Not Found"); break;
   case 501: writeResponse(code, "Not Implemented"); break;
@@ -198,8 +287,88 @@ HTTPServer::Session::writeResponse(int code) {
   };
 
   // This return code is passed straight out of processHTTP().
-  // true indicates that the request has been completely processed.
-  return true;
+  return finishResponse();
+}
+
+// readHeader() notes the request headers which affect the response.
+
+void
+HTTPServer::Session::readHeader() {
+  char* value = strchr(line.buf, ':');
+  if (!value)
+    return;
+  *value++ = 0;
+  while (*value == ' ' || *value == '\t')
+    value++;
+
+  if (strcasecmp(line.buf, "Connection") == 0) {
+    if (strcasecmp(value, "close") == 0)
+      keepAlive = false;
+    else if (strcasecmp(value, "keep-alive") == 0)
+      keepAlive = true;
+  } else if (strcasecmp(line.buf, "If-Modified-Since") == 0) {
+    ifModifiedSince = parseHTTPDate(value);
+  } else if (strcasecmp(line.buf, "If-None-Match") == 0) {
+    ifNoneMatch.buf = strDup(value);
+  }
+}
+
+// isNotModified() returns true if the request's conditions show that the
+// client already has the current body.  An ETag takes precedence over a
+// date, and only bodies with known modification times qualify.
+
+bool
+HTTPServer::Session::isNotModified() {
+  if (!body->cached)
+    return false;
+  if (ifNoneMatch.buf)
+    return (strcmp(ifNoneMatch.buf, "*") == 0 ||
+            strstr(ifNoneMatch.buf, body->etag.buf) != 0);
+  return ifModifiedSince != -1 && body->lastModified <= ifModifiedSince;
+}
+
+// writeBody() writes as much of the body as the socket will take.  Most is
+// written straight from the Body, but if the socket fills up then a chunk
+// is queued in its OutStream, so that the caller will be told when it can
+// be written to again.  It returns true once all of the body is written.
+
+bool
+HTTPServer::Session::writeBody() {
+  rdr::FdOutStream& os = sock.outStream();
+  os.flush();
+  while (bodyPos < body->length && !os.bufferUsage()) {
+    int n = os.writeDirect(body->data + bodyPos, body->length - bodyPos);
+    if (n == 0) {
+      n = __rfbmin(bodyChunkSize, body->length - bodyPos);
+      os.writeBytes(body->data + bodyPos, n);
+      os.flush();
+    }
+    bodyPos += n;
+  }
+  return bodyPos == body->length;
+}
+
+// finishResponse() is called once a response has been written, to get
+// ready for the next request, or to close the connection once the output
+// has been written.  Like processHTTP(), it returns true if the session is
+// over.
+
+bool
+HTTPServer::Session::finishResponse() {
+  if (body) {
+    server.releaseBody(body);
+    body = 0;
+  }
+  requests++;
+  if (keepAlive) {
+    uri.replaceBuf(0);
+    ifNoneMatch.replaceBuf(0);
+    ifModifiedSince = -1;
+    state = ReadRequestLine;
+    return false;
+  }
+  state = Closing;
+  return !sock.outStream().bufferUsage();
 }
 
 // - Main HTTP request processing routine
@@ -231,6 +400,9 @@ HTTPServer::Session::processHTTP() {
         if (matched != 3)
           return writeResponse(400);
 
+        // HTTP/1.1 connections are kept alive unless the client says not
+        keepAlive = (strcmp(version, "HTTP/1.1") == 0);
+
         // Store the required "method"
         if (strcmp(method, "GET") == 0)
           request = GetRequest;
@@ -254,34 +426,43 @@ HTTPServer::Session::processHTTP() {
       if (!line.read())
         return false;
 
-      // Skip headers until we hit a blank line
-      if (strlen(line.buf) != 0)
+      // Note any headers we need until we hit a blank line
+      if (strlen(line.buf) != 0) {
+        readHeader();
         continue;
+      }
 
       // Headers ended - write the response!
       {
         CharArray address(sock.getPeerAddress());
         vlog.info("getting %s for %s", uri.buf, address.buf);
-        contentLength = -1;
-        lastModified = -1;
-        InStream* data = server.getFile(uri.buf, &contentType, &contentLength,
-                                        &lastModified);
-        if (!data)
+        body = server.getBody(uri.buf);
+        if (!body)
           return writeResponse(404);
-
-        try {
-          writeResponse(200);
-          if (request == GetRequest)
-            copyStream(*data, sock.outStream());
-          sock.outStream().flush();
-        } catch (rdr::Exception& e) {
-          vlog.error("error writing HTTP document:%s", e.str());
-        }
-        delete data;
+        if (isNotModified())
+          return writeResponse(304);
+
+        writeResponse(200, "OK");
+        if (request == HeadRequest)
+          return finishResponse();
+        bodyPos = 0;
+        state = WriteBody;
+        if (!writeBody())
+          return false;
+        if (finishResponse())
+          return true;
       }
+      break;
 
-      // The operation is complete!
-      return true;
+      // Still writing a response, or closing.  Pipelined requests are not
+      // supported, so drop them and close the connection once the response
+      // is written.  The client will make them again.
+    case WriteBody:
+    case Closing:
+      keepAlive = false;
+      sock.inStream().skip(sock.inStream().getend() -
+                           sock.inStream().getptr());
+      break;
 
     default:
       throw rdr::Exception("invalid HTTPSession state!");
@@ -293,9 +474,35 @@ HTTPServer::Session::processHTTP() {
   return false;
 }
 
+// processWrite() carries on writing the response.  Like processHTTP(), it
+// returns true if the session is over.
+
+bool
+HTTPServer::Session::processWrite() {
+  lastActive = time(0);
+  sock.outStream().flush();
+
+  switch (state) {
+  case WriteBody:
+    if (!writeBody())
+      return false;
+    if (finishResponse())
+      return true;
+    // Any further request will already have been signalled, so read it
+    return processHTTP();
+  case Closing:
+    return !sock.outStream().bufferUsage();
+  default:
+    return false;
+  }
+}
+
 int HTTPServer::Session::checkIdleTimeout() {
   time_t now = time(0);
-  int timeout = (lastActive + idleTimeoutSecs) - now;
+  int idleSecs = idleTimeoutSecs;
+  if (requests && state == ReadRequestLine)
+    idleSecs = keepAliveTimeoutSecs;
+  int timeout = (lastActive + idleSecs) - now;
   if (timeout > 0)
     return secsToMillis(timeout);
   sock.shutdown();
@@ -304,13 +511,16 @@ int HTTPServer::Session::checkIdleTimeout() {
 
 // -=- Constructor / destructor
 
-HTTPServer::HTTPServer() {
+HTTPServer::HTTPServer() : cacheSize(0) {
 }
 
 HTTPServer::~HTTPServer() {
   std::list<Session*>::iterator i;
   for (i=sessions.begin(); i!=sessions.end(); i++)
     delete *i;
+  std::list<Body*>::iterator b;
+  for (b=cache.begin(); b!=cache.end(); b++)
+    delete *b;
 }
 
 
@@ -324,6 +534,7 @@ HTTPServer::addSocket(network::Socket* sock, bool) {
   } else {
     sock->inStream().setTimeout(clientWaitTimeMillis);
     sock->outStream().setTimeout(clientWaitTimeMillis);
+    sock->outStream().setBlocking(false, maxSendQueue);
     sessions.push_front(s);
   }
 }
@@ -360,6 +571,26 @@ HTTPServer::processSocketEvent(network::Socket* sock) {
   throw rdr::Exception("invalid Socket in HTTPServer");
 }
 
+void
+HTTPServer::processSocketWriteEvent(network::Socket* sock) {
+  std::list<Session*>::iterator i;
+  for (i=sessions.begin(); i!=sessions.end(); i++) {
+    if ((*i)->getSock() == sock) {
+      try {
+        if ((*i)->processWrite()) {
+          vlog.info("completed HTTP request");
+          sock->shutdown();
+        }
+      } catch (rdr::Exception& e) {
+        vlog.error("error writing HTTP document:%s", e.str());
+        sock->shutdown();
+      }
+      return;
+    }
+  }
+  sock->outStream().flush();
+}
+
 void HTTPServer::getSockets(std::list<network::Socket*>* sockets)
 {
   sockets->clear();
@@ -379,6 +610,113 @@ int HTTPServer::checkTimeouts() {
 }
 
 
+// -=- File cache
+
+// getBody() asks getFile() for the named file.  If it has a known length
+// and modification time and is cached with the same ones, the cached Body
+// is used without reading the file.  Otherwise the file is read, and cached
+// if it qualifies, evicting the least recently used files to make room.
+
+HTTPServer::Body*
+HTTPServer::getBody(const char* name) {
+  const char* contentType = 0;
+  int contentLength = -1;
+  time_t lastModified = -1;
+  InStream* data = getFile(name, &contentType, &contentLength,
+                           &lastModified);
+  if (!data)
+    return 0;
+  if (lastModified == 0)
+    lastModified = -1;
+
+  Body* body = 0;
+  std::list<Body*>::iterator i;
+  for (i=cache.begin(); i!=cache.end(); i++) {
+    if (strcmp((*i)->name.buf, name) == 0) {
+      body = *i;
+      cache.erase(i);
+      if (lastModified != -1 && body->lastModified == lastModified &&
+          body->length == contentLength) {
+        cache.push_front(body);
+        delete data;
+        body->users++;
+        return body;
+      }
+      // The file has changed, so forget the old copy
+      cacheSize -= body->length;
+      body->cached = false;
+      if (!body->users)
+        delete body;
+      break;
+    }
+  }
+
+  body = new Body;
+  body->name.buf = strDup(name);
+  body->lastModified = lastModified;
+  {
+    MemOutStream content(contentLength > 0 ? contentLength : 1024);
+    try {
+      readStream(*data, content);
+    } catch (rdr::Exception&) {
+      delete data;
+      delete body;
+      throw;
+    }
+    delete data;
+    body->length = content.length();
+    body->data = new U8[body->length];
+    memcpy(body->data, content.data(), body->length);
+  }
+
+  if (!contentType)
+    contentType = guessContentType(name, "text/html");
+  time_t modified = lastModified != -1 ? lastModified : time(0);
+  char buffer[256];
+  MemOutStream headers;
+  sprintf(buffer, "Content-Type: %.200s", contentType);
+  writeLine(headers, buffer);
+  sprintf(buffer, "Content-Length: %d", body->length);
+  writeLine(headers, buffer);
+  formatHTTPDate(buffer, 256, "Last-Modified", modified);
+  writeLine(headers, buffer);
+  if (lastModified != -1 && contentLength == body->length &&
+      body->length <= maxCachedFileSize) {
+    sprintf(buffer, "\"%lx-%x-%x\"", (unsigned long)lastModified,
+            body->length, hashData(body->data, body->length));
+    body->etag.buf = strDup(buffer);
+    sprintf(buffer, "ETag: %s", body->etag.buf);
+    writeLine(headers, buffer);
+    body->cached = true;
+  }
+  headers.writeU8(0);
+  body->headers.buf = strDup((const char*)headers.data());
+
+  if (body->cached) {
+    cache.push_front(body);
+    cacheSize += body->length;
+    while (cacheSize > maxCacheSize && cache.back() != body) {
+      Body* old = cache.back();
+      cache.pop_back();
+      cacheSize -= old->length;
+      old->cached = false;
+      if (!old->users)
+        delete old;
+    }
+  }
+
+  body->users++;
+  return body;
+}
+
+void
+HTTPServer::releaseBody(Body* body) {
+  body->users--;
+  if (!body->users && !body->cached)
+    delete body;
+}
+
+
 // -=- Default getFile implementation
 
 InStream*
@@ -19,9 +19,11 @@
 // -=- HTTPServer.h
 
 // Single-threaded HTTP server implementation.
-// All I/O is handled by the processSocketEvent routine,
-// which is called by the main-loop of the VNC server whenever
-// there is an event on an HTTP socket.
+// All I/O is handled by the processSocketEvent and processSocketWriteEvent
+// routines, which are called by the main-loop of the VNC server whenever
+// there is an event on an HTTP socket.  Responses are written without
+// blocking, and connections are kept alive for further requests where the
+// client allows it.
 
 #ifndef __RFB_HTTP_SERVER_H__
 #define __RFB_HTTP_SERVER_H__
@@ -64,6 +66,11 @@ namespace rfb {
     //   network sockets.
     virtual void processSocketEvent(network::Socket* sock);
 
+    // processSocketWriteEvent()
+    //   Called when a socket with output queued can be written to again,
+    //   to carry on sending the response.
+    virtual void processSocketWriteEvent(network::Socket* sock);
+
     // Check for socket timeouts
     virtual int checkTimeouts();
 
@@ -103,6 +110,18 @@ namespace rfb {
   protected:
     class Session;
     std::list<Session*> sessions;
+
+    // Files returned by getFile() with a known length and modification time
+    // are kept in memory, with their headers made ready, so that further
+    // requests for them need not read them again.  Other files are read
+    // into an uncached Body for each request.  getBody() returns the Body
+    // for a file, or null if there is none, and releaseBody() must be
+    // called once it has been sent.
+    struct Body;
+    Body* getBody(const char* name);
+    void releaseBody(Body* body);
+    std::list<Body*> cache;
+    int cacheSize;
   };
 }
 
@@ -24,6 +24,7 @@ using namespace rfb;
 
 #define EXTRA_ARGS ImageGetter* ig
 #define GET_IMAGE_INTO_BUF(r,buf) ig->getImage(buf, r);
+#define GET_PIXELS_R(r,stride) ig->getPixelsR(r, stride)
 #define BPP 8
 #include <rfb/hextileEncode.h>
 #undef BPP
@@ -18,6 +18,7 @@
 #ifndef __RFB_IMAGEGETTER_H__
 #define __RFB_IMAGEGETTER_H__
 
+#include <rdr/types.h>
 #include <rfb/Rect.h>
 
 namespace rfb {
@@ -25,6 +26,16 @@ namespace rfb {
   public:
     virtual void getImage(void* imageBuf,
                           const Rect& r, int stride=0) = 0;
+
+    // getPixelsR() returns a read-only pointer to the pixel data for the given
+    // rectangle, setting *stride to the number of pixels per row, if that data
+    // is already exactly what getImage() would produce.  This allows an
+    // encoder to read pixels in place instead of copying them.  It returns
+    // null if no such pointer is available, in which case getImage() must be
+    // used.
+    virtual const rdr::U8* getPixelsR(const Rect& r, int* stride) {
+      return 0;
+    }
   };
 }
 #endif
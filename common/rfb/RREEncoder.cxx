@@ -50,16 +50,22 @@ bool RREEncoder::writeRect(const Rect& r, ImageGetter* ig, Rect* actual)
 {
   int w = r.width();
   int h = r.height();
-  rdr::U8* imageBuf = writer->getImageBuf(w*h);
-  ig->getImage(imageBuf, r);
+  int stride;
+  const rdr::U8* pixels = ig->getPixelsR(r, &stride);
+  if (!pixels) {
+    rdr::U8* imageBuf = writer->getImageBuf(w*h);
+    ig->getImage(imageBuf, r);
+    pixels = imageBuf;
+    stride = w;
+  }
 
   mos.clear();
 
   int nSubrects = -1;
   switch (writer->bpp()) {
-  case 8:  nSubrects = rreEncode8(imageBuf, w, h, &mos);  break;
-  case 16: nSubrects = rreEncode16(imageBuf, w, h, &mos); break;
-  case 32: nSubrects = rreEncode32(imageBuf, w, h, &mos); break;
+  case 8:  nSubrects = rreEncode8(pixels, w, h, stride, &mos);  break;
+  case 16: nSubrects = rreEncode16(pixels, w, h, stride, &mos); break;
+  case 32: nSubrects = rreEncode32(pixels, w, h, stride, &mos); break;
   }
   
   if (nSubrects < 0) {
@@ -42,9 +42,25 @@ bool RawEncoder::writeRect(const Rect& r, ImageGetter* ig, Rect* actual)
   int y = r.tl.y;
   int w = r.width();
   int h = r.height();
+  int bytesPerRow = w * (writer->bpp() / 8);
+
+  // If the pixels need no translation, send them straight from the buffer.
+  int stride;
+  const rdr::U8* pixels = ig->getPixelsR(r, &stride);
+  if (pixels) {
+    int strideBytes = stride * (writer->bpp() / 8);
+    writer->startRect(r, encodingRaw);
+    while (h > 0) {
+      writer->getOutStream()->writeBytes(pixels, bytesPerRow);
+      pixels += strideBytes;
+      h--;
+    }
+    writer->endRect();
+    return true;
+  }
+
   int nPixels;
   rdr::U8* imageBuf = writer->getImageBuf(w, w*h, &nPixels);
-  int bytesPerRow = w * (writer->bpp() / 8);
   writer->startRect(r, encodingRaw);
   while (h > 0) {
     int nRows = nPixels / w;
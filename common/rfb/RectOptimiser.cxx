@@ -0,0 +1,154 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#include <algorithm>
+#include <rfb/encodings.h>
+#include <rfb/Region.h>
+#include <rfb/RectOptimiser.h>
+
+using namespace rfb;
+
+// Merging only looks back this many rectangles, which keeps it linear in the
+// number of rectangles while catching the strips of a banded region.
+static const int mergeWindow = 16;
+
+static const int tileSize = 64;
+
+RectOptimiser::RectOptimiser()
+  : rectBytes(12), pixelSixteenths(64), bytesPerPixel(4), maxRectBytes(0)
+{
+}
+
+// The estimates are rough: a rectangle header is 12 bytes, ZRLE adds a
+// length and a zlib flush to that, and the compressing encoders typically
+// send a pixel in a fraction of its raw size.
+
+void RectOptimiser::setEncoding(unsigned int encoding, int bpp)
+{
+  bytesPerPixel = bpp / 8;
+  switch (encoding) {
+  case encodingRaw:
+    setCosts(12, 16 * bytesPerPixel);
+    break;
+  case encodingZRLE:
+  case encodingZYWRLE:
+    setCosts(24, 4 * bytesPerPixel);
+    break;
+  default:
+    setCosts(16, 8 * bytesPerPixel);
+    break;
+  }
+}
+
+void RectOptimiser::setCosts(int rectBytes_, int pixelSixteenths_)
+{
+  rectBytes = rectBytes_;
+  pixelSixteenths = pixelSixteenths_;
+}
+
+void RectOptimiser::setMaxRectBytes(int maxBytes)
+{
+  maxRectBytes = maxBytes;
+}
+
+void RectOptimiser::optimise(const Region& region, std::vector<Rect>* rects)
+{
+  region.get_rects(rects);
+  if (rects->size() > 1)
+    merge(rects);
+  if (maxRectBytes)
+    split(rects);
+}
+
+double RectOptimiser::cost(const Rect& r)
+{
+  return rectBytes + (double)r.area() * pixelSixteenths / 16;
+}
+
+static bool topToBottom(const Rect& a, const Rect& b)
+{
+  if (a.tl.y != b.tl.y) return a.tl.y < b.tl.y;
+  return a.tl.x < b.tl.x;
+}
+
+// merge() adds each rectangle in turn to the output, first merging it with
+// whichever recent output rectangle saves the most, for as long as any
+// merge saves something.
+
+void RectOptimiser::merge(std::vector<Rect>* rects)
+{
+  std::vector<Rect> out;
+  out.reserve(rects->size());
+
+  std::vector<Rect>::const_iterator i;
+  for (i = rects->begin(); i != rects->end(); i++) {
+    Rect r = *i;
+    while (true) {
+      int best = -1;
+      double bestSaving = 0;
+      int first = (int)out.size() - mergeWindow;
+      if (first < 0) first = 0;
+      for (int j = first; j < (int)out.size(); j++) {
+        double saving = (cost(r) + cost(out[j])
+                         - cost(r.union_boundary(out[j])));
+        if (saving > bestSaving) {
+          best = j;
+          bestSaving = saving;
+        }
+      }
+      if (best < 0) break;
+      r = r.union_boundary(out[best]);
+      out.erase(out.begin() + best);
+    }
+    out.push_back(r);
+  }
+
+  std::sort(out.begin(), out.end(), topToBottom);
+  rects->swap(out);
+}
+
+// split() cuts each rectangle which is too large into bands whose edges lie
+// on the 64-pixel tile grid, so that an encoder working in tiles isn't left
+// with a partial row of them.
+
+void RectOptimiser::split(std::vector<Rect>* rects)
+{
+  std::vector<Rect> out;
+  out.reserve(rects->size());
+
+  std::vector<Rect>::const_iterator i;
+  for (i = rects->begin(); i != rects->end(); i++) {
+    int rowBytes = i->width() * bytesPerPixel;
+    if (i->height() * rowBytes <= maxRectBytes) {
+      out.push_back(*i);
+      continue;
+    }
+
+    int bandHeight = maxRectBytes / rowBytes / tileSize * tileSize;
+    if (bandHeight < tileSize) bandHeight = tileSize;
+
+    Rect band = *i;
+    while (band.tl.y < i->br.y) {
+      band.br.y = (band.tl.y / tileSize * tileSize) + bandHeight;
+      if (band.br.y > i->br.y) band.br.y = i->br.y;
+      out.push_back(band);
+      band.tl.y = band.br.y;
+    }
+  }
+
+  rects->swap(out);
+}
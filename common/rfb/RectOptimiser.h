@@ -0,0 +1,76 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// RectOptimiser - chooses the rectangles used to send a changed region.
+//
+// A Region's rectangles are banded, so even a simple shape such as two
+// overlapping windows can come out as many thin strips, each of which costs
+// a rectangle header and the encoder's setup.  RectOptimiser merges nearby
+// rectangles when sending their bounding box is estimated to be cheaper than
+// sending them separately, taking into account the unchanged pixels the
+// bounding box adds.  It also splits rectangles which are too large for the
+// encoder to send in one go into bands of whole 64-pixel tile rows, and
+// returns the rectangles ordered top to bottom so that the framebuffer is
+// read in order.
+//
+// The rectangles returned cover the region but may overlap each other and
+// extend outside it.  This is harmless since every pixel sent is up to date.
+//
+
+#ifndef __RFB_RECTOPTIMISER_H__
+#define __RFB_RECTOPTIMISER_H__
+
+#include <vector>
+#include <rfb/Rect.h>
+
+namespace rfb {
+
+  class Region;
+
+  class RectOptimiser {
+  public:
+    RectOptimiser();
+
+    // setEncoding() chooses cost estimates suited to the given encoding and
+    // number of bits per pixel.
+    void setEncoding(unsigned int encoding, int bpp);
+
+    // setCosts() sets the estimated cost of a rectangle as a fixed number of
+    // bytes plus a number of sixteenths of a byte for each pixel.
+    void setCosts(int rectBytes, int pixelSixteenths);
+
+    // setMaxRectBytes() sets the largest rectangle, in bytes of raw pixel
+    // data, which is sent without being split.  0 means there is no limit.
+    void setMaxRectBytes(int maxBytes);
+
+    // optimise() sets rects to the rectangles to use to send the region.
+    void optimise(const Region& region, std::vector<Rect>* rects);
+
+  private:
+    double cost(const Rect& r);
+    void merge(std::vector<Rect>* rects);
+    void split(std::vector<Rect>* rects);
+
+    int rectBytes;
+    int pixelSixteenths;
+    int bytesPerPixel;
+    int maxRectBytes;
+  };
+
+}
+#endif
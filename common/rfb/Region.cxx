@@ -18,9 +18,10 @@
 
 // Cross-platform Region class based on the X11 region implementation.  Note
 // that for efficiency this code manipulates the Xlib region structure
-// directly.  Apart from the layout of the structure, there is one other key
-// assumption made: a Region returned from XCreateRegion must always have its
-// rects member allocated so that there is space for at least one rectangle.
+// directly.  The structure is kept within the Region itself, set up by
+// XInitRegion to use the Region's own space for up to nInlineRects
+// rectangles, so there is always space for at least one rectangle.  Larger
+// arrays come from the pool of arrays kept by Xregion.
 //
 
 #include <rfb/Region.h>
@@ -44,6 +45,8 @@ public:
     region.extents.x2 = r.br.x;
     region.extents.y2 = r.br.y;
     region.size = 1;
+    region.inlineRects = &region.extents;
+    region.inlineSize = 1;
     if (r.is_empty())
       region.numRects = 0;
   }
@@ -51,25 +54,31 @@ public:
 };
 
 
+void rfb::Region::init() {
+  // These fail to compile unless the storage matches the Xlib structures
+  switch (0) { case 0: case sizeof(storage) == sizeof(REGION): break; }
+  switch (0) { case 0: case sizeof(ShortRect) == sizeof(BOX): break; }
+
+  xrgn = (struct _XRegion*)&storage;
+  XInitRegion(xrgn, (BOX*)inlineRects, nInlineRects);
+}
+
 rfb::Region::Region() {
-  xrgn = XCreateRegion();
-  assert(xrgn);
+  init();
 }
 
 rfb::Region::Region(const Rect& r) {
-  xrgn = XCreateRegion();
-  assert(xrgn);
+  init();
   reset(r);
 }
 
 rfb::Region::Region(const rfb::Region& r) {
-  xrgn = XCreateRegion();
-  assert(xrgn);
+  init();
   XUnionRegion(xrgn, r.xrgn, xrgn);
 }
 
 rfb::Region::~Region() {
-  XDestroyRegion(xrgn);
+  XReleaseRegion(xrgn);
 }
 
 rfb::Region& rfb::Region::operator=(const rfb::Region& r) {
@@ -78,6 +87,32 @@ rfb::Region& rfb::Region::operator=(const rfb::Region& r) {
   return *this;
 }
 
+void rfb::Region::swap(rfb::Region& r) {
+  REGION tmp = *xrgn;
+  ShortRect tmpRects[nInlineRects];
+  bool thisInline = xrgn->rects == xrgn->inlineRects;
+  bool otherInline = r.xrgn->rects == r.xrgn->inlineRects;
+
+  // Rectangles held inline have to be copied, but otherwise the arrays are
+  // simply exchanged
+  if (thisInline)
+    memcpy(tmpRects, inlineRects, xrgn->numRects * sizeof(BOX));
+  if (otherInline)
+    memcpy(inlineRects, r.inlineRects, r.xrgn->numRects * sizeof(BOX));
+  if (thisInline)
+    memcpy(r.inlineRects, tmpRects, xrgn->numRects * sizeof(BOX));
+
+  xrgn->size = r.xrgn->size;
+  xrgn->numRects = r.xrgn->numRects;
+  xrgn->rects = otherInline ? xrgn->inlineRects : r.xrgn->rects;
+  xrgn->extents = r.xrgn->extents;
+
+  r.xrgn->size = tmp.size;
+  r.xrgn->numRects = tmp.numRects;
+  r.xrgn->rects = thisInline ? r.xrgn->inlineRects : tmp.rects;
+  r.xrgn->extents = tmp.extents;
+}
+
 void rfb::Region::clear() {
   xrgn->numRects = 0;
   xrgn->extents.x1 = 0;
@@ -114,16 +149,9 @@ void rfb::Region::setOrderedRects(const std::vector<Rect>& rects) {
 void rfb::Region::setExtentsAndOrderedRects(const ShortRect* extents,
                                             int nRects, const ShortRect* rects)
 {
-  if (xrgn->size < nRects)
-  {
-    BOX* prevRects = xrgn->rects;
-    xrgn->rects = (BOX*)Xrealloc((char*)xrgn->rects, nRects * sizeof(BOX));
-    if (!xrgn->rects) {
-      fprintf(stderr,"Xrealloc failed\n");
-      Xfree(prevRects);
-      return;
-    }
-    xrgn->size = nRects;
+  if (!XReserveRegion(xrgn, nRects)) {
+    fprintf(stderr,"XReserveRegion failed\n");
+    return;
   }
 
   xrgn->numRects = nRects;
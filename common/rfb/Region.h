@@ -44,6 +44,11 @@ namespace rfb {
 
     ~Region();
 
+    // Exchange contents with another region.  This is much cheaper than
+    // copying, so use it to take the result of an operation into an
+    // existing region.
+    void swap(Region& r);
+
     // the following methods alter the region in place:
 
     void clear();
@@ -76,7 +81,24 @@ namespace rfb {
 
   protected:
 
+    void init();
+
+    // The X region structure is kept within the Region, along with space
+    // for a few rectangles, so that small regions need no heap allocation.
+    // XRegionStorage must match the layout of struct _XRegion.
+    enum { nInlineRects = 4 };
+    struct XRegionStorage {
+      long size;
+      long numRects;
+      void* rects;
+      ShortRect extents;
+      void* inlineRects;
+      long inlineSize;
+    };
+
     struct _XRegion* xrgn;
+    XRegionStorage storage;
+    ShortRect inlineRects[nInlineRects];
   };
 
 };
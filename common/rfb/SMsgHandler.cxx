@@ -39,14 +39,45 @@ void SMsgHandler::setPixelFormat(const PixelFormat& pf)
 
 void SMsgHandler::setEncodings(int nEncodings, rdr::U32* encodings)
 {
+  bool firstFence = !cp.supportsFence;
+  bool firstContinuousUpdates = !cp.supportsContinuousUpdates;
+  int oldScale = cp.scale;
+
   cp.setEncodings(nEncodings, encodings);
   supportsLocalCursor();
+
+  if (cp.supportsFence && firstFence)
+    supportsFence();
+  if (cp.supportsContinuousUpdates && firstContinuousUpdates)
+    supportsContinuousUpdates();
+  if (cp.scale != oldScale)
+    scaleChange();
 }
 
 void SMsgHandler::framebufferUpdateRequest(const Rect& r, bool incremental)
 {
 }
 
+void SMsgHandler::enableContinuousUpdates(bool enable, const Rect& r)
+{
+}
+
+void SMsgHandler::fence(rdr::U32 flags, int len, const char* data)
+{
+}
+
 void SMsgHandler::supportsLocalCursor()
 {
 }
+
+void SMsgHandler::supportsFence()
+{
+}
+
+void SMsgHandler::supportsContinuousUpdates()
+{
+}
+
+void SMsgHandler::scaleChange()
+{
+}
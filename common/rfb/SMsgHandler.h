@@ -46,6 +46,8 @@ namespace rfb {
     virtual void setPixelFormat(const PixelFormat& pf);
     virtual void setEncodings(int nEncodings, rdr::U32* encodings);
     virtual void framebufferUpdateRequest(const Rect& r, bool incremental);
+    virtual void enableContinuousUpdates(bool enable, const Rect& r);
+    virtual void fence(rdr::U32 flags, int len, const char* data);
 
     // InputHandler interface
     // The InputHandler methods will be called for the corresponding messages.
@@ -56,6 +58,15 @@ namespace rfb {
     // specially for this purpose.
     virtual void supportsLocalCursor();
 
+    // supportsFence() and supportsContinuousUpdates() are called the first
+    // time a setEncodings message shows that the client supports fences and
+    // continuous updates respectively.
+    virtual void supportsFence();
+    virtual void supportsContinuousUpdates();
+
+    // scaleChange() is called when a setEncodings message changes cp.scale.
+    virtual void scaleChange();
+
     ConnParams cp;
   };
 }
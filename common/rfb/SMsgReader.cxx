@@ -19,6 +19,7 @@
 #include <rdr/InStream.h>
 #include <rfb/Exception.h>
 #include <rfb/util.h>
+#include <rfb/fenceTypes.h>
 #include <rfb/SMsgHandler.h>
 #include <rfb/SMsgReader.h>
 #include <rfb/Configuration.h>
@@ -95,3 +96,28 @@ void SMsgReader::readClientCutText()
   is->readBytes(ca.buf, len);
   handler->clientCutText(ca.buf, len);
 }
+
+void SMsgReader::readEnableContinuousUpdates()
+{
+  bool enable = is->readU8();
+  int x = is->readU16();
+  int y = is->readU16();
+  int w = is->readU16();
+  int h = is->readU16();
+  handler->enableContinuousUpdates(enable, Rect(x, y, x+w, y+h));
+}
+
+void SMsgReader::readFence()
+{
+  is->skip(3);
+  rdr::U32 flags = is->readU32();
+  int len = is->readU8();
+  if (len > fenceMaxDataLen) {
+    fprintf(stderr,"fence payload too long (%d bytes) - ignoring\n",len);
+    is->skip(len);
+    return;
+  }
+  char data[fenceMaxDataLen];
+  is->readBytes(data, len);
+  handler->fence(flags, len, data);
+}
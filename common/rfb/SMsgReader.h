@@ -46,6 +46,8 @@ namespace rfb {
     virtual void readKeyEvent();
     virtual void readPointerEvent();
     virtual void readClientCutText();
+    virtual void readEnableContinuousUpdates();
+    virtual void readFence();
 
     SMsgReader(SMsgHandler* handler, rdr::InStream* is);
 
@@ -16,14 +16,18 @@
  * USA.
  */
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include <rdr/OutStream.h>
 #include <rfb/msgTypes.h>
+#include <rfb/fenceTypes.h>
+#include <rfb/Exception.h>
 #include <rfb/ColourMap.h>
 #include <rfb/ConnParams.h>
 #include <rfb/UpdateTracker.h>
 #include <rfb/SMsgWriter.h>
 #include <rfb/LogWriter.h>
+#include <rfb/ServerCore.h>
 
 using namespace rfb;
 
@@ -32,7 +36,8 @@ static LogWriter vlog("SMsgWriter");
 SMsgWriter::SMsgWriter(ConnParams* cp_, rdr::OutStream* os_)
   : imageBufIdealSize(0), cp(cp_), os(os_), lenBeforeRect(0),
     currentEncoding(0), updatesSent(0), rawBytesEquivalent(0),
-    imageBuf(0), imageBufSize(0)
+    qualityLevel(-1), tileCacheLookups(0), tileCacheHits(0), imageBuf(0),
+    imageBufSize(0), tileCache(0), tileBuf(0)
 {
   for (unsigned int i = 0; i <= encodingMax; i++) {
     encoders[i] = 0;
@@ -55,7 +60,12 @@ SMsgWriter::~SMsgWriter()
   }
   vlog.info("  raw bytes equivalent %d, compression ratio %f",
           rawBytesEquivalent, (double)rawBytesEquivalent / bytes);
+  if (tileCacheLookups)
+    vlog.info("  tile cache hits %d of %d tiles", tileCacheHits,
+              tileCacheLookups);
   delete [] imageBuf;
+  delete tileCache;
+  delete [] tileBuf;
 }
 
 void SMsgWriter::writeSetColourMapEntries(int firstColour, int nColours,
@@ -90,32 +100,154 @@ void SMsgWriter::writeServerCutText(const char* str, int len)
   endMsg();
 }
 
+void SMsgWriter::writeFence(rdr::U32 flags, int len, const char* data)
+{
+  if (!cp->supportsFence)
+    throw Exception("Client does not support fences");
+  if (len > fenceMaxDataLen)
+    throw Exception("Too large fence payload");
+  if ((flags & ~fenceFlagsSupported) != 0)
+    throw Exception("Unknown fence flags");
+
+  startMsg(msgTypeServerFence);
+  os->pad(3);
+  os->writeU32(flags);
+  os->writeU8(len);
+  os->writeBytes(data, len);
+  endMsg();
+}
+
+void SMsgWriter::writeEndOfContinuousUpdates()
+{
+  if (!cp->supportsContinuousUpdates)
+    throw Exception("Client does not support continuous updates");
+
+  startMsg(msgTypeEndOfContinuousUpdates);
+  endMsg();
+}
+
 void SMsgWriter::writeFramebufferUpdate(const UpdateInfo& ui, ImageGetter* ig,
                                         Region* updatedRegion)
 {
-  writeFramebufferUpdateStart(ui.numRects());
+  writeFramebufferUpdateStart();
   writeRects(ui, ig, updatedRegion);
   writeFramebufferUpdateEnd();
 }
 
 void SMsgWriter::writeRects(const UpdateInfo& ui, ImageGetter* ig,
-                            Region* updatedRegion)
+                            Region* updatedRegion, Region* encodedRegion)
 {
   std::vector<Rect> rects;
   std::vector<Rect>::const_iterator i;
   updatedRegion->copyFrom(ui.changed);
-  updatedRegion->assign_union(ui.copied);
+  std::list<CopyGroup>::const_iterator g;
+  for (g = ui.copied.begin(); g != ui.copied.end(); g++) {
+    updatedRegion->assign_union(g->region);
+    g->region.get_rects(&rects, g->delta.x <= 0, g->delta.y <= 0);
+    for (i = rects.begin(); i != rects.end(); i++)
+      writeCopyRect(*i, i->tl.x - g->delta.x, i->tl.y - g->delta.y);
+  }
 
-  ui.copied.get_rects(&rects, ui.copy_delta.x <= 0, ui.copy_delta.y <= 0);
-  for (i = rects.begin(); i != rects.end(); i++)
-    writeCopyRect(*i, i->tl.x - ui.copy_delta.x, i->tl.y - ui.copy_delta.y);
+  Region changed(ui.changed);
+  std::vector<CacheCandidate> misses;
+  if (useTileCache())
+    findCachedTiles(&changed, ig, &misses);
+  Region encoded = ui.changed.subtract(changed);
 
-  ui.changed.get_rects(&rects);
+  unsigned int encoding = cp->currentEncoding();
+  rectOptimiser.setEncoding(encoding, bpp());
+  rectOptimiser.setMaxRectBytes(getEncoder(encoding)->maxRectBytes());
+  rectOptimiser.optimise(changed, &rects);
   for (i = rects.begin(); i != rects.end(); i++) {
     Rect actual;
-    if (!writeRect(*i, ig, &actual)) {
+    if (writeRect(*i, encoding, ig, &actual)) {
+      updatedRegion->assign_union(*i);
+      encoded.assign_union(*i);
+    } else {
       updatedRegion->assign_subtract(*i);
       updatedRegion->assign_union(actual);
+      encoded.assign_union(actual);
+    }
+  }
+  if (encodedRegion)
+    *encodedRegion = encoded;
+
+  // Now that the client has the tiles which weren't cached, tell it to cache
+  // them, unless the encoder didn't manage to send all of one.  A lossy
+  // encoder leaves the client with pixels which don't match the key, so
+  // nothing it sent is cached.
+
+  if (getEncoder(encoding)->lossy())
+    return;
+
+  std::vector<CacheCandidate>::const_iterator m;
+  for (m = misses.begin(); m != misses.end(); m++) {
+    if (Region(m->r).subtract(*updatedRegion).is_empty()) {
+      writeCacheStore(m->r, m->key);
+      tileCache->insert(m->key, m->check);
+    }
+  }
+}
+
+bool SMsgWriter::useTileCache()
+{
+  return cp->tileCacheSize > 0 && rfb::Server::tileCacheSize > 0;
+}
+
+// findCachedTiles() looks up each whole tile of the changed region in the
+// tile cache, writing a reference for each one the client already has and
+// removing it from the changed region.  The tiles which aren't cached are
+// returned in misses.  Tiles are aligned to a grid of maxTileSize pixels, so
+// that a window revisited at the same place produces the same tiles.  Tiles
+// of a single colour are left to the encoder, which does well enough with
+// them.
+
+void SMsgWriter::findCachedTiles(Region* changed, ImageGetter* ig,
+                                 std::vector<CacheCandidate>* misses)
+{
+  const int ts = TileCache::maxTileSize;
+  int size = cp->tileCacheSize;
+  if (size > rfb::Server::tileCacheSize)
+    size = rfb::Server::tileCacheSize;
+
+  if (tileCache && (tileCache->maxTiles() != size ||
+                    !tileCachePF.equal(cp->pf()))) {
+    delete tileCache;
+    tileCache = 0;
+  }
+  if (!tileCache) {
+    tileCache = new TileCache(size);
+    tileCachePF = cp->pf();
+    delete [] tileBuf;
+    tileBuf = new rdr::U8[ts * ts * tileCachePF.bpp / 8];
+  }
+
+  Rect br = changed->get_bounding_rect();
+  int bytesPerPixel = tileCachePF.bpp / 8;
+  int len = ts * ts * bytesPerPixel;
+
+  for (int y = br.tl.y / ts * ts; y + ts <= br.br.y; y += ts) {
+    for (int x = br.tl.x / ts * ts; x + ts <= br.br.x; x += ts) {
+      Rect tile(x, y, x + ts, y + ts);
+      if (tile.tl.y < br.tl.y || tile.tl.x < br.tl.x ||
+          !Region(tile).subtract(*changed).is_empty())
+        continue;
+
+      ig->getImage(tileBuf, tile);
+      if (memcmp(tileBuf, tileBuf + bytesPerPixel, len - bytesPerPixel) == 0)
+        continue;
+
+      CacheCandidate c;
+      c.r = tile;
+      c.key = TileCache::hash(tileBuf, ts, ts, bytesPerPixel, &c.check);
+      tileCacheLookups++;
+      if (tileCache->lookup(c.key, c.check) >= 0) {
+        tileCacheHits++;
+        writeCachedTile(tile, c.key);
+        changed->assign_subtract(tile);
+      } else {
+        misses->push_back(c);
+      }
     }
   }
 }
@@ -133,12 +265,17 @@ bool SMsgWriter::writeRect(const Rect& r, ImageGetter* ig, Rect* actual)
 
 bool SMsgWriter::writeRect(const Rect& r, unsigned int encoding,
                            ImageGetter* ig, Rect* actual)
+{
+  return getEncoder(encoding)->writeRect(r, ig, actual);
+}
+
+Encoder* SMsgWriter::getEncoder(unsigned int encoding)
 {
   if (!encoders[encoding]) {
     encoders[encoding] = Encoder::createEncoder(encoding, this);
     assert(encoders[encoding]);
   }
-  return encoders[encoding]->writeRect(r, ig, actual);
+  return encoders[encoding];
 }
 
 void SMsgWriter::writeCopyRect(const Rect& r, int srcX, int srcY)
@@ -149,6 +286,22 @@ void SMsgWriter::writeCopyRect(const Rect& r, int srcX, int srcY)
   endRect();
 }
 
+void SMsgWriter::writeCachedTile(const Rect& r, const TileCache::Key& key)
+{
+  startRect(r,pseudoEncodingCachedTile);
+  os->writeU32(key.hi);
+  os->writeU32(key.lo);
+  endRect();
+}
+
+void SMsgWriter::writeCacheStore(const Rect& r, const TileCache::Key& key)
+{
+  startRect(r,pseudoEncodingCacheStore);
+  os->writeU32(key.hi);
+  os->writeU32(key.lo);
+  endRect();
+}
+
 rdr::U8* SMsgWriter::getImageBuf(int required, int requested, int* nPixels)
 {
   int requiredBytes = required * (cp->pf().bpp / 8);
@@ -22,15 +22,19 @@
 #ifndef __RFB_SMSGWRITER_H__
 #define __RFB_SMSGWRITER_H__
 
+#include <vector>
 #include <rdr/types.h>
 #include <rfb/encodings.h>
+#include <rfb/Rect.h>
 #include <rfb/Encoder.h>
+#include <rfb/PixelFormat.h>
+#include <rfb/RectOptimiser.h>
+#include <rfb/TileCache.h>
 
 namespace rdr { class OutStream; }
 
 namespace rfb {
 
-  class PixelFormat;
   class ConnParams;
   class ImageGetter;
   class ColourMap;
@@ -62,6 +66,11 @@ namespace rfb {
     virtual void writeBell();
     virtual void writeServerCutText(const char* str, int len);
 
+    // writeFence() and writeEndOfContinuousUpdates() may only be used if the
+    // client supports fences and continuous updates respectively.
+    virtual void writeFence(rdr::U32 flags, int len, const char* data);
+    virtual void writeEndOfContinuousUpdates();
+
     // writeSetDesktopSize() on a V3 writer won't actually write immediately,
     // but will write the relevant pseudo-rectangle as part of the next update.
     virtual bool writeSetDesktopSize()=0;
@@ -89,12 +98,17 @@ namespace rfb {
 
     // writeRects() accepts an UpdateInfo (changed & copied regions) and an
     // ImageGetter to fetch pixels from.  It then calls writeCopyRect() and
-    // writeRect() as appropriate.  writeFramebufferUpdateStart() must be used
-    // before the first writeRects() call and writeFrameBufferUpdateEnd() after
-    // the last one.  It returns the actual region sent to the client, which
-    // may be smaller than the update passed in.
+    // writeRect() as appropriate, using a RectOptimiser to choose the
+    // rectangles for the changed region.  Since the number of rectangles isn't
+    // known in advance, writeFramebufferUpdateStart() with no arguments must
+    // be used before the first writeRects() call and
+    // writeFrameBufferUpdateEnd() after the last one.  It returns the actual
+    // region sent to the client, which may be smaller than the update passed
+    // in, or larger where rectangles were merged.  If encodedRegion is given,
+    // it is set to the part of that whose pixels came from the ImageGetter,
+    // rather than being copied by the client.
     virtual void writeRects(const UpdateInfo& update, ImageGetter* ig,
-                            Region* updatedRegion);
+                            Region* updatedRegion, Region* encodedRegion=0);
 
     // To construct a framebuffer update you can call
     // writeFramebufferUpdateStart(), followed by a number of writeCopyRect()s
@@ -114,9 +128,26 @@ namespace rfb {
 
     virtual void writeCopyRect(const Rect& r, int srcX, int srcY);
 
+    // useTileCache() returns true if writeRects() may replace tiles the
+    // client has cached with references to them.
+    bool useTileCache();
+
+    // writeCachedTile() writes a reference to a tile in the client's cache,
+    // and writeCacheStore() tells the client to add the given rectangle of
+    // its framebuffer to its cache.
+    virtual void writeCachedTile(const Rect& r, const TileCache::Key& key);
+    virtual void writeCacheStore(const Rect& r, const TileCache::Key& key);
+
     virtual void startRect(const Rect& r, unsigned int enc)=0;
     virtual void endRect()=0;
 
+    // setQualityLevel() lets the server trade image quality for bandwidth in
+    // lossy encodings, on the same 0 to 9 scale as the client's quality level.
+    // It takes effect from the next rectangle, so it can be adjusted between
+    // updates.  The default of -1 follows the client's quality level.
+    void setQualityLevel(int level) { qualityLevel = level; }
+    int getQualityLevel() { return qualityLevel; }
+
     ConnParams* getConnParams() { return cp; }
     rdr::OutStream* getOutStream() { return os; }
     rdr::U8* getImageBuf(int required, int requested=0, int* nPixels=0);
@@ -126,6 +157,8 @@ namespace rfb {
     int getRectsSent(int encoding) { return rectsSent[encoding]; }
     int getBytesSent(int encoding) { return bytesSent[encoding]; }
     int getRawBytesEquivalent()    { return rawBytesEquivalent; }
+    int getTileCacheLookups()      { return tileCacheLookups; }
+    int getTileCacheHits()         { return tileCacheHits; }
 
     int imageBufIdealSize;
 
@@ -135,6 +168,15 @@ namespace rfb {
     virtual void startMsg(int type)=0;
     virtual void endMsg()=0;
 
+    struct CacheCandidate {
+      Rect r;
+      TileCache::Key key;
+      rdr::U32 check;
+    };
+    void findCachedTiles(Region* changed, ImageGetter* ig,
+                         std::vector<CacheCandidate>* misses);
+    Encoder* getEncoder(unsigned int encoding);
+
     ConnParams* cp;
     rdr::OutStream* os;
 
@@ -145,9 +187,18 @@ namespace rfb {
     int bytesSent[encodingMax+1];
     int rectsSent[encodingMax+1];
     int rawBytesEquivalent;
+    int qualityLevel;
+    int tileCacheLookups;
+    int tileCacheHits;
 
     rdr::U8* imageBuf;
     int imageBufSize;
+
+    TileCache* tileCache;
+    PixelFormat tileCachePF;
+    rdr::U8* tileBuf;
+
+    RectOptimiser rectOptimiser;
   };
 }
 #endif
@@ -105,6 +105,10 @@ void SMsgWriterV3::writeFramebufferUpdateStart()
   if (!updateOS)
     updateOS = new rdr::MemOutStream;
   os = updateOS;
+  if (wsccb) {
+    wsccb->writeSetCursorCallback();
+    wsccb = 0;
+  }
 }
 
 void SMsgWriterV3::writeFramebufferUpdateEnd()
@@ -150,7 +154,7 @@ void SMsgWriterV3::startRect(const Rect& r, unsigned int encoding)
 
   currentEncoding = encoding;
   lenBeforeRect = os->length();
-  if (encoding != encodingCopyRect)
+  if (encoding != encodingCopyRect && encoding != pseudoEncodingCacheStore)
     rawBytesEquivalent += 12 + r.width() * r.height() * (bpp()/8);
 
   os->writeS16(r.tl.x);
@@ -0,0 +1,407 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- SSyntheticDesktop.cxx
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#define strcasecmp _stricmp
+#endif
+
+#include <rfb/SSyntheticDesktop.h>
+#include <rfb/LogWriter.h>
+#include <rfb/util.h>
+
+using namespace rfb;
+
+static LogWriter vlog("SSyntheticDesktop");
+
+// Height of the band at the top of the screen holding the latency probes,
+// size of a character cell, and height of a window's title bar
+static const int probeBand = 8;
+static const int charWidth = 8;
+static const int lineHeight = 16;
+static const int titleHeight = 20;
+
+const PixelFormat SSyntheticDesktop::pf(32, 24, false, true,
+                                        255, 255, 255, 16, 8, 0);
+
+static Pixel rgb(int r, int g, int b) {
+  return (r << 16) | (g << 8) | b;
+}
+
+static const Pixel paper = rgb(255, 255, 255);
+static const Pixel ink = rgb(16, 16, 16);
+static const Pixel frame = rgb(160, 160, 176);
+static const Pixel title = rgb(32, 64, 160);
+static const Pixel stripes[2] = { rgb(0, 96, 128), rgb(0, 104, 136) };
+
+
+SSyntheticDesktop::SSyntheticDesktop(const Point& size, const char* script)
+  : server(0), buffer(0), seed(1)
+{
+  // - Parse the script
+  CharArray copy(strDup(script));
+  for (char* name = strtok(copy.buf, ", "); name; name = strtok(0, ", ")) {
+    Activity a;
+    char* rate = strchr(name, ':');
+    if (rate)
+      *rate++ = 0;
+    if (strcasecmp(name, "type") == 0) {
+      a.type = Typing;
+      a.rate = 10;
+    } else if (strcasecmp(name, "scroll") == 0) {
+      a.type = Scrolling;
+      a.rate = 5;
+    } else if (strcasecmp(name, "drag") == 0) {
+      a.type = Dragging;
+      a.rate = 200;
+    } else if (strcasecmp(name, "video") == 0) {
+      a.type = Video;
+      a.rate = 25;
+    } else if (strcasecmp(name, "pointer") == 0) {
+      a.type = Pointer;
+      a.rate = 50;
+    } else {
+      vlog.error("unknown activity \"%s\"", name);
+      throw Exception("unknown activity in desktop script");
+    }
+    if (rate)
+      a.rate = atoi(rate);
+    if (a.rate <= 0)
+      throw Exception("invalid rate in desktop script");
+    a.progress = 0;
+    a.frame = 0;
+    activities.push_back(a);
+  }
+  if (activities.empty())
+    throw Exception("empty desktop script");
+
+  // - Draw the initial desktop
+  buffer = new ManagedPixelBuffer(pf, size.x, size.y);
+  buffer->fillRect(Rect(0, 0, size.x, probeBand), 0);
+  drawBackground(Rect(0, probeBand, size.x, size.y));
+  layout();
+}
+
+SSyntheticDesktop::~SSyntheticDesktop() {
+  delete buffer;
+}
+
+
+void SSyntheticDesktop::start(VNCServer* vs) {
+  server = vs;
+  server->setPixelBuffer(buffer);
+
+  std::vector<Activity>::iterator a;
+  for (a = activities.begin(); a != activities.end(); a++) {
+    if (a->type == Pointer) {
+      setCursor();
+      server->setCursorPos(a->pos);
+      break;
+    }
+  }
+}
+
+void SSyntheticDesktop::stop() {
+  server->setPixelBuffer(0);
+  server = 0;
+}
+
+
+void SSyntheticDesktop::keyEvent(rdr::U32 key, bool down) {
+  if (!down || !server)
+    return;
+  int x = probeBand * (key >> 16) % buffer->width();
+  Rect r(x, 0, x + probeBand, probeBand);
+  r = r.intersect(buffer->getRect());
+  buffer->fillRect(r, key & 0xffff);
+  server->add_changed(r);
+}
+
+
+void SSyntheticDesktop::animate(int ms) {
+  if (!server)
+    return;
+
+  std::vector<Activity>::iterator a;
+  for (a = activities.begin(); a != activities.end(); a++) {
+    a->progress += ms * a->rate;
+    int steps = a->progress / 1000;
+    a->progress %= 1000;
+    if (steps == 0)
+      continue;
+
+    switch (a->type) {
+    case Typing:    type(*a, steps); break;
+    case Scrolling: scroll(*a, steps); break;
+    case Dragging:  drag(*a, steps); break;
+    case Video:     playVideo(*a); break;
+    case Pointer:   movePointer(*a, steps); break;
+    }
+  }
+
+  server->tryUpdate();
+}
+
+
+// -=- Drawing
+
+// layout() divides the screen below the probe band into a grid with a cell
+// for each activity, and draws its initial state.  Dragged windows move
+// about within their cell, while the other activities happen inside a
+// window filling the cell.
+
+void SSyntheticDesktop::layout() {
+  int n = activities.size();
+  int cols = 1;
+  while (cols * cols < n)
+    cols++;
+  int rows = (n + cols - 1) / cols;
+  int cellWidth = buffer->width() / cols;
+  int cellHeight = (buffer->height() - probeBand) / rows;
+
+  for (int i = 0; i < n; i++) {
+    Activity& a = activities[i];
+    Rect cell;
+    cell.setXYWH((i % cols) * cellWidth, probeBand + (i / cols) * cellHeight,
+                 cellWidth, cellHeight);
+    Rect window(cell.tl.x + 8, cell.tl.y + 8, cell.br.x - 8, cell.br.y - 8);
+    if (window.width() < 4 * charWidth ||
+        window.height() < titleHeight + 2 * lineHeight)
+      throw Exception("desktop too small for its script");
+
+    if (a.type == Dragging) {
+      a.area = window;
+      a.pos = window.tl;
+      a.dir = Point(1, 1);
+      drawWindow(a);
+    } else {
+      a.area = Rect(window.tl.x + 4, window.tl.y + titleHeight,
+                    window.br.x - 4, window.br.y - 4);
+      a.pos = a.area.tl;
+      buffer->fillRect(window, frame);
+      buffer->fillRect(Rect(window.tl.x + 4, window.tl.y + 4,
+                            window.br.x - 4, window.tl.y + titleHeight - 4),
+                       title);
+      a.dir = Point(1, 1);
+      if (a.type == Scrolling || a.type == Pointer)
+        drawText(a.area);
+      else
+        buffer->fillRect(a.area, paper);
+    }
+  }
+}
+
+// drawWindow() draws a dragged window, which is half the width and height
+// of the area it moves about in, at its current position.
+
+void SSyntheticDesktop::drawWindow(const Activity& a) {
+  Rect window;
+  window.setXYWH(a.pos.x, a.pos.y, a.area.width() / 2, a.area.height() / 2);
+  buffer->fillRect(window, frame);
+  buffer->fillRect(Rect(window.tl.x + 4, window.tl.y + 4,
+                        window.br.x - 4, window.tl.y + titleHeight - 4),
+                   title);
+  drawText(Rect(window.tl.x + 4, window.tl.y + titleHeight,
+                window.br.x - 4, window.br.y - 4));
+}
+
+// drawText() fills a rectangle with lines of random "words".
+
+void SSyntheticDesktop::drawText(const Rect& r) {
+  buffer->fillRect(r, paper);
+  for (int y = r.tl.y; y + lineHeight <= r.br.y; y += lineHeight) {
+    int end = r.tl.x + rnd(r.width());
+    for (int x = r.tl.x; x + charWidth <= end; x += charWidth) {
+      if (rnd(6) != 0)
+        drawChar(Point(x, y));
+    }
+  }
+}
+
+// drawChar() draws a character of a few random strokes onto the paper
+// already in its cell.
+
+void SSyntheticDesktop::drawChar(const Point& p) {
+  for (int s = 0; s < 3; s++) {
+    Rect stroke;
+    if (rnd(2))
+      stroke.setXYWH(p.x + 1 + rnd(4), p.y + 3 + rnd(10), 1 + rnd(2), 3);
+    else
+      stroke.setXYWH(p.x + 1 + rnd(3), p.y + 3 + rnd(10), 3, 1 + rnd(2));
+    buffer->fillRect(stroke, ink);
+  }
+}
+
+// drawBackground() draws the desktop's background of vertical stripes, which
+// depends only on position so that any part of it can be redrawn.
+
+void SSyntheticDesktop::drawBackground(const Rect& r) {
+  for (int x = r.tl.x - r.tl.x % 16; x < r.br.x; x += 16) {
+    Rect stripe(x, r.tl.y, x + 16, r.br.y);
+    buffer->fillRect(stripe.intersect(r), stripes[(x / 16) % 2]);
+  }
+}
+
+
+// -=- Activities
+
+// type() types characters at the cursor position, wrapping at the edge of
+// the window and starting again from the top once the window is full.
+
+void SSyntheticDesktop::type(Activity& a, int chars) {
+  Region changed;
+  for (int i = 0; i < chars; i++) {
+    if (a.pos.x + charWidth > a.area.br.x || rnd(60) == 0) {
+      a.pos.x = a.area.tl.x;
+      a.pos.y += lineHeight;
+    }
+    if (a.pos.y + lineHeight > a.area.br.y) {
+      a.pos = a.area.tl;
+      buffer->fillRect(a.area, paper);
+      changed.assign_union(a.area);
+    }
+    Rect cell;
+    cell.setXYWH(a.pos.x, a.pos.y, charWidth, lineHeight);
+    buffer->fillRect(cell, paper);
+    if (rnd(6) != 0)
+      drawChar(a.pos);
+    changed.assign_union(cell);
+    a.pos.x += charWidth;
+  }
+  server->add_changed(changed);
+}
+
+// scroll() scrolls the window's contents up by the given number of lines,
+// and fills the space left at the bottom with new text.
+
+void SSyntheticDesktop::scroll(Activity& a, int lines) {
+  int dy = lineHeight * __rfbmin(lines, a.area.height() / lineHeight);
+  Rect dest(a.area.tl.x, a.area.tl.y, a.area.br.x, a.area.br.y - dy);
+  Point delta(0, -dy);
+  buffer->copyRect(dest, delta);
+  server->add_copied(dest, delta);
+
+  Rect exposed(a.area.tl.x, a.area.br.y - dy, a.area.br.x, a.area.br.y);
+  drawText(exposed);
+  server->add_changed(exposed);
+}
+
+// drag() moves the dragged window diagonally, bouncing off the edges of its
+// area, and redraws the background it uncovers.
+
+void SSyntheticDesktop::drag(Activity& a, int pixels) {
+  Point size(a.area.width() / 2, a.area.height() / 2);
+  pixels = __rfbmin(pixels, __rfbmin(size.x, size.y));
+  Point pos(a.pos.x + a.dir.x * pixels, a.pos.y + a.dir.y * pixels);
+  if (pos.x < a.area.tl.x || pos.x + size.x > a.area.br.x) {
+    a.dir.x = -a.dir.x;
+    pos.x = a.pos.x + a.dir.x * pixels;
+  }
+  if (pos.y < a.area.tl.y || pos.y + size.y > a.area.br.y) {
+    a.dir.y = -a.dir.y;
+    pos.y = a.pos.y + a.dir.y * pixels;
+  }
+
+  Rect from, to;
+  from.setXYWH(a.pos.x, a.pos.y, size.x, size.y);
+  to.setXYWH(pos.x, pos.y, size.x, size.y);
+  Point delta(pos.x - a.pos.x, pos.y - a.pos.y);
+  buffer->copyRect(to, delta);
+  server->add_copied(to, delta);
+  a.pos = pos;
+
+  Region exposed = Region(from).subtract(to);
+  std::vector<Rect> rects;
+  std::vector<Rect>::iterator i;
+  exposed.get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); i++)
+    drawBackground(*i);
+  server->add_changed(exposed);
+}
+
+// playVideo() draws the next frame of a moving gradient with some noise in
+// it, much as a real video looks to the encoders.  Frames due in the time
+// since the last call are dropped, as a player would.
+
+void SSyntheticDesktop::playVideo(Activity& a) {
+  int stride;
+  rdr::U32* data = (rdr::U32*)buffer->getPixelsRW(a.area, &stride);
+  int f = a.frame++;
+  for (int y = 0; y < a.area.height(); y++) {
+    for (int x = 0; x < a.area.width(); x++) {
+      int r = (x + f * 3) & 255;
+      int g = (y + f * 2) & 255;
+      int b = ((x + y) / 2 + f) & 255;
+      data[x] = rgb(r, g, b ^ (rnd(8)));
+    }
+    data += stride;
+  }
+  server->add_changed(a.area);
+}
+
+// movePointer() moves the pointer diagonally across its window, a few pixels
+// at a time, bouncing off the edges.
+
+void SSyntheticDesktop::movePointer(Activity& a, int moves) {
+  for (int i = 0; i < moves * 4; i++) {
+    if (a.pos.x + a.dir.x < a.area.tl.x || a.pos.x + a.dir.x >= a.area.br.x)
+      a.dir.x = -a.dir.x;
+    if (a.pos.y + a.dir.y < a.area.tl.y || a.pos.y + a.dir.y >= a.area.br.y)
+      a.dir.y = -a.dir.y;
+    a.pos = a.pos.translate(a.dir);
+  }
+  server->setCursorPos(a.pos);
+}
+
+// setCursor() gives the server an arrow-shaped cursor, white with a black
+// outline, with its hotspot at the tip.
+
+void SSyntheticDesktop::setCursor() {
+  const int width = 12, height = 19;
+  rdr::U32 data[width * height];
+  rdr::U8 mask[(width + 7) / 8 * height];
+  memset(mask, 0, sizeof(mask));
+  for (int y = 0; y < height; y++) {
+    // A triangle for the head, then a short tail
+    int left = 0, right = __rfbmin(y, width - 1);
+    if (y >= 13) {
+      left = 4 + (y - 13) / 2;
+      right = left + 2;
+    }
+    for (int x = 0; x < width; x++) {
+      bool inside = (x >= left && x <= right);
+      bool edge = (x == left || x == right || y == 12 || y == height - 1);
+      data[y * width + x] = edge ? rgb(0, 0, 0) : rgb(255, 255, 255);
+      if (inside)
+        mask[y * ((width + 7) / 8) + x / 8] |= 0x80 >> (x % 8);
+    }
+  }
+  server->setCursor(width, height, Point(0, 0), data, mask);
+}
+
+
+// A small linear congruential generator, so that every run draws the same
+// desktop
+
+int SSyntheticDesktop::rnd(int n) {
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) % n;
+}
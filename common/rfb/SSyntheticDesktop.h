@@ -0,0 +1,105 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- SSyntheticDesktop.h
+
+// SSyntheticDesktop is an SDesktop which animates its own framebuffer, so
+// that the server can be exercised without a real desktop to export.  It is
+// driven by a script listing the activities to run, each in its own area of
+// the screen and each optionally followed by a rate:
+//
+//   type[:chars/s]     text being typed into a window (default 10)
+//   scroll[:lines/s]   text scrolling up through a window (default 5)
+//   drag[:pixels/s]    a window being dragged about (default 200)
+//   video[:frames/s]   a moving image, as in a video player (default 25)
+//   pointer[:moves/s]  the pointer moving about over a window (default 50)
+//
+// e.g. "type:20,scroll,video:10".  The caller must call animate() regularly,
+// which draws whatever has happened in the time since the last call and
+// tells the server about it.
+//
+// Key presses are used to measure latency.  The top eight rows of the
+// framebuffer are reserved for them, and each key press sets the 8x8 block
+// at x = 8 * (key >> 16) % width to the value (key & 0xffff), so a viewer
+// can send a key with its own number in the top half and time how long it
+// takes for the value to come back.  The block is big enough to survive
+// being scaled down.
+
+#ifndef __RFB_SSYNTHETICDESKTOP_H__
+#define __RFB_SSYNTHETICDESKTOP_H__
+
+#include <vector>
+#include <rfb/SDesktop.h>
+
+namespace rfb {
+
+  class SSyntheticDesktop : public SDesktop {
+  public:
+    SSyntheticDesktop(const Point& size, const char* script);
+    virtual ~SSyntheticDesktop();
+
+    // animate() advances the activities by the given number of milliseconds
+    // and calls the server's tryUpdate().  It does nothing unless the
+    // desktop has been started.
+    void animate(int ms);
+
+    // SDesktop interface
+    virtual void start(VNCServer* vs);
+    virtual void stop();
+    virtual Point getFbSize() { return Point(buffer->width(), buffer->height()); }
+
+    // InputHandler interface
+    virtual void keyEvent(rdr::U32 key, bool down);
+
+    // The PixelFormat of the framebuffer
+    static const PixelFormat pf;
+
+  protected:
+    enum ActivityType { Typing, Scrolling, Dragging, Video, Pointer };
+    struct Activity {
+      ActivityType type;
+      int rate;
+      int progress;
+      Rect area;
+      Point pos;
+      Point dir;
+      int frame;
+    };
+
+    void layout();
+    void drawWindow(const Activity& a);
+    void drawText(const Rect& r);
+    void drawChar(const Point& p);
+    void drawBackground(const Rect& r);
+    void type(Activity& a, int chars);
+    void scroll(Activity& a, int lines);
+    void drag(Activity& a, int pixels);
+    void playVideo(Activity& a);
+    void movePointer(Activity& a, int moves);
+    void setCursor();
+    int rnd(int n);
+
+    VNCServer* server;
+    ManagedPixelBuffer* buffer;
+    std::vector<Activity> activities;
+    unsigned int seed;
+  };
+
+};
+
+#endif // __RFB_SSYNTHETICDESKTOP_H__
@@ -0,0 +1,336 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <string.h>
+#include <rfb/ScaledPixelBuffer.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCALE_SSE2
+#endif
+
+using namespace rfb;
+
+ScaledPixelBuffer::ScaledPixelBuffer()
+  : source(0), scale(1), overlay(0)
+{
+}
+
+ScaledPixelBuffer::~ScaledPixelBuffer()
+{
+}
+
+void ScaledPixelBuffer::setSource(PixelBuffer* source_, int scale_)
+{
+  source = source_;
+  scale = scale_;
+  overlay = 0;
+  setPF(source->getPF());
+  setColourMap(source->getColourMap(), false);
+  setSize((source->width() + scale - 1) / scale,
+          (source->height() + scale - 1) / scale);
+  stale.reset(getRect());
+}
+
+Rect ScaledPixelBuffer::toScaled(const Rect& r) const
+{
+  return Rect(r.tl.x / scale, r.tl.y / scale,
+              (r.br.x + scale - 1) / scale,
+              (r.br.y + scale - 1) / scale).intersect(getRect());
+}
+
+Region ScaledPixelBuffer::toScaled(const Region& r) const
+{
+  Region scaled;
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator i;
+  r.get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); i++)
+    scaled.assign_union(toScaled(*i));
+  return scaled;
+}
+
+Rect ScaledPixelBuffer::toSource(const Rect& r) const
+{
+  return Rect(r.tl.x * scale, r.tl.y * scale, r.br.x * scale,
+              r.br.y * scale).intersect(source->getRect());
+}
+
+// A point maps to the middle of its block, so that a client clicking on a
+// pixel hits what the pixel mostly shows.
+
+Point ScaledPixelBuffer::toSource(const Point& p) const
+{
+  Point sp(p.x * scale + scale / 2, p.y * scale + scale / 2);
+  if (sp.x >= source->width()) sp.x = source->width() - 1;
+  if (sp.y >= source->height()) sp.y = source->height() - 1;
+  return sp;
+}
+
+// Only a copy by whole blocks, of blocks lying wholly within the source
+// buffer, gives the same blocks here as working them out again would.  The
+// blocks partly in the destination are taken from elsewhere in the source,
+// so they count as changed.
+
+void ScaledPixelBuffer::toScaledCopy(const Region& srcDest,
+                                     const Point& srcDelta, Region* dest,
+                                     Point* delta, Region* changed) const
+{
+  dest->clear();
+  *changed = toScaled(srcDest);
+  if (srcDelta.x % scale || srcDelta.y % scale)
+    return;
+
+  *delta = Point(srcDelta.x / scale, srcDelta.y / scale);
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator i;
+  srcDest.get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); i++) {
+    Rect whole((i->tl.x + scale - 1) / scale, (i->tl.y + scale - 1) / scale,
+               i->br.x / scale, i->br.y / scale);
+    if (!whole.is_empty())
+      dest->assign_union(whole);
+  }
+  changed->assign_subtract(*dest);
+}
+
+void ScaledPixelBuffer::invalidate(const Region& srcRegion)
+{
+  stale.assign_union(toScaled(srcRegion));
+}
+
+void ScaledPixelBuffer::setOverlay(PixelBuffer* overlay_, const Point& pos)
+{
+  if (overlay)
+    invalidate(overlay->getRect(overlayPos));
+  overlay = overlay_;
+  overlayPos = pos;
+  if (overlay)
+    invalidate(overlay->getRect(overlayPos));
+}
+
+const rdr::U8* ScaledPixelBuffer::getPixelsR(const Rect& r, int* stride)
+{
+  if (!stale.is_empty()) {
+    Region toScale = stale.intersect(r);
+    if (!toScale.is_empty()) {
+      std::vector<Rect> rects;
+      std::vector<Rect>::const_iterator i;
+      toScale.get_rects(&rects);
+      for (i = rects.begin(); i != rects.end(); i++)
+        scaleRect(*i);
+      stale.assign_subtract(toScale);
+    }
+  }
+  return getPixelsRW(r, stride);
+}
+
+
+// -=- Downsampling
+//
+// Each function takes the w x h block of output pixels at out, and the
+// sw x sh source pixels they're worked out from at in.  Strides are in
+// bytes.
+
+// scaleBytes() averages each byte of the pixels separately, which does for
+// any 32-bit format whose colours are whole bytes.
+
+#ifdef SCALE_SSE2
+
+// halve4() averages eight pixels from each of two rows in pairs, giving four
+// pixels.  Sums of bytes are kept in 16-bit lanes, and each pixel's sum is
+// then added to its neighbour's by lining up alternate pixels.
+
+static inline __m128i halve2(__m128i a, __m128i b)
+{
+  __m128i zero = _mm_setzero_si128();
+  __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                             _mm_unpacklo_epi8(b, zero));
+  __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+                             _mm_unpackhi_epi8(b, zero));
+  __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi),
+                              _mm_unpackhi_epi64(lo, hi));
+  return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+}
+
+static inline void halve4(rdr::U8* out, const rdr::U8* row0,
+                          const rdr::U8* row1)
+{
+  __m128i a0 = _mm_loadu_si128((const __m128i*)row0);
+  __m128i a1 = _mm_loadu_si128((const __m128i*)(row0 + 16));
+  __m128i b0 = _mm_loadu_si128((const __m128i*)row1);
+  __m128i b1 = _mm_loadu_si128((const __m128i*)(row1 + 16));
+  _mm_storeu_si128((__m128i*)out,
+                   _mm_packus_epi16(halve2(a0, b0), halve2(a1, b1)));
+}
+
+#endif
+
+static void scaleBytes(rdr::U8* out, int outStride, const rdr::U8* in,
+                       int inStride, int w, int h, int sw, int sh, int scale)
+{
+  for (int y = 0; y < h; y++) {
+    const rdr::U8* row = in + y * scale * inStride;
+    rdr::U8* o = out + y * outStride;
+    int bh = sh - y * scale;
+    if (bh > scale) bh = scale;
+    int x = 0;
+#ifdef SCALE_SSE2
+    if (scale == 2 && bh == 2) {
+      for (; x + 4 <= w && (x + 4) * 2 <= sw; x += 4)
+        halve4(o + x * 4, row + x * 8, row + inStride + x * 8);
+    }
+#endif
+    for (; x < w; x++) {
+      int bw = sw - x * scale;
+      if (bw > scale) bw = scale;
+      unsigned int sum[4] = { 0, 0, 0, 0 };
+      const rdr::U8* p = row + x * scale * 4;
+      for (int j = 0; j < bh; j++, p += inStride) {
+        for (int i = 0; i < bw * 4; i += 4) {
+          sum[0] += p[i];
+          sum[1] += p[i+1];
+          sum[2] += p[i+2];
+          sum[3] += p[i+3];
+        }
+      }
+      unsigned int n = bw * bh;
+      for (int c = 0; c < 4; c++)
+        o[x * 4 + c] = (sum[c] + n / 2) / n;
+    }
+  }
+}
+
+// scalePixels() averages the red, green and blue of pixels in any other true
+// colour format.
+
+static inline Pixel readPixel(const rdr::U8* p, int bytes, bool bigEndian)
+{
+  Pixel pix = 0;
+  if (bigEndian) {
+    for (int i = 0; i < bytes; i++)
+      pix = (pix << 8) | p[i];
+  } else {
+    for (int i = bytes - 1; i >= 0; i--)
+      pix = (pix << 8) | p[i];
+  }
+  return pix;
+}
+
+static inline void writePixel(rdr::U8* p, Pixel pix, int bytes,
+                              bool bigEndian)
+{
+  for (int i = 0; i < bytes; i++, pix >>= 8)
+    p[bigEndian ? bytes - 1 - i : i] = pix & 0xff;
+}
+
+static void scalePixels(rdr::U8* out, int outStride, const rdr::U8* in,
+                        int inStride, int w, int h, int sw, int sh, int scale,
+                        const PixelFormat& pf)
+{
+  int bytes = pf.bpp / 8;
+  for (int y = 0; y < h; y++) {
+    int bh = sh - y * scale;
+    if (bh > scale) bh = scale;
+    for (int x = 0; x < w; x++) {
+      int bw = sw - x * scale;
+      if (bw > scale) bw = scale;
+      unsigned int r = 0, g = 0, b = 0;
+      const rdr::U8* p = in + y * scale * inStride + x * scale * bytes;
+      for (int j = 0; j < bh; j++, p += inStride) {
+        for (int i = 0; i < bw; i++) {
+          Pixel pix = readPixel(p + i * bytes, bytes, pf.bigEndian);
+          r += (pix >> pf.redShift) & pf.redMax;
+          g += (pix >> pf.greenShift) & pf.greenMax;
+          b += (pix >> pf.blueShift) & pf.blueMax;
+        }
+      }
+      unsigned int n = bw * bh;
+      Pixel pix = ((((r + n / 2) / n) << pf.redShift) |
+                   (((g + n / 2) / n) << pf.greenShift) |
+                   (((b + n / 2) / n) << pf.blueShift));
+      writePixel(out + y * outStride + x * bytes, pix, bytes, pf.bigEndian);
+    }
+  }
+}
+
+// samplePixels() takes the top-left pixel of each block, since colour map
+// entries can't be averaged.
+
+static void samplePixels(rdr::U8* out, int outStride, const rdr::U8* in,
+                         int inStride, int w, int h, int scale, int bytes)
+{
+  for (int y = 0; y < h; y++) {
+    const rdr::U8* p = in + y * scale * inStride;
+    rdr::U8* o = out + y * outStride;
+    for (int x = 0; x < w; x++)
+      memcpy(o + x * bytes, p + x * scale * bytes, bytes);
+  }
+}
+
+static bool byteColours(const PixelFormat& pf)
+{
+  return (pf.bpp == 32 && pf.redMax == 255 && pf.greenMax == 255 &&
+          pf.blueMax == 255 && pf.redShift % 8 == 0 &&
+          pf.greenShift % 8 == 0 && pf.blueShift % 8 == 0);
+}
+
+// scaleRect() works out the given rectangle of this buffer from the source,
+// and from the overlay where it has one.
+
+void ScaledPixelBuffer::scaleRect(const Rect& r)
+{
+  Rect sr = toSource(r);
+  const PixelFormat& pf = getPF();
+  int bytes = pf.bpp / 8;
+
+  const rdr::U8* in;
+  int inStride;
+  Rect overlaid;
+  if (overlay)
+    overlaid = overlay->getRect(overlayPos).intersect(sr);
+  if (!overlaid.is_empty()) {
+    composite.setPF(pf);
+    composite.setSize(sr.width(), sr.height());
+    source->getImage(composite.data, sr);
+    int overlayStride;
+    const rdr::U8* overlayData
+      = overlay->getPixelsR(overlaid.translate(overlayPos.negate()),
+                            &overlayStride);
+    composite.imageRect(overlaid.translate(sr.tl.negate()), overlayData,
+                        overlayStride);
+    in = composite.data;
+    inStride = sr.width();
+  } else {
+    in = source->getPixelsR(sr, &inStride);
+  }
+
+  int outStride;
+  rdr::U8* out = getPixelsRW(r, &outStride);
+
+  if (pf.trueColour && byteColours(pf))
+    scaleBytes(out, outStride * bytes, in, inStride * bytes, r.width(),
+               r.height(), sr.width(), sr.height(), scale);
+  else if (pf.trueColour)
+    scalePixels(out, outStride * bytes, in, inStride * bytes, r.width(),
+                r.height(), sr.width(), sr.height(), scale, pf);
+  else
+    samplePixels(out, outStride * bytes, in, inStride * bytes, r.width(),
+                 r.height(), scale, bytes);
+}
@@ -0,0 +1,90 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// ScaledPixelBuffer - a copy of another PixelBuffer scaled down by a whole
+// number factor, used to send a client a smaller framebuffer than the
+// server's.
+//
+// Each pixel is the average of a square block of source pixels, or of what
+// there is of the block at the right and bottom edges.  Pixels are only
+// worked out when they are read, and then only those marked stale since,
+// so the scaled copy costs no more to keep up to date than the updates sent
+// from it.  Copies in the source can be mapped to copies here when they move
+// by whole blocks.
+//
+
+#ifndef __RFB_SCALEDPIXELBUFFER_H__
+#define __RFB_SCALEDPIXELBUFFER_H__
+
+#include <rfb/PixelBuffer.h>
+#include <rfb/Region.h>
+
+namespace rfb {
+
+  class ScaledPixelBuffer : public ManagedPixelBuffer {
+  public:
+    ScaledPixelBuffer();
+    virtual ~ScaledPixelBuffer();
+
+    // setSource() sets the PixelBuffer to be scaled and the factor by which
+    // to scale it down, and marks everything stale.  It must be called again
+    // whenever the source changes size or format.
+    void setSource(PixelBuffer* source_, int scale_);
+    int getScale() const { return scale; }
+
+    // toScaled() returns the part of this buffer worked out from the given
+    // part of the source.  toSource() returns the part of the source from
+    // which the given part of this buffer is worked out.
+    Rect toScaled(const Rect& r) const;
+    Region toScaled(const Region& r) const;
+    Rect toSource(const Rect& r) const;
+    Point toSource(const Point& p) const;
+
+    // toScaledCopy() maps a copy within the source to the copy which can be
+    // made here, returned in dest and delta, and the region which has to be
+    // treated as changed instead, returned in changed.
+    void toScaledCopy(const Region& srcDest, const Point& srcDelta,
+                      Region* dest, Point* delta, Region* changed) const;
+
+    // invalidate() marks as stale the part of this buffer worked out from
+    // the given region of the source.
+    void invalidate(const Region& srcRegion);
+
+    // setOverlay() puts the given PixelBuffer, such as a rendered cursor, in
+    // front of the source at pos, or takes it away if overlay is null.  The
+    // parts of this buffer it affects are marked stale either way.
+    void setOverlay(PixelBuffer* overlay_, const Point& pos);
+
+    // getPixelsR() brings any stale part of the rectangle up to date before
+    // returning a pointer to it.
+    virtual const rdr::U8* getPixelsR(const Rect& r, int* stride);
+
+  protected:
+    void scaleRect(const Rect& r);
+
+    PixelBuffer* source;
+    int scale;
+    Region stale;
+    PixelBuffer* overlay;
+    Point overlayPos;
+    ManagedPixelBuffer composite;
+  };
+
+}
+
+#endif
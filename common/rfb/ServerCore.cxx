@@ -35,10 +35,74 @@ rfb::IntParameter rfb::Server::clientWaitTimeMillis
  "The number of milliseconds to wait for a client which is no longer "
  "responding",
  20000, 0);
+rfb::IntParameter rfb::Server::maxSendQueue
+("MaxSendQueue",
+ "The number of kilobytes of output to queue for a client which is slow to "
+ "receive it, beyond which the server waits for the client",
+ 4096, 16);
+rfb::IntParameter rfb::Server::maxUpdateTime
+("MaxUpdateTime",
+ "The number of milliseconds a client should take to receive each update. "
+ "Changes which would make an update take longer are left for later, "
+ "sending those which have waited longest first (zero means send all "
+ "changes in each update)",
+ 100, 0);
+rfb::IntParameter rfb::Server::deferUpdateTime
+("DeferUpdate",
+ "The number of milliseconds to gather changes for before sending them, so "
+ "that a burst of small changes goes out as one update.  It is lengthened, "
+ "up to four times, when every client is far away or when preparing "
+ "updates is slow (zero means send changes at once)",
+ 10, 0);
+rfb::IntParameter rfb::Server::updatePipeline
+("UpdatePipeline",
+ "The number of batches of changes which may be compared on a separate "
+ "thread while earlier ones are sent, where threads are supported (zero "
+ "means compare each batch just before it is sent).  The thread keeps a "
+ "copy of the framebuffer of its own, so this is ignored if CompareHashes "
+ "is set",
+ 0, 0, 8);
 rfb::BoolParameter rfb::Server::compareFB
 ("CompareFB",
  "Perform pixel comparison on framebuffer to reduce unnecessary updates",
  true);
+rfb::IntParameter rfb::Server::compareThreads
+("CompareThreads",
+ "The number of threads to use for framebuffer comparison, where threads "
+ "are supported (zero means one per processor)",
+ 0, 0);
+rfb::BoolParameter rfb::Server::compareHashes
+("CompareHashes",
+ "Compare a hash of each block of the framebuffer rather than a copy of it, "
+ "which uses much less memory",
+ false);
+rfb::IntParameter rfb::Server::compareHashBlockSize
+("CompareHashBlockSize",
+ "The size in pixels of the square blocks which are hashed when "
+ "CompareHashes is set",
+ 32, 8, 256);
+rfb::IntParameter rfb::Server::compareHashRecheck
+("CompareHashRecheck",
+ "When CompareHashes is set, send every block reported as changed on each "
+ "Nth comparison even if its hash is unchanged, in case the hash matched "
+ "by chance (zero means trust the hashes)",
+ 0, 0);
+rfb::BoolParameter rfb::Server::detectScrolling
+("DetectScrolling",
+ "Look for scrolled areas when comparing the framebuffer, so that they can "
+ "be sent as copies",
+ false);
+rfb::IntParameter rfb::Server::heatMapHalfLife
+("HeatMapHalfLife",
+ "The time in milliseconds over which changes to an area of the screen "
+ "count half as much towards how often that area is considered to change",
+ 1000, 1);
+rfb::IntParameter rfb::Server::changeTileSize
+("ChangeTileSize",
+ "Record changes to the framebuffer as a grid of square tiles of this many "
+ "pixels rather than as exact regions, which is cheaper when there are very "
+ "many small changes (zero means exact regions)",
+ 0, 0, 256);
 rfb::BoolParameter rfb::Server::protocol3_3
 ("Protocol3.3",
  "Always use protocol version 3.3 for backwards compatibility with "
@@ -80,3 +144,14 @@ rfb::BoolParameter rfb::Server::queryConnect
 ("QueryConnect",
  "Prompt the local user to accept or reject incoming connections.",
  false);
+rfb::IntParameter rfb::Server::tileCacheSize
+("TileCacheSize",
+ "The maximum number of 64x64 tiles to remember for each client which "
+ "offers a tile cache, so that they can be sent again by reference "
+ "(zero disables the tile cache)",
+ 4096, 0);
+rfb::IntParameter rfb::Server::maxScale
+("MaxScale",
+ "The largest factor by which a client which asks for it may have the "
+ "framebuffer scaled down before it is sent (1 disables scaling)",
+ 8, 1, 8);
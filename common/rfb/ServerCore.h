@@ -34,7 +34,18 @@ namespace rfb {
 
     static IntParameter idleTimeout;
     static IntParameter clientWaitTimeMillis;
+    static IntParameter maxSendQueue;
+    static IntParameter maxUpdateTime;
+    static IntParameter deferUpdateTime;
+    static IntParameter updatePipeline;
     static BoolParameter compareFB;
+    static IntParameter compareThreads;
+    static BoolParameter compareHashes;
+    static IntParameter compareHashBlockSize;
+    static IntParameter compareHashRecheck;
+    static BoolParameter detectScrolling;
+    static IntParameter heatMapHalfLife;
+    static IntParameter changeTileSize;
     static BoolParameter protocol3_3;
     static BoolParameter alwaysShared;
     static BoolParameter neverShared;
@@ -44,6 +55,8 @@ namespace rfb {
     static BoolParameter acceptCutText;
     static BoolParameter sendCutText;
     static BoolParameter queryConnect;
+    static IntParameter tileCacheSize;
+    static IntParameter maxScale;
 
   };
 
@@ -26,6 +26,11 @@
 
 #ifdef _WIN32
 #include "../../vnc/rfb_win32/Threading.h"
+#else
+#include <unistd.h>
+#if defined(_POSIX_THREADS) && _POSIX_THREADS > 0
+#include <rfb/Threading_posix.h>
+#endif
 #endif
 
 #endif // __RFB_THREADING_H__
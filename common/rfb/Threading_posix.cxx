@@ -0,0 +1,151 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- Threading_posix.cxx
+// POSIX Threading interface implementation
+
+#include <errno.h>
+#include <sys/time.h>
+
+#include <rdr/Exception.h>
+#include <rfb/LogWriter.h>
+#include <rfb/Threading.h>
+
+#ifdef __RFB_THREADING_IMPL_POSIX
+
+using namespace rfb;
+
+static LogWriter vlog("Threading");
+
+
+inline void logAction(Thread* t, const char* action) {
+  vlog.debug("%-16.16s %s(%p)", action, t->getName(), (void*)t);
+}
+
+inline void logError(Thread* t, const char* err) {
+  vlog.error("%-16.16s %s(%p):%s", "failed", t->getName(), (void*)t, err);
+}
+
+
+void
+Condition::wait(int timeout) {
+  if (timeout < 0) {
+    pthread_cond_wait(&cond, &mutex.mutex);
+    return;
+  }
+  struct timeval now;
+  gettimeofday(&now, 0);
+  struct timespec until;
+  until.tv_sec = now.tv_sec + timeout / 1000;
+  until.tv_nsec = (now.tv_usec + (timeout % 1000) * 1000) * 1000;
+  if (until.tv_nsec >= 1000000000) {
+    until.tv_sec++;
+    until.tv_nsec -= 1000000000;
+  }
+  int result = pthread_cond_timedwait(&cond, &mutex.mutex, &until);
+  if (result != 0 && result != ETIMEDOUT)
+    throw rdr::SystemException("failed to wait on Condition", result);
+}
+
+
+void*
+Thread::threadProc(void* param) {
+  Thread* thread = (Thread*) param;
+  logAction(thread, "started");
+  try {
+    thread->run();
+    logAction(thread, "stopped");
+  } catch (rdr::Exception& e) {
+    logError(thread, e.str());
+  }
+  bool deleteThread = false;
+  {
+    Lock l(thread->mutex);
+    if (thread->state == ThreadStarted)
+      thread->state = ThreadStopped;
+    deleteThread = thread->deleteAfterRun;
+  }
+  if (deleteThread) {
+    pthread_detach(pthread_self());
+    delete thread;
+  }
+  return 0;
+}
+
+Thread::Thread(const char* name_)
+  : name(strDup(name_ ? name_ : "Unnamed")), state(ThreadCreated),
+    deleteAfterRun(false) {
+  logAction(this, "created");
+}
+
+Thread::~Thread() {
+  logAction(this, "destroying");
+  if (!deleteAfterRun && state != ThreadCreated)
+    this->join();
+  logAction(this, "destroyed");
+}
+
+void
+Thread::run() {
+}
+
+void
+Thread::start() {
+  Lock l(mutex);
+  if (state == ThreadCreated) {
+    int result = pthread_create(&thread, 0, threadProc, this);
+    if (result != 0)
+      throw rdr::SystemException("unable to create thread", result);
+    state = ThreadStarted;
+  }
+}
+
+Thread*
+Thread::join() {
+  if (deleteAfterRun)
+    throw rdr::Exception("attempt to join() with deleteAfterRun thread");
+  {
+    Lock l(mutex);
+    if (state == ThreadCreated)
+      return this;
+    if (state == ThreadJoined) {
+      logAction(this, "already joined");
+      return this;
+    }
+  }
+  logAction(this, "joining");
+  pthread_join(thread, 0);
+  {
+    Lock l(mutex);
+    state = ThreadJoined;
+  }
+  logAction(this, "joined");
+  return this;
+}
+
+const char*
+Thread::getName() const {
+  return name.buf;
+}
+
+ThreadState
+Thread::getState() const {
+  return state;
+}
+
+#endif
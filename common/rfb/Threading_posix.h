@@ -0,0 +1,126 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- Threading_posix.h
+// POSIX Threading interface implementation
+
+#ifndef __RFB_THREADING_IMPL_POSIX
+#define __RFB_THREADING_IMPL_POSIX
+
+#define __RFB_THREADING_IMPL POSIX
+
+#include <pthread.h>
+#include <rfb/util.h>
+
+
+namespace rfb {
+
+  // Mutexes are recursive, like the Win32 critical sections they stand in
+  // for, so that a thread may take a Lock it already holds.
+
+  class Mutex {
+  public:
+    Mutex() {
+      pthread_mutexattr_t attr;
+      pthread_mutexattr_init(&attr);
+      pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+      pthread_mutex_init(&mutex, &attr);
+      pthread_mutexattr_destroy(&attr);
+    }
+    ~Mutex() {
+      pthread_mutex_destroy(&mutex);
+    }
+    friend class Lock;
+    friend class Condition;
+  protected:
+    void enter() {pthread_mutex_lock(&mutex);}
+    void exit() {pthread_mutex_unlock(&mutex);}
+    pthread_mutex_t mutex;
+  };
+
+  class Lock {
+  public:
+    Lock(Mutex& m) : mutex(m) {m.enter();}
+    ~Lock() {mutex.exit();}
+  protected:
+    Mutex& mutex;
+  };
+
+  class Condition {
+  public:
+    Condition(Mutex& m) : mutex(m) {
+      pthread_cond_init(&cond, 0);
+    }
+    ~Condition() {
+      pthread_cond_destroy(&cond);
+    }
+
+    // Wake up the specified number of threads that are waiting
+    // on this Condition, or all of them if -1 is specified.
+    void signal(int howMany=1) {
+      if (howMany < 0) {
+        pthread_cond_broadcast(&cond);
+      } else {
+        while (howMany-- > 0)
+          pthread_cond_signal(&cond);
+      }
+    }
+
+    // NB: Must hold "mutex" to call wait()
+    // Wait until either the Condition is signalled or the timeout (in
+    // milliseconds) expires.  A negative timeout waits indefinitely.
+    void wait(int timeout=-1);
+
+  protected:
+    Mutex& mutex;
+    pthread_cond_t cond;
+  };
+
+  enum ThreadState {ThreadCreated, ThreadStarted, ThreadStopped, ThreadJoined};
+
+  class Thread {
+  public:
+    Thread(const char* name_=0);
+    virtual ~Thread();
+
+    virtual void run();
+
+    virtual void start();
+    virtual Thread* join();
+
+    const char* getName() const;
+    ThreadState getState() const;
+
+    // Determines whether the thread should delete itself when run() returns
+    // If you set this, you must NEVER call join()!
+    void setDeleteAfterRun() {deleteAfterRun = true;};
+
+  protected:
+    static void* threadProc(void* param);
+
+    pthread_t thread;
+    CharArray name;
+    ThreadState state;
+    Mutex mutex;
+
+    bool deleteAfterRun;
+  };
+
+};
+
+#endif // __RFB_THREADING_IMPL
@@ -0,0 +1,181 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#include <string.h>
+#include <rfb/encodings.h>
+#include <rfb/TileCache.h>
+
+using namespace rfb;
+
+int TileCache::sizeForEncoding(unsigned int encoding)
+{
+  return 64 << (encoding - pseudoEncodingTileCache0);
+}
+
+unsigned int TileCache::encodingForSize(int tiles)
+{
+  if (tiles < 64) return 0;
+  unsigned int encoding = pseudoEncodingTileCache0;
+  while (encoding < pseudoEncodingTileCache15 &&
+         sizeForEncoding(encoding + 1) <= tiles)
+    encoding++;
+  return encoding;
+}
+
+// hash() runs two independent multiplicative hashes over the pixels a word
+// at a time, giving a 64-bit key.  The size of the tile is included so that
+// tiles of different shapes holding the same bytes don't collide.  The check
+// value is a Fletcher-style sum over the same words, seeded with the length,
+// which shares nothing with the multiplicative hashes.
+
+static inline rdr::U32 mix(rdr::U32 h)
+{
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+TileCache::Key TileCache::hash(const void* data, int w, int h,
+                               int bytesPerPixel, rdr::U32* check)
+{
+  const rdr::U8* p = (const rdr::U8*)data;
+  int len = w * h * bytesPerPixel;
+  rdr::U32 lo = 2166136261U ^ ((w << 16) | h);
+  rdr::U32 hi = 0x9e3779b9U ^ len;
+  rdr::U32 sum1 = len;
+  rdr::U32 sum2 = 0;
+
+  const rdr::U8* end = p + (len & ~3);
+  while (p < end) {
+    rdr::U32 v;
+    memcpy(&v, p, 4);
+    lo = (lo ^ v) * 16777619U;
+    hi = (((hi << 5) | (hi >> 27)) ^ v) * 0x9e3779b1U;
+    sum1 += v;
+    sum2 += sum1;
+    p += 4;
+  }
+  for (int i = 0; i < (len & 3); i++) {
+    lo = (lo ^ p[i]) * 16777619U;
+    hi = (((hi << 5) | (hi >> 27)) ^ p[i]) * 0x9e3779b1U;
+    sum1 += p[i];
+    sum2 += sum1;
+  }
+
+  if (check)
+    *check = sum1 ^ ((sum2 << 16) | (sum2 >> 16));
+  return Key(mix(hi ^ lo), mix(lo));
+}
+
+TileCache::TileCache(int maxTiles, int tileBytes_)
+  : maxTiles_(maxTiles), tileBytes(tileBytes_), nTiles(0), head(-1),
+    tail(-1), data_(0), lookups(0), hits(0)
+{
+  nBuckets = 1;
+  while (nBuckets < maxTiles_) nBuckets <<= 1;
+  buckets = new int[nBuckets];
+  for (int i = 0; i < nBuckets; i++)
+    buckets[i] = -1;
+  keys = new Key[maxTiles_];
+  checks = new rdr::U32[maxTiles_];
+  chain = new int[maxTiles_];
+  prev = new int[maxTiles_];
+  next = new int[maxTiles_];
+  if (tileBytes)
+    data_ = new rdr::U8[maxTiles_ * tileBytes];
+}
+
+TileCache::~TileCache()
+{
+  delete [] buckets;
+  delete [] keys;
+  delete [] checks;
+  delete [] chain;
+  delete [] prev;
+  delete [] next;
+  delete [] data_;
+}
+
+int TileCache::lookup(const Key& key, rdr::U32 check)
+{
+  lookups++;
+  int slot = find(key);
+  if (slot < 0 || checks[slot] != check) return -1;
+  hits++;
+  unlink(slot);
+  pushFront(slot);
+  return slot;
+}
+
+int TileCache::insert(const Key& key, rdr::U32 check)
+{
+  int slot = find(key);
+  if (slot >= 0) {
+    checks[slot] = check;
+    unlink(slot);
+    pushFront(slot);
+    return slot;
+  }
+
+  if (nTiles < maxTiles_) {
+    slot = nTiles++;
+  } else {
+    // Evict the least recently used tile, removing it from its hash chain
+    slot = tail;
+    unlink(slot);
+    int* link = &buckets[bucket(keys[slot])];
+    while (*link != slot)
+      link = &chain[*link];
+    *link = chain[slot];
+  }
+
+  keys[slot] = key;
+  checks[slot] = check;
+  chain[slot] = buckets[bucket(key)];
+  buckets[bucket(key)] = slot;
+  pushFront(slot);
+  return slot;
+}
+
+int TileCache::find(const Key& key)
+{
+  for (int slot = buckets[bucket(key)]; slot >= 0; slot = chain[slot]) {
+    if (keys[slot] == key)
+      return slot;
+  }
+  return -1;
+}
+
+void TileCache::unlink(int slot)
+{
+  if (prev[slot] >= 0) next[prev[slot]] = next[slot];
+  else head = next[slot];
+  if (next[slot] >= 0) prev[next[slot]] = prev[slot];
+  else tail = prev[slot];
+}
+
+void TileCache::pushFront(int slot)
+{
+  prev[slot] = -1;
+  next[slot] = head;
+  if (head >= 0) prev[head] = slot;
+  else tail = slot;
+  head = slot;
+}
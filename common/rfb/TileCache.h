@@ -0,0 +1,126 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// TileCache - an LRU cache of 64x64 pixel tiles keyed by their hash.
+//
+// The tile cache pseudo-encodings let a server refer to tiles the client has
+// seen before instead of sending their pixels again.  The client announces
+// the number of tiles it can cache with pseudoEncodingTileCache0 + n, meaning
+// 64 << n tiles.  Each end then keeps a TileCache: the server's holds only
+// the keys, while the client's also holds the pixel data for each tile.
+//
+// A pseudoEncodingCacheStore rectangle, carrying a key as two U32s, asks the
+// client to copy the given rectangle of its framebuffer into its cache.  A
+// pseudoEncodingCachedTile rectangle asks it to draw the cached tile with the
+// given key there.  Both ends apply exactly the same sequence of insert() and
+// lookup() calls, so they agree on which tiles are in the cache without any
+// further messages.  A server may use a smaller cache than the client asked
+// for, since an LRU cache always holds the same tiles as any smaller one
+// given the same sequence of accesses.
+//
+// Both caches are emptied whenever the pixel format or the cache size
+// changes.
+//
+// Two different tiles with the same 64-bit key would leave the client
+// drawing the wrong pixels, so the server also keeps a 32-bit check value
+// for each tile, computed differently from the key, and treats a tile whose
+// check value differs as a miss.  It then stores the new tile under the same
+// key, replacing the old one at both ends.  Only a tile matching in the key
+// and the check value, 96 bits in all, can be drawn wrongly.
+//
+
+#ifndef __RFB_TILECACHE_H__
+#define __RFB_TILECACHE_H__
+
+#include <rdr/types.h>
+
+namespace rfb {
+
+  class TileCache {
+  public:
+
+    static const int maxTileSize = 64;
+
+    struct Key {
+      Key() : hi(0), lo(0) {}
+      Key(rdr::U32 hi_, rdr::U32 lo_) : hi(hi_), lo(lo_) {}
+      bool operator==(const Key& k) const { return hi == k.hi && lo == k.lo; }
+      rdr::U32 hi, lo;
+    };
+
+    // sizeForEncoding() returns the number of tiles which the given tile
+    // cache pseudo-encoding offers.  encodingForSize() returns the
+    // pseudo-encoding for the largest cache which fits in the given number of
+    // tiles, or 0 if it is too small for any.
+    static int sizeForEncoding(unsigned int encoding);
+    static unsigned int encodingForSize(int tiles);
+
+    // hash() returns the key for a tile of the given size whose pixels are
+    // held contiguously in data.  If check is non-null the tile's check value
+    // is also returned there.
+    static Key hash(const void* data, int w, int h, int bytesPerPixel,
+                    rdr::U32* check=0);
+
+    // A cache created with tileBytes of 0 keeps only the keys, as the server
+    // does.
+    TileCache(int maxTiles, int tileBytes=0);
+    ~TileCache();
+
+    int maxTiles() const { return maxTiles_; }
+
+    // lookup() returns the slot holding the given key, making it the most
+    // recently used tile, or -1 if it is not in the cache.  The server passes
+    // the tile's check value, and a tile stored with a different one is left
+    // untouched and reported as missing.
+    int lookup(const Key& key, rdr::U32 check=0);
+
+    // insert() adds the given key to the cache, if it is not already there,
+    // evicting the least recently used tile if the cache is full.  It returns
+    // the key's slot, which the client should then fill with the tile's
+    // pixels.
+    int insert(const Key& key, rdr::U32 check=0);
+
+    rdr::U8* data(int slot) { return data_ + slot * tileBytes; }
+
+    int getLookups() { return lookups; }
+    int getHits()    { return hits; }
+
+  private:
+    int find(const Key& key);
+    void unlink(int slot);
+    void pushFront(int slot);
+    int bucket(const Key& key) { return key.lo & (nBuckets - 1); }
+
+    int maxTiles_;
+    int tileBytes;
+    int nTiles;
+    int nBuckets;
+    int* buckets;
+    Key* keys;
+    rdr::U32* checks;
+    int* chain;
+    int* prev;
+    int* next;
+    int head, tail;
+    rdr::U8* data_;
+    int lookups;
+    int hits;
+  };
+
+}
+#endif
@@ -0,0 +1,249 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#include <string.h>
+#include <rfb/Exception.h>
+#include <rfb/TileUpdateTracker.h>
+
+using namespace rfb;
+
+// Each row of tiles is held in wordsPerRow words, with tile x in bit (x % 32)
+// of word (x / 32).  Bits beyond the last tile in a row are always zero.
+
+static inline void setRun(rdr::U32* row, int x1, int x2)
+{
+  int w1 = x1 / 32, w2 = (x2 - 1) / 32;
+  rdr::U32 m1 = 0xffffffff << (x1 % 32);
+  rdr::U32 m2 = 0xffffffff >> (31 - (x2 - 1) % 32);
+  if (w1 == w2) {
+    row[w1] |= m1 & m2;
+    return;
+  }
+  row[w1] |= m1;
+  for (int w = w1 + 1; w < w2; w++)
+    row[w] = 0xffffffff;
+  row[w2] |= m2;
+}
+
+static inline void clearRun(rdr::U32* row, int x1, int x2)
+{
+  int w1 = x1 / 32, w2 = (x2 - 1) / 32;
+  rdr::U32 m1 = 0xffffffff << (x1 % 32);
+  rdr::U32 m2 = 0xffffffff >> (31 - (x2 - 1) % 32);
+  if (w1 == w2) {
+    row[w1] &= ~(m1 & m2);
+    return;
+  }
+  row[w1] &= ~m1;
+  for (int w = w1 + 1; w < w2; w++)
+    row[w] = 0;
+  row[w2] &= ~m2;
+}
+
+// lowestBit() returns the index of the lowest set bit in a non-zero word
+
+static inline int lowestBit(rdr::U32 v)
+{
+  static const int table[32] = {
+    0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+    31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
+  };
+  return table[((v & (0 - v)) * 0x077CB531U) >> 27];
+}
+
+// findRun() finds the first run of set bits in a row at or after tile x,
+// returning false if there is none.
+
+static inline bool findRun(const rdr::U32* row, int wordsPerRow, int x,
+                           int* start, int* end)
+{
+  int w = x / 32;
+  if (w >= wordsPerRow) return false;
+  rdr::U32 v = row[w] & (0xffffffff << (x % 32));
+  while (!v) {
+    if (++w == wordsPerRow) return false;
+    v = row[w];
+  }
+  *start = w * 32 + lowestBit(v);
+
+  v = ~row[w] & (0xffffffff << (*start % 32));
+  while (!v) {
+    if (++w == wordsPerRow) {
+      *end = wordsPerRow * 32;
+      return true;
+    }
+    v = ~row[w];
+  }
+  *end = w * 32 + lowestBit(v);
+  return true;
+}
+
+
+TileUpdateTracker::TileUpdateTracker(const Rect& bounds_, int tileSize_)
+  : bounds(bounds_), tileSize(tileSize_)
+{
+  tilesAcross = (bounds.width() + tileSize - 1) / tileSize;
+  tilesDown = (bounds.height() + tileSize - 1) / tileSize;
+  wordsPerRow = (tilesAcross + 31) / 32;
+  bits = new rdr::U32[wordsPerRow * tilesDown];
+  clear();
+}
+
+TileUpdateTracker::~TileUpdateTracker()
+{
+  delete [] bits;
+}
+
+void TileUpdateTracker::add_changed(const Region& region)
+{
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator i;
+  region.get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); i++) {
+    Rect r = i->intersect(bounds);
+    if (r.is_empty()) continue;
+    int x1 = (r.tl.x - bounds.tl.x) / tileSize;
+    int x2 = (r.br.x - bounds.tl.x + tileSize - 1) / tileSize;
+    int y1 = (r.tl.y - bounds.tl.y) / tileSize;
+    int y2 = (r.br.y - bounds.tl.y + tileSize - 1) / tileSize;
+    for (int y = y1; y < y2; y++)
+      setRun(&bits[y * wordsPerRow], x1, x2);
+  }
+}
+
+void TileUpdateTracker::add_copied(const Region& dest, const Point& delta)
+{
+  add_changed(dest);
+}
+
+void TileUpdateTracker::subtract(const Region& region)
+{
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator i;
+  region.get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); i++) {
+    Rect r = i->intersect(bounds);
+    if (r.is_empty()) continue;
+
+    // Only tiles wholly inside r are removed.  The last column and row of
+    // tiles may be cut short by the bounds.
+    int x1 = (r.tl.x - bounds.tl.x + tileSize - 1) / tileSize;
+    int x2 = (r.br.x == bounds.br.x ? tilesAcross
+              : (r.br.x - bounds.tl.x) / tileSize);
+    int y1 = (r.tl.y - bounds.tl.y + tileSize - 1) / tileSize;
+    int y2 = (r.br.y == bounds.br.y ? tilesDown
+              : (r.br.y - bounds.tl.y) / tileSize);
+    if (x1 >= x2) continue;
+    for (int y = y1; y < y2; y++)
+      clearRun(&bits[y * wordsPerRow], x1, x2);
+  }
+}
+
+void TileUpdateTracker::checkGrid(const TileUpdateTracker& t) const
+{
+  if (!t.bounds.equals(bounds) || t.tileSize != tileSize)
+    throw Exception("TileUpdateTracker: trackers have different tile grids");
+}
+
+void TileUpdateTracker::assign_union(const TileUpdateTracker& t)
+{
+  checkGrid(t);
+  int n = wordsPerRow * tilesDown;
+  for (int i = 0; i < n; i++)
+    bits[i] |= t.bits[i];
+}
+
+void TileUpdateTracker::assign_intersect(const TileUpdateTracker& t)
+{
+  checkGrid(t);
+  int n = wordsPerRow * tilesDown;
+  for (int i = 0; i < n; i++)
+    bits[i] &= t.bits[i];
+}
+
+void TileUpdateTracker::assign_subtract(const TileUpdateTracker& t)
+{
+  checkGrid(t);
+  int n = wordsPerRow * tilesDown;
+  for (int i = 0; i < n; i++)
+    bits[i] &= ~t.bits[i];
+}
+
+bool TileUpdateTracker::is_empty() const
+{
+  int n = wordsPerRow * tilesDown;
+  for (int i = 0; i < n; i++)
+    if (bits[i]) return false;
+  return true;
+}
+
+void TileUpdateTracker::clear()
+{
+  memset(bits, 0, wordsPerRow * tilesDown * sizeof(rdr::U32));
+}
+
+void TileUpdateTracker::get_rects(std::vector<Rect>* rects) const
+{
+  // A band is a group of consecutive rows of tiles with identical bits.
+  // Its runs are only found once the band ends.
+  int bandStart = 0;
+  for (int y = 1; y <= tilesDown; y++) {
+    const rdr::U32* band = &bits[bandStart * wordsPerRow];
+    if (y < tilesDown && memcmp(band, &bits[y * wordsPerRow],
+                                wordsPerRow * sizeof(rdr::U32)) == 0)
+      continue;
+
+    int y1 = bounds.tl.y + bandStart * tileSize;
+    int y2 = __rfbmin(bounds.tl.y + y * tileSize, bounds.br.y);
+    int start, end = 0;
+    while (findRun(band, wordsPerRow, end, &start, &end)) {
+      int x1 = bounds.tl.x + start * tileSize;
+      int x2 = __rfbmin(bounds.tl.x + end * tileSize, bounds.br.x);
+      rects->push_back(Rect(x1, y1, x2, y2));
+    }
+    bandStart = y;
+  }
+}
+
+Region TileUpdateTracker::get_changed() const
+{
+  std::vector<Rect> rects;
+  get_rects(&rects);
+
+  Region region;
+  if (rects.empty())
+    return region;
+
+  // The rectangles are already in the banded order which Region keeps, so
+  // they can be given to it directly.
+  std::vector<ShortRect> srects(rects.size());
+  ShortRect extents;
+  extents.x1 = extents.y1 = 0x7fff;
+  extents.x2 = extents.y2 = -0x8000;
+  for (size_t i = 0; i < rects.size(); i++) {
+    srects[i].x1 = rects[i].tl.x;
+    srects[i].y1 = rects[i].tl.y;
+    srects[i].x2 = rects[i].br.x;
+    srects[i].y2 = rects[i].br.y;
+    extents.x1 = __rfbmin(extents.x1, srects[i].x1);
+    extents.y1 = __rfbmin(extents.y1, srects[i].y1);
+    extents.x2 = __rfbmax(extents.x2, srects[i].x2);
+    extents.y2 = __rfbmax(extents.y2, srects[i].y2);
+  }
+  region.setExtentsAndOrderedRects(&extents, srects.size(), &srects[0]);
+  return region;
+}
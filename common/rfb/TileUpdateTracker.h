@@ -0,0 +1,83 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// TileUpdateTracker - records changes as a bitmap of fixed-size tiles.
+//
+// This is an alternative to keeping the changed area as an exact Region.
+// Adding a change costs a few word operations per row of tiles, however
+// fragmented the changes are, at the price of rounding each change out to
+// whole tiles.  Trackers with the same bounds and tile size can be combined
+// a word at a time.  Copies are simply recorded as changes at their
+// destination.
+//
+
+#ifndef __RFB_TILEUPDATETRACKER_H__
+#define __RFB_TILEUPDATETRACKER_H__
+
+#include <vector>
+#include <rdr/types.h>
+#include <rfb/UpdateTracker.h>
+
+namespace rfb {
+
+  class TileUpdateTracker : public UpdateTracker {
+  public:
+    TileUpdateTracker(const Rect& bounds, int tileSize=16);
+    virtual ~TileUpdateTracker();
+
+    virtual void add_changed(const Region& region);
+    virtual void add_copied(const Region& dest, const Point& delta);
+
+    // subtract() removes the tiles which lie completely within region
+    void subtract(const Region& region);
+
+    // The following require the other tracker to have the same bounds and
+    // tile size
+    void assign_union(const TileUpdateTracker& t);
+    void assign_intersect(const TileUpdateTracker& t);
+    void assign_subtract(const TileUpdateTracker& t);
+
+    bool is_empty() const;
+    void clear();
+
+    // get_rects() returns the changed tiles as rectangles clipped to the
+    // bounds, joining tiles into runs along each row and joining rows with
+    // identical runs.  get_changed() returns the same rectangles as a Region.
+    void get_rects(std::vector<Rect>* rects) const;
+    Region get_changed() const;
+
+    const Rect& getBounds() const { return bounds; }
+    int getTileSize() const { return tileSize; }
+
+  private:
+    TileUpdateTracker(const TileUpdateTracker&);
+    TileUpdateTracker& operator=(const TileUpdateTracker&);
+
+    void checkGrid(const TileUpdateTracker& t) const;
+
+    Rect bounds;
+    int tileSize;
+    int tilesAcross;
+    int tilesDown;
+    int wordsPerRow;
+    rdr::U32* bits;
+  };
+
+}
+
+#endif
@@ -19,6 +19,7 @@
 // -=- Timer.cxx
 
 #include <stdio.h>
+#include <time.h>
 #ifdef _WIN32
 #include <windows.h>
 #ifndef _WIN32_WCE
@@ -37,7 +38,7 @@ static LogWriter vlog("Timer");
 
 
 // Win32 does not provide gettimeofday, so we emulate it to simplify the
-// Timer code.
+// Timer code.  The performance counter it uses is monotonic.
 
 #ifdef _WIN32
 static void gettimeofday(struct timeval* tv, void*)
@@ -87,80 +88,138 @@ inline static int diffTimeMillis(timeval later, timeval earlier) {
   return ((later.tv_sec - earlier.tv_sec) * 1000) + ((later.tv_usec - earlier.tv_usec) / 1000);
 }
 
-std::list<Timer*> Timer::pending;
+std::vector<Timer*> Timer::pending;
 
 int Timer::checkTimeouts() {
-  if (pending.empty())
-    return 0;
   timeval now;
-  gettimeofday(&now, 0);
-  while (pending.front()->isBefore(now)) {
-    Timer* timer = pending.front();
-    pending.pop_front();
+  getTime(&now);
+  while (!pending.empty() && pending[0]->isBefore(now)) {
+    Timer* timer = pending[0];
+    removeTimer(timer);
     vlog.debug("handleTimeout(%p)", timer);
-    if (timer->cb->handleTimeout(timer)) {
+    // If the handler restarted the Timer itself then it is left as it is.
+    if (timer->cb->handleTimeout(timer) && !timer->isStarted()) {
       timer->dueTime = addMillis(timer->dueTime, timer->timeoutMs);
       if (timer->isBefore(now)) {
-        // Time has jumped forwards!
-	      vlog.info("time has moved forwards!");
+        // We have fallen behind - skip the timeouts we have missed
+        vlog.debug("timer %p is late", timer);
         timer->dueTime = addMillis(now, timer->timeoutMs);
       }
       insertTimer(timer);
-    } else if (pending.empty()) {
-      return 0;
     }
   }
   return getNextTimeout();
 }
 
 int Timer::getNextTimeout() {
+  if (pending.empty())
+    return 0;
   timeval now;
-  gettimeofday(&now, 0);
-  int toWait = __rfbmax(1, diffTimeMillis(pending.front()->dueTime, now));
-  if (toWait > pending.front()->timeoutMs) {
-    if (toWait - pending.front()->timeoutMs < 1000) {
+  getTime(&now);
+  int toWait = __rfbmax(1, diffTimeMillis(pending[0]->dueTime, now));
+  if (toWait > pending[0]->timeoutMs) {
+    if (toWait - pending[0]->timeoutMs < 1000) {
       vlog.info("gettimeofday is broken...");
       return toWait;
     }
     // Time has jumped backwards!
     vlog.info("time has moved backwards!");
-    pending.front()->dueTime = now;
+    Timer* timer = pending[0];
+    removeTimer(timer);
+    timer->dueTime = now;
+    insertTimer(timer);
     toWait = 1;
   }
   return toWait;
 }
 
-void Timer::insertTimer(Timer* t) {
-  std::list<Timer*>::iterator i;
-  for (i=pending.begin(); i!=pending.end(); i++) {
-    if (t->isBefore((*i)->dueTime)) {
-      pending.insert(i, t);
-      return;
-    }
+void Timer::getTime(timeval* now) {
+#if !defined(_WIN32) && defined(CLOCK_MONOTONIC)
+  timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+    now->tv_sec = ts.tv_sec;
+    now->tv_usec = ts.tv_nsec / 1000;
+    return;
   }
+#endif
+  gettimeofday(now, 0);
+}
+
+int Timer::msSince(timeval then) {
+  timeval now;
+  getTime(&now);
+  return diffTimeMillis(now, then);
+}
+
+void Timer::insertTimer(Timer* t) {
+  t->heapIndex = pending.size();
   pending.push_back(t);
+  siftUp(t->heapIndex);
+}
+
+void Timer::removeTimer(Timer* t) {
+  int index = t->heapIndex;
+  Timer* last = pending.back();
+  pending.pop_back();
+  t->heapIndex = -1;
+  if (last == t)
+    return;
+  // Fill the gap with the last Timer, and move it to wherever it belongs
+  pending[index] = last;
+  last->heapIndex = index;
+  siftUp(index);
+  siftDown(last->heapIndex);
+}
+
+void Timer::siftUp(int index) {
+  Timer* t = pending[index];
+  while (index > 0) {
+    int parent = (index - 1) / 2;
+    if (!t->isBefore(pending[parent]->dueTime))
+      break;
+    pending[index] = pending[parent];
+    pending[index]->heapIndex = index;
+    index = parent;
+  }
+  pending[index] = t;
+  t->heapIndex = index;
+}
+
+void Timer::siftDown(int index) {
+  Timer* t = pending[index];
+  int n = pending.size();
+  while (true) {
+    int child = index * 2 + 1;
+    if (child >= n)
+      break;
+    if (child + 1 < n && pending[child + 1]->isBefore(pending[child]->dueTime))
+      child++;
+    if (!pending[child]->isBefore(t->dueTime))
+      break;
+    pending[index] = pending[child];
+    pending[index]->heapIndex = index;
+    index = child;
+  }
+  pending[index] = t;
+  t->heapIndex = index;
 }
 
 void Timer::start(int timeoutMs_) {
   timeval now;
-  gettimeofday(&now, 0);
-  stop();
+  getTime(&now);
   timeoutMs = timeoutMs_;
   dueTime = addMillis(now, timeoutMs);
-  insertTimer(this);
+  if (isStarted()) {
+    siftUp(heapIndex);
+    siftDown(heapIndex);
+  } else {
+    insertTimer(this);
+  }
 }
 
 void Timer::stop() {
-  pending.remove(this);
-}
-
-bool Timer::isStarted() {
-  std::list<Timer*>::iterator i;
-  for (i=pending.begin(); i!=pending.end(); i++) {
-    if (*i == this)
-      return true;
-  }
-  return false;
+  if (isStarted())
+    removeTimer(this);
 }
 
 int Timer::getTimeoutMs() {
@@ -19,7 +19,7 @@
 #ifndef __RFB_TIMER_H__
 #define __RFB_TIMER_H__
 
-#include <list>
+#include <vector>
 #ifdef _WIN32
 #include <winsock2.h>
 #else
@@ -38,6 +38,12 @@ namespace rfb {
      dispatch elapsed Timer callbacks and to determine how long to wait in select() for
      the next timeout to occur.
 
+     Active Timers are kept in a binary heap ordered by due time, and each Timer knows
+     its own place in the heap, so that starting or stopping one takes O(log n) time
+     however many are active, and isStarted() takes constant time.  Times are taken
+     from a monotonic clock where there is one, so that changes to the system time do
+     not affect timeouts.
+
   */
 
   struct Timer {
@@ -53,16 +59,24 @@ namespace rfb {
 
     // checkTimeouts()
     //   Dispatches any elapsed Timers, and returns the number of milliseconds until the
-    //   next Timer will timeout.
+    //   next Timer will timeout, or zero if no Timers are active.
     static int checkTimeouts();
 
     // getNextTimeout()
     //   Returns the number of milliseconds until the next timeout, without dispatching
-    //   any elapsed Timers.
+    //   any elapsed Timers, or zero if no Timers are active.
     static int getNextTimeout();
 
+    // getTime()
+    //   Gets the current time from the same clock as is used for timeouts.
+    static void getTime(timeval* now);
+
+    // msSince()
+    //   Returns the number of milliseconds since a time given by getTime().
+    static int msSince(timeval then);
+
     // Create a Timer with the specified callback handler
-    Timer(Callback* cb_) {cb = cb_;}
+    Timer(Callback* cb_) : timeoutMs(0), cb(cb_), heapIndex(-1) {}
     ~Timer() {stop();}
 
     // startTimer
@@ -76,7 +90,7 @@ namespace rfb {
 
     // isStarted
     //   Determines whether the timer is started.
-    bool isStarted();
+    bool isStarted() {return heapIndex >= 0;}
 
     // getTimeoutMs
     //   Determines the previously used timeout value, if any.
@@ -91,10 +105,15 @@ namespace rfb {
     timeval dueTime;
     int timeoutMs;
     Callback* cb;
+    // The Timer's index in pending, or -1 if it is not started.
+    int heapIndex;
 
     static void insertTimer(Timer* t);
-    // The list of currently active Timers, ordered by time left until timeout.
-    static std::list<Timer*> pending;
+    static void removeTimer(Timer* t);
+    static void siftUp(int index);
+    static void siftDown(int index);
+    // The currently active Timers, as a binary heap with the soonest to timeout first.
+    static std::vector<Timer*> pending;
   };
 
 };
@@ -270,6 +270,17 @@ void TransImageGetter::getImage(void* outPtr, const Rect& r, int outStride)
              outPF, outPtr, outStride, r.width(), r.height());
 }
 
+const rdr::U8* TransImageGetter::getPixelsR(const Rect& r, int* stride)
+{
+  if (!transFn)
+    throw Exception("TransImageGetter: not initialised yet");
+
+  if (transFn != noTransFn)
+    return 0;
+
+  return pb->getPixelsR(r.translate(offset.negate()), stride);
+}
+
 void TransImageGetter::translatePixels(void* inPtr, void* outPtr,
                                        int nPixels) const
 {
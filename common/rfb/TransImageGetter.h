@@ -75,6 +75,11 @@ namespace rfb {
     // padding will be outStride-r.width() pixels).
     void getImage(void* outPtr, const Rect& r, int outStride=0);
 
+    // getPixelsR() returns a pointer directly into the PixelBuffer if the
+    // client's pixel format is the same as the PixelBuffer's, so that no
+    // translation is needed.  Otherwise it returns null.
+    const rdr::U8* getPixelsR(const Rect& r, int* stride);
+
     // translatePixels() translates the given number of pixels from inPtr,
     // putting it into the buffer pointed to by outPtr.  The pixels at inPtr
     // should be in the same format as the PixelBuffer, and the translated
@@ -0,0 +1,233 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- UpdatePipeline.cxx
+
+#include <string.h>
+#include <rfb/UpdatePipeline.h>
+#include <rfb/ServerCore.h>
+#include <rfb/LogWriter.h>
+
+using namespace rfb;
+
+static LogWriter vlog("UpdatePipeline");
+
+static double msBetween(const timeval& start, const timeval& end)
+{
+  return ((end.tv_sec - start.tv_sec) * 1000.0 +
+          (end.tv_usec - start.tv_usec) / 1000.0);
+}
+
+
+UpdatePipeline::UpdatePipeline(PixelBuffer* fb_, int depth_)
+  : fb(fb_), comparer(0), depth(depth_), inPipeline(0)
+#ifdef __RFB_THREADING_IMPL
+  , thread(0), workReady(mutex), stopping(false)
+#endif
+{
+#ifdef __RFB_THREADING_IMPL
+  // The compare thread needs a copy of the framebuffer to compare against,
+  // which would defeat the point of comparing hashes
+  if (depth > 0 && !rfb::Server::compareHashes) {
+    frame.setPF(fb->getPF());
+    frame.setSize(fb->width(), fb->height());
+    comparer = new ComparingUpdateTracker(&frame);
+    thread = new CompareThread(this);
+    thread->start();
+  }
+#endif
+  if (!comparer) {
+    comparer = new ComparingUpdateTracker(fb);
+    depth = 1;
+  }
+}
+
+UpdatePipeline::~UpdatePipeline()
+{
+#ifdef __RFB_THREADING_IMPL
+  if (thread) {
+    {
+      Lock l(mutex);
+      stopping = true;
+      workReady.signal();
+    }
+    thread->join();
+    delete thread;
+  }
+#endif
+
+  while (!toCompare.empty()) {
+    delete toCompare.front();
+    toCompare.pop_front();
+  }
+  while (!toCollect.empty()) {
+    delete toCollect.front();
+    toCollect.pop_front();
+  }
+  delete comparer;
+
+  if (compareStage.count) {
+    vlog.info("%u batches, average times: grab %.2fms, copy %.2fms, "
+              "queued %.2fms, compare %.2fms, waiting %.2fms, send %.2fms",
+              compareStage.count, grabStage.average(), copyStage.average(),
+              queueStage.average(), compareStage.average(),
+              collectStage.average(), sendStage.average());
+  }
+}
+
+
+void UpdatePipeline::capture(const Region& region)
+{
+  timeval start, end;
+  Timer::getTime(&start);
+  fb->grabRegion(region);
+  Timer::getTime(&end);
+  grabStage.add(msBetween(start, end));
+}
+
+void UpdatePipeline::submit(SimpleUpdateTracker* changes)
+{
+  Batch* batch = new Batch;
+  changes->copyTo(&batch->changes);
+  changes->clear();
+  Timer::getTime(&batch->submitted);
+  inPipeline++;
+
+#ifdef __RFB_THREADING_IMPL
+  if (thread) {
+    // Copy the changed pixels, since the framebuffer may have changed again
+    // by the time they are compared
+    Region toCopy = batch->changes.get_changed()
+      .union_(batch->changes.get_copied());
+    toCopy.get_rects(&batch->rects);
+    int bytesPerPixel = fb->getPF().bpp / 8;
+    size_t size = 0;
+    std::vector<Rect>::const_iterator i;
+    for (i = batch->rects.begin(); i != batch->rects.end(); i++)
+      size += i->area() * bytesPerPixel;
+    batch->pixels.resize(size);
+
+    rdr::U8* dest = size ? &batch->pixels[0] : 0;
+    for (i = batch->rects.begin(); i != batch->rects.end(); i++) {
+      int stride;
+      const rdr::U8* src = fb->getPixelsR(*i, &stride);
+      int rowBytes = i->width() * bytesPerPixel;
+      for (int y = 0; y < i->height(); y++) {
+        memcpy(dest, src, rowBytes);
+        dest += rowBytes;
+        src += stride * bytesPerPixel;
+      }
+    }
+
+    timeval end;
+    Timer::getTime(&end);
+    copyStage.add(msBetween(batch->submitted, end));
+
+    Lock l(mutex);
+    toCompare.push_back(batch);
+    workReady.signal();
+    return;
+  }
+#endif
+
+  compare(batch);
+  toCollect.push_back(batch);
+}
+
+bool UpdatePipeline::collect(UpdateTracker* changes)
+{
+  Batch* batch = 0;
+  {
+#ifdef __RFB_THREADING_IMPL
+    Lock l(mutex);
+#endif
+    if (!toCollect.empty()) {
+      batch = toCollect.front();
+      toCollect.pop_front();
+    }
+  }
+  if (!batch)
+    return false;
+
+  inPipeline--;
+  timeval now;
+  Timer::getTime(&now);
+  collectStage.add(msBetween(batch->compared, now));
+  batch->changes.copyTo(changes);
+  delete batch;
+  return true;
+}
+
+void UpdatePipeline::sent(double ms)
+{
+  sendStage.add(ms);
+}
+
+
+void UpdatePipeline::compare(Batch* batch)
+{
+  timeval start;
+  Timer::getTime(&start);
+  queueStage.add(msBetween(batch->submitted, start));
+
+  // Bring the compare thread's copy of the framebuffer up to date
+  const rdr::U8* src = batch->pixels.empty() ? 0 : &batch->pixels[0];
+  int bytesPerPixel = frame.getPF().bpp / 8;
+  std::vector<Rect>::const_iterator i;
+  for (i = batch->rects.begin(); i != batch->rects.end(); i++) {
+    frame.imageRect(*i, src);
+    src += i->area() * bytesPerPixel;
+  }
+  batch->rects.clear();
+  batch->pixels.clear();
+
+  batch->changes.copyTo(comparer);
+  batch->changes.clear();
+  if (rfb::Server::compareFB)
+    comparer->compare();
+  comparer->copyTo(&batch->changes);
+  comparer->clear();
+
+  Timer::getTime(&batch->compared);
+  compareStage.add(msBetween(start, batch->compared));
+}
+
+#ifdef __RFB_THREADING_IMPL
+void UpdatePipeline::work()
+{
+  while (true) {
+    Batch* batch;
+    {
+      Lock l(mutex);
+      while (!stopping && toCompare.empty())
+        workReady.wait();
+      if (stopping)
+        return;
+      batch = toCompare.front();
+      toCompare.pop_front();
+    }
+
+    compare(batch);
+
+    {
+      Lock l(mutex);
+      toCollect.push_back(batch);
+    }
+  }
+}
+#endif
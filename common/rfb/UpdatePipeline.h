@@ -0,0 +1,137 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- UpdatePipeline.h
+//
+// The UpdatePipeline passes batches of framebuffer changes through the
+// ComparingUpdateTracker on their way to the clients.  Where threads are
+// supported the comparison is done by a thread of its own, so that one batch
+// can be compared while the clients encode and send the last.
+//
+// Only the comparison moves off the calling thread.  The framebuffer is
+// still grabbed, and the changes still passed on to clients, by the caller,
+// so an SDesktop sees no difference.  The framebuffer goes on changing while
+// a batch is compared, though, so the changed pixels are copied into the
+// batch when it is submitted, and the compare thread keeps a copy of the
+// framebuffer of its own, made up of them.  That copy is as big again as the
+// comparer's own, so when hashes are compared to save memory each batch is
+// compared on the calling thread instead.
+//
+// Batches are collected in the order they were submitted.  No more than
+// depth of them may be in the pipeline at once - once it is full, callers
+// should leave further changes to gather until a batch has been collected.
+// The time spent at each stage is recorded, and logged when the pipeline is
+// destroyed.
+
+#ifndef __RFB_UPDATEPIPELINE_H__
+#define __RFB_UPDATEPIPELINE_H__
+
+#include <deque>
+#include <vector>
+#include <rfb/ComparingUpdateTracker.h>
+#include <rfb/Threading.h>
+#include <rfb/Timer.h>
+
+namespace rfb {
+
+  class UpdatePipeline {
+  public:
+    // If depth is zero, hashes are compared, or threads are not supported,
+    // each batch is compared against fb as soon as it is submitted.
+    UpdatePipeline(PixelBuffer* fb, int depth);
+    ~UpdatePipeline();
+
+    // capture() grabs a region of the framebuffer, which must include any
+    // changes about to be submitted.
+    void capture(const Region& region);
+
+    // submit() moves the changes into a new batch to be compared.
+    void submit(SimpleUpdateTracker* changes);
+
+    // collect() adds the changes found by the oldest compared batch to
+    // changes, and returns true, or returns false if no batch is ready.
+    bool collect(UpdateTracker* changes);
+
+    // sent() records the time a client took to encode and send an update.
+    void sent(double ms);
+
+    // full() is true if no more batches may be submitted until one has been
+    // collected.  busy() is true if any batch remains to be collected.
+    bool full() const { return inPipeline >= depth; }
+    bool busy() const { return inPipeline > 0; }
+
+  protected:
+    struct Batch {
+      SimpleUpdateTracker changes;
+      std::vector<Rect> rects;
+      std::vector<rdr::U8> pixels;
+      timeval submitted;
+      timeval compared;
+    };
+
+    // compare() passes a batch through the comparer, returning its changes
+    // to it.
+    void compare(Batch* batch);
+
+    // A Stage counts how many times it has been passed through, and how long
+    // that took.
+    struct Stage {
+      Stage() : count(0), time(0) {}
+      void add(double ms) { count++; time += ms; }
+      double average() const { return count ? time / count : 0; }
+      unsigned int count;
+      double time;
+    };
+
+    PixelBuffer* fb;
+    ManagedPixelBuffer frame;
+    ComparingUpdateTracker* comparer;
+    int depth;
+
+    // Batches waiting to be compared, and compared batches waiting to be
+    // collected.  Only pointers are passed between threads, so the mutex is
+    // only ever held briefly.
+    std::deque<Batch*> toCompare;
+    std::deque<Batch*> toCollect;
+    int inPipeline;
+
+    Stage grabStage, copyStage, queueStage, compareStage, collectStage;
+    Stage sendStage;
+
+#ifdef __RFB_THREADING_IMPL
+    class CompareThread : public Thread {
+    public:
+      CompareThread(UpdatePipeline* p) : Thread("UpdatePipeline"), pipeline(p) {}
+      virtual void run() { pipeline->work(); }
+    protected:
+      UpdatePipeline* pipeline;
+    };
+    friend class CompareThread;
+
+    // work() is run by the compare thread until the pipeline is destroyed.
+    void work();
+
+    Thread* thread;
+    Mutex mutex;
+    Condition workReady;
+    bool stopping;
+#endif
+  };
+
+}
+#endif
@@ -0,0 +1,131 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <rfb/UpdateScheduler.h>
+
+using namespace rfb;
+
+static int regionArea(const Region& region)
+{
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator i;
+  int area = 0;
+  region.get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); i++)
+    area += i->area();
+  return area;
+}
+
+UpdateScheduler::UpdateScheduler() : bytesPerPixel(0)
+{
+}
+
+void UpdateScheduler::changed(const Region& region)
+{
+  Region fresh = region.subtract(waiting);
+  if (fresh.is_empty())
+    return;
+  waiting.assign_union(fresh);
+
+  if (!damages.empty() &&
+      Timer::msSince(damages.back().time) < granularity) {
+    damages.back().region.assign_union(fresh);
+    return;
+  }
+
+  // Keep the oldest times, since those matter most, by merging the newest
+  // changes together when there are too many.
+  if ((int)damages.size() >= maxDamages) {
+    Damage& newest = damages.back();
+    fresh.assign_union(newest.region);
+    damages.pop_back();
+  }
+
+  damages.push_back(Damage());
+  Timer::getTime(&damages.back().time);
+  damages.back().region.swap(fresh);
+}
+
+void UpdateScheduler::sent(const Region& region, unsigned int bytes)
+{
+  int area = regionArea(region);
+  if (area > 0) {
+    double sample = (double)bytes / area;
+    if (bytesPerPixel == 0)
+      bytesPerPixel = sample;
+    else
+      bytesPerPixel = (bytesPerPixel * 3 + sample) / 4;
+  }
+
+  waiting.assign_subtract(region);
+  std::list<Damage>::iterator i;
+  for (i = damages.begin(); i != damages.end();) {
+    i->region.assign_subtract(region);
+    if (i->region.is_empty())
+      i = damages.erase(i);
+    else
+      i++;
+  }
+}
+
+void UpdateScheduler::clear()
+{
+  damages.clear();
+  waiting.clear();
+}
+
+int UpdateScheduler::oldestAge()
+{
+  if (damages.empty())
+    return 0;
+  return Timer::msSince(damages.front().time);
+}
+
+double UpdateScheduler::estimate(const Region& region)
+{
+  return bytesPerPixel * regionArea(region);
+}
+
+Region UpdateScheduler::select(const Region& pending, unsigned int budget)
+{
+  // Until an update has been sent there is no telling how big one will be
+  if (bytesPerPixel == 0)
+    return pending;
+
+  double maxArea = budget / bytesPerPixel;
+  Region chosen;
+  double area = 0;
+
+  std::list<Damage>::iterator i;
+  for (i = damages.begin(); i != damages.end(); i++) {
+    Region r = i->region.intersect(pending);
+    if (r.is_empty())
+      continue;
+    int a = regionArea(r);
+    if (!chosen.is_empty() && area + a > maxArea)
+      return chosen;
+    chosen.assign_union(r);
+    area += a;
+  }
+
+  Region untracked = pending.subtract(waiting);
+  if (!untracked.is_empty() &&
+      (chosen.is_empty() || area + regionArea(untracked) <= maxArea))
+    chosen.assign_union(untracked);
+  return chosen;
+}
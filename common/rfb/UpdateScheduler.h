@@ -0,0 +1,85 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// UpdateScheduler - decides which pending changes a client is sent next.
+//
+// Changes for a client accumulate in its update tracker until they can be
+// sent, so a client which falls behind simply skips the intermediate states
+// of an area which keeps changing.  UpdateScheduler also remembers when each
+// area first changed, and when an update would take the client too long to
+// receive it chooses the areas which have been waiting longest, leaving the
+// rest to be merged with later changes.  That way a slow client lags behind
+// by a bounded time rather than by a growing backlog of updates.
+//
+
+#ifndef __RFB_UPDATESCHEDULER_H__
+#define __RFB_UPDATESCHEDULER_H__
+
+#include <list>
+#include <rfb/Region.h>
+#include <rfb/Timer.h>
+
+namespace rfb {
+
+  class UpdateScheduler {
+  public:
+    UpdateScheduler();
+
+    // changed() records that region has changed.  Areas which were already
+    // waiting to be sent keep their original time.
+    void changed(const Region& region);
+
+    // sent() records that region has been sent, taking the given number of
+    // bytes to do so.
+    void sent(const Region& region, unsigned int bytes);
+
+    void clear();
+
+    // oldestAge() returns how many milliseconds the longest-waiting change
+    // has been waiting, or zero if there are none.
+    int oldestAge();
+
+    // select() returns the part of pending which should be sent now, given a
+    // budget of bytes which the client can receive in the time allowed for
+    // an update.  The longest-waiting areas are chosen first, and at least
+    // one area is always chosen.  Any part of pending which changed() has
+    // not been told about is taken to have only just changed.
+    Region select(const Region& pending, unsigned int budget);
+
+    // estimate() returns how many bytes sending region is likely to take,
+    // judging by the updates sent so far, or zero if none have been.
+    double estimate(const Region& region);
+
+  private:
+    struct Damage {
+      timeval time;
+      Region region;
+    };
+
+    // Changes within this many milliseconds of each other are kept together,
+    // and at most maxDamages separate times are remembered.
+    static const int granularity = 20;
+    static const int maxDamages = 16;
+
+    std::list<Damage> damages;
+    Region waiting;
+    double bytesPerPixel;
+  };
+
+}
+#endif
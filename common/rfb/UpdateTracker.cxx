@@ -55,9 +55,9 @@ void ClippingUpdateTracker::add_copied(const Region &dest, const Point &delta) {
   }
 
   // And add any bits that we had to remove to the changed region
-  tmp = clipdest.subtract(tmp);
-  if (!tmp.is_empty())
-    ut->add_changed(tmp);
+  clipdest.assign_subtract(tmp);
+  if (!clipdest.is_empty())
+    ut->add_changed(clipdest);
 }
 
 // SimpleUpdateTracker
@@ -71,7 +71,7 @@ SimpleUpdateTracker::~SimpleUpdateTracker() {
 
 void SimpleUpdateTracker::enable_copyrect(bool enable) {
   if (!enable && copy_enabled) {
-    add_changed(copied);
+    add_changed(get_copied());
     copied.clear();
   }
   copy_enabled=enable;
@@ -91,66 +91,174 @@ void SimpleUpdateTracker::add_copied(const Region &dest, const Point &delta) {
   // Is there anything to do?
   if (dest.is_empty()) return;
 
-  // Calculate whether any of this copy can be treated as a continuation
-  // of an earlier one
+  // Each part of the source was either changed, or copied by an earlier
+  // copy, or is still as the client has it.  Work out which, so that the
+  // new copies can all be made from the client's framebuffer.
   Region src = dest;
   src.translate(delta.negate());
-  Region overlap = src.intersect(copied);
-
-  if (overlap.is_empty()) {
-    // There is no overlap
-
-    Rect newbr = dest.get_bounding_rect();
-    Rect oldbr = copied.get_bounding_rect();
-    if (oldbr.area() > newbr.area()) {
-      // Old copyrect is (probably) bigger - use it
-      changed.assign_union(dest);
-    } else {
-      // New copyrect is probably bigger
-      // Use the new one
-      // But be careful not to copy stuff that still needs
-      // to be updated.
-      Region invalid_src = src.intersect(changed);
-      invalid_src.translate(delta);
-      changed.assign_union(invalid_src);
-      changed.assign_union(copied);
-      copied = dest;
-      copy_delta = delta;
-    }
-    return;
+
+  Region invalid_src = src.intersect(changed);
+  Region client_src = src.subtract(changed);
+
+  std::list<CopyGroup> pieces;
+  std::list<CopyGroup>::iterator i;
+  for (i = copied.begin(); i != copied.end(); i++) {
+    Region piece = client_src.intersect(i->region);
+    if (piece.is_empty()) continue;
+    client_src.assign_subtract(piece);
+    piece.translate(delta);
+    pieces.push_back(CopyGroup(piece, i->delta.translate(delta)));
+  }
+  if (!client_src.is_empty()) {
+    client_src.translate(delta);
+    pieces.push_back(CopyGroup(client_src, delta));
   }
 
-  Region invalid_src = overlap.intersect(changed);
+  // The destination's previous contents are gone
+  changed.assign_subtract(dest);
   invalid_src.translate(delta);
   changed.assign_union(invalid_src);
-  
-  overlap.translate(delta);
 
-  Region nonoverlapped_copied = dest.union_(copied).subtract(overlap);
-  changed.assign_union(nonoverlapped_copied);
+  for (i = copied.begin(); i != copied.end();) {
+    i->region.assign_subtract(dest);
+    if (i->region.is_empty())
+      i = copied.erase(i);
+    else
+      i++;
+  }
+
+  // Add the new pieces to any group with the same delta.  A piece copied
+  // back to where it started is already correct on the client.
+  std::list<CopyGroup>::iterator p;
+  for (p = pieces.begin(); p != pieces.end(); p++) {
+    if (p->delta.equals(Point(0, 0))) continue;
+    for (i = copied.begin(); i != copied.end(); i++) {
+      if (i->delta.equals(p->delta)) {
+        i->region.assign_union(p->region);
+        break;
+      }
+    }
+    if (i == copied.end())
+      copied.push_back(*p);
+  }
+
+  orderCopies();
+}
+
+// orderCopies() puts the copy groups in an order in which each reads its
+// source before any other group overwrites it.  Where groups read from each
+// other's destinations there is no such order, so the reading parts are
+// treated as changed instead.  It also limits the number of groups.
+
+void SimpleUpdateTracker::orderCopies() {
+  while ((int)copied.size() > maxCopyGroups) {
+    std::list<CopyGroup>::iterator i, smallest = copied.begin();
+    for (i = copied.begin(); i != copied.end(); i++) {
+      if (i->region.get_bounding_rect().area() <
+          smallest->region.get_bounding_rect().area())
+        smallest = i;
+    }
+    changed.assign_union(smallest->region);
+    copied.erase(smallest);
+  }
+
+  std::list<CopyGroup> ordered;
+  while (!copied.empty()) {
+    // Find a group whose destination no other remaining group reads from
+    std::list<CopyGroup>::iterator i, j;
+    for (i = copied.begin(); i != copied.end(); i++) {
+      for (j = copied.begin(); j != copied.end(); j++) {
+        if (j == i) continue;
+        Region read = i->region;
+        read.translate(j->delta);
+        if (!read.intersect(j->region).is_empty())
+          break;
+      }
+      if (j == copied.end())
+        break;
+    }
+
+    // If there is none then make the first such a group
+    if (i == copied.end()) {
+      i = copied.begin();
+      for (j = copied.begin(); j != copied.end(); j++) {
+        if (j == i) continue;
+        Region read = i->region;
+        read.translate(j->delta);
+        read.assign_intersect(j->region);
+        changed.assign_union(read);
+        j->region.assign_subtract(read);
+      }
+    }
 
-  copied = overlap;
-  copy_delta = copy_delta.translate(delta);
+    ordered.push_back(*i);
+    copied.erase(i);
+  }
 
-  return;
+  // Drop any groups left empty
+  std::list<CopyGroup>::iterator i;
+  for (i = ordered.begin(); i != ordered.end(); i++) {
+    if (!i->region.is_empty())
+      copied.push_back(*i);
+  }
 }
 
 void SimpleUpdateTracker::subtract(const Region& region) {
-  copied.assign_subtract(region);
   changed.assign_subtract(region);
+
+  // Copies which read from the region must now be made from what was sent
+  // rather than what the client had, so they are changed instead
+  std::list<CopyGroup>::iterator i;
+  for (i = copied.begin(); i != copied.end();) {
+    i->region.assign_subtract(region);
+    Region stale = region;
+    stale.translate(i->delta);
+    stale.assign_intersect(i->region);
+    if (!stale.is_empty()) {
+      changed.assign_union(stale);
+      i->region.assign_subtract(stale);
+    }
+    if (i->region.is_empty())
+      i = copied.erase(i);
+    else
+      i++;
+  }
 }
 
 void SimpleUpdateTracker::getUpdateInfo(UpdateInfo* info, const Region& clip)
 {
-  copied.assign_subtract(changed);
-  info->changed = changed.intersect(clip);
-  info->copied = copied.intersect(clip);
-  info->copy_delta = copy_delta;
+  changed.intersect(clip).swap(info->changed);
+  info->copied.clear();
+  std::list<CopyGroup>::iterator i;
+  for (i = copied.begin(); i != copied.end(); i++) {
+    i->region.assign_subtract(changed);
+    Region r = i->region.intersect(clip);
+    if (!r.is_empty()) {
+      info->copied.push_back(CopyGroup(Region(), i->delta));
+      info->copied.back().region.swap(r);
+    }
+  }
 }
 
 void SimpleUpdateTracker::copyTo(UpdateTracker* to) const {
-  if (!copied.is_empty())
-    to->add_copied(copied, copy_delta);
+  std::list<CopyGroup>::const_iterator i;
+  for (i = copied.begin(); i != copied.end(); i++)
+    to->add_copied(i->region, i->delta);
   if (!changed.is_empty())
     to->add_changed(changed);
 }
+
+Region SimpleUpdateTracker::get_copied() const {
+  Region r;
+  std::list<CopyGroup>::const_iterator i;
+  for (i = copied.begin(); i != copied.end(); i++)
+    r.assign_union(i->region);
+  return r;
+}
+
+void SimpleUpdateTracker::translate(const Point& p) {
+  changed.translate(p);
+  std::list<CopyGroup>::iterator i;
+  for (i = copied.begin(); i != copied.end(); i++)
+    i->region.translate(p);
+}
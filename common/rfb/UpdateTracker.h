@@ -19,22 +19,38 @@
 #ifndef __RFB_UPDATETRACKER_INCLUDED__
 #define __RFB_UPDATETRACKER_INCLUDED__
 
+#include <list>
 #include <rfb/Rect.h>
 #include <rfb/Region.h>
 #include <rfb/PixelBuffer.h>
 
 namespace rfb {
 
+  // A CopyGroup is a region whose contents were copied from elsewhere on the
+  // framebuffer, all by the same delta.  Lists of CopyGroups are kept in the
+  // order they must be applied, so that no group's source has been
+  // overwritten by an earlier group.
+
+  class CopyGroup {
+  public:
+    CopyGroup(const Region& r, const Point& d) : region(r), delta(d) {}
+    Region region;
+    Point delta;
+  };
+
   class UpdateInfo {
   public:
     Region changed;
-    Region copied;
-    Point copy_delta;
+    std::list<CopyGroup> copied;
     bool is_empty() const {
-      return copied.is_empty() && changed.is_empty();
+      return copied.empty() && changed.is_empty();
     }
     int numRects() const {
-      return copied.numRects() + changed.numRects();
+      int n = changed.numRects();
+      std::list<CopyGroup>::const_iterator i;
+      for (i = copied.begin(); i != copied.end(); i++)
+        n += i->region.numRects();
+      return n;
     }
   };
 
@@ -80,21 +96,26 @@ namespace rfb {
     virtual void copyTo(UpdateTracker* to) const;
 
 
-    // Get the changed/copied regions
+    // Get the changed region, the copy groups, and all copied regions
     const Region& get_changed() const {return changed;}
-    const Region& get_copied() const {return copied;}
-    const Point& get_delta() const {return copy_delta;}
+    const std::list<CopyGroup>& get_copies() const {return copied;}
+    Region get_copied() const;
 
     // Move the entire update region by an offset
-    void translate(const Point& p) {changed.translate(p); copied.translate(p);}
+    void translate(const Point& p);
 
-    virtual bool is_empty() const {return changed.is_empty() && copied.is_empty();}
+    virtual bool is_empty() const {return changed.is_empty() && copied.empty();}
 
     virtual void clear() {changed.clear(); copied.clear();};
+
+    // The most copy groups that are tracked at once.  Beyond this the
+    // smallest is treated as changed.
+    static const int maxCopyGroups = 8;
   protected:
+    void orderCopies();
+
     Region changed;
-    Region copied;
-    Point copy_delta;
+    std::list<CopyGroup> copied;
     bool copy_enabled;
   };
 
@@ -16,11 +16,12 @@
  * USA.
  */
 
+#include <string.h>
 #include <rfb/VNCSConnectionST.h>
 #include <rfb/LogWriter.h>
 #include <rfb/secTypes.h>
 #include <rfb/ServerCore.h>
-#include <rfb/ComparingUpdateTracker.h>
+#include <rfb/UpdatePipeline.h>
 #include <rfb/KeyRemapper.h>
 #define XK_MISCELLANY
 #define XK_XKB_KEYS
@@ -30,18 +31,26 @@ using namespace rfb;
 
 static LogWriter vlog("VNCSConnST");
 
+// No update is built while more than this many bytes of earlier output are
+// still queued to be written to the socket
+static const int sendQueueLowWatermark = 16384;
+
 VNCSConnectionST::VNCSConnectionST(VNCServerST* server_, network::Socket *s,
                                    bool reverse)
   : SConnection(server_->securityFactory, reverse), sock(s), server(server_),
-    updates(false), image_getter(server->useEconomicTranslate),
+    updates(false), image_getter(server->useEconomicTranslate), scale(1),
     drawRenderedCursor(false), removeRenderedCursor(false),
-    pointerEventTime(0), accessRights(AccessDefault)
+    continuousUpdates(false), pendingSyncFence(false), syncFence(false),
+    fenceFlags(0), fenceDataLen(0), pointerEventTime(0),
+    accessRights(AccessDefault)
 {
   setStreams(&sock->inStream(), &sock->outStream());
   peerEndpoint.buf = sock->getPeerEndpoint();
   VNCServerST::connectionsLog.write(1,"accepted: %s", peerEndpoint.buf);
 
-  // Configure the socket
+  // Configure the socket.  Output is queued rather than waiting for a slow
+  // client, so that the other clients are not kept waiting too.
+  sock->outStream().setBlocking(false, rfb::Server::maxSendQueue * 1024);
   setSocketTimeouts();
   lastEventTime = time(0);
 
@@ -107,10 +116,22 @@ void VNCSConnectionST::processMessages()
     bool clientsReadyBefore = server->clientsReadyForUpdate();
 
     while (getInStream()->checkNoWait(1)) {
+      // A fence with fenceFlagSyncNext is returned once the message after it
+      // has been processed.
+      if (pendingSyncFence) {
+        syncFence = true;
+        pendingSyncFence = false;
+      }
+
       processMsg();
+
+      if (syncFence) {
+        writer()->writeFence(fenceFlags, fenceDataLen, fenceData);
+        syncFence = false;
+      }
     }
 
-    if (!clientsReadyBefore && !requested.is_empty())
+    if (!clientsReadyBefore && readyForUpdate())
       server->desktop->framebufferUpdateRequest();
   } catch (rdr::EndOfStream&) {
     close("Clean disconnection");
@@ -132,8 +153,12 @@ void VNCSConnectionST::pixelBufferChange()
 {
   try {
     if (!authenticated()) return;
-    if (cp.width && cp.height && (server->pb->width() != cp.width ||
-                                  server->pb->height() != cp.height))
+    if (scale > 1)
+      scaledPb.setSource(server->pb, scale);
+    sentDuringBatches.clear();
+    PixelBuffer* pb = clientBuffer();
+    if (cp.width && cp.height && (pb->width() != cp.width ||
+                                  pb->height() != cp.height))
     {
       // We need to clip the next update to the new size, but also add any
       // extra bits if it's bigger.  If we wanted to do this exactly, something
@@ -150,10 +175,11 @@ void VNCSConnectionST::pixelBufferChange()
       //  updates.add_changed(Rect(0, cp.height, cp.width,
       //                           server->pb->height()));
 
-      renderedCursorRect = renderedCursorRect.intersect(server->pb->getRect());
+      renderedCursorRect = renderedCursorRect.intersect(pb->getRect());
+      cuRegion.assign_intersect(pb->getRect());
 
-      cp.width = server->pb->width();
-      cp.height = server->pb->height();
+      cp.width = pb->width();
+      cp.height = pb->height();
       if (state() == RFBSTATE_NORMAL) {
         if (!writer()->writeSetDesktopSize()) {
           close("Client does not support desktop resize");
@@ -164,9 +190,10 @@ void VNCSConnectionST::pixelBufferChange()
     // Just update the whole screen at the moment because we're too lazy to
     // work out what's actually changed.
     updates.clear();
-    updates.add_changed(server->pb->getRect());
+    scheduler.clear();
+    updates.add_changed(pb->getRect());
     vlog.debug("pixel buffer changed - re-initialising image getter");
-    image_getter.init(server->pb, cp.pf(), writer());
+    image_getter.init(pb, cp.pf(), writer());
     if (writer()->needFakeUpdate())
       writeFramebufferUpdate();
   } catch(rdr::Exception &e) {
@@ -243,6 +270,73 @@ int VNCSConnectionST::checkIdleTimeout()
   return secsToMillis(timeLeft);
 }
 
+bool VNCSConnectionST::flushSocket()
+{
+  if (state() == RFBSTATE_CLOSING || !sock->outStream().bufferUsage())
+    return false;
+  try {
+    setSocketTimeouts();
+    sock->outStream().flush();
+    congestion.updateQueue(sock->outStream().length() -
+                           sock->outStream().bufferUsage(),
+                           sock->outStream().bufferUsage());
+    writeFramebufferUpdate();
+  } catch (rdr::Exception &e) {
+    close(e.str());
+    return false;
+  }
+  return sock->outStream().bufferUsage() != 0;
+}
+
+void VNCSConnectionST::add_changed(const Region& region)
+{
+  if (scale > 1) {
+    scaledPb.invalidate(region);
+    Region scaled = scaledPb.toScaled(region);
+    updates.add_changed(scaled);
+    scheduler.changed(scaled);
+    return;
+  }
+  updates.add_changed(region);
+  scheduler.changed(region);
+}
+
+void VNCSConnectionST::add_copied(const Region& dest, const Point& delta)
+{
+  if (scale > 1) {
+    scaledPb.invalidate(dest);
+    Region scaledDest, changed;
+    Point scaledDelta;
+    scaledPb.toScaledCopy(dest, delta, &scaledDest, &scaledDelta, &changed);
+    if (!scaledDest.is_empty())
+      updates.add_copied(scaledDest, scaledDelta);
+    updates.add_changed(changed);
+    scheduler.changed(scaledDest.union_(changed));
+    return;
+  }
+  updates.add_copied(dest, delta);
+  scheduler.changed(dest);
+}
+
+void VNCSConnectionST::add_batch(const SimpleUpdateTracker& batch,
+                                 unsigned int number)
+{
+  Region fresh;
+  std::list<VNCServerST::SentArea>::const_iterator s;
+  for (s = sentDuringBatches.begin(); s != sentDuringBatches.end(); s++) {
+    if (s->lastBatch >= number)
+      fresh.assign_union(s->region);
+  }
+  while (!sentDuringBatches.empty() &&
+         sentDuringBatches.front().lastBatch <= number)
+    sentDuringBatches.pop_front();
+
+  std::list<CopyGroup>::const_iterator g;
+  for (g = batch.get_copies().begin(); g != batch.get_copies().end(); g++)
+    add_copied(g->region, g->delta);
+  add_changed(batch.get_changed().subtract(fresh));
+}
+
 // renderedCursorChange() is called whenever the server-side rendered cursor
 // changes shape or position.  It ensures that the next update will clean up
 // the old rendered cursor and if necessary draw the new rendered cursor.
@@ -373,7 +467,7 @@ void VNCSConnectionST::setPixelFormat(const PixelFormat& pf)
   char buffer[256];
   pf.print(buffer, 256);
   vlog.info("Client pixel format %s", buffer);
-  image_getter.init(server->pb, pf, writer());
+  image_getter.init(clientBuffer(), pf, writer());
   setCursor();
 }
 
@@ -383,7 +477,7 @@ void VNCSConnectionST::pointerEvent(const Point& pos, int buttonMask)
   if (!(accessRights & AccessPtrEvents)) return;
   if (!rfb::Server::acceptPointerEvents) return;
   if (!server->pointerClient || server->pointerClient == this) {
-    pointerEventPos = pos;
+    pointerEventPos = scale > 1 ? scaledPb.toSource(pos) : pos;
     if (buttonMask)
       server->pointerClient = this;
     else
@@ -449,18 +543,79 @@ void VNCSConnectionST::framebufferUpdateRequest(const Rect& r,bool incremental)
 
   SConnection::framebufferUpdateRequest(r, incremental);
 
-  Region reqRgn(r);
+  // The client may not yet know that its framebuffer has shrunk
+  Rect reqRect = r.intersect(clientBuffer()->getRect());
+  Region reqRgn(reqRect);
   requested.assign_union(reqRgn);
 
   if (!incremental) {
     // Non-incremental update - treat as if area requested has changed
     updates.add_changed(reqRgn);
-    server->comparer->add_changed(reqRgn);
+    if (scale > 1)
+      server->changes.add_changed(scaledPb.toSource(reqRect));
+    else
+      server->changes.add_changed(reqRgn);
   }
 
   writeFramebufferUpdate();
 }
 
+void VNCSConnectionST::enableContinuousUpdates(bool enable, const Rect& r)
+{
+  if (!cp.supportsFence || !cp.supportsContinuousUpdates)
+    throw Exception("Client tried to enable continuous updates when not "
+                    "allowed");
+
+  continuousUpdates = enable;
+  cuRegion.reset(r.intersect(clientBuffer()->getRect()));
+
+  if (enable)
+    writeFramebufferUpdate();
+  else
+    writer()->writeEndOfContinuousUpdates();
+}
+
+// The first byte of the payload of our own fences says what they are for.
+
+static const char fenceTypeHello = 0;
+static const char fenceTypeRTT = 1;
+
+void VNCSConnectionST::fence(rdr::U32 flags, int len, const char* data)
+{
+  if (flags & fenceFlagRequest) {
+    if (flags & fenceFlagSyncNext) {
+      pendingSyncFence = true;
+      fenceFlags = flags & (fenceFlagBlockBefore | fenceFlagBlockAfter |
+                            fenceFlagSyncNext);
+      fenceDataLen = len;
+      memcpy(fenceData, data, len);
+      return;
+    }
+
+    // Messages are processed one at a time, so the blocking flags are
+    // trivially honoured
+    writer()->writeFence(flags & (fenceFlagBlockBefore | fenceFlagBlockAfter),
+                         len, data);
+    return;
+  }
+
+  if (len < 1) {
+    vlog.error("fence response with no payload");
+    return;
+  }
+
+  switch (data[0]) {
+  case fenceTypeHello:
+    break;
+  case fenceTypeRTT:
+    congestion.gotPong();
+    writeFramebufferUpdate();
+    break;
+  default:
+    vlog.error("fence response of unknown type %d", data[0]);
+  }
+}
+
 void VNCSConnectionST::setInitialColourMap()
 {
   setColourMapEntries(0, 0);
@@ -480,6 +635,61 @@ void VNCSConnectionST::supportsLocalCursor()
   }
 }
 
+// supportsFence() tells the client that fences are supported here too, by
+// sending one.
+
+void VNCSConnectionST::supportsFence()
+{
+  char type = fenceTypeHello;
+  writer()->writeFence(fenceFlagRequest, sizeof(type), &type);
+}
+
+// supportsContinuousUpdates() tells the client they are supported by sending
+// EndOfContinuousUpdates.  They are only used if the client also supports
+// fences, since otherwise there is no way to tell how fast to send.
+
+void VNCSConnectionST::supportsContinuousUpdates()
+{
+  if (!cp.supportsFence)
+    return;
+  writer()->writeEndOfContinuousUpdates();
+}
+
+// scaleChange() is called when the client asks to have the framebuffer
+// scaled down by a different factor.  The client has to be told its new
+// size, so scaling is only done for clients which support desktop resize,
+// and by no more than MaxScale.  The whole framebuffer is then sent again.
+
+void VNCSConnectionST::scaleChange()
+{
+  int newScale = cp.scale;
+  if (newScale > rfb::Server::maxScale)
+    newScale = rfb::Server::maxScale;
+  if (!cp.supportsDesktopResize)
+    newScale = 1;
+  if (newScale == scale)
+    return;
+
+  vlog.info("scaling framebuffer down by %d", newScale);
+  scale = newScale;
+  if (scale > 1)
+    scaledPb.setSource(server->pb, scale);
+  PixelBuffer* pb = clientBuffer();
+
+  renderedCursorRect.clear();
+  removeRenderedCursor = false;
+  cuRegion.assign_intersect(pb->getRect());
+
+  cp.width = pb->width();
+  cp.height = pb->height();
+  writer()->writeSetDesktopSize();
+
+  updates.clear();
+  scheduler.clear();
+  updates.add_changed(pb->getRect());
+  image_getter.init(pb, cp.pf(), writer());
+}
+
 void VNCSConnectionST::writeSetCursorCallback()
 {
   rdr::U8* transData = writer()->getImageBuf(server->cursor.area());
@@ -495,19 +705,32 @@ void VNCSConnectionST::writeSetCursorCallback()
 
 void VNCSConnectionST::writeFramebufferUpdate()
 {
+  // With continuous updates the client has in effect always requested its
+  // chosen area.
+  if (continuousUpdates)
+    requested.assign_union(cuRegion);
+
   if (state() != RFBSTATE_NORMAL || requested.is_empty()) return;
 
+  // Leave the changes to accumulate while the client catches up.  The next
+  // returned fence will try again.
+  if (isCongested()) return;
+
   server->checkUpdate();
 
   // If the previous position of the rendered cursor overlaps the source of the
   // copy, then when the copy happens the corresponding rectangle in the
   // destination will be wrong, so add it to the changed region.
 
-  if (!updates.get_copied().is_empty() && !renderedCursorRect.is_empty()) {
-    Rect bogusCopiedCursor = (renderedCursorRect.translate(updates.get_delta())
-                              .intersect(server->pb->getRect()));
-    if (!updates.get_copied().intersect(bogusCopiedCursor).is_empty()) {
-      updates.add_changed(bogusCopiedCursor);
+  if (!renderedCursorRect.is_empty()) {
+    std::list<CopyGroup>::const_iterator g;
+    for (g = updates.get_copies().begin(); g != updates.get_copies().end();
+         g++) {
+      Rect bogusCopiedCursor = (renderedCursorRect.translate(g->delta)
+                                .intersect(clientBuffer()->getRect()));
+      if (!g->region.intersect(bogusCopiedCursor).is_empty()) {
+        updates.add_changed(bogusCopiedCursor);
+      }
     }
   }
 
@@ -532,8 +755,11 @@ void VNCSConnectionST::writeFramebufferUpdate()
 
   if (needRenderedCursor()) {
     renderedCursorRect
-      = (server->renderedCursor.getRect(server->renderedCursorTL)
-         .intersect(requested.get_bounding_rect()));
+      = server->renderedCursor.getRect(server->renderedCursorTL);
+    if (scale > 1)
+      renderedCursorRect = scaledPb.toScaled(renderedCursorRect);
+    renderedCursorRect
+      = renderedCursorRect.intersect(requested.get_bounding_rect());
 
     if (renderedCursorRect.is_empty()) {
       drawRenderedCursor = false;
@@ -551,19 +777,122 @@ void VNCSConnectionST::writeFramebufferUpdate()
     //  updates.subtract(renderedCursorRect);
   }
 
+  // If the client can tell us how fast it receives data, keep each update
+  // small enough to arrive within MaxUpdateTime, sending the changes which
+  // have waited longest first.  The rest wait for the next update, by which
+  // time they may have changed again.
+  Region toSend = requested;
+  unsigned int drainRate = congestion.getDrainRate();
+  if ((cp.supportsFence || drainRate) && rfb::Server::maxUpdateTime > 0) {
+    unsigned int budget = (unsigned int)((double)drainRate *
+                                         rfb::Server::maxUpdateTime / 1000);
+    if (cp.supportsFence && budget < congestion.getWindow())
+      budget = congestion.getWindow();
+    unsigned int queued = sock->outStream().bufferUsage();
+    budget = budget > queued ? budget - queued : 0;
+    Region pending = updates.get_changed().union_(updates.get_copied());
+    pending.assign_intersect(requested);
+    toSend = scheduler.select(pending, budget);
+    adjustQuality(!pending.subtract(toSend).is_empty() ||
+                  scheduler.estimate(toSend) > budget);
+  }
+
   UpdateInfo update;
   updates.enable_copyrect(cp.useCopyRect);
-  updates.getUpdateInfo(&update, requested);
+  updates.getUpdateInfo(&update, toSend);
   if (!update.is_empty() || writer()->needFakeUpdate() || drawRenderedCursor) {
-    int nRects = update.numRects() + (drawRenderedCursor ? 1 : 0);
-    writer()->writeFramebufferUpdateStart(nRects);
-    Region updatedRegion;
-    writer()->writeRects(update, &image_getter, &updatedRegion);
+    unsigned int startOffset = sock->outStream().length();
+    timeval start, end;
+    Timer::getTime(&start);
+    writer()->writeFramebufferUpdateStart();
+    Region updatedRegion, encodedRegion;
+    writer()->writeRects(update, &image_getter, &updatedRegion,
+                         &encodedRegion);
     updates.subtract(updatedRegion);
+
+    // Merged rectangles may have painted over the rendered cursor, even where
+    // it was outside the update, in which case it has to be drawn again.
+    if (needRenderedCursor() &&
+        !updatedRegion.intersect(renderedCursorRect).is_empty())
+      drawRenderedCursor = true;
     if (drawRenderedCursor)
       writeRenderedCursorRect();
     writer()->writeFramebufferUpdateEnd();
+    Timer::getTime(&end);
+
+    // The update only reaches the socket's stream once it is complete
+    scheduler.sent(updatedRegion, sock->outStream().length() - startOffset);
+
+    // The server tracks what was sent in its own coordinates
+    Region encodedSource = encodedRegion;
+    if (scale > 1) {
+      std::vector<Rect> rects;
+      std::vector<Rect>::const_iterator i;
+      encodedRegion.get_rects(&rects);
+      encodedSource.clear();
+      for (i = rects.begin(); i != rects.end(); i++)
+        encodedSource.assign_union(Region(scaledPb.toSource(*i)));
+    }
+    server->sentUpdate(encodedSource,
+                       (end.tv_sec - start.tv_sec) * 1000.0 +
+                       (end.tv_usec - start.tv_usec) / 1000.0);
+
+    // A scaled framebuffer may hold pixels older than the batches in the
+    // pipeline, so only the server's own counts as fresh
+    unsigned int lastBatch = server->batchesSubmitted;
+    if (scale == 1 && lastBatch > server->batchesCollected &&
+        !encodedRegion.is_empty()) {
+      if (!sentDuringBatches.empty() &&
+          sentDuringBatches.back().lastBatch == lastBatch)
+        sentDuringBatches.back().region.assign_union(encodedRegion);
+      else
+        sentDuringBatches.push_back(VNCServerST::SentArea(encodedRegion,
+                                                          lastBatch));
+    }
     requested.clear();
+    if (cp.supportsFence)
+      writeRTTPing();
+    congestion.updateQueue(sock->outStream().length() -
+                           sock->outStream().bufferUsage(),
+                           sock->outStream().bufferUsage());
+  }
+}
+
+bool VNCSConnectionST::isCongested()
+{
+  if (sock->outStream().bufferUsage() > sendQueueLowWatermark)
+    return true;
+  if (!cp.supportsFence)
+    return false;
+  return congestion.isCongested(sock->outStream().length());
+}
+
+void VNCSConnectionST::writeRTTPing()
+{
+  char type = fenceTypeRTT;
+  writer()->writeFence(fenceFlagRequest | fenceFlagBlockBefore,
+                       sizeof(type), &type);
+  congestion.sentPing(sock->outStream().length());
+}
+
+void VNCSConnectionST::adjustQuality(bool behind)
+{
+  // A client which didn't ask for a quality level gets the best
+  int clientLevel = cp.qualityLevel >= 0 ? cp.qualityLevel : 9;
+  int level = writer()->getQualityLevel();
+  if (level < 0)
+    level = clientLevel;
+
+  if (behind && level > 0)
+    level--;
+  else if (!behind)
+    level++;
+
+  if (level >= clientLevel)
+    level = -1;
+  if (level != writer()->getQualityLevel()) {
+    vlog.debug("quality level %d", level);
+    writer()->setQualityLevel(level);
   }
 }
 
@@ -573,10 +902,22 @@ void VNCSConnectionST::writeFramebufferUpdate()
 
 void VNCSConnectionST::writeRenderedCursorRect()
 {
+  Rect actual;
+
+  // When scaling, the cursor is drawn over the server's framebuffer before
+  // it is scaled down, and taken away again afterwards.
+
+  if (scale > 1) {
+    scaledPb.setOverlay(&server->renderedCursor, server->renderedCursorTL);
+    writer()->writeRect(renderedCursorRect, &image_getter, &actual);
+    scaledPb.setOverlay(0, Point(0,0));
+    drawRenderedCursor = false;
+    return;
+  }
+
   image_getter.setPixelBuffer(&server->renderedCursor);
   image_getter.setOffset(server->renderedCursorTL);
 
-  Rect actual;
   writer()->writeRect(renderedCursorRect, &image_getter, &actual);
 
   image_getter.setPixelBuffer(server->pb);
@@ -593,7 +934,7 @@ void VNCSConnectionST::setColourMapEntries(int firstColour, int nColours)
   image_getter.setColourMapEntries(firstColour, nColours, writer());
 
   if (cp.pf().trueColour) {
-    updates.add_changed(server->pb->getRect());
+    updates.add_changed(clientBuffer()->getRect());
   }
 }
 
@@ -29,7 +29,11 @@
 #include <set>
 #include <rfb/SConnection.h>
 #include <rfb/SMsgWriter.h>
+#include <rfb/Congestion.h>
+#include <rfb/UpdateScheduler.h>
+#include <rfb/fenceTypes.h>
 #include <rfb/TransImageGetter.h>
+#include <rfb/ScaledPixelBuffer.h>
 #include <rfb/VNCServerST.h>
 
 namespace rfb {
@@ -72,6 +76,11 @@ namespace rfb {
     // zero is returned.  Zero is also returned if there is no idle timeout.
     int checkIdleTimeout();
 
+    // flushSocket() writes as much queued output to the socket as it will
+    // take, and once enough has been written, sends any changes held back
+    // meanwhile.  It returns true if output is still queued.
+    bool flushSocket();
+
     // The following methods never throw exceptions nor do they ever delete the
     // SConnectionST object.
 
@@ -87,12 +96,28 @@ namespace rfb {
     bool needRenderedCursor();
 
     network::Socket* getSock() { return sock; }
-    bool readyForUpdate() { return !requested.is_empty(); }
-    void add_changed(const Region& region) { updates.add_changed(region); }
-    void add_copied(const Region& dest, const Point& delta) {
-      updates.add_copied(dest, delta);
+
+    // getBaseRTT() returns the shortest round-trip time seen to the client,
+    // or zero if the client cannot measure it.
+    int getBaseRTT() {
+      return cp.supportsFence ? congestion.getBaseRTT() : 0;
+    }
+
+    bool readyForUpdate() {
+      return continuousUpdates || !requested.is_empty();
     }
 
+    // add_changed() and add_copied() take regions of the server's
+    // framebuffer, which are scaled to match the client's if need be.
+    void add_changed(const Region& region);
+    void add_copied(const Region& dest, const Point& delta);
+
+    // add_batch() adds a batch of changes collected from the server's update
+    // pipeline, given its number.  Changed areas which the client has been
+    // sent since the batch was submitted are left out, since the pixels it
+    // was sent are at least as new as the batch's.
+    void add_batch(const SimpleUpdateTracker& batch, unsigned int number);
+
     const char* getPeerEndpoint() const {return peerEndpoint.buf;}
 
     // approveConnectionOrClose() is called some time after
@@ -118,8 +143,13 @@ namespace rfb {
     virtual void keyEvent(rdr::U32 key, bool down);
     virtual void clientCutText(const char* str, int len);
     virtual void framebufferUpdateRequest(const Rect& r, bool incremental);
+    virtual void enableContinuousUpdates(bool enable, const Rect& r);
+    virtual void fence(rdr::U32 flags, int len, const char* data);
     virtual void setInitialColourMap();
     virtual void supportsLocalCursor();
+    virtual void supportsFence();
+    virtual void supportsContinuousUpdates();
+    virtual void scaleChange();
 
     // setAccessRights() allows a security package to limit the access rights
     // of a VNCSConnectioST to the server.  These access rights are applied
@@ -137,20 +167,54 @@ namespace rfb {
 
     void writeFramebufferUpdate();
 
+    // isCongested() returns true if the last update is still mostly queued
+    // to be written to the socket, or if the client hasn't yet processed
+    // enough of the updates already sent for another to be worth sending.
+    // writeRTTPing() sends the fence used to measure the latter.
+    bool isCongested();
+    void writeRTTPing();
+
+    // adjustQuality() lowers the quality of lossy encodings a step while
+    // updates leave changes behind or overrun the client's budget, and raises
+    // it back towards the client's own a step at a time once they don't.
+    void adjustQuality(bool behind);
+
     void writeRenderedCursorRect();
     void setColourMapEntries(int firstColour, int nColours);
     void setCursor();
     void setSocketTimeouts();
 
+    // clientBuffer() returns the framebuffer as the client sees it, which is
+    // the server's own unless it is being scaled down.
+    PixelBuffer* clientBuffer() {
+      return scale > 1 ? &scaledPb : server->pb;
+    }
+
     network::Socket* sock;
     CharArray peerEndpoint;
     VNCServerST* server;
     SimpleUpdateTracker updates;
     TransImageGetter image_getter;
+    ScaledPixelBuffer scaledPb;
+    int scale;
     Region requested;
     bool drawRenderedCursor, removeRenderedCursor;
     Rect renderedCursorRect;
 
+    // The areas sent while batches were in the server's update pipeline,
+    // tagged with the last batch submitted at the time
+    std::list<VNCServerST::SentArea> sentDuringBatches;
+
+    bool continuousUpdates;
+    Region cuRegion;
+    Congestion congestion;
+    UpdateScheduler scheduler;
+
+    bool pendingSyncFence, syncFence;
+    rdr::U32 fenceFlags;
+    int fenceDataLen;
+    char fenceData[fenceMaxDataLen];
+
     std::set<rdr::U32> pressedKeys;
 
     time_t lastEventTime;
@@ -50,7 +50,8 @@
 #include <rfb/ServerCore.h>
 #include <rfb/VNCServerST.h>
 #include <rfb/VNCSConnectionST.h>
-#include <rfb/ComparingUpdateTracker.h>
+#include <rfb/UpdatePipeline.h>
+#include <rfb/TileUpdateTracker.h>
 #include <rfb/SSecurityFactoryStandard.h>
 #include <rfb/KeyRemapper.h>
 #include <rfb/util.h>
@@ -63,6 +64,11 @@ static LogWriter slog("VNCServerST");
 LogWriter VNCServerST::connectionsLog("Connections");
 static SSecurityFactoryStandard defaultSecurityFactory;
 
+// How often checkTimeouts() should be called while output is queued, and
+// while changes are being compared by the pipeline
+static const int sendQueuePollTime = 50;
+static const int pipelinePollTime = 2;
+
 //
 // -=- VNCServerST Implementation
 //
@@ -72,8 +78,10 @@ static SSecurityFactoryStandard defaultSecurityFactory;
 VNCServerST::VNCServerST(const char* name_, SDesktop* desktop_,
                          SSecurityFactory* sf)
   : blHosts(&blacklist), desktop(desktop_), desktopStarted(false), pb(0),
-    name(strDup(name_)), pointerClient(0), comparer(0),
-    renderedCursorInvalid(false),
+    name(strDup(name_)), pointerClient(0), pipeline(0),
+    changedTiles(0), batchesSubmitted(0), batchesCollected(0),
+    renderedCursorInvalid(false), deferTimer(this), deferPending(false),
+    updateCost(0), deferredChanges(0), deferredUpdates(0), deferredTime(0),
     securityFactory(sf ? sf : &defaultSecurityFactory),
     queryConnectionHandler(0), keyRemapper(&KeyRemapper::defInstance),
     useEconomicTranslate(false)
@@ -100,7 +108,15 @@ VNCServerST::~VNCServerST()
     desktop->stop();
   }
 
-  delete comparer;
+  delete pipeline;
+  delete changedTiles;
+
+  if (deferredUpdates) {
+    slog.info("deferred updates: %u changes sent as %u updates, "
+              "%.1f per update, average wait %.1fms", deferredChanges,
+              deferredUpdates, (double)deferredChanges / deferredUpdates,
+              deferredTime / deferredUpdates);
+  }
 }
 
 
@@ -162,6 +178,19 @@ void VNCServerST::processSocketEvent(network::Socket* sock)
   throw rdr::Exception("invalid Socket in VNCServerST");
 }
 
+void VNCServerST::processSocketWriteEvent(network::Socket* sock)
+{
+  std::list<VNCSConnectionST*>::iterator ci;
+  for (ci = clients.begin(); ci != clients.end(); ci++) {
+    if ((*ci)->getSock() == sock) {
+      (*ci)->flushSocket();
+      return;
+    }
+  }
+  // Sockets refused in addSocket() just need flushing
+  sock->outStream().flush();
+}
+
 int VNCServerST::checkTimeouts()
 {
   int timeout = 0;
@@ -169,6 +198,15 @@ int VNCServerST::checkTimeouts()
   for (ci=clients.begin();ci!=clients.end();ci=ci_next) {
     ci_next = ci; ci_next++;
     soonestTimeout(&timeout, (*ci)->checkIdleTimeout());
+    if ((*ci)->flushSocket())
+      soonestTimeout(&timeout, sendQueuePollTime);
+  }
+
+  if (pipeline && pipeline->busy()) {
+    if (collectUpdates())
+      tryUpdate();
+    if (pipeline->busy())
+      soonestTimeout(&timeout, pipelinePollTime);
   }
   return timeout;
 }
@@ -179,13 +217,24 @@ int VNCServerST::checkTimeouts()
 void VNCServerST::setPixelBuffer(PixelBuffer* pb_)
 {
   pb = pb_;
-  delete comparer;
-  comparer = 0;
+  delete pipeline;
+  pipeline = 0;
+  delete changedTiles;
+  changedTiles = 0;
+  changes.clear();
+  sentEarly.clear();
+  batchesSubmitted = batchesCollected = 0;
 
   if (pb) {
-    comparer = new ComparingUpdateTracker(pb);
+    pipeline = new UpdatePipeline(pb, rfb::Server::updatePipeline);
+    changes.add_changed(pb->getRect());
+    if (rfb::Server::changeTileSize > 0)
+      changedTiles = new TileUpdateTracker(pb->getRect(),
+                                           rfb::Server::changeTileSize);
     cursor.setPF(pb->getPF());
     renderedCursor.setPF(pb->getPF());
+    renderedCursor.setSize(0, 0);
+    renderedCursor.setCursor(&cursor);
 
     std::list<VNCSConnectionST*>::iterator ci, ci_next;
     for (ci=clients.begin();ci!=clients.end();ci=ci_next) {
@@ -227,12 +276,19 @@ void VNCServerST::serverCutText(const char* str, int len)
 
 void VNCServerST::add_changed(const Region& region)
 {
-  comparer->add_changed(region);
+  deferUpdate();
+  if (changedTiles)
+    changedTiles->add_changed(region);
+  else
+    changes.add_changed(region);
 }
 
 void VNCServerST::add_copied(const Region& dest, const Point& delta)
 {
-  comparer->add_copied(dest, delta);
+  // Changes made before the copy must be gathered first
+  flushChangedTiles();
+  changes.add_copied(dest, delta);
+  deferUpdate();
 }
 
 bool VNCServerST::clientsReadyForUpdate()
@@ -247,6 +303,10 @@ bool VNCServerST::clientsReadyForUpdate()
 
 void VNCServerST::tryUpdate()
 {
+  // The changes will be sent when the defer timer goes off
+  if (deferPending)
+    return;
+
   std::list<VNCSConnectionST*>::iterator ci, ci_next;
   for (ci = clients.begin(); ci != clients.end(); ci = ci_next) {
     ci_next = ci; ci_next++;
@@ -264,6 +324,7 @@ void VNCServerST::setCursor(int width, int height, const Point& newHotspot,
 
   cursor.crop();
 
+  renderedCursor.setCursor(&cursor);
   renderedCursorInvalid = true;
 
   std::list<VNCSConnectionST*>::iterator ci, ci_next;
@@ -285,6 +346,34 @@ void VNCServerST::setCursorPos(const Point& pos)
   }
 }
 
+// Timer::Callback methods
+
+bool VNCServerST::handleTimeout(Timer* t)
+{
+  if (t != &deferTimer)
+    return false;
+
+  deferredUpdates++;
+  deferredTime += Timer::msSince(deferStart);
+  deferPending = false;
+
+  // Pass the changes on to every client now, even those not ready for an
+  // update, so that they are not held up by the next batch when they are.
+  // Note how long this takes, for deferTime().
+  timeval start, end;
+  Timer::getTime(&start);
+  if (pipeline)
+    checkUpdate();
+  tryUpdate();
+  Timer::getTime(&end);
+  double cost = ((end.tv_sec - start.tv_sec) * 1000.0 +
+                 (end.tv_usec - start.tv_usec) / 1000.0);
+  updateCost += (cost - updateCost) / 8;
+
+  return false;
+}
+
+
 // Other public methods
 
 void VNCServerST::approveConnection(network::Socket* sock, bool accept,
@@ -363,57 +452,195 @@ inline bool VNCServerST::needRenderedCursor()
   return false;
 }
 
-// checkUpdate() is called just before sending an update.  It checks to see
-// what updates are pending and propagates them to the update tracker for each
-// client.  It uses the ComparingUpdateTracker's compare() method to filter out
-// areas of the screen which haven't actually changed.  It also checks the
-// state of the (server-side) rendered cursor, if necessary rendering it again
-// with the correct background.
+// checkUpdate() is called just before sending an update.  It submits the
+// pending changes to the UpdatePipeline, which filters out areas of the
+// screen which haven't actually changed, and propagates any it has finished
+// with to the update tracker for each client.
 
 void VNCServerST::checkUpdate()
 {
+  // Leave the changes to gather until the defer timer goes off
+  if (!deferPending)
+    submitUpdate();
+
+  collectUpdates();
+}
+
+// submitUpdate() grabs the changed areas of the framebuffer and submits them
+// to the pipeline, unless it is full, in which case they wait for the next
+// call.  It also checks the state of the (server-side) rendered cursor, if
+// necessary rendering it again with the correct background.
+
+void VNCServerST::submitUpdate()
+{
+  flushChangedTiles();
+
   bool renderCursor = needRenderedCursor();
+  bool submit = !changes.is_empty() && !pipeline->full();
 
-  if (comparer->is_empty() && !(renderCursor && renderedCursorInvalid))
+  if (!submit && !(renderCursor && renderedCursorInvalid))
     return;
 
-  Region toCheck = comparer->get_changed().union_(comparer->get_copied());
+  Region pending = changes.get_changed().union_(changes.get_copied());
+  Region toCheck;
+  if (submit)
+    toCheck = pending;
 
+  Rect clippedCursorRect;
   if (renderCursor) {
-    Rect clippedCursorRect
-      = cursor.getRect(cursorTL()).intersect(pb->getRect());
+    clippedCursorRect = cursor.getRect(cursorTL()).intersect(pb->getRect());
 
     if (!renderedCursorInvalid && (toCheck.intersect(clippedCursorRect)
                                    .is_empty())) {
       renderCursor = false;
     } else {
-      renderedCursorTL = clippedCursorRect.tl;
-      renderedCursor.setSize(clippedCursorRect.width(),
-                             clippedCursorRect.height());
-      toCheck.assign_union(clippedCursorRect);
+      // The framebuffer is up to date where the cursor was last drawn,
+      // apart from any changes since, so only the rest needs grabbing
+      Region toGrab(clippedCursorRect);
+      toGrab.assign_subtract(renderedCursor.getRect(renderedCursorTL));
+      toGrab.assign_union(pending.intersect(clippedCursorRect));
+      toCheck.assign_union(toGrab);
     }
   }
 
-  pb->grabRegion(toCheck);
+  pipeline->capture(toCheck);
 
-  if (rfb::Server::compareFB)
-    comparer->compare();
+  if (submit) {
+    pipeline->submit(&changes);
+    batchesSubmitted++;
+  }
 
   if (renderCursor) {
-    pb->getImage(renderedCursor.data,
-                 renderedCursor.getRect(renderedCursorTL));
-    renderedCursor.maskRect(cursor.getRect(cursorTL()
-                                           .subtract(renderedCursorTL)),
-                            cursor.data, cursor.mask.buf);
+    renderedCursorTL = clippedCursorRect.tl;
+    renderedCursor.render(pb, cursorTL(), clippedCursorRect);
     renderedCursorInvalid = false;
   }
+}
 
-  std::list<VNCSConnectionST*>::iterator ci, ci_next;
-  for (ci = clients.begin(); ci != clients.end(); ci = ci_next) {
-    ci_next = ci; ci_next++;
-    (*ci)->add_copied(comparer->get_copied(), comparer->get_delta());
-    (*ci)->add_changed(comparer->get_changed());
+// collectUpdates() passes the changes from any batches the pipeline has
+// finished comparing on to the clients, returning false if there were none.
+
+bool VNCServerST::collectUpdates()
+{
+  SimpleUpdateTracker batch;
+  bool collected = false;
+  while (pipeline->collect(&batch)) {
+    demoteStaleCopies(&batch, ++batchesCollected);
+    std::list<VNCSConnectionST*>::iterator ci;
+    for (ci = clients.begin(); ci != clients.end(); ci++)
+      (*ci)->add_batch(batch, batchesCollected);
+    batch.clear();
+    collected = true;
+  }
+  return collected;
+}
+
+// demoteStaleCopies() turns the copies in a batch into changes wherever
+// their source was sent to clients while the batch was on its way to them,
+// and then forgets the areas which can affect no later batch.
+
+void VNCServerST::demoteStaleCopies(SimpleUpdateTracker* batch,
+                                    unsigned int number)
+{
+  Region sent;
+  std::list<SentArea>::const_iterator s;
+  for (s = sentEarly.begin(); s != sentEarly.end(); s++) {
+    if (s->lastBatch >= number)
+      sent.assign_union(s->region);
+  }
+  while (!sentEarly.empty() && sentEarly.front().lastBatch <= number)
+    sentEarly.pop_front();
+  if (sent.is_empty())
+    return;
+
+  SimpleUpdateTracker checked;
+  std::list<CopyGroup>::const_iterator g;
+  for (g = batch->get_copies().begin(); g != batch->get_copies().end(); g++) {
+    Region stale = sent;
+    stale.translate(g->delta);
+    stale.assign_intersect(g->region);
+    checked.add_copied(g->region.subtract(stale), g->delta);
+    checked.add_changed(stale);
+  }
+  checked.add_changed(batch->get_changed());
+  batch->clear();
+  checked.copyTo(batch);
+}
+
+// sentUpdate() is called by each client when it has sent an update, with
+// the area whose pixels were read from the framebuffer.
+
+void VNCServerST::sentUpdate(const Region& encoded, double ms)
+{
+  pipeline->sent(ms);
+
+  // The update can affect the batches still in the pipeline, and the next
+  // one too if copies are already waiting to go into it
+  unsigned int lastBatch = batchesSubmitted;
+  if (!changes.get_copied().is_empty())
+    lastBatch++;
+  if (lastBatch <= batchesCollected || encoded.is_empty())
+    return;
+  if (!sentEarly.empty() && sentEarly.back().lastBatch == lastBatch)
+    sentEarly.back().region.assign_union(encoded);
+  else
+    sentEarly.push_back(SentArea(encoded, lastBatch));
+}
+
+// flushChangedTiles() passes changes recorded in the tile grid, if there is
+// one, on to the other pending changes.
+
+void VNCServerST::flushChangedTiles()
+{
+  if (!changedTiles || changedTiles->is_empty())
+    return;
+  changes.add_changed(changedTiles->get_changed());
+  changedTiles->clear();
+}
+
+// deferUpdate() is called for each change to the framebuffer.  The first
+// change starts the defer timer, and the rest are gathered up with it.
+
+void VNCServerST::deferUpdate()
+{
+  if (rfb::Server::deferUpdateTime <= 0)
+    return;
+
+  deferredChanges++;
+  if (deferPending)
+    return;
+
+  deferPending = true;
+  Timer::getTime(&deferStart);
+  deferTimer.start(deferTime());
+}
+
+// deferTime() returns how long to gather changes for.  Waiting costs little
+// next to a long round trip, so when every client is far away the wait grows
+// towards a quarter of the shortest round-trip time.  It also grows to match
+// the time taken to prepare recent updates, so that a busy server spends no
+// more than about half its time on them.  Neither takes it past four times
+// DeferUpdate.
+
+int VNCServerST::deferTime()
+{
+  int defer = rfb::Server::deferUpdateTime;
+  int limit = defer * 4;
+
+  int rtt = -1;
+  std::list<VNCSConnectionST*>::iterator ci;
+  for (ci = clients.begin(); ci != clients.end(); ci++) {
+    if (!(*ci)->authenticated())
+      continue;
+    int clientRTT = (*ci)->getBaseRTT();
+    if (rtt < 0 || clientRTT < rtt)
+      rtt = clientRTT;
   }
 
-  comparer->clear();
+  if (rtt / 4 > defer)
+    defer = rtt / 4;
+  if (updateCost > defer)
+    defer = (int)updateCost;
+
+  return __rfbmin(defer, limit);
 }
@@ -31,16 +31,20 @@
 #include <rfb/LogWriter.h>
 #include <rfb/Blacklist.h>
 #include <rfb/Cursor.h>
+#include <rfb/Timer.h>
+#include <rfb/UpdateTracker.h>
 #include <network/Socket.h>
 
 namespace rfb {
 
   class VNCSConnectionST;
-  class ComparingUpdateTracker;
+  class UpdatePipeline;
+  class TileUpdateTracker;
   class PixelBuffer;
   class KeyRemapper;
 
-  class VNCServerST : public VNCServer, public network::SocketServer {
+  class VNCServerST : public VNCServer, public Timer::Callback,
+                      public network::SocketServer {
   public:
     // -=- Constructors
 
@@ -67,10 +71,19 @@ namespace rfb {
     //   removeSocket() to be called by the caller at a later time.
     virtual void processSocketEvent(network::Socket* sock);
 
+    // processSocketWriteEvent
+    //   Write queued output to the Socket, and send the client any changes
+    //   which were held back while it was queued.
+    virtual void processSocketWriteEvent(network::Socket* sock);
+
     // checkTimeouts
     //   Returns the number of milliseconds left until the next idle timeout
     //   expires.  If any have already expired, the corresponding connections
-    //   are closed.  Zero is returned if there is no idle timeout.
+    //   are closed.  Zero is returned if there is no idle timeout.  Queued
+    //   output is also written here, in case the caller does not report
+    //   write events, and if any remains a short timeout is returned.
+    //   Likewise, changes which have been compared by the UpdatePipeline
+    //   are sent here, and a short timeout returned while any are left.
     virtual int checkTimeouts();
 
 
@@ -90,6 +103,13 @@ namespace rfb {
 
     virtual void bell();
 
+    // Methods overridden from Timer::Callback
+
+    // handleTimeout
+    //   Called when the changes gathered while updates were deferred are
+    //   due to be sent.
+    virtual bool handleTimeout(Timer* t);
+
     // - Close all currently-connected clients, by calling
     //   their close() method with the supplied reason.
     virtual void closeClients(const char* reason) {closeClients(reason, 0);}
@@ -200,13 +220,31 @@ namespace rfb {
     VNCSConnectionST* pointerClient;
     std::list<network::Socket*> closingSockets;
 
-    ComparingUpdateTracker* comparer;
+    // Changes are gathered here before being passed through the pipeline
+    SimpleUpdateTracker changes;
+    UpdatePipeline* pipeline;
+    TileUpdateTracker* changedTiles;
+
+    // The areas clients have been sent while changes were on their way to
+    // them.  A copy made before then may have moved pixels which clients
+    // were sent afterwards, so where its source was sent it is treated as
+    // changed instead.  Each area is tagged with the last batch it can
+    // affect, and dropped once that batch has been collected.  Batches are
+    // numbered from 1 in the order they are submitted.
+    struct SentArea {
+      SentArea(const Region& r, unsigned int b) : region(r), lastBatch(b) {}
+      Region region;
+      unsigned int lastBatch;
+    };
+    std::list<SentArea> sentEarly;
+    unsigned int batchesSubmitted;
+    unsigned int batchesCollected;
 
     Point cursorPos;
     Cursor cursor;
     Point cursorTL() { return cursorPos.subtract(cursor.hotspot); }
     Point renderedCursorTL;
-    ManagedPixelBuffer renderedCursor;
+    RenderedCursor renderedCursor;
     bool renderedCursorInvalid;
 
     // - Check how many of the clients are authenticated.
@@ -214,6 +252,24 @@ namespace rfb {
 
     bool needRenderedCursor();
     void checkUpdate();
+    void submitUpdate();
+    bool collectUpdates();
+    void demoteStaleCopies(SimpleUpdateTracker* batch, unsigned int number);
+    void sentUpdate(const Region& encoded, double ms);
+    void flushChangedTiles();
+
+    // Deferred updates.  Changes are gathered for deferTime() milliseconds
+    // after the first, during which checkUpdate() leaves them where they
+    // are.  The counts are logged when the server is destroyed.
+    void deferUpdate();
+    int deferTime();
+    Timer deferTimer;
+    bool deferPending;
+    timeval deferStart;
+    double updateCost;
+    unsigned int deferredChanges;
+    unsigned int deferredUpdates;
+    double deferredTime;
 
     SSecurityFactory* securityFactory;
     QueryConnectionHandler* queryConnectionHandler;
@@ -42,24 +42,37 @@ using namespace rfb;
 
 Decoder* ZRLEDecoder::create(CMsgReader* reader)
 {
-  return new ZRLEDecoder(reader);
+  return new ZRLEDecoder(reader, false);
 }
 
-ZRLEDecoder::ZRLEDecoder(CMsgReader* reader_) : reader(reader_)
+Decoder* ZRLEDecoder::createZYWRLE(CMsgReader* reader)
 {
+  return new ZRLEDecoder(reader, true);
+}
+
+ZRLEDecoder::ZRLEDecoder(CMsgReader* reader_, bool zywrle_)
+  : reader(reader_), zywrle(0)
+{
+  if (zywrle_)
+    zywrle = new Zywrle;
 }
 
 ZRLEDecoder::~ZRLEDecoder()
 {
+  delete zywrle;
 }
 
 void ZRLEDecoder::readRect(const Rect& r, CMsgHandler* handler)
 {
   rdr::InStream* is = reader->getInStream();
   rdr::U8* buf = reader->getImageBuf(64 * 64 * 4);
+  if (zywrle) {
+    zywrle->setPF(handler->cp.pf());
+    zywrle->setLevel(Zywrle::levelForQuality(handler->cp.qualityLevel));
+  }
   switch (reader->bpp()) {
-  case 8:  zrleDecode8 (r, is, &zis, (rdr::U8*) buf, handler); break;
-  case 16: zrleDecode16(r, is, &zis, (rdr::U16*)buf, handler); break;
+  case 8:  zrleDecode8 (r, is, &zis, (rdr::U8*) buf, zywrle, handler); break;
+  case 16: zrleDecode16(r, is, &zis, (rdr::U16*)buf, zywrle, handler); break;
   case 32:
     {
       const rfb::PixelFormat& pf = handler->cp.pf();
@@ -74,16 +87,16 @@ void ZRLEDecoder::readRect(const Rect& r, CMsgHandler* handler)
       if ((fitsInLS3Bytes && !pf.bigEndian) ||
           (fitsInMS3Bytes && pf.bigEndian))
       {
-        zrleDecode24A(r, is, &zis, (rdr::U32*)buf, handler);
+        zrleDecode24A(r, is, &zis, (rdr::U32*)buf, zywrle, handler);
       }
       else if ((fitsInLS3Bytes && pf.bigEndian) ||
                (fitsInMS3Bytes && !pf.bigEndian))
       {
-        zrleDecode24B(r, is, &zis, (rdr::U32*)buf, handler);
+        zrleDecode24B(r, is, &zis, (rdr::U32*)buf, zywrle, handler);
       }
       else
       {
-        zrleDecode32(r, is, &zis, (rdr::U32*)buf, handler);
+        zrleDecode32(r, is, &zis, (rdr::U32*)buf, zywrle, handler);
       }
       break;
     }
@@ -20,17 +20,20 @@
 
 #include <rdr/ZlibInStream.h>
 #include <rfb/Decoder.h>
+#include <rfb/Zywrle.h>
 
 namespace rfb {
 
   class ZRLEDecoder : public Decoder {
   public:
     static Decoder* create(CMsgReader* reader);
+    static Decoder* createZYWRLE(CMsgReader* reader);
     virtual void readRect(const Rect& r, CMsgHandler* handler);
     virtual ~ZRLEDecoder();
   private:
-    ZRLEDecoder(CMsgReader* reader);
+    ZRLEDecoder(CMsgReader* reader, bool zywrle);
     CMsgReader* reader;
+    Zywrle* zywrle;
     rdr::ZlibInStream zis;
   };
 }
@@ -33,6 +33,7 @@ IntParameter zlibLevel("ZlibLevel","Zlib compression level",-1);
 
 #define EXTRA_ARGS ImageGetter* ig
 #define GET_IMAGE_INTO_BUF(r,buf) ig->getImage(buf, r);
+#define GET_PIXELS_R(r,stride) ig->getPixelsR(r, stride)
 #define BPP 8
 #include <rfb/zrleEncode.h>
 #undef BPP
@@ -51,12 +52,19 @@ IntParameter zlibLevel("ZlibLevel","Zlib compression level",-1);
 
 Encoder* ZRLEEncoder::create(SMsgWriter* writer)
 {
-  return new ZRLEEncoder(writer);
+  return new ZRLEEncoder(writer, false);
 }
 
-ZRLEEncoder::ZRLEEncoder(SMsgWriter* writer_)
-  : writer(writer_), zos(0,0,zlibLevel)
+Encoder* ZRLEEncoder::createZYWRLE(SMsgWriter* writer)
 {
+  return new ZRLEEncoder(writer, true);
+}
+
+ZRLEEncoder::ZRLEEncoder(SMsgWriter* writer_, bool zywrle_)
+  : writer(writer_), zywrle(0), zos(0,0,zlibLevel)
+{
+  if (zywrle_)
+    zywrle = new Zywrle;
   if (sharedMos)
     mos = sharedMos;
   else
@@ -67,6 +75,20 @@ ZRLEEncoder::~ZRLEEncoder()
 {
   if (!sharedMos)
     delete mos;
+  delete zywrle;
+}
+
+// ZRLE can expand incompressible pixels slightly, so leave some room below
+// maxLen.
+
+int ZRLEEncoder::maxRectBytes()
+{
+  return maxLen - maxLen / 16;
+}
+
+bool ZRLEEncoder::lossy()
+{
+  return zywrle != 0;
 }
 
 bool ZRLEEncoder::writeRect(const Rect& r, ImageGetter* ig, Rect* actual)
@@ -76,12 +98,26 @@ bool ZRLEEncoder::writeRect(const Rect& r, ImageGetter* ig, Rect* actual)
   bool wroteAll = true;
   *actual = r;
 
+  // The wavelet level follows the client's quality level, since the decoder
+  // works it out the same way, but the quantisation can be set by the server.
+  if (zywrle) {
+    ConnParams* cp = writer->getConnParams();
+    zywrle->setPF(cp->pf());
+    zywrle->setLevel(Zywrle::levelForQuality(cp->qualityLevel));
+    if (writer->getQualityLevel() >= 0)
+      zywrle->setQualityLevel(writer->getQualityLevel());
+    else
+      zywrle->setQualityLevel(cp->qualityLevel);
+  }
+
   switch (writer->bpp()) {
   case 8:
-    wroteAll = zrleEncode8(r, mos, &zos, imageBuf, maxLen, actual, ig);
+    wroteAll = zrleEncode8(r, mos, &zos, imageBuf, maxLen, actual,
+                           zywrle, ig);
     break;
   case 16:
-    wroteAll = zrleEncode16(r, mos, &zos, imageBuf, maxLen, actual, ig);
+    wroteAll = zrleEncode16(r, mos, &zos, imageBuf, maxLen, actual,
+                            zywrle, ig);
     break;
   case 32:
     {
@@ -98,22 +134,25 @@ bool ZRLEEncoder::writeRect(const Rect& r, ImageGetter* ig, Rect* actual)
       if ((fitsInLS3Bytes && !pf.bigEndian) ||
           (fitsInMS3Bytes && pf.bigEndian))
       {
-        wroteAll = zrleEncode24A(r, mos, &zos, imageBuf, maxLen, actual, ig);
+        wroteAll = zrleEncode24A(r, mos, &zos, imageBuf, maxLen, actual,
+                                 zywrle, ig);
       }
       else if ((fitsInLS3Bytes && pf.bigEndian) ||
                (fitsInMS3Bytes && !pf.bigEndian))
       {
-        wroteAll = zrleEncode24B(r, mos, &zos, imageBuf, maxLen, actual, ig);
+        wroteAll = zrleEncode24B(r, mos, &zos, imageBuf, maxLen, actual,
+                                 zywrle, ig);
       }
       else
       {
-        wroteAll = zrleEncode32(r, mos, &zos, imageBuf, maxLen, actual, ig);
+        wroteAll = zrleEncode32(r, mos, &zos, imageBuf, maxLen, actual,
+                                zywrle, ig);
       }
       break;
     }
   }
 
-  writer->startRect(*actual, encodingZRLE);
+  writer->startRect(*actual, zywrle ? encodingZYWRLE : encodingZRLE);
   rdr::OutStream* os = writer->getOutStream();
   os->writeU32(mos->length());
   os->writeBytes(mos->data(), mos->length());
@@ -21,13 +21,17 @@
 #include <rdr/MemOutStream.h>
 #include <rdr/ZlibOutStream.h>
 #include <rfb/Encoder.h>
+#include <rfb/Zywrle.h>
 
 namespace rfb {
 
   class ZRLEEncoder : public Encoder {
   public:
     static Encoder* create(SMsgWriter* writer);
+    static Encoder* createZYWRLE(SMsgWriter* writer);
     virtual bool writeRect(const Rect& r, ImageGetter* ig, Rect* actual);
+    virtual int maxRectBytes();
+    virtual bool lossy();
     virtual ~ZRLEEncoder();
 
     // setMaxLen() sets the maximum size in bytes of any ZRLE rectangle.  This
@@ -43,8 +47,9 @@ namespace rfb {
     static void setSharedMos(rdr::MemOutStream* mos_) { sharedMos = mos_; }
 
   private:
-    ZRLEEncoder(SMsgWriter* writer);
+    ZRLEEncoder(SMsgWriter* writer, bool zywrle);
     SMsgWriter* writer;
+    Zywrle* zywrle;
     rdr::ZlibOutStream zos;
     rdr::MemOutStream* mos;
     static rdr::MemOutStream* sharedMos;
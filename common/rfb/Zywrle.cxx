@@ -0,0 +1,345 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#include <string.h>
+#include <rfb/Zywrle.h>
+
+using namespace rfb;
+
+static rdr::U32 endianTest = 1;
+static bool nativeBigEndian = *(rdr::U8*)(&endianTest) != 1;
+
+// Quantisation masks for the high-frequency coefficients of each wavelet
+// level, indexed by [quantRow][level].  Row 0 keeps the most detail.  Each
+// row n matches what a (n+1)-level transform uses by default.
+
+static const int yQuantMasks[3][3] = {
+  { 0xf0, 0xff, 0xff },
+  { 0xc0, 0xf0, 0xff },
+  { 0xc0, 0xc0, 0xf0 }
+};
+
+static const int uvQuantMasks[3][3] = {
+  { 0x00, 0xf0, 0xff },
+  { 0x00, 0xf0, 0xf0 },
+  { 0x00, 0xc0, 0xf0 }
+};
+
+static int bits(int max)
+{
+  int n = 0;
+  while (max >> n) n++;
+  return n;
+}
+
+static inline rdr::U8 to8(int v, int bits)
+{
+  return bits >= 8 ? v >> (bits - 8) : v << (8 - bits);
+}
+
+static inline int from8(rdr::U8 v, int bits)
+{
+  return bits >= 8 ? v << (bits - 8) : v >> (8 - bits);
+}
+
+static inline int clamp(int v)
+{
+  return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+// quantiseCoeff() rounds a coefficient towards zero to the bits in mask.
+
+static inline rdr::S8 quantiseCoeff(rdr::S8 c, int mask)
+{
+  int v = c;
+  if (v < 0) v += ~mask & 0xff;
+  return (rdr::S8)(v & mask);
+}
+
+// harr() is the piecewise-linear Haar transform of a pair of signed bytes,
+// replacing them with their low and high frequency components.  It is its
+// own inverse.
+
+static inline void harr(rdr::S8* x0p, rdr::S8* x1p)
+{
+  int x0 = *x0p, x1 = *x1p;
+  int orgX0 = x0, orgX1 = x1;
+  if ((x0 ^ x1) & 0x80) {
+    // differing signs
+    x1 += x0;
+    if (((x1 ^ orgX1) & 0x80) == 0)
+      x0 -= x1;                 // |x1| > |x0|
+  } else {
+    // same sign
+    x0 -= x1;
+    if (((x0 ^ orgX0) & 0x80) == 0)
+      x1 += x0;                 // |x0| > |x1|
+  }
+  *x0p = (rdr::S8)x1;
+  *x1p = (rdr::S8)x0;
+}
+
+// waveletLevel() transforms one row or column of n coefficients, step apart,
+// at level l.  The low and high frequency components are interleaved in
+// place rather than separated into a pyramid, so at level l the pairs are
+// 1<<l coefficients apart.
+
+static void waveletLevel(rdr::S8* p, int n, int l, int step)
+{
+  int ofs = (1 << l) * step;
+  int s = (2 << l) * step;
+  rdr::S8* end = p + (n >> (l + 1)) * s;
+  for (; p < end; p += s)
+    harr(p, p + ofs);
+}
+
+
+Zywrle::Zywrle()
+  : supported(false), swap(false), redBits(0), greenBits(0), blueBits(0),
+    yMask(0), uvMask(0), level_(0), quantRow(0)
+{
+}
+
+int Zywrle::levelForQuality(int qualityLevel)
+{
+  if (qualityLevel < 0) return 1;
+  if (qualityLevel < 3) return 3;
+  if (qualityLevel < 6) return 2;
+  return 1;
+}
+
+void Zywrle::setPF(const PixelFormat& pf_)
+{
+  pf = pf_;
+  redBits = bits(pf.redMax);
+  greenBits = bits(pf.greenMax);
+  blueBits = bits(pf.blueMax);
+  supported = (pf.trueColour && pf.bpp != 8 &&
+               redBits && greenBits && blueBits);
+  swap = pf.bigEndian != nativeBigEndian;
+
+  int uvBits = redBits < blueBits ? redBits : blueBits;
+  yMask = (rdr::S8)(0xff << (8 - (greenBits < 8 ? greenBits : 8)));
+  uvMask = (rdr::S8)(0xff << (8 - (uvBits < 8 ? uvBits : 8)));
+
+  if (!supported) level_ = 0;
+}
+
+void Zywrle::setLevel(int level)
+{
+  if (level < 0 || level > 3)
+    level = 3;
+  level_ = supported ? level : 0;
+}
+
+void Zywrle::setQualityLevel(int qualityLevel)
+{
+  if (qualityLevel < 0)
+    quantRow = level_ > 0 ? level_ - 1 : 0;
+  else
+    quantRow = levelForQuality(qualityLevel) - 1;
+}
+
+inline void Zywrle::rgbFromPixel(rdr::U32 p, int* r, int* g, int* b)
+{
+  if (swap) {
+    if (pf.bpp == 16)
+      p = ((p & 0xff) << 8) | ((p >> 8) & 0xff);
+    else
+      p = (((p & 0xff) << 24) | ((p & 0xff00) << 8) |
+           ((p >> 8) & 0xff00) | (p >> 24));
+  }
+  *r = to8((p >> pf.redShift) & pf.redMax, redBits);
+  *g = to8((p >> pf.greenShift) & pf.greenMax, greenBits);
+  *b = to8((p >> pf.blueShift) & pf.blueMax, blueBits);
+}
+
+inline rdr::U32 Zywrle::pixelFromRGB(int r, int g, int b)
+{
+  rdr::U32 p = ((from8(r, redBits) << pf.redShift) |
+                (from8(g, greenBits) << pf.greenShift) |
+                (from8(b, blueBits) << pf.blueShift));
+  if (swap) {
+    if (pf.bpp == 16)
+      p = ((p & 0xff) << 8) | ((p >> 8) & 0xff);
+    else
+      p = (((p & 0xff) << 24) | ((p & 0xff00) << 8) |
+           ((p >> 8) & 0xff00) | (p >> 24));
+  }
+  return p;
+}
+
+void Zywrle::analyse(rdr::U32* buf, int w, int h)
+{
+  int aw = w & ~((1 << level_) - 1);
+  int ah = h & ~((1 << level_) - 1);
+
+  transferEdges(buf, w, h, aw, ah, false);
+
+  for (int y = 0; y < ah; y++) {
+    for (int x = 0; x < aw; x++) {
+      int r, g, b;
+      rgbFromPixel(buf[y * w + x], &r, &g, &b);
+
+      int Y = ((r + (g << 1) + b) >> 2) - 128;
+      int U = (b - g) >> 1;
+      int V = (r - g) >> 1;
+      Y &= yMask;
+      U &= uvMask;
+      V &= uvMask;
+      if (Y == -128) Y -= yMask;
+      if (U == -128) U -= uvMask;
+      if (V == -128) V -= uvMask;
+
+      int i = y * aw + x;
+      coeffs[0][i] = (rdr::S8)Y;
+      coeffs[1][i] = (rdr::S8)U;
+      coeffs[2][i] = (rdr::S8)V;
+    }
+  }
+
+  wavelet(aw, ah);
+  transferCoeffs(buf, aw, ah, true);
+  memcpy(buf + aw * ah, edges, (w * h - aw * ah) * sizeof(rdr::U32));
+}
+
+void Zywrle::synthesise(rdr::U32* buf, int w, int h)
+{
+  int aw = w & ~((1 << level_) - 1);
+  int ah = h & ~((1 << level_) - 1);
+
+  memcpy(edges, buf + aw * ah, (w * h - aw * ah) * sizeof(rdr::U32));
+  transferCoeffs(buf, aw, ah, false);
+  invWavelet(aw, ah);
+
+  for (int y = 0; y < ah; y++) {
+    for (int x = 0; x < aw; x++) {
+      int i = y * aw + x;
+      int Y = coeffs[0][i] + 128;
+      int U = coeffs[1][i] << 1;
+      int V = coeffs[2][i] << 1;
+      int g = Y - ((U + V) >> 2);
+      int b = U + g;
+      int r = V + g;
+      buf[y * w + x] = pixelFromRGB(clamp(r), clamp(g), clamp(b));
+    }
+  }
+
+  transferEdges(buf, w, h, aw, ah, true);
+}
+
+void Zywrle::wavelet(int w, int h)
+{
+  for (int l = 0; l < level_; l++) {
+    for (int c = 0; c < 3; c++) {
+      for (int y = 0; y < h; y += 1 << l)
+        waveletLevel(&coeffs[c][y * w], w, l, 1);
+      for (int x = 0; x < w; x += 1 << l)
+        waveletLevel(&coeffs[c][x], h, l, w);
+    }
+    quantise(w, h, l);
+  }
+}
+
+void Zywrle::invWavelet(int w, int h)
+{
+  for (int l = level_ - 1; l >= 0; l--) {
+    for (int c = 0; c < 3; c++) {
+      for (int x = 0; x < w; x += 1 << l)
+        waveletLevel(&coeffs[c][x], h, l, w);
+      for (int y = 0; y < h; y += 1 << l)
+        waveletLevel(&coeffs[c][y * w], w, l, 1);
+    }
+  }
+}
+
+// quantise() quantises the three high-frequency sub-bands of level l
+
+void Zywrle::quantise(int w, int h, int l)
+{
+  int yq = yQuantMasks[quantRow][l] & yMask;
+  int uvq = uvQuantMasks[quantRow][l] & uvMask;
+  int s = 1 << l;
+
+  for (int band = 1; band < 4; band++) {
+    for (int y = (band & 2) ? s : 0; y < h; y += 2 * s) {
+      for (int x = (band & 1) ? s : 0; x < w; x += 2 * s) {
+        int i = y * w + x;
+        coeffs[0][i] = quantiseCoeff(coeffs[0][i], yq);
+        coeffs[1][i] = quantiseCoeff(coeffs[1][i], uvq);
+        coeffs[2][i] = quantiseCoeff(coeffs[2][i], uvq);
+      }
+    }
+  }
+}
+
+// transferCoeffs() packs the coefficients of an aw x ah area into buf, or
+// unpacks them from it.  Each coefficient becomes a pixel with V, Y and U in
+// the red, green and blue channels.  They are sent a sub-band at a time,
+// highest frequency first, finishing with the lowest frequency sub-band of
+// the last level.
+
+void Zywrle::transferCoeffs(rdr::U32* buf, int aw, int ah, bool pack)
+{
+  rdr::U32* p = buf;
+
+  for (int l = 0; l < level_; l++) {
+    int s = 1 << l;
+    for (int band = 3; band >= (l == level_ - 1 ? 0 : 1); band--) {
+      for (int y = (band & 2) ? s : 0; y < ah; y += 2 * s) {
+        for (int x = (band & 1) ? s : 0; x < aw; x += 2 * s) {
+          int i = y * aw + x;
+          if (pack) {
+            *p++ = pixelFromRGB((rdr::U8)coeffs[2][i], (rdr::U8)coeffs[0][i],
+                                (rdr::U8)coeffs[1][i]);
+          } else {
+            int r, g, b;
+            rgbFromPixel(*p++, &r, &g, &b);
+            coeffs[0][i] = (rdr::S8)g;
+            coeffs[1][i] = (rdr::S8)b;
+            coeffs[2][i] = (rdr::S8)r;
+          }
+        }
+      }
+    }
+  }
+}
+
+// transferEdges() copies the pixels of a w x h tile which lie outside its
+// aw x ah top-left area between the tile and the edges array, in the order in
+// which they are sent: the pixels to the right of the area, then those below
+// it, then the bottom-right corner.
+
+void Zywrle::transferEdges(rdr::U32* buf, int w, int h, int aw, int ah,
+                           bool toTile)
+{
+  const int parts[3][4] = {
+    { aw, 0, w, ah }, { 0, ah, aw, h }, { aw, ah, w, h }
+  };
+  rdr::U32* e = edges;
+
+  for (int n = 0; n < 3; n++) {
+    for (int y = parts[n][1]; y < parts[n][3]; y++) {
+      for (int x = parts[n][0]; x < parts[n][2]; x++) {
+        if (toTile)
+          buf[y * w + x] = *e++;
+        else
+          *e++ = buf[y * w + x];
+      }
+    }
+  }
+}
@@ -0,0 +1,116 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// Zywrle - the wavelet transform used by the ZYWRLE encoding.
+//
+// ZYWRLE is ZRLE with a lossy pre-transform for the tiles which ZRLE would
+// otherwise send raw, typically photographs and video.  This variant is not
+// wire-compatible with the registered ZYWRLE encoding (number 17) used by
+// other VNC implementations, so it has an encoding number of its own (see
+// encodings.h).  When the transform is in use, a raw ZRLE tile (subencoding 0)
+// is immediately followed by a second, ordinary ZRLE tile of the same size
+// holding the tile's wavelet coefficients packed into pixels.  Both ends work
+// out the number of wavelet levels, from 1 to 3, from the quality level
+// pseudo-encoding sent by the client, so the level never appears on the wire.
+//
+// The transform converts RGB to a YUV-like colour space and then applies a
+// piecewise-linear Haar wavelet, which works on signed bytes so that each
+// coefficient fits back into a pixel.  The high-frequency coefficients of
+// each level are quantised, which is where the loss (and the compression)
+// comes from.  The decoder's inverse transform depends on the level but not
+// on the quantisation, so the server may quantise more coarsely than the
+// client's quality level asks, as it does while updates fall behind (see
+// SMsgWriter::setQualityLevel()).  The level itself can't vary that way.
+// Since nothing on the wire says which level a tile used, a client which
+// changes its quality level while ZYWRLE rectangles are in flight will decode
+// them with the wrong level.
+//
+// Only the largest part of a tile which is a multiple of 2^level pixels in
+// each direction is transformed.  The remaining pixels to the right and below
+// it are sent untransformed after the coefficients, so a tile narrower or
+// shorter than 2^level is sent as it is, though still as a nested tile.
+//
+// The pixel data is passed as rdr::U32 values in the pixel format given to
+// setPF(), in the byte order they have in memory.  Colour-mapped pixel
+// formats and 8-bit pixels are not supported; for those level() is always 0
+// and tiles are sent as plain ZRLE.
+//
+
+#ifndef __RFB_ZYWRLE_H__
+#define __RFB_ZYWRLE_H__
+
+#include <rdr/types.h>
+#include <rfb/PixelFormat.h>
+
+namespace rfb {
+
+  class Zywrle {
+  public:
+    Zywrle();
+
+    // levelForQuality() returns the number of wavelet levels to use for the
+    // given quality level, from 0 (lowest quality) to 9, or -1 if the client
+    // did not specify one.
+    static int levelForQuality(int qualityLevel);
+
+    void setPF(const PixelFormat& pf);
+
+    // setLevel() sets the number of wavelet levels, or 0 to disable the
+    // transform.
+    void setLevel(int level);
+    int level() const { return level_; }
+
+    // setQualityLevel() sets how coarsely the encoder quantises the
+    // coefficients, using the same scale as the quality level
+    // pseudo-encoding.  It has no effect on the decoder.
+    void setQualityLevel(int qualityLevel);
+
+    // analyse() replaces the w x h pixels in buf with the packed wavelet
+    // coefficients and untransformed edge pixels, in the order they are sent.
+    // synthesise() does the reverse.  The tile must be at most 64x64 and
+    // level() must not be 0.
+    void analyse(rdr::U32* buf, int w, int h);
+    void synthesise(rdr::U32* buf, int w, int h);
+
+    // pixels is scratch space for converting a tile to rdr::U32 values
+    rdr::U32 pixels[64 * 64];
+
+  private:
+    void rgbFromPixel(rdr::U32 p, int* r, int* g, int* b);
+    rdr::U32 pixelFromRGB(int r, int g, int b);
+    void wavelet(int w, int h);
+    void invWavelet(int w, int h);
+    void quantise(int w, int h, int l);
+    void transferCoeffs(rdr::U32* buf, int w, int h, bool pack);
+    void transferEdges(rdr::U32* buf, int w, int h, int aw, int ah,
+                       bool toTile);
+
+    PixelFormat pf;
+    bool supported;
+    bool swap;
+    int redBits, greenBits, blueBits;
+    int yMask, uvMask;
+
+    int level_;
+    int quantRow;
+
+    rdr::S8 coeffs[3][64 * 64];
+    rdr::U32 edges[64 * 64];
+  };
+}
+#endif
@@ -0,0 +1,169 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// blacklistbench - Blacklist benchmark.
+//
+// Makes connection attempts from generated addresses, and prints one line
+// of comma-separated values per scenario:
+//
+//   scenario,attempts,sources,refused,entries,kbytes,seconds,usPerOp
+//
+// "scan" makes one attempt from each of a number of distinct IPv4
+// addresses, as an internet-wide scanner would, and "scan6" does the same
+// with IPv6 addresses.  "scan24" repeats "scan" with BlacklistPrefix=24, so
+// that hosts are grouped by network - the addresses come from 4096 /24
+// networks.  "bruteforce" makes the same number of attempts from just 1000
+// addresses, and "rated" repeats it with BlacklistRate=60 and a threshold
+// too high to reach, so that only the rate limit refuses attempts.  entries
+// and kbytes show how much of the table was in use at the end.
+//
+// Usage: blacklistbench [-sources N] [Param=value]...
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <rfb/Blacklist.h>
+#include <rfb/Configuration.h>
+
+using namespace rfb;
+
+// Space for each generated address
+static const int nameLen = 48;
+
+class BenchBlacklist : public Blacklist {
+public:
+  int entries() { return tables[0].size() + tables[1].size(); }
+  int kbytes() {
+    return (int)((tables[0].capacity() + tables[1].capacity()) *
+                 sizeof(BlacklistInfo) / 1024);
+  }
+};
+
+// A small xorshift generator, so that every run sees the same addresses
+static rdr::U32 seed;
+static rdr::U32 rnd()
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+// Distinct addresses, from an odd multiplier
+static void makeIPv4(std::vector<char>* names, int n)
+{
+  names->resize(n * nameLen);
+  for (int i = 0; i < n; i++) {
+    rdr::U32 a = (rdr::U32)i * 2654435761U;
+    sprintf(&(*names)[i * nameLen], "%d.%d.%d.%d",
+            a >> 24, (a >> 16) & 0xff, (a >> 8) & 0xff, a & 0xff);
+  }
+}
+
+static void makeIPv4Networks(std::vector<char>* names, int n)
+{
+  names->resize(n * nameLen);
+  for (int i = 0; i < n; i++) {
+    rdr::U32 net = (rdr::U32)(i % 4096) * 2654435761U;
+    sprintf(&(*names)[i * nameLen], "%d.%d.%d.%d",
+            net >> 24, (net >> 16) & 0xff, (net >> 8) & 0xff,
+            (i / 4096) & 0xff);
+  }
+}
+
+static void makeIPv6(std::vector<char>* names, int n)
+{
+  names->resize(n * nameLen);
+  for (int i = 0; i < n; i++) {
+    rdr::U32 a = (rdr::U32)i * 2654435761U;
+    sprintf(&(*names)[i * nameLen], "2001:db8:%x::%x:%x",
+            rnd() & 0xffff, a >> 16, a & 0xffff);
+  }
+}
+
+// attempts are made from the names in turn
+static void run(const char* scenario, const std::vector<char>& names,
+                int attempts)
+{
+  BenchBlacklist bl;
+  int sources = names.size() / nameLen;
+  int refused = 0;
+  clock_t start = clock();
+  for (int i = 0; i < attempts; i++) {
+    if (bl.isBlackmarked(&names[(i % sources) * nameLen]))
+      refused++;
+  }
+  double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  printf("%s,%d,%d,%d,%d,%d,%.3f,%.3f\n", scenario, attempts, sources,
+         refused, bl.entries(), bl.kbytes(), seconds,
+         seconds * 1000000 / attempts);
+  fflush(stdout);
+}
+
+static void usage(const char* prog)
+{
+  fprintf(stderr, "usage: %s [-sources N] [Param=value]...\n", prog);
+  exit(1);
+}
+
+int main(int argc, char** argv)
+{
+  int sources = 1000000;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-sources") == 0 && i + 1 < argc) {
+      sources = atoi(argv[++i]);
+      if (sources < 1000)
+        usage(argv[0]);
+    } else if (!Configuration::setParam(argv[i])) {
+      usage(argv[0]);
+    }
+  }
+
+  printf("scenario,attempts,sources,refused,entries,kbytes,seconds,"
+         "usPerOp\n");
+
+  std::vector<char> names;
+  seed = 1;
+  makeIPv4(&names, sources);
+  run("scan", names, sources);
+
+  makeIPv6(&names, sources);
+  run("scan6", names, sources);
+
+  makeIPv4Networks(&names, sources);
+  int prefix = Blacklist::prefixLength;
+  Blacklist::prefixLength.setParam(24);
+  run("scan24", names, sources);
+  Blacklist::prefixLength.setParam(prefix);
+
+  makeIPv4(&names, 1000);
+  run("bruteforce", names, sources);
+
+  int rate = Blacklist::rate, threshold = Blacklist::threshold;
+  Blacklist::rate.setParam(60);
+  Blacklist::threshold.setParam(sources);
+  run("rated", names, sources);
+  Blacklist::rate.setParam(rate);
+  Blacklist::threshold.setParam(threshold);
+
+  return 0;
+}
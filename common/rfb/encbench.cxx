@@ -0,0 +1,444 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// encbench - encoder benchmark.
+//
+// Runs every Encoder over a set of frames, in each client pixel format we
+// care about, and prints one line of comma-separated values per encoder,
+// pixel format and frame set:
+//
+//   encoding,format,frameset,frames,rawBytes,bytesOut,ratio,seconds,MBps
+//
+// rawBytes is the size of the frames in the client's pixel format, which is
+// also what MBps is measured against.  The frames are procedurally generated
+// text, UI chrome, gradients, photo-like images and a scrolling sequence.
+// Frames can also be loaded from raw dumps given on the command line as
+// file:WIDTHxHEIGHT, containing 32-bit little-endian pixels with red in bits
+// 16-23, green in 8-15 and blue in 0-7 (the layout of a Windows DIB).
+//
+// Usage: encbench [-size WIDTHxHEIGHT] [-time SECONDS] [file:WIDTHxHEIGHT]...
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <rdr/MemOutStream.h>
+#include <rfb/ConnParams.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/TransImageGetter.h>
+#include <rfb/SMsgWriterV3.h>
+#include <rfb/encodings.h>
+
+using namespace rfb;
+
+// Framebuffer format of the generated and loaded frames
+static const PixelFormat serverPF(32, 24, false, true,
+                                  255, 255, 255, 16, 8, 0);
+
+struct ClientFormat {
+  const char* name;
+  PixelFormat pf;
+};
+
+// The 32bpp formats are chosen so that ZRLE exercises both of its 24-bit
+// CPIXEL modes: 24A packs the least significant three bytes, 24B the most.
+static const ClientFormat clientFormats[] = {
+  { "bgr233",    PixelFormat(8,  8,  false, true, 7,   7,   3,   0,  3,  6) },
+  { "rgb565",    PixelFormat(16, 16, false, true, 31,  63,  31,  11, 5,  0) },
+  { "rgb888-24A",PixelFormat(32, 24, false, true, 255, 255, 255, 16, 8,  0) },
+  { "rgb888-24B",PixelFormat(32, 24, false, true, 255, 255, 255, 24, 16, 8) },
+};
+
+static const unsigned int benchEncodings[] = {
+  encodingRaw, encodingRRE, encodingHextile, encodingZRLE, encodingZYWRLE
+};
+
+struct FrameSet {
+  FrameSet(const char* name_) : name(name_) {}
+  const char* name;
+  std::vector<ManagedPixelBuffer*> frames;
+};
+
+
+// -=- Frame generation
+
+static unsigned int randState = 1;
+
+static unsigned int rnd(unsigned int n)
+{
+  randState = randState * 1103515245 + 12345;
+  return ((randState >> 8) & 0xffffff) % n;
+}
+
+static inline rdr::U32 rgb(int r, int g, int b)
+{
+  return (r << 16) | (g << 8) | b;
+}
+
+static void fill(ManagedPixelBuffer* pb, const Rect& r, rdr::U32 pix)
+{
+  pb->fillRect(r.intersect(pb->getRect()), pix);
+}
+
+static inline void setPixel(ManagedPixelBuffer* pb, int x, int y, rdr::U32 pix)
+{
+  ((rdr::U32*)pb->data)[y * pb->getStride() + x] = pix;
+}
+
+// drawText() draws lines of pseudo-text: each character cell is 8x16 with a
+// glyph picked from a small set of random bitmaps, with occasional coloured
+// words as in a syntax-highlighting editor.
+
+static void drawText(ManagedPixelBuffer* pb, const Rect& r, int firstLine)
+{
+  static rdr::U8 glyphs[64][12];
+  static bool glyphsMade = false;
+  if (!glyphsMade) {
+    unsigned int saved = randState;
+    randState = 4321;
+    for (int g = 0; g < 64; g++)
+      for (int row = 0; row < 12; row++)
+        glyphs[g][row] = rnd(256) & 0x7e;
+    randState = saved;
+    glyphsMade = true;
+  }
+
+  static const rdr::U32 inks[] = {
+    rgb(0,0,0), rgb(0,0,160), rgb(160,0,0), rgb(0,128,0)
+  };
+
+  fill(pb, r, rgb(255,255,255));
+  for (int y = r.tl.y; y + 16 <= r.br.y; y += 16) {
+    unsigned int saved = randState;
+    randState = firstLine + (y - r.tl.y) / 16;
+    int len = rnd((r.width() / 8) + 1);
+    rdr::U32 ink = inks[0];
+    for (int c = 0; c < len; c++) {
+      int g = rnd(70);
+      if (g >= 64) {
+        ink = inks[rnd(4)];
+        continue;              // space between words
+      }
+      int x = r.tl.x + c * 8;
+      for (int row = 0; row < 12; row++)
+        for (int bit = 0; bit < 8; bit++)
+          if (glyphs[g][row] & (0x80 >> bit))
+            setPixel(pb, x + bit, y + 2 + row, ink);
+    }
+    randState = saved;
+  }
+}
+
+static void drawGradient(ManagedPixelBuffer* pb, const Rect& r,
+                         rdr::U32 from, rdr::U32 to, bool vertical)
+{
+  int n = vertical ? r.height() : r.width();
+  for (int i = 0; i < n; i++) {
+    int r0 = (from >> 16) & 255, g0 = (from >> 8) & 255, b0 = from & 255;
+    int r1 = (to >> 16) & 255, g1 = (to >> 8) & 255, b1 = to & 255;
+    rdr::U32 pix = rgb(r0 + (r1 - r0) * i / n, g0 + (g1 - g0) * i / n,
+                       b0 + (b1 - b0) * i / n);
+    if (vertical)
+      fill(pb, Rect(r.tl.x, r.tl.y + i, r.br.x, r.tl.y + i + 1), pix);
+    else
+      fill(pb, Rect(r.tl.x + i, r.tl.y, r.tl.x + i + 1, r.br.y), pix);
+  }
+}
+
+static void drawButton(ManagedPixelBuffer* pb, const Rect& r)
+{
+  fill(pb, r, rgb(212,208,200));
+  fill(pb, Rect(r.tl.x, r.tl.y, r.br.x, r.tl.y+1), rgb(255,255,255));
+  fill(pb, Rect(r.tl.x, r.tl.y, r.tl.x+1, r.br.y), rgb(255,255,255));
+  fill(pb, Rect(r.tl.x, r.br.y-1, r.br.x, r.br.y), rgb(64,64,64));
+  fill(pb, Rect(r.br.x-1, r.tl.y, r.br.x, r.br.y), rgb(64,64,64));
+}
+
+// drawChrome() draws a few overlapping windows with title bars, menus,
+// buttons, icons and text panels.
+
+static void drawChrome(ManagedPixelBuffer* pb, int seed)
+{
+  randState = seed;
+  fill(pb, pb->getRect(), rgb(58,110,165));
+  for (int w = 0; w < 4; w++) {
+    int x = rnd(pb->width() / 2), y = rnd(pb->height() / 2);
+    Rect win(x, y, x + pb->width() / 2, y + pb->height() / 2);
+    win = win.intersect(pb->getRect());
+    fill(pb, win, rgb(212,208,200));
+    drawGradient(pb, Rect(win.tl.x+3, win.tl.y+3, win.br.x-3, win.tl.y+21),
+                 rgb(10,36,106), rgb(166,202,240), false);
+    for (int b = 0; b < 3; b++)
+      drawButton(pb, Rect(win.br.x-60+b*18, win.tl.y+5,
+                          win.br.x-44+b*18, win.tl.y+19));
+    for (int m = 0; m < 6; m++)
+      drawText(pb, Rect(win.tl.x+6+m*48, win.tl.y+24,
+                        win.tl.x+46+m*48, win.tl.y+40), seed + m);
+    for (int i = 0; i < 8; i++) {
+      Rect icon(win.tl.x+8+i*24, win.tl.y+44, win.tl.x+24+i*24, win.tl.y+60);
+      for (int iy = icon.tl.y; iy < icon.br.y && iy < win.br.y; iy++)
+        for (int ix = icon.tl.x; ix < icon.br.x && ix < win.br.x; ix++)
+          setPixel(pb, ix, iy, rgb(rnd(256), rnd(256), rnd(256)));
+    }
+    Rect panel(win.tl.x+6, win.tl.y+64, win.br.x-6, win.br.y-30);
+    if (!panel.is_empty())
+      drawText(pb, panel, seed * 7 + w);
+    for (int b = 0; b < 2; b++)
+      drawButton(pb, Rect(win.br.x-170+b*80, win.br.y-26,
+                          win.br.x-100+b*80, win.br.y-6).intersect(win));
+  }
+}
+
+// drawPhoto() draws a smooth image made of overlapping colour blobs with a
+// little per-pixel noise, which is roughly how photographs behave for the
+// encoders: few runs and many distinct colours.
+
+static void drawPhoto(ManagedPixelBuffer* pb, int seed)
+{
+  randState = seed;
+  int cx[6], cy[6], cr[6], cc[6][3];
+  for (int i = 0; i < 6; i++) {
+    cx[i] = rnd(pb->width()); cy[i] = rnd(pb->height());
+    cr[i] = 100 + rnd(pb->width() / 2);
+    for (int c = 0; c < 3; c++) cc[i][c] = rnd(256);
+  }
+  for (int y = 0; y < pb->height(); y++) {
+    for (int x = 0; x < pb->width(); x++) {
+      int col[3] = { 40, 40, 40 };
+      for (int i = 0; i < 6; i++) {
+        int dx = x - cx[i], dy = y - cy[i];
+        int d2 = dx*dx + dy*dy, r2 = cr[i]*cr[i];
+        if (d2 < r2)
+          for (int c = 0; c < 3; c++)
+            col[c] += cc[i][c] * (r2 - d2) / r2 / 2;
+      }
+      for (int c = 0; c < 3; c++) {
+        col[c] += (int)rnd(9) - 4;
+        if (col[c] < 0) col[c] = 0;
+        if (col[c] > 255) col[c] = 255;
+      }
+      setPixel(pb, x, y, rgb(col[0], col[1], col[2]));
+    }
+  }
+}
+
+static ManagedPixelBuffer* newFrame(int w, int h)
+{
+  return new ManagedPixelBuffer(serverPF, w, h);
+}
+
+static void makeFrameSets(std::vector<FrameSet*>* sets, int w, int h)
+{
+  FrameSet* fs;
+
+  fs = new FrameSet("text");
+  for (int i = 0; i < 4; i++) {
+    ManagedPixelBuffer* pb = newFrame(w, h);
+    drawText(pb, pb->getRect(), i * 1000);
+    fs->frames.push_back(pb);
+  }
+  sets->push_back(fs);
+
+  fs = new FrameSet("chrome");
+  for (int i = 0; i < 4; i++) {
+    ManagedPixelBuffer* pb = newFrame(w, h);
+    drawChrome(pb, i + 1);
+    fs->frames.push_back(pb);
+  }
+  sets->push_back(fs);
+
+  fs = new FrameSet("gradient");
+  for (int i = 0; i < 4; i++) {
+    ManagedPixelBuffer* pb = newFrame(w, h);
+    drawGradient(pb, pb->getRect(), rgb(i*60, 20, 200), rgb(255, 200, i*60),
+                 i & 1);
+    fs->frames.push_back(pb);
+  }
+  sets->push_back(fs);
+
+  fs = new FrameSet("photo");
+  for (int i = 0; i < 4; i++) {
+    ManagedPixelBuffer* pb = newFrame(w, h);
+    drawPhoto(pb, i + 1);
+    fs->frames.push_back(pb);
+  }
+  sets->push_back(fs);
+
+  // A scrolling sequence: the same document moved up by a few lines per
+  // frame, inside a fixed window frame.
+  fs = new FrameSet("scroll");
+  for (int i = 0; i < 8; i++) {
+    ManagedPixelBuffer* pb = newFrame(w, h);
+    drawChrome(pb, 99);
+    drawText(pb, Rect(20, 40, w - 20, h - 20), i * 3);
+    fs->frames.push_back(pb);
+  }
+  sets->push_back(fs);
+}
+
+static bool loadRawFrame(std::vector<FrameSet*>* sets, const char* arg)
+{
+  const char* colon = strrchr(arg, ':');
+  int w, h;
+  if (!colon || sscanf(colon + 1, "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+    fprintf(stderr, "bad raw frame argument %s\n", arg);
+    return false;
+  }
+  char* filename = new char[colon - arg + 1];
+  memcpy(filename, arg, colon - arg);
+  filename[colon - arg] = 0;
+
+  FILE* f = fopen(filename, "rb");
+  if (!f) {
+    fprintf(stderr, "unable to open %s\n", filename);
+    delete [] filename;
+    return false;
+  }
+
+  // A file may hold several frames of the same size back to back
+  FrameSet* fs = new FrameSet(filename);
+  while (true) {
+    ManagedPixelBuffer* pb = newFrame(w, h);
+    if (fread(pb->data, 1, pb->dataLen(), f) != (size_t)pb->dataLen()) {
+      delete pb;
+      break;
+    }
+    fs->frames.push_back(pb);
+  }
+  fclose(f);
+
+  if (fs->frames.empty()) {
+    fprintf(stderr, "%s is smaller than one %dx%d frame\n", filename, w, h);
+    delete fs;
+    delete [] filename;
+    return false;
+  }
+  sets->push_back(fs);
+  return true;
+}
+
+
+// -=- Benchmarking
+
+// encodeFrame() encodes the whole of a frame as a single update, carrying on
+// from where the encoder stopped if it could not send the whole rectangle.
+
+static void encodeFrame(SMsgWriter* writer, unsigned int encoding,
+                        ImageGetter* ig, const Rect& r)
+{
+  writer->writeFramebufferUpdateStart();
+  Rect remaining = r;
+  while (!remaining.is_empty()) {
+    Rect actual;
+    if (writer->writeRect(remaining, encoding, ig, &actual))
+      break;
+    remaining.tl.y = actual.br.y;
+  }
+  writer->writeFramebufferUpdateEnd();
+}
+
+static void runBenchmark(const FrameSet* fs, unsigned int encoding,
+                         const ClientFormat& cf, double minTime)
+{
+  ConnParams cp;
+  cp.width = fs->frames[0]->width();
+  cp.height = fs->frames[0]->height();
+  cp.setPF(cf.pf);
+
+  rdr::MemOutStream os(1024*1024);
+  SMsgWriterV3 writer(&cp, &os);
+  TransImageGetter ig;
+  ig.init(fs->frames[0], cf.pf);
+
+  double rawBytes = 0, bytesOut = 0, seconds = 0;
+  int frames = 0;
+
+  while (seconds < minTime || frames < (int)fs->frames.size()) {
+    ManagedPixelBuffer* pb = fs->frames[frames % fs->frames.size()];
+    ig.setPixelBuffer(pb);
+
+    clock_t start = clock();
+    encodeFrame(&writer, encoding, &ig, pb->getRect());
+    seconds += (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    rawBytes += (double)pb->area() * (cf.pf.bpp / 8);
+    bytesOut += os.length();
+    os.clear();
+    frames++;
+  }
+
+  printf("%s,%s,%s,%d,%.0f,%.0f,%.3f,%.3f,%.2f\n",
+         encodingName(encoding), cf.name, fs->name, frames, rawBytes,
+         bytesOut, rawBytes / bytesOut, seconds,
+         seconds > 0 ? rawBytes / seconds / (1024*1024) : 0);
+  fflush(stdout);
+}
+
+static void usage(const char* prog)
+{
+  fprintf(stderr, "usage: %s [-size WIDTHxHEIGHT] [-time SECONDS] "
+          "[file:WIDTHxHEIGHT]...\n", prog);
+  exit(1);
+}
+
+int main(int argc, char** argv)
+{
+  int width = 1024, height = 768;
+  double minTime = 1.0;
+  std::vector<FrameSet*> sets;
+  std::vector<const char*> rawFiles;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-size") == 0 && i + 1 < argc) {
+      if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 ||
+          width < 64 || height < 64)
+        usage(argv[0]);
+    } else if (strcmp(argv[i], "-time") == 0 && i + 1 < argc) {
+      minTime = atof(argv[++i]);
+    } else if (argv[i][0] == '-') {
+      usage(argv[0]);
+    } else {
+      rawFiles.push_back(argv[i]);
+    }
+  }
+
+  makeFrameSets(&sets, width, height);
+  for (size_t i = 0; i < rawFiles.size(); i++)
+    if (!loadRawFrame(&sets, rawFiles[i]))
+      return 1;
+
+  printf("encoding,format,frameset,frames,rawBytes,bytesOut,ratio,"
+         "seconds,MBps\n");
+
+  int nEncodings = sizeof(benchEncodings) / sizeof(benchEncodings[0]);
+  int nFormats = sizeof(clientFormats) / sizeof(clientFormats[0]);
+  for (int e = 0; e < nEncodings; e++)
+    for (int f = 0; f < nFormats; f++)
+      for (size_t s = 0; s < sets.size(); s++)
+        runBenchmark(sets[s], benchEncodings[e], clientFormats[f], minTime);
+
+  for (size_t s = 0; s < sets.size(); s++) {
+    for (size_t i = 0; i < sets[s]->frames.size(); i++)
+      delete sets[s]->frames[i];
+    delete sets[s];
+  }
+  return 0;
+}
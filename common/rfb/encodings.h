@@ -27,10 +27,24 @@ namespace rfb {
   const unsigned int encodingHextile = 5;
   const unsigned int encodingZRLE = 16;
 
+  // Not the registered ZYWRLE encoding (17), whose wire format differs, but
+  // the variant described in Zywrle.h, under a number of its own
+  const unsigned int encodingZYWRLE = 0xe4;
+
   const unsigned int encodingMax = 255;
 
   const unsigned int pseudoEncodingCursor = 0xffffff11;
   const unsigned int pseudoEncodingDesktopSize = 0xffffff21;
+  const unsigned int pseudoEncodingTileCache0 = 0xffffff50;
+  const unsigned int pseudoEncodingTileCache15 = 0xffffff5f;
+  const unsigned int pseudoEncodingCachedTile = 0xffffff60;
+  const unsigned int pseudoEncodingCacheStore = 0xffffff61;
+  const unsigned int pseudoEncodingScale1 = 0xffffff70;
+  const unsigned int pseudoEncodingScale8 = 0xffffff77;
+  const unsigned int pseudoEncodingContinuousUpdates = 0xfffffec7;
+  const unsigned int pseudoEncodingFence = 0xfffffec8;
+  const unsigned int pseudoEncodingQualityLevel0 = 0xffffffe0;
+  const unsigned int pseudoEncodingQualityLevel9 = 0xffffffe9;
 
   int encodingNum(const char* name);
   const char* encodingName(unsigned int num);
@@ -0,0 +1,47 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#ifndef __RFB_FENCETYPES_H__
+#define __RFB_FENCETYPES_H__
+
+#include <rdr/types.h>
+
+namespace rfb {
+
+  // Flags carried by Fence messages.  A fence with fenceFlagRequest set must
+  // be returned by the other side with the same payload.  fenceFlagBlockBefore
+  // and fenceFlagBlockAfter ask that the fence not be processed until earlier
+  // messages have been, or later messages not until it has been, and
+  // fenceFlagSyncNext asks for the message after the fence to be processed
+  // before the fence is returned.  The responder clears any flags it does
+  // not honour.
+
+  const rdr::U32 fenceFlagBlockBefore = 1<<0;
+  const rdr::U32 fenceFlagBlockAfter = 1<<1;
+  const rdr::U32 fenceFlagSyncNext = 1<<2;
+
+  const rdr::U32 fenceFlagRequest = 1<<31;
+
+  const rdr::U32 fenceFlagsSupported = (fenceFlagBlockBefore |
+                                        fenceFlagBlockAfter |
+                                        fenceFlagSyncNext |
+                                        fenceFlagRequest);
+
+  // The payload of a fence is at most this many bytes.
+  const int fenceMaxDataLen = 64;
+}
+#endif
@@ -22,7 +22,14 @@
 // BPP                - 8, 16 or 32
 // EXTRA_ARGS         - optional extra arguments
 // GET_IMAGE_INTO_BUF - gets a rectangle of pixel data into a buffer
+// GET_PIXELS_R       - optional, gets a read-only pointer to a rectangle of
+//                      pixel data and its stride, or null if there is none,
+//                      in which case GET_IMAGE_INTO_BUF is used instead
+//
+// The tile functions never modify the pixel data they are given, so it may
+// point directly into a framebuffer.
 
+#include <string.h>
 #include <rdr/OutStream.h>
 #include <rfb/hextileConstants.h>
 
@@ -41,9 +48,10 @@ namespace rfb {
 #define HEXTILE_ENCODE_TILE CONCAT2E(hextileEncodeTile,BPP)
 #define TEST_TILE_TYPE CONCAT2E(hextileTestTileType,BPP)
 
-int TEST_TILE_TYPE (PIXEL_T* data, int w, int h, PIXEL_T* bg, PIXEL_T* fg);
-int HEXTILE_ENCODE_TILE (PIXEL_T* data, int w, int h, int tileType,
-                         rdr::U8* encoded, PIXEL_T bg);
+int TEST_TILE_TYPE (const PIXEL_T* data, int w, int h, int stride,
+                    PIXEL_T* bg, PIXEL_T* fg);
+int HEXTILE_ENCODE_TILE (const PIXEL_T* data, int w, int h, int stride,
+                         int tileType, rdr::U8* encoded, PIXEL_T bg);
 
 void HEXTILE_ENCODE(const Rect& r, rdr::OutStream* os
 #ifdef EXTRA_ARGS
@@ -66,10 +74,20 @@ void HEXTILE_ENCODE(const Rect& r, rdr::OutStream* os
 
       t.br.x = __rfbmin(r.br.x, t.tl.x + 16);
 
-      GET_IMAGE_INTO_BUF(t,buf);
+      const PIXEL_T* data = 0;
+      int stride = t.width();
+#ifdef GET_PIXELS_R
+      data = (const PIXEL_T*)GET_PIXELS_R(t,&stride);
+#endif
+      if (!data) {
+        GET_IMAGE_INTO_BUF(t,buf);
+        data = buf;
+        stride = t.width();
+      }
 
       PIXEL_T bg, fg;
-      int tileType = TEST_TILE_TYPE(buf, t.width(), t.height(), &bg, &fg);
+      int tileType = TEST_TILE_TYPE(data, t.width(), t.height(), stride,
+                                    &bg, &fg);
 
       if (!oldBgValid || oldBg != bg) {
         tileType |= hextileBgSpecified;
@@ -91,13 +109,13 @@ void HEXTILE_ENCODE(const Rect& r, rdr::OutStream* os
           }
         }
 
-        encodedLen = HEXTILE_ENCODE_TILE(buf, t.width(), t.height(), tileType,
-                                         encoded, bg);
+        encodedLen = HEXTILE_ENCODE_TILE(data, t.width(), t.height(), stride,
+                                         tileType, encoded, bg);
 
         if (encodedLen < 0) {
-          GET_IMAGE_INTO_BUF(t,buf);
           os->writeU8(hextileRaw);
-          os->writeBytes(buf, t.width() * t.height() * (BPP/8));
+          for (int y = 0; y < t.height(); y++)
+            os->writeBytes(data + y*stride, t.width() * (BPP/8));
           oldBgValid = oldFgValid = false;
           continue;
         }
@@ -112,36 +130,39 @@ void HEXTILE_ENCODE(const Rect& r, rdr::OutStream* os
 }
 
 
-int HEXTILE_ENCODE_TILE (PIXEL_T* data, int w, int h, int tileType,
-                         rdr::U8* encoded, PIXEL_T bg)
+int HEXTILE_ENCODE_TILE (const PIXEL_T* data, int w, int h, int stride,
+                         int tileType, rdr::U8* encoded, PIXEL_T bg)
 {
   rdr::U8* nSubrectsPtr = encoded;
   *nSubrectsPtr = 0;
   encoded++;
 
+  // Pixels already covered by a subrect are treated as background.  They are
+  // marked in a separate mask so that the pixel data itself is left alone.
+
+  rdr::U8 covered[256];
+  memset(covered, 0, w*h);
+
+#define HEXTILE_PIXEL(px,py) (covered[(py)*w+(px)] ? bg : data[(py)*stride+(px)])
+
   for (int y = 0; y < h; y++)
   {
     int x = 0;
     while (x < w) {
-      if (*data == bg) {
+      PIXEL_T pix = HEXTILE_PIXEL(x,y);
+      if (pix == bg) {
         x++;
-        data++;
         continue;
       }
 
       // Find horizontal subrect first
-      PIXEL_T* ptr = data+1;
-      PIXEL_T* eol = data+w-x;
-      while (ptr < eol && *ptr == *data) ptr++;
-      int sw = ptr - data;
+      int sw = 1;
+      while (x+sw < w && HEXTILE_PIXEL(x+sw,y) == pix) sw++;
 
-      ptr = data + w;
       int sh = 1;
       while (sh < h-y) {
-        eol = ptr + sw;
-        while (ptr < eol)
-          if (*ptr++ != *data) goto endOfHorizSubrect;
-        ptr += w - sw;
+        for (int i = 0; i < sw; i++)
+          if (HEXTILE_PIXEL(x+i,y+sh) != pix) goto endOfHorizSubrect;
         sh++;
       }
     endOfHorizSubrect:
@@ -149,15 +170,13 @@ int HEXTILE_ENCODE_TILE (PIXEL_T* data, int w, int h, int tileType,
       // Find vertical subrect
       int vh;
       for (vh = sh; vh < h-y; vh++)
-        if (data[vh*w] != *data) break;
+        if (HEXTILE_PIXEL(x,y+vh) != pix) break;
 
       if (vh != sh) {
-        ptr = data+1;
         int vw;
         for (vw = 1; vw < sw; vw++) {
           for (int i = 0; i < vh; i++)
-            if (ptr[i*w] != *data) goto endOfVertSubrect;
-          ptr++;
+            if (HEXTILE_PIXEL(x+vw,y+i) != pix) goto endOfVertSubrect;
         }
       endOfVertSubrect:
 
@@ -173,15 +192,15 @@ int HEXTILE_ENCODE_TILE (PIXEL_T* data, int w, int h, int tileType,
       if (tileType & hextileSubrectsColoured) {
         if (encoded - nSubrectsPtr + (BPP/8) > w*h*(BPP/8)) return -1;
 #if (BPP == 8)
-        *encoded++ = *data;
+        *encoded++ = pix;
 #elif (BPP == 16)
-        *encoded++ = ((rdr::U8*)data)[0];
-        *encoded++ = ((rdr::U8*)data)[1];
+        *encoded++ = ((rdr::U8*)&pix)[0];
+        *encoded++ = ((rdr::U8*)&pix)[1];
 #elif (BPP == 32)
-        *encoded++ = ((rdr::U8*)data)[0];
-        *encoded++ = ((rdr::U8*)data)[1];
-        *encoded++ = ((rdr::U8*)data)[2];
-        *encoded++ = ((rdr::U8*)data)[3];
+        *encoded++ = ((rdr::U8*)&pix)[0];
+        *encoded++ = ((rdr::U8*)&pix)[1];
+        *encoded++ = ((rdr::U8*)&pix)[2];
+        *encoded++ = ((rdr::U8*)&pix)[3];
 #endif
       }
 
@@ -189,47 +208,47 @@ int HEXTILE_ENCODE_TILE (PIXEL_T* data, int w, int h, int tileType,
       *encoded++ = (x << 4) | y;
       *encoded++ = ((sw-1) << 4) | (sh-1);
 
-      ptr = data+w;
-      PIXEL_T* eor = data+w*sh;
-      while (ptr < eor) {
-        eol = ptr + sw;
-        while (ptr < eol) *ptr++ = bg;
-        ptr += w - sw;
-      }
+      for (int i = 1; i < sh; i++)
+        memset(&covered[(y+i)*w+x], 1, sw);
       x += sw;
-      data += sw;
     }
   }
   return encoded - nSubrectsPtr;
 }
 
+#undef HEXTILE_PIXEL
 
-int TEST_TILE_TYPE (PIXEL_T* data, int w, int h, PIXEL_T* bg, PIXEL_T* fg)
+
+int TEST_TILE_TYPE (const PIXEL_T* data, int w, int h, int stride,
+                    PIXEL_T* bg, PIXEL_T* fg)
 {
   int tileType = 0;
   PIXEL_T pix1 = *data, pix2 = 0;
   int count1 = 0, count2 = 0;
-  PIXEL_T* end = data + w*h;
+  const PIXEL_T* row = data;
 
-  for (PIXEL_T* ptr = data; ptr < end; ptr++) {
-    if (*ptr == pix1) {
-      count1++;
-      continue;
-    }
+  for (int y = 0; y < h; y++, row += stride) {
+    for (const PIXEL_T* ptr = row; ptr < row + w; ptr++) {
+      if (*ptr == pix1) {
+        count1++;
+        continue;
+      }
 
-    if (count2 == 0) {
-      tileType |= hextileAnySubrects;
-      pix2 = *ptr;
-    }
+      if (count2 == 0) {
+        tileType |= hextileAnySubrects;
+        pix2 = *ptr;
+      }
 
-    if (*data == pix2) {
-      count2++;
-      continue;
-    }
+      if (*data == pix2) {
+        count2++;
+        continue;
+      }
 
-    tileType |= hextileSubrectsColoured;
-    break;
+      tileType |= hextileSubrectsColoured;
+      goto done;
+    }
   }
+done:
 
   if (count1 >= count2) {
     *bg = pix1; *fg = pix2;
@@ -0,0 +1,518 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// loadgen - server load generator.
+//
+// Runs a VNCServerST exporting an SSyntheticDesktop in a child process, and
+// connects a number of headless viewers to it over the loopback interface.
+// Each viewer decodes updates into its own framebuffer and asks for the next
+// update as soon as the last has arrived.  Every so often it presses a key,
+// which the desktop echoes into the framebuffer, and times how long that
+// takes to come back (see SSyntheticDesktop.h).  When the run is over it
+// prints one line of comma-separated values per viewer:
+//
+//   viewer,updates,updatesPerSec,kbitsPerSec,probes,meanLatencyMs,maxLatencyMs
+//
+// and then the same for all viewers together, along with the CPU used by the
+// server and by the viewers, as a percentage of one CPU.  Only the time after
+// every viewer has received its first update is measured.  The viewers all
+// run in one process, and a viewer waits while the rest of a message it has
+// started to read arrives, so if the viewers' CPU nears 100% the results say
+// more about the load generator than about the server.
+//
+// -stall N adds N more viewers, in a process of their own which stops once
+// they have had their first updates, as if their network had hung.  The
+// other viewers should carry on regardless.
+//
+// -scale N has the viewers ask the server to scale the framebuffer down by
+// a factor of 2, 4 or 8 before sending it.
+//
+// Usage: loadgen [-viewers N] [-stall N] [-time SECONDS]
+//                [-size WIDTHxHEIGHT] [-script SCRIPT] [-encoding NAME]
+//                [-scale N] [Param=value]...
+//
+// Param=value arguments set parameters of the server, such as
+// MaxUpdateTime=50, or Log=*:stderr:30 to see what it is doing.
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <map>
+#include <vector>
+#include <network/TcpSocket.h>
+#include <network/SocketManager.h>
+#include <rfb/CConnection.h>
+#include <rfb/CMsgWriter.h>
+#include <rfb/CSecurityNone.h>
+#include <rfb/Configuration.h>
+#include <rfb/LogWriter.h>
+#include <rfb/Logger_stdio.h>
+#include <rfb/SSyntheticDesktop.h>
+#include <rfb/VNCServerST.h>
+#include <rfb/encodings.h>
+
+using namespace rfb;
+using namespace network;
+
+static LogWriter vlog("loadgen");
+
+// How often each viewer measures latency, and how long it waits for an
+// answer before giving up
+static const double probeInterval = 0.2;
+static const double probeTimeout = 5;
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static double cpuTime()
+{
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1000000.0 +
+         ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1000000.0;
+}
+
+
+// -=- Server process
+
+// The parent sends SIGUSR1 when it starts measuring and SIGTERM when it has
+// finished, after which the server writes the CPU time it has used in
+// between to the pipe and exits.
+
+static volatile sig_atomic_t markRequested = 0;
+static volatile sig_atomic_t stopRequested = 0;
+
+static void markHandler(int) { markRequested = 1; }
+static void stopHandler(int) { stopRequested = 1; }
+
+static void runServer(TcpListener* listener, const Point& size,
+                      const char* script, int resultFd)
+{
+  signal(SIGUSR1, markHandler);
+  signal(SIGTERM, stopHandler);
+
+  SSyntheticDesktop desktop(size, script);
+  VNCServerST server("loadgen", &desktop);
+  SocketManager manager;
+  manager.addListener(listener, &server);
+
+  double cpuMark = cpuTime();
+  double last = now();
+  while (!stopRequested) {
+    manager.processEvents(10);
+    if (markRequested) {
+      cpuMark = cpuTime();
+      markRequested = 0;
+    }
+    int ms = (int)((now() - last) * 1000);
+    if (ms > 0) {
+      desktop.animate(ms);
+      last += ms / 1000.0;
+    }
+  }
+
+  double cpu = cpuTime() - cpuMark;
+  write(resultFd, &cpu, sizeof(cpu));
+}
+
+
+// -=- Viewer
+
+class Viewer : public CConnection {
+public:
+  Viewer(int id_, Socket* sock_, int encoding_, int scale_)
+    : id(id_), sock(sock_), encoding(encoding_), scale(scale_), fb(0),
+      serverWidth(0), probeSeq(0), probeTime(0), nextProbe(0) {
+    resetStats();
+    setServerName("loadgen");
+    setStreams(&sock->inStream(), &sock->outStream());
+    addSecType(secTypeNone);
+    setShared(true);
+    initialiseProtocol();
+  }
+  virtual ~Viewer() {
+    delete fb;
+  }
+
+  virtual CSecurity* getCSecurity(int secType) {
+    return new CSecurityNone();
+  }
+
+  virtual void serverInit() {
+    CConnection::serverInit();
+    fb = new ManagedPixelBuffer(cp.pf(), cp.width, cp.height);
+    serverWidth = cp.width;
+    cp.scale = scale;
+    writer()->writeSetEncodings(encoding, true);
+    writer()->writeFramebufferUpdateRequest(Rect(0, 0, cp.width, cp.height),
+                                            false);
+  }
+
+  virtual void setDesktopSize(int w, int h) {
+    CConnection::setDesktopSize(w, h);
+    if (fb)
+      fb->setSize(w, h);
+  }
+
+  virtual void framebufferUpdateEnd() {
+    updates++;
+    if (probeTime) {
+      int stride;
+      const rdr::U8* p = fb->getPixelsR(Rect(probeX(), 0, probeX() + 1, 1),
+                                        &stride);
+      Pixel pix = 0;
+      memcpy(&pix, p, fb->getPF().bpp / 8);
+      if (pix == (probeSeq & 0xffff)) {
+        double latency = now() - probeTime;
+        probes++;
+        totalLatency += latency;
+        if (latency > maxLatency)
+          maxLatency = latency;
+        probeTime = 0;
+      }
+    }
+    writer()->writeFramebufferUpdateRequest(Rect(0, 0, cp.width, cp.height),
+                                            true);
+  }
+
+  virtual void fillRect(const Rect& r, Pixel pix) {
+    fb->fillRect(r, pix);
+  }
+  virtual void imageRect(const Rect& r, void* pixels) {
+    fb->imageRect(r, pixels);
+  }
+  virtual void copyRect(const Rect& r, int srcX, int srcY) {
+    fb->copyRect(r, Point(r.tl.x - srcX, r.tl.y - srcY));
+  }
+
+  void processMessages() {
+    while (sock->inStream().checkNoWait(1))
+      processMsg();
+  }
+
+  // probe() presses a key if it is time to measure the latency again
+  void probe(double t) {
+    if (!sock || state() != RFBSTATE_NORMAL || t < nextProbe)
+      return;
+    if (probeTime && t - probeTime < probeTimeout)
+      return;
+    if (probeTime)
+      lostProbes++;
+    if ((++probeSeq & 0xffff) == 0)
+      probeSeq++;
+    rdr::U32 key = (id << 16) | (probeSeq & 0xffff);
+    writer()->keyEvent(key, true);
+    writer()->keyEvent(key, false);
+    probeTime = t;
+    nextProbe = t + probeInterval;
+  }
+
+  void resetStats() {
+    updates = probes = lostProbes = 0;
+    totalLatency = maxLatency = 0;
+    bytesMark = sock ? sock->inStream().pos() : 0;
+    bytesAtClose = 0;
+  }
+  int bytesRead() {
+    return sock ? sock->inStream().pos() - bytesMark : bytesAtClose;
+  }
+  void socketClosed() {
+    bytesAtClose = bytesRead();
+    sock = 0;
+  }
+
+  int id;
+  Socket* sock;
+  int updates, probes, lostProbes;
+  double totalLatency, maxLatency;
+
+protected:
+  // probeX() returns where the desktop sets this viewer's probe block, once
+  // the framebuffer has been scaled down if it is going to be
+  int probeX() {
+    int x = 8 * id % serverWidth;
+    return cp.width < serverWidth ? x / scale : x;
+  }
+
+  int encoding;
+  int scale;
+  ManagedPixelBuffer* fb;
+  int serverWidth;
+  rdr::U32 probeSeq;
+  double probeTime;
+  double nextProbe;
+  int bytesMark, bytesAtClose;
+};
+
+
+// -=- ViewerSet - the SocketServer for the viewers' sockets
+
+class ViewerSet : public SocketServer {
+public:
+  virtual ~ViewerSet() {
+    for (size_t i = 0; i < viewers.size(); i++)
+      delete viewers[i];
+  }
+  // connect() connects count viewers, numbered from first
+  void connect(SocketManager* manager, int first, int count, int port,
+               int encoding, int scale) {
+    for (int i = first; i < first + count; i++) {
+      TcpSocket* sock = new TcpSocket("127.0.0.1", port);
+      Viewer* v = new Viewer(i, sock, encoding, scale);
+      viewers.push_back(v);
+      bySocket[sock] = v;
+      manager->addSocket(sock, this);
+    }
+  }
+
+  // waitForFirstUpdates() processes events until every viewer has had an
+  // update or been disconnected, or until a timeout
+  void waitForFirstUpdates(SocketManager* manager) {
+    double start = now();
+    while (now() - start < 30) {
+      size_t ready = 0;
+      for (size_t i = 0; i < viewers.size(); i++) {
+        if (viewers[i]->updates > 0 || !viewers[i]->sock)
+          ready++;
+      }
+      if (ready == viewers.size())
+        break;
+      manager->processEvents(10);
+    }
+  }
+
+  virtual void addSocket(Socket* sock, bool outgoing) {}
+  virtual void removeSocket(Socket* sock) {
+    bySocket[sock]->socketClosed();
+    bySocket.erase(sock);
+  }
+  virtual void processSocketEvent(Socket* sock) {
+    Viewer* v = bySocket[sock];
+    try {
+      v->processMessages();
+    } catch (rdr::Exception& e) {
+      vlog.error("viewer %d: %s", v->id, e.str());
+      sock->shutdown();
+    }
+  }
+  virtual int checkTimeouts() { return 0; }
+
+  std::vector<Viewer*> viewers;
+  std::map<Socket*, Viewer*> bySocket;
+};
+
+
+static void usage(const char* prog)
+{
+  fprintf(stderr, "usage: %s [-viewers N] [-stall N] [-time SECONDS]\n"
+          "       [-size WIDTHxHEIGHT] [-script SCRIPT] [-encoding NAME]\n"
+          "       [-scale N] [Param=value]...\n", prog);
+  exit(1);
+}
+
+int main(int argc, char** argv)
+{
+  int nViewers = 10;
+  int nStalled = 0;
+  double duration = 10;
+  Point size(1024, 768);
+  const char* script = "type,scroll,drag,video";
+  int encoding = encodingZRLE;
+  int scale = 1;
+
+  initStdIOLoggers();
+  LogWriter::setLogParams("*:stderr:0");
+  Configuration::setParam("SecurityTypes", "None");
+  Configuration::setParam("BlacklistThreshold", "1000000");
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-viewers") == 0 && i + 1 < argc) {
+      nViewers = atoi(argv[++i]);
+      if (nViewers <= 0 || nViewers > 65535)
+        usage(argv[0]);
+    } else if (strcmp(argv[i], "-stall") == 0 && i + 1 < argc) {
+      nStalled = atoi(argv[++i]);
+      if (nStalled < 0)
+        usage(argv[0]);
+    } else if (strcmp(argv[i], "-time") == 0 && i + 1 < argc) {
+      duration = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-size") == 0 && i + 1 < argc) {
+      if (sscanf(argv[++i], "%dx%d", &size.x, &size.y) != 2 ||
+          size.x <= 0 || size.y <= 0)
+        usage(argv[0]);
+    } else if (strcmp(argv[i], "-script") == 0 && i + 1 < argc) {
+      script = argv[++i];
+    } else if (strcmp(argv[i], "-encoding") == 0 && i + 1 < argc) {
+      encoding = encodingNum(argv[++i]);
+      if (encoding < 0)
+        usage(argv[0]);
+    } else if (strcmp(argv[i], "-scale") == 0 && i + 1 < argc) {
+      scale = atoi(argv[++i]);
+      if (scale <= 0 || 8 % scale != 0)
+        usage(argv[0]);
+    } else if (strchr(argv[i], '=')) {
+      if (!Configuration::setParam(argv[i]))
+        usage(argv[0]);
+    } else {
+      usage(argv[0]);
+    }
+  }
+
+  // Both ends of every connection are on this machine
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 &&
+      rl.rlim_cur < (rlim_t)nViewers + 64) {
+    rl.rlim_cur = nViewers + 64;
+    if (rl.rlim_max != RLIM_INFINITY && rl.rlim_cur > rl.rlim_max)
+      rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  try {
+    // - Start the server
+    TcpListener* listener = new TcpListener(0, true);
+    int port = listener->getMyPort();
+    int resultPipe[2];
+    if (pipe(resultPipe) < 0)
+      throw rdr::SystemException("pipe", errno);
+
+    pid_t server = fork();
+    if (server < 0)
+      throw rdr::SystemException("fork", errno);
+    if (server == 0) {
+      close(resultPipe[0]);
+      try {
+        runServer(listener, size, script, resultPipe[1]);
+      } catch (rdr::Exception& e) {
+        fprintf(stderr, "loadgen server: %s\n", e.str());
+        _exit(1);
+      }
+      _exit(0);
+    }
+    close(resultPipe[1]);
+    delete listener;
+
+    // - Start any stalled viewers
+    pid_t stalled = 0;
+    if (nStalled) {
+      int readyPipe[2];
+      if (pipe(readyPipe) < 0)
+        throw rdr::SystemException("pipe", errno);
+      stalled = fork();
+      if (stalled < 0)
+        throw rdr::SystemException("fork", errno);
+      if (stalled == 0) {
+        close(readyPipe[0]);
+        close(resultPipe[0]);
+        ViewerSet viewers;
+        SocketManager manager;
+        viewers.connect(&manager, nViewers, nStalled, port, encoding,
+                        scale);
+        viewers.waitForFirstUpdates(&manager);
+        char ready = 0;
+        write(readyPipe[1], &ready, 1);
+        raise(SIGSTOP);
+        _exit(0);
+      }
+      close(readyPipe[1]);
+      char ready;
+      read(readyPipe[0], &ready, 1);
+      close(readyPipe[0]);
+    }
+
+    // - Connect the viewers, and wait for their first updates
+    ViewerSet viewers;
+    SocketManager manager;
+    double start = now();
+    viewers.connect(&manager, 0, nViewers, port, encoding, scale);
+    viewers.waitForFirstUpdates(&manager);
+    fprintf(stderr, "%d viewers connected in %.2fs\n", manager.numSockets(),
+            now() - start);
+
+    // - Measure
+    for (int i = 0; i < nViewers; i++)
+      viewers.viewers[i]->resetStats();
+    kill(server, SIGUSR1);
+    double cpuStart = cpuTime();
+    start = now();
+    double t;
+    while ((t = now()) - start < duration) {
+      manager.processEvents(10);
+      for (int i = 0; i < nViewers; i++)
+        viewers.viewers[i]->probe(t);
+    }
+    double elapsed = now() - start;
+    double viewerCpu = cpuTime() - cpuStart;
+
+    if (stalled) {
+      kill(stalled, SIGKILL);
+      waitpid(stalled, 0, 0);
+    }
+    kill(server, SIGTERM);
+    double serverCpu = 0;
+    if (read(resultPipe[0], &serverCpu, sizeof(serverCpu)) !=
+        sizeof(serverCpu))
+      fprintf(stderr, "loadgen: no result from server\n");
+    int status;
+    waitpid(server, &status, 0);
+
+    // - Report
+    printf("viewer,updates,updatesPerSec,kbitsPerSec,probes,"
+           "meanLatencyMs,maxLatencyMs\n");
+    long updates = 0, probes = 0, lost = 0, closed = 0;
+    double bytes = 0, totalLatency = 0, maxLatency = 0;
+    for (int i = 0; i < nViewers; i++) {
+      Viewer* v = viewers.viewers[i];
+      printf("%d,%d,%.1f,%.0f,%d,%.1f,%.1f\n", i, v->updates,
+             v->updates / elapsed, v->bytesRead() * 8 / elapsed / 1000,
+             v->probes, v->probes ? v->totalLatency / v->probes * 1000 : 0,
+             v->maxLatency * 1000);
+      updates += v->updates;
+      bytes += v->bytesRead();
+      probes += v->probes;
+      lost += v->lostProbes;
+      totalLatency += v->totalLatency;
+      if (v->maxLatency > maxLatency)
+        maxLatency = v->maxLatency;
+      if (!v->sock)
+        closed++;
+    }
+    printf("all,%ld,%.1f,%.0f,%ld,%.1f,%.1f\n", updates, updates / elapsed,
+           bytes * 8 / elapsed / 1000, probes,
+           probes ? totalLatency / probes * 1000 : 0, maxLatency * 1000);
+    printf("\nviewers,seconds,serverCpuPercent,viewerCpuPercent,"
+           "lostProbes,disconnected\n");
+    printf("%d,%.2f,%.1f,%.1f,%ld,%ld\n", nViewers, elapsed,
+           serverCpu / elapsed * 100, viewerCpu / elapsed * 100, lost, closed);
+    return closed ? 1 : 0;
+  } catch (rdr::Exception& e) {
+    fprintf(stderr, "loadgen: %s\n", e.str());
+    return 1;
+  }
+}
@@ -0,0 +1,310 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// regionbench - change tracking benchmark.
+//
+// Records a set of generated changes with an exact Region and with a
+// TileUpdateTracker, and prints one line of comma-separated values per
+// structure, change pattern, number of changes and operation:
+//
+//   structure,pattern,changes,operation,iterations,rects,area,seconds,usPerOp
+//
+// The "accumulate" operation adds each change in turn and then gets the
+// resulting rectangles, as the server does for each update.  The "union",
+// "intersect" and "subtract" operations combine two such sets of changes.
+// rects and area describe the result, so the cost of rounding out to whole
+// tiles can be seen alongside the time taken.  The "temporaries" operation,
+// which only applies to Region, makes the small short-lived regions which
+// the update trackers make for each change, to measure the cost of creating,
+// copying and destroying regions.
+//
+// Usage: regionbench [-size WIDTHxHEIGHT] [-tile SIZE] [-time SECONDS]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <rfb/Region.h>
+#include <rfb/TileUpdateTracker.h>
+
+using namespace rfb;
+
+// -=- Change patterns
+
+// A small linear congruential generator, so that every run sees the same
+// changes
+static unsigned int seed;
+static int rnd(int n)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) % n;
+}
+
+// scatter - small rectangles of random size anywhere on the screen
+static void makeScatter(std::vector<Region>* changes, const Rect& fb, int n)
+{
+  for (int i = 0; i < n; i++) {
+    int w = 1 + rnd(32), h = 1 + rnd(32);
+    int x = rnd(fb.width() - w), y = rnd(fb.height() - h);
+    changes->push_back(Rect(x, y, x + w, y + h));
+  }
+}
+
+// text - character cells typed along lines of text within a window
+static void makeText(std::vector<Region>* changes, const Rect& fb, int n)
+{
+  int left = fb.width() / 8, right = fb.width() * 7 / 8;
+  int x = left, y = fb.height() / 8;
+  for (int i = 0; i < n; i++) {
+    changes->push_back(Rect(x, y, x + 8, y + 16));
+    x += 8;
+    if (x + 8 > right || rnd(40) == 0) {
+      x = left + rnd(4) * 32;
+      y += 16;
+      if (y + 16 > fb.height() * 7 / 8)
+        y = fb.height() / 8;
+    }
+  }
+}
+
+// staircase - overlapping squares stepping diagonally, which gives an exact
+// region a separate band for almost every row
+static void makeStaircase(std::vector<Region>* changes, const Rect& fb, int n)
+{
+  int x = 0, y = 0;
+  for (int i = 0; i < n; i++) {
+    changes->push_back(Rect(x, y, x + 24, y + 24));
+    x += 5; y += 3;
+    if (x + 24 > fb.width() || y + 24 > fb.height()) {
+      x = rnd(fb.width() / 2);
+      y = 0;
+    }
+  }
+}
+
+// windows - a few large overlapping rectangles
+static void makeWindows(std::vector<Region>* changes, const Rect& fb, int n)
+{
+  for (int i = 0; i < n; i++) {
+    int w = fb.width() / 8 + rnd(fb.width() / 2);
+    int h = fb.height() / 8 + rnd(fb.height() / 2);
+    int x = rnd(fb.width() - w), y = rnd(fb.height() - h);
+    changes->push_back(Rect(x, y, x + w, y + h));
+  }
+}
+
+struct Pattern {
+  const char* name;
+  void (*make)(std::vector<Region>* changes, const Rect& fb, int n);
+};
+
+static const Pattern patterns[] = {
+  { "scatter", makeScatter },
+  { "text", makeText },
+  { "staircase", makeStaircase },
+  { "windows", makeWindows },
+};
+
+static const int changeCounts[] = { 10, 100, 1000, 10000 };
+
+
+// -=- Structures under test
+
+// rectsArea() adds up the areas of the rectangles.  They may overlap, as
+// those from the "temporaries" operation do, so the total can be far larger
+// than the framebuffer.
+
+static double rectsArea(const std::vector<Rect>& rects)
+{
+  double area = 0;
+  for (size_t i = 0; i < rects.size(); i++)
+    area += rects[i].area();
+  return area;
+}
+
+static void regionAccumulate(const std::vector<Region>& changes,
+                             Region* region)
+{
+  region->clear();
+  for (size_t i = 0; i < changes.size(); i++)
+    region->assign_union(changes[i]);
+}
+
+static void tilesAccumulate(const std::vector<Region>& changes,
+                            TileUpdateTracker* tiles)
+{
+  tiles->clear();
+  for (size_t i = 0; i < changes.size(); i++)
+    tiles->add_changed(changes[i]);
+}
+
+enum Operation { Accumulate, Union, Intersect, Subtract, Temporaries };
+
+static const char* operationNames[] = {
+  "accumulate", "union", "intersect", "subtract", "temporaries"
+};
+
+// runRegion() and runTiles() each perform the operation once, leaving the
+// resulting rectangles in rects.
+
+static void regionTemporaries(const std::vector<Region>& changes,
+                              const Rect& fb, std::vector<Rect>* rects)
+{
+  Region screen(fb), cursor(Rect(fb.width() / 2, fb.height() / 2,
+                                 fb.width() / 2 + 32, fb.height() / 2 + 32));
+  rects->clear();
+  for (size_t i = 0; i < changes.size(); i++) {
+    Region r(changes[i].get_bounding_rect());
+    Region copy = r;
+    Region clipped = copy.intersect(screen);
+    if (!clipped.union_(cursor).subtract(cursor).is_empty())
+      rects->push_back(clipped.get_bounding_rect());
+  }
+}
+
+static void runRegion(Operation op, const std::vector<Region>& a,
+                      const std::vector<Region>& b, const Rect& fb,
+                      std::vector<Rect>* rects)
+{
+  if (op == Temporaries) {
+    regionTemporaries(a, fb, rects);
+    return;
+  }
+
+  Region ra, rb;
+  regionAccumulate(a, &ra);
+  if (op != Accumulate) {
+    regionAccumulate(b, &rb);
+    switch (op) {
+    case Union:     ra.assign_union(rb);     break;
+    case Intersect: ra.assign_intersect(rb); break;
+    case Subtract:  ra.assign_subtract(rb);  break;
+    default: break;
+    }
+  }
+  rects->clear();
+  ra.get_rects(rects);
+}
+
+static void runTiles(Operation op, const std::vector<Region>& a,
+                     const std::vector<Region>& b, std::vector<Rect>* rects,
+                     TileUpdateTracker* ta, TileUpdateTracker* tb)
+{
+  tilesAccumulate(a, ta);
+  if (op != Accumulate) {
+    tilesAccumulate(b, tb);
+    switch (op) {
+    case Union:     ta->assign_union(*tb);     break;
+    case Intersect: ta->assign_intersect(*tb); break;
+    case Subtract:  ta->assign_subtract(*tb);  break;
+    default: break;
+    }
+  }
+  rects->clear();
+  ta->get_rects(rects);
+}
+
+static void report(const char* structure, const char* pattern, int changes,
+                   Operation op, int iterations, const std::vector<Rect>& rects,
+                   double seconds)
+{
+  printf("%s,%s,%d,%s,%d,%d,%.0f,%.3f,%.2f\n", structure, pattern, changes,
+         operationNames[op], iterations, (int)rects.size(), rectsArea(rects),
+         seconds, seconds * 1000000 / iterations);
+  fflush(stdout);
+}
+
+static void runBenchmark(const Pattern& p, int n, Operation op,
+                         const Rect& fb, int tileSize, double minTime)
+{
+  std::vector<Region> a, b;
+  seed = n;
+  p.make(&a, fb, n);
+  p.make(&b, fb, n);
+
+  std::vector<Rect> rects;
+  int iterations = 0;
+  double seconds = 0;
+  clock_t start = clock();
+  while (seconds < minTime) {
+    runRegion(op, a, b, fb, &rects);
+    iterations++;
+    seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  }
+  report("region", p.name, n, op, iterations, rects, seconds);
+  if (op == Temporaries)
+    return;
+
+  TileUpdateTracker ta(fb, tileSize), tb(fb, tileSize);
+  iterations = 0;
+  seconds = 0;
+  start = clock();
+  while (seconds < minTime) {
+    runTiles(op, a, b, &rects, &ta, &tb);
+    iterations++;
+    seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  }
+  report("tiles", p.name, n, op, iterations, rects, seconds);
+}
+
+static void usage(const char* prog)
+{
+  fprintf(stderr, "usage: %s [-size WIDTHxHEIGHT] [-tile SIZE] "
+          "[-time SECONDS]\n", prog);
+  exit(1);
+}
+
+int main(int argc, char** argv)
+{
+  int width = 1920, height = 1080, tileSize = 16;
+  double minTime = 0.2;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-size") == 0 && i + 1 < argc) {
+      if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 ||
+          width < 256 || height < 256 || width > 32767 || height > 32767)
+        usage(argv[0]);
+    } else if (strcmp(argv[i], "-tile") == 0 && i + 1 < argc) {
+      tileSize = atoi(argv[++i]);
+      if (tileSize < 1)
+        usage(argv[0]);
+    } else if (strcmp(argv[i], "-time") == 0 && i + 1 < argc) {
+      minTime = atof(argv[++i]);
+    } else {
+      usage(argv[0]);
+    }
+  }
+
+  Rect fb(0, 0, width, height);
+
+  printf("structure,pattern,changes,operation,iterations,rects,area,"
+         "seconds,usPerOp\n");
+
+  int nPatterns = sizeof(patterns) / sizeof(patterns[0]);
+  int nCounts = sizeof(changeCounts) / sizeof(changeCounts[0]);
+  for (int p = 0; p < nPatterns; p++)
+    for (int c = 0; c < nCounts; c++)
+      for (int op = Accumulate; op <= Temporaries; op++)
+        runBenchmark(patterns[p], changeCounts[c], (Operation)op, fb,
+                     tileSize, minTime);
+
+  return 0;
+}
@@ -21,11 +21,14 @@
 // This file is #included after having set the following macros:
 // BPP                - 8, 16 or 32
 //
-// The data argument to RRE_ENCODE contains the pixel data, and it writes the
-// encoded version to the given OutStream.  If the encoded version exceeds w*h
-// it aborts and returns -1, otherwise it returns the number of subrectangles.
+// The data argument to RRE_ENCODE contains the pixel data, with stride pixels
+// per row, and it writes the encoded version to the given OutStream.  The
+// pixel data is not modified, so it may point directly into a framebuffer.  If
+// the encoded version exceeds w*h it aborts and returns -1, otherwise it
+// returns the number of subrectangles.
 //
 
+#include <string.h>
 #include <rdr/OutStream.h>
 
 namespace rfb {
@@ -41,9 +44,10 @@ namespace rfb {
 #define WRITE_PIXEL CONCAT2E(writeOpaque,BPP)
 #define RRE_ENCODE CONCAT2E(rreEncode,BPP)
 
-int RRE_ENCODE (PIXEL_T* data, int w, int h, rdr::OutStream* os, PIXEL_T bg);
+int RRE_ENCODE (const PIXEL_T* data, int w, int h, int stride,
+                rdr::OutStream* os, PIXEL_T bg);
 
-int RRE_ENCODE (void* data, int w, int h, rdr::OutStream* os)
+int RRE_ENCODE (const void* data, int w, int h, int stride, rdr::OutStream* os)
 {
   // Find the background colour - count occurrences of up to 4 different pixel
   // values, and choose the one which occurs most often.
@@ -51,24 +55,29 @@ int RRE_ENCODE (void* data, int w, int h, rdr::OutStream* os)
   const int nCols = 4;
   PIXEL_T pix[nCols];
   int count[nCols] = { 0, };
-  PIXEL_T* ptr = (PIXEL_T*)data;
-  PIXEL_T* end = ptr + w*h;
-
-  while (ptr < end) {
-    int i;
-    for (i = 0; i < nCols; i++) {
-      if (count[i] == 0)
-        pix[i] = *ptr;
-
-      if (pix[i] == *ptr) {
-        count[i]++;
-        break;
+  const PIXEL_T* row = (const PIXEL_T*)data;
+
+  for (int y = 0; y < h; y++, row += stride) {
+    const PIXEL_T* ptr = row;
+    const PIXEL_T* eol = row + w;
+
+    while (ptr < eol) {
+      int i;
+      for (i = 0; i < nCols; i++) {
+        if (count[i] == 0)
+          pix[i] = *ptr;
+
+        if (pix[i] == *ptr) {
+          count[i]++;
+          break;
+        }
       }
-    }
 
-    if (i == nCols) break;
-    ptr++;
+      if (i == nCols) goto doneCounting;
+      ptr++;
+    }
   }
+doneCounting:
   
   int bg = 0;
   for (int i = 1; i < nCols; i++)
@@ -76,39 +85,43 @@ int RRE_ENCODE (void* data, int w, int h, rdr::OutStream* os)
 
   // Now call the function to do the encoding.
 
-  return RRE_ENCODE ((PIXEL_T*)data, w, h, os, pix[bg]);
+  return RRE_ENCODE ((const PIXEL_T*)data, w, h, stride, os, pix[bg]);
 }
 
-int RRE_ENCODE (PIXEL_T* data, int w, int h, rdr::OutStream* os, PIXEL_T bg)
+int RRE_ENCODE (const PIXEL_T* data, int w, int h, int stride,
+                rdr::OutStream* os, PIXEL_T bg)
 {
   int oldLen = os->length();
   os->WRITE_PIXEL(bg);
 
+  // Pixels already covered by a subrect are treated as background.  They are
+  // marked in a separate mask so that the pixel data itself is left alone.
+
+  rdr::U8Array covered(w*h);
+  memset(covered.buf, 0, w*h);
+
+#define RRE_PIXEL(px,py) (covered.buf[(py)*w+(px)] ? bg : data[(py)*stride+(px)])
+
   int nSubrects = 0;
 
   for (int y = 0; y < h; y++)
   {
     int x = 0;
     while (x < w) {
-      if (*data == bg) {
+      PIXEL_T pix = RRE_PIXEL(x,y);
+      if (pix == bg) {
         x++;
-        data++;
         continue;
       }
 
       // Find horizontal subrect first
-      PIXEL_T* ptr = data+1;
-      PIXEL_T* eol = data+w-x;
-      while (ptr < eol && *ptr == *data) ptr++;
-      int sw = ptr - data;
+      int sw = 1;
+      while (x+sw < w && RRE_PIXEL(x+sw,y) == pix) sw++;
 
-      ptr = data + w;
       int sh = 1;
       while (sh < h-y) {
-        eol = ptr + sw;
-        while (ptr < eol)
-          if (*ptr++ != *data) goto endOfHorizSubrect;
-        ptr += w - sw;
+        for (int i = 0; i < sw; i++)
+          if (RRE_PIXEL(x+i,y+sh) != pix) goto endOfHorizSubrect;
         sh++;
       }
     endOfHorizSubrect:
@@ -116,15 +129,13 @@ int RRE_ENCODE (PIXEL_T* data, int w, int h, rdr::OutStream* os, PIXEL_T bg)
       // Find vertical subrect
       int vh;
       for (vh = sh; vh < h-y; vh++)
-        if (data[vh*w] != *data) break;
+        if (RRE_PIXEL(x,y+vh) != pix) break;
 
       if (vh != sh) {
-        ptr = data+1;
         int vw;
         for (vw = 1; vw < sw; vw++) {
           for (int i = 0; i < vh; i++)
-            if (ptr[i*w] != *data) goto endOfVertSubrect;
-          ptr++;
+            if (RRE_PIXEL(x+vw,y+i) != pix) goto endOfVertSubrect;
         }
       endOfVertSubrect:
 
@@ -136,28 +147,23 @@ int RRE_ENCODE (PIXEL_T* data, int w, int h, rdr::OutStream* os, PIXEL_T bg)
       }
 
       nSubrects++;
-      os->WRITE_PIXEL(*data);
+      os->WRITE_PIXEL(pix);
       os->writeU16(x);
       os->writeU16(y);
       os->writeU16(sw);
       os->writeU16(sh);
       if (os->length() > oldLen + w*h) return -1;
 
-      ptr = data+w;
-      PIXEL_T* eor = data+w*sh;
-      while (ptr < eor) {
-        eol = ptr + sw;
-        while (ptr < eol) *ptr++ = bg;
-        ptr += w - sw;
-      }
+      for (int i = 1; i < sh; i++)
+        memset(&covered.buf[(y+i)*w+x], 1, sw);
       x += sw;
-      data += sw;
     }
   }
 
   return nSubrects;
 }
 
+#undef RRE_PIXEL
 #undef PIXEL_T
 #undef WRITE_PIXEL
 #undef RRE_ENCODE
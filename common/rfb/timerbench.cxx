@@ -0,0 +1,193 @@
+/* Copyright (C) 2002-2005 RealVNC Ltd.  All Rights Reserved.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// timerbench - rfb::Timer benchmark.
+//
+// Starts a number of Timers and prints one line of comma-separated values
+// per number of Timers and operation:
+//
+//   timers,operation,operations,seconds,usPerOp,lateMs
+//
+// The "restart" operation starts a randomly chosen Timer again with a new
+// timeout, as is done each time a client's idle timeout is reset.  The
+// "cancel" operation stops a randomly chosen Timer and starts it again.  The
+// "dispatch" operation runs a main loop with every Timer repeating at a
+// random interval of 10 to 1000ms, and counts each timeout.  Its seconds are
+// of CPU time, and lateMs is the average time by which timeouts were late.
+//
+// Usage: timerbench [-timers N] [-time SECONDS]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <vector>
+#include <rfb/Timer.h>
+
+using namespace rfb;
+
+// A small linear congruential generator, so that every run sees the same
+// timeouts
+static unsigned int seed;
+static int rnd(int n)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) % n;
+}
+
+static double now()
+{
+  timeval tv;
+  Timer::getTime(&tv);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+class BenchTimer : public Timer, public Timer::Callback {
+public:
+  BenchTimer() : Timer(this), fired(0), lateUs(0) {}
+  virtual ~BenchTimer() {}
+  virtual bool handleTimeout(Timer* t) {
+    timeval tv;
+    getTime(&tv);
+    lateUs += ((tv.tv_sec - dueTime.tv_sec) * 1000000.0 +
+               (tv.tv_usec - dueTime.tv_usec));
+    fired++;
+    return true;
+  }
+  int fired;
+  double lateUs;
+};
+
+static void report(int n, const char* operation, int operations,
+                   double seconds, double lateMs)
+{
+  printf("%d,%s,%d,%.3f,%.3f,%.2f\n", n, operation, operations, seconds,
+         seconds * 1000000 / operations, lateMs);
+  fflush(stdout);
+}
+
+// Long timeouts, which will not expire during the benchmark
+static void startAll(std::vector<BenchTimer*>& timers)
+{
+  for (size_t i = 0; i < timers.size(); i++)
+    timers[i]->start(60000 + rnd(60000));
+}
+
+static void runRestart(std::vector<BenchTimer*>& timers, double minTime)
+{
+  startAll(timers);
+  int operations = 0;
+  double seconds = 0;
+  clock_t start = clock();
+  while (seconds < minTime) {
+    for (int i = 0; i < 1000; i++)
+      timers[rnd(timers.size())]->start(60000 + rnd(60000));
+    operations += 1000;
+    seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  }
+  report(timers.size(), "restart", operations, seconds, 0);
+}
+
+static void runCancel(std::vector<BenchTimer*>& timers, double minTime)
+{
+  startAll(timers);
+  int operations = 0;
+  double seconds = 0;
+  clock_t start = clock();
+  while (seconds < minTime) {
+    for (int i = 0; i < 1000; i++) {
+      BenchTimer* t = timers[rnd(timers.size())];
+      t->stop();
+      t->start(60000 + rnd(60000));
+    }
+    operations += 1000;
+    seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  }
+  report(timers.size(), "cancel", operations, seconds, 0);
+}
+
+static void runDispatch(std::vector<BenchTimer*>& timers, double minTime)
+{
+  for (size_t i = 0; i < timers.size(); i++) {
+    timers[i]->fired = 0;
+    timers[i]->lateUs = 0;
+    timers[i]->start(10 + rnd(991));
+  }
+
+  clock_t start = clock();
+  double end = now() + minTime;
+  while (now() < end) {
+    int timeout = Timer::checkTimeouts();
+    poll(0, 0, timeout ? timeout : -1);
+  }
+  double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  int fired = 0;
+  double lateUs = 0;
+  for (size_t i = 0; i < timers.size(); i++) {
+    fired += timers[i]->fired;
+    lateUs += timers[i]->lateUs;
+    timers[i]->stop();
+  }
+  if (fired)
+    report(timers.size(), "dispatch", fired, seconds, lateUs / fired / 1000);
+}
+
+static void usage(const char* prog)
+{
+  fprintf(stderr, "usage: %s [-timers N] [-time SECONDS]\n", prog);
+  exit(1);
+}
+
+int main(int argc, char** argv)
+{
+  int counts[] = { 100, 1000, 10000 };
+  int nCounts = sizeof(counts) / sizeof(counts[0]);
+  double minTime = 1;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-timers") == 0 && i + 1 < argc) {
+      counts[0] = atoi(argv[++i]);
+      nCounts = 1;
+      if (counts[0] < 1)
+        usage(argv[0]);
+    } else if (strcmp(argv[i], "-time") == 0 && i + 1 < argc) {
+      minTime = atof(argv[++i]);
+    } else {
+      usage(argv[0]);
+    }
+  }
+
+  printf("timers,operation,operations,seconds,usPerOp,lateMs\n");
+
+  for (int c = 0; c < nCounts; c++) {
+    std::vector<BenchTimer*> timers;
+    for (int i = 0; i < counts[c]; i++)
+      timers.push_back(new BenchTimer);
+    seed = counts[c];
+    runRestart(timers, minTime);
+    runCancel(timers, minTime);
+    runDispatch(timers, minTime);
+    for (int i = 0; i < counts[c]; i++)
+      delete timers[i];
+  }
+
+  return 0;
+}
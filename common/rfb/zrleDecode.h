@@ -24,9 +24,13 @@
 // EXTRA_ARGS         - optional extra arguments
 // FILL_RECT          - fill a rectangle with a single colour
 // IMAGE_RECT         - draw a rectangle of pixel data from a buffer
+//
+// If a Zywrle object with a non-zero level is given, raw tiles are ZYWRLE
+// tiles: the tile's wavelet coefficients follow as a nested tile.
 
 #include <rdr/InStream.h>
 #include <rdr/ZlibInStream.h>
+#include <rfb/Zywrle.h>
 #include <assert.h>
 
 namespace rfb {
@@ -42,14 +46,19 @@ namespace rfb {
 #define PIXEL_T rdr::CONCAT2E(U,BPP)
 #define READ_PIXEL CONCAT2E(readOpaque,CPIXEL)
 #define ZRLE_DECODE CONCAT2E(zrleDecode,CPIXEL)
+#define ZRLE_READ_TILE CONCAT2E(zrleReadTile,CPIXEL)
 #else
 #define PIXEL_T rdr::CONCAT2E(U,BPP)
 #define READ_PIXEL CONCAT2E(readOpaque,BPP)
 #define ZRLE_DECODE CONCAT2E(zrleDecode,BPP)
+#define ZRLE_READ_TILE CONCAT2E(zrleReadTile,BPP)
 #endif
 
+bool ZRLE_READ_TILE (int w, int h, rdr::InStream* zis, PIXEL_T* buf,
+                     Zywrle* zywrle);
+
 void ZRLE_DECODE (const Rect& r, rdr::InStream* is,
-                      rdr::ZlibInStream* zis, PIXEL_T* buf
+                      rdr::ZlibInStream* zis, PIXEL_T* buf, Zywrle* zywrle
 #ifdef EXTRA_ARGS
                       , EXTRA_ARGS
 #endif
@@ -67,185 +76,147 @@ void ZRLE_DECODE (const Rect& r, rdr::InStream* is,
 
       t.br.x = __rfbmin(r.br.x, t.tl.x + 64);
 
-      int mode = zis->readU8();
-      bool rle = mode & 128;
-      int palSize = mode & 127;
-      PIXEL_T palette[128];
-
-      for (int i = 0; i < palSize; i++) {
-        palette[i] = zis->READ_PIXEL();
-      }
-
-      if (palSize == 1) {
-        PIXEL_T pix = palette[0];
+      if (ZRLE_READ_TILE(t.width(), t.height(), zis, buf, zywrle)) {
+        PIXEL_T pix = buf[0];
         FILL_RECT(t,pix);
-        continue;
+      } else {
+        IMAGE_RECT(t,buf);
       }
+    }
+  }
+
+  zis->reset();
+}
 
-      if (!rle) {
-        if (palSize == 0) {
+// ZRLE_READ_TILE reads a single w x h tile into buf.  If the tile is a single
+// colour it just sets buf[0] and returns true.
+
+bool ZRLE_READ_TILE (int w, int h, rdr::InStream* zis, PIXEL_T* buf,
+                     Zywrle* zywrle)
+{
+  int mode = zis->readU8();
+  bool rle = mode & 128;
+  int palSize = mode & 127;
+  PIXEL_T palette[128];
+
+  for (int i = 0; i < palSize; i++) {
+    palette[i] = zis->READ_PIXEL();
+  }
+
+  if (palSize == 1) {
+    buf[0] = palette[0];
+    return true;
+  }
+
+  if (!rle) {
+    if (palSize == 0) {
+
+      if (zywrle && zywrle->level()) {
+
+        // ZYWRLE - the wavelet coefficients follow as another tile
+
+        if (ZRLE_READ_TILE(w, h, zis, buf, 0)) {
+          for (PIXEL_T* ptr = buf+1; ptr < buf+w*h; ptr++)
+            *ptr = buf[0];
+        }
+        rdr::U32* pixels = zywrle->pixels;
+        for (int i = 0; i < w*h; i++)
+          pixels[i] = buf[i];
+        zywrle->synthesise(pixels, w, h);
+        for (int i = 0; i < w*h; i++)
+          buf[i] = pixels[i];
+        return false;
+      }
 
-          // raw
+      // raw
 
 #ifdef CPIXEL
-          for (PIXEL_T* ptr = buf; ptr < buf+t.area(); ptr++) {
-            *ptr = zis->READ_PIXEL();
-          }
+      for (PIXEL_T* ptr = buf; ptr < buf+w*h; ptr++) {
+        *ptr = zis->READ_PIXEL();
+      }
 #else
-          zis->readBytes(buf, t.area() * (BPP / 8));
+      zis->readBytes(buf, w * h * (BPP / 8));
 #endif
 
-        } else {
+    } else {
 
-          // packed pixels
-          int bppp = ((palSize > 16) ? 8 :
-                      ((palSize > 4) ? 4 : ((palSize > 2) ? 2 : 1)));
+      // packed pixels
+      int bppp = ((palSize > 16) ? 8 :
+                  ((palSize > 4) ? 4 : ((palSize > 2) ? 2 : 1)));
 
-          PIXEL_T* ptr = buf;
+      PIXEL_T* ptr = buf;
 
-          for (int i = 0; i < t.height(); i++) {
-            PIXEL_T* eol = ptr + t.width();
-            rdr::U8 byte = 0;
-            rdr::U8 nbits = 0;
+      for (int i = 0; i < h; i++) {
+        PIXEL_T* eol = ptr + w;
+        rdr::U8 byte = 0;
+        rdr::U8 nbits = 0;
 
-            while (ptr < eol) {
-              if (nbits == 0) {
-                byte = zis->readU8();
-                nbits = 8;
-              }
-              nbits -= bppp;
-              rdr::U8 index = (byte >> nbits) & ((1 << bppp) - 1) & 127;
-              *ptr++ = palette[index];
-            }
+        while (ptr < eol) {
+          if (nbits == 0) {
+            byte = zis->readU8();
+            nbits = 8;
           }
+          nbits -= bppp;
+          rdr::U8 index = (byte >> nbits) & ((1 << bppp) - 1) & 127;
+          *ptr++ = palette[index];
         }
+      }
+    }
 
-#ifdef FAVOUR_FILL_RECT
-       //fprintf(stderr,"copying data to screen %dx%d at %d,%d\n",
-        //t.width(),t.height(),t.tl.x,t.tl.y);
-        IMAGE_RECT(t,buf);
-#endif
+  } else {
 
-      } else {
+    if (palSize == 0) {
 
-        if (palSize == 0) {
-
-          // plain RLE
-
-          PIXEL_T* ptr = buf;
-          PIXEL_T* end = ptr + t.area();
-          while (ptr < end) {
-            PIXEL_T pix = zis->READ_PIXEL();
-            int len = 1;
-            int b;
-            do {
-              b = zis->readU8();
-              len += b;
-            } while (b == 255);
-
-            assert(len <= end - ptr);
-
-#ifdef FAVOUR_FILL_RECT
-            int i = ptr - buf;
-            ptr += len;
-
-            int runX = i % t.width();
-            int runY = i / t.width();
-
-            if (runX + len > t.width()) {
-              if (runX != 0) {
-                FILL_RECT(Rect(t.tl.x+runX, t.tl.y+runY, t.width()-runX, 1),
-                          pix);
-                len -= t.width()-runX;
-                runX = 0;
-                runY++;
-              }
-
-              if (len > t.width()) {
-                FILL_RECT(Rect(t.tl.x, t.tl.y+runY, t.width(), len/t.width()),
-                          pix);
-                runY += len / t.width();
-                len = len % t.width();
-              }
-            }
-
-            if (len != 0) {
-              FILL_RECT(Rect(t.tl.x+runX, t.tl.y+runY, len, 1), pix);
-            }
-#else
-            while (len-- > 0) *ptr++ = pix;
-#endif
+      // plain RLE
 
-          }
-        } else {
-
-          // palette RLE
-
-          PIXEL_T* ptr = buf;
-          PIXEL_T* end = ptr + t.area();
-          while (ptr < end) {
-            int index = zis->readU8();
-            int len = 1;
-            if (index & 128) {
-              int b;
-              do {
-                b = zis->readU8();
-                len += b;
-              } while (b == 255);
-
-              assert(len <= end - ptr);
-            }
-
-            index &= 127;
-
-            PIXEL_T pix = palette[index];
-
-#ifdef FAVOUR_FILL_RECT
-            int i = ptr - buf;
-            ptr += len;
-
-            int runX = i % t.width();
-            int runY = i / t.width();
-
-            if (runX + len > t.width()) {
-              if (runX != 0) {
-                FILL_RECT(Rect(t.tl.x+runX, t.tl.y+runY, t.width()-runX, 1),
-                          pix);
-                len -= t.width()-runX;
-                runX = 0;
-                runY++;
-              }
-
-              if (len > t.width()) {
-                FILL_RECT(Rect(t.tl.x, t.tl.y+runY, t.width(), len/t.width()),
-                          pix);
-                runY += len / t.width();
-                len = len % t.width();
-              }
-            }
-
-            if (len != 0) {
-              FILL_RECT(Rect(t.tl.x+runX, t.tl.y+runY, len, 1), pix);
-            }
-#else
-            while (len-- > 0) *ptr++ = pix;
-#endif
-          }
-        }
+      PIXEL_T* ptr = buf;
+      PIXEL_T* end = ptr + w*h;
+      while (ptr < end) {
+        PIXEL_T pix = zis->READ_PIXEL();
+        int len = 1;
+        int b;
+        do {
+          b = zis->readU8();
+          len += b;
+        } while (b == 255);
+
+        assert(len <= end - ptr);
+
+        while (len-- > 0) *ptr++ = pix;
       }
+    } else {
+
+      // palette RLE
+
+      PIXEL_T* ptr = buf;
+      PIXEL_T* end = ptr + w*h;
+      while (ptr < end) {
+        int index = zis->readU8();
+        int len = 1;
+        if (index & 128) {
+          int b;
+          do {
+            b = zis->readU8();
+            len += b;
+          } while (b == 255);
+
+          assert(len <= end - ptr);
+        }
 
-#ifndef FAVOUR_FILL_RECT
-      //fprintf(stderr,"copying data to screen %dx%d at %d,%d\n",
-      //t.width(),t.height(),t.tl.x,t.tl.y);
-      IMAGE_RECT(t,buf);
-#endif
+        index &= 127;
+
+        PIXEL_T pix = palette[index];
+
+        while (len-- > 0) *ptr++ = pix;
+      }
     }
   }
 
-  zis->reset();
+  return false;
 }
 
 #undef ZRLE_DECODE
+#undef ZRLE_READ_TILE
 #undef READ_PIXEL
 #undef PIXEL_T
 }
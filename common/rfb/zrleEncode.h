@@ -23,14 +23,21 @@
 // BPP                - 8, 16 or 32
 // EXTRA_ARGS         - optional extra arguments
 // GET_IMAGE_INTO_BUF - gets a rectangle of pixel data into a buffer
+// GET_PIXELS_R       - optional, gets a read-only pointer to a rectangle of
+//                      pixel data and its stride, or null if there is none,
+//                      in which case GET_IMAGE_INTO_BUF is used instead
 //
-// Note that the buf argument to ZRLE_ENCODE needs to be at least one pixel
-// bigger than the largest tile of pixel data, since the ZRLE encoding
-// algorithm writes to the position one past the end of the pixel data.
+// ZRLE_ENCODE_TILE never modifies the pixel data it is given, so it may point
+// directly into a framebuffer.
+//
+// If a Zywrle object with a non-zero level is given, tiles which would be
+// sent raw are sent as ZYWRLE tiles instead: a raw subencoding followed by
+// the tile's wavelet coefficients as a nested tile.
 //
 
 #include <rdr/OutStream.h>
 #include <rdr/ZlibOutStream.h>
+#include <rfb/Zywrle.h>
 #include <assert.h>
 
 namespace rfb {
@@ -47,12 +54,14 @@ namespace rfb {
 #define WRITE_PIXEL CONCAT2E(writeOpaque,CPIXEL)
 #define ZRLE_ENCODE CONCAT2E(zrleEncode,CPIXEL)
 #define ZRLE_ENCODE_TILE CONCAT2E(zrleEncodeTile,CPIXEL)
+#define ZRLE_WRITE_RUN CONCAT2E(zrleWriteRun,CPIXEL)
 #define BPPOUT 24
 #else
 #define PIXEL_T rdr::CONCAT2E(U,BPP)
 #define WRITE_PIXEL CONCAT2E(writeOpaque,BPP)
 #define ZRLE_ENCODE CONCAT2E(zrleEncode,BPP)
 #define ZRLE_ENCODE_TILE CONCAT2E(zrleEncodeTile,BPP)
+#define ZRLE_WRITE_RUN CONCAT2E(zrleWriteRun,BPP)
 #define BPPOUT BPP
 #endif
 
@@ -112,10 +121,14 @@ public:
 };
 #endif
 
-void ZRLE_ENCODE_TILE (PIXEL_T* data, int w, int h, rdr::OutStream* os);
+void ZRLE_ENCODE_TILE (const PIXEL_T* data, int w, int h, int stride,
+                       rdr::OutStream* os, Zywrle* zywrle);
+void ZRLE_WRITE_RUN (PIXEL_T pix, int len, PaletteHelper* ph,
+                     rdr::OutStream* os);
 
 bool ZRLE_ENCODE (const Rect& r, rdr::OutStream* os,
-                  rdr::ZlibOutStream* zos, void* buf, int maxLen, Rect* actual
+                  rdr::ZlibOutStream* zos, void* buf, int maxLen, Rect* actual,
+                  Zywrle* zywrle
 #ifdef EXTRA_ARGS
                   , EXTRA_ARGS
 #endif
@@ -145,9 +158,18 @@ bool ZRLE_ENCODE (const Rect& r, rdr::OutStream* os,
 
       t.br.x = __rfbmin(r.br.x, t.tl.x + 64);
 
-      GET_IMAGE_INTO_BUF(t,buf);
+      const PIXEL_T* data = 0;
+      int stride = t.width();
+#ifdef GET_PIXELS_R
+      data = (const PIXEL_T*)GET_PIXELS_R(t,&stride);
+#endif
+      if (!data) {
+        GET_IMAGE_INTO_BUF(t,buf);
+        data = (const PIXEL_T*)buf;
+        stride = t.width();
+      }
 
-      ZRLE_ENCODE_TILE((PIXEL_T*)buf, t.width(), t.height(), zos);
+      ZRLE_ENCODE_TILE(data, t.width(), t.height(), stride, zos, zywrle);
     }
 
     zos->flush();
@@ -156,29 +178,35 @@ bool ZRLE_ENCODE (const Rect& r, rdr::OutStream* os,
 }
 
 
-void ZRLE_ENCODE_TILE (PIXEL_T* data, int w, int h, rdr::OutStream* os)
+void ZRLE_ENCODE_TILE (const PIXEL_T* data, int w, int h, int stride,
+                       rdr::OutStream* os, Zywrle* zywrle)
 {
-  // First find the palette and the number of runs
+  // First find the palette and the number of runs.  Runs carry on from the
+  // end of one row to the start of the next.
 
   PaletteHelper ph;
 
   int runs = 0;
   int singlePixels = 0;
 
-  PIXEL_T* ptr = data;
-  PIXEL_T* end = ptr + h * w;
-  *end = ~*(end-1); // one past the end is different so the while loop ends
+  PIXEL_T runPix = *data;
+  int runLen = 0;
+  const PIXEL_T* row = data;
 
-  while (ptr < end) {
-    PIXEL_T pix = *ptr;
-    if (*++ptr != pix) {
-      singlePixels++;
-    } else {
-      while (*++ptr == pix) ;
-      runs++;
+  for (int y = 0; y < h; y++, row += stride) {
+    for (const PIXEL_T* ptr = row; ptr < row + w; ptr++) {
+      if (*ptr == runPix) {
+        runLen++;
+        continue;
+      }
+      if (runLen == 1) singlePixels++; else runs++;
+      ph.insert(runPix);
+      runPix = *ptr;
+      runLen = 1;
     }
-    ph.insert(pix);
   }
+  if (runLen == 1) singlePixels++; else runs++;
+  ph.insert(runPix);
 
   //fprintf(stderr,"runs %d, single pixels %d, paletteSize %d\n",
   //        runs, singlePixels, ph.size);
@@ -239,36 +267,22 @@ void ZRLE_ENCODE_TILE (PIXEL_T* data, int w, int h, rdr::OutStream* os)
 
   if (useRle) {
 
-    PIXEL_T* ptr = data;
-    PIXEL_T* end = ptr + w * h;
-    PIXEL_T* runStart;
-    PIXEL_T pix;
-    while (ptr < end) {
-      runStart = ptr;
-      pix = *ptr++;
-      while (*ptr == pix && ptr < end)
-        ptr++;
-      int len = ptr - runStart;
-      if (len <= 2 && usePalette) {
-        int index = ph.lookup(pix);
-        if (len == 2)
-          os->writeU8(index);
-        os->writeU8(index);
-        continue;
-      }
-      if (usePalette) {
-        int index = ph.lookup(pix);
-        os->writeU8(index | 128);
-      } else {
-        os->WRITE_PIXEL(pix);
-      }
-      len -= 1;
-      while (len >= 255) {
-        os->writeU8(255);
-        len -= 255;
+    runPix = *data;
+    runLen = 0;
+    row = data;
+
+    for (int y = 0; y < h; y++, row += stride) {
+      for (const PIXEL_T* ptr = row; ptr < row + w; ptr++) {
+        if (*ptr == runPix) {
+          runLen++;
+          continue;
+        }
+        ZRLE_WRITE_RUN(runPix, runLen, usePalette ? &ph : 0, os);
+        runPix = *ptr;
+        runLen = 1;
       }
-      os->writeU8(len);
     }
+    ZRLE_WRITE_RUN(runPix, runLen, usePalette ? &ph : 0, os);
 
   } else {
 
@@ -282,13 +296,12 @@ void ZRLE_ENCODE_TILE (PIXEL_T* data, int w, int h, rdr::OutStream* os)
 
       int bppp = bitsPerPackedPixel[ph.size-1];
 
-      PIXEL_T* ptr = data;
-
       for (int i = 0; i < h; i++) {
         rdr::U8 nbits = 0;
         rdr::U8 byte = 0;
 
-        PIXEL_T* eol = ptr + w;
+        const PIXEL_T* ptr = data + i * stride;
+        const PIXEL_T* eol = ptr + w;
 
         while (ptr < eol) {
           PIXEL_T pix = *ptr++;
@@ -305,24 +318,71 @@ void ZRLE_ENCODE_TILE (PIXEL_T* data, int w, int h, rdr::OutStream* os)
           os->writeU8(byte);
         }
       }
+    } else if (zywrle && zywrle->level()) {
+
+      // ZYWRLE - send the wavelet coefficients as another tile.  The pixels
+      // are narrowed back to PIXEL_T in place, which is safe going forwards.
+
+      rdr::U32* pixels = zywrle->pixels;
+      for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++)
+          *pixels++ = data[y * stride + x];
+      zywrle->analyse(zywrle->pixels, w, h);
+
+      PIXEL_T* coeffs = (PIXEL_T*)zywrle->pixels;
+      for (int i = 0; i < w * h; i++)
+        coeffs[i] = zywrle->pixels[i];
+      ZRLE_ENCODE_TILE(coeffs, w, h, w, os, 0);
+
     } else {
 
       // raw
 
+      for (int i = 0; i < h; i++) {
 #ifdef CPIXEL
-      for (PIXEL_T* ptr = data; ptr < data+w*h; ptr++) {
-        os->WRITE_PIXEL(*ptr);
-      }
+        const PIXEL_T* ptr = data + i * stride;
+        for (const PIXEL_T* eol = ptr + w; ptr < eol; ptr++) {
+          os->WRITE_PIXEL(*ptr);
+        }
 #else
-      os->writeBytes(data, w*h*(BPP/8));
+        os->writeBytes(data + i * stride, w*(BPP/8));
 #endif
+      }
     }
   }
 }
 
+// ZRLE_WRITE_RUN writes a single run of len pixels of value pix, either as a
+// palette index if ph is given, or as the pixel value itself.
+
+void ZRLE_WRITE_RUN (PIXEL_T pix, int len, PaletteHelper* ph,
+                     rdr::OutStream* os)
+{
+  if (len <= 2 && ph) {
+    int index = ph->lookup(pix);
+    if (len == 2)
+      os->writeU8(index);
+    os->writeU8(index);
+    return;
+  }
+  if (ph) {
+    int index = ph->lookup(pix);
+    os->writeU8(index | 128);
+  } else {
+    os->WRITE_PIXEL(pix);
+  }
+  len -= 1;
+  while (len >= 255) {
+    os->writeU8(255);
+    len -= 255;
+  }
+  os->writeU8(len);
+}
+
 #undef PIXEL_T
 #undef WRITE_PIXEL
 #undef ZRLE_ENCODE
 #undef ZRLE_ENCODE_TILE
+#undef ZRLE_WRITE_RUN
 #undef BPPOUT
 }
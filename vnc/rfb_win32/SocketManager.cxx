@@ -21,6 +21,7 @@
 #include <winsock2.h>
 #include <list>
 #include <rfb/LogWriter.h>
+#include <rfb/Timer.h>
 #include <rfb_win32/SocketManager.h>
 
 using namespace rfb;
@@ -132,6 +133,7 @@ void SocketManager::remSocket(network::Socket* sock_) {
 int SocketManager::checkTimeouts() {
   network::SocketServer* server = 0;
   int timeout = EventManager::checkTimeouts();
+  soonestTimeout(&timeout, rfb::Timer::checkTimeouts());
 
   std::map<HANDLE,ListenInfo>::iterator i;
   for (i=listeners.begin(); i!=listeners.end(); i++)
@@ -190,16 +192,25 @@ void SocketManager::processEvent(HANDLE event) {
       // Reset the event object
       WSAResetEvent(event);
 
+      // Send any queued output the socket can now take
+      if (ci.sock->outStream().bufferUsage())
+        ci.server->processSocketWriteEvent(ci.sock);
+
       // Call the socket server to process the event
-      ci.server->processSocketEvent(ci.sock);
+      if (!ci.sock->isShutdown())
+        ci.server->processSocketEvent(ci.sock);
       if (ci.sock->isShutdown()) {
         remSocket(ci.sock);
         return;
       }
 
-      // Re-instate the required socket event
+      // Re-instate the required socket event, asking to hear when the
+      // socket can be written to if there is still output queued
       // If the read event is still valid, the event object gets set here
-      if (WSAEventSelect(ci.sock->getFd(), event, FD_READ | FD_CLOSE) == SOCKET_ERROR)
+      long events = FD_READ | FD_CLOSE;
+      if (ci.sock->outStream().bufferUsage())
+        events |= FD_WRITE;
+      if (WSAEventSelect(ci.sock->getFd(), event, events) == SOCKET_ERROR)
         throw rdr::SystemException("unable to re-enable WSAEventSelect:%u", WSAGetLastError());
     } catch (rdr::Exception& e) {
       vlog.error(e.str());
@@ -27,8 +27,12 @@
 #include <rfb/CSecurityNone.h>
 #include <rfb/CSecurityVncAuth.h>
 #include <rfb/CMsgWriter.h>
+#include <rfb/fenceTypes.h>
+#include <rdr/MemInStream.h>
+#include <rdr/MemOutStream.h>
 #include <rfb/Configuration.h>
 #include <rfb/LogWriter.h>
+#include <rfb/Timer.h>
 #include <rfb_win32/AboutDialog.h>
 
 using namespace rfb;
@@ -54,6 +58,17 @@ const int IDM_ALT_KEY = 11;
 
 static IntParameter debugDelay("DebugDelay","Milliseconds to display inverted "
                                "pixel data - a debugging feature", 0);
+static IntParameter tileCacheSize("TileCacheSize","Number of 64x64 tiles to "
+                                  "keep so the server can refer to them "
+                                  "rather than resend them (0 disables)", 1024);
+static BoolParameter useContinuousUpdates("ContinuousUpdates",
+                                          "Let the server send updates "
+                                          "without waiting to be asked, if "
+                                          "it supports this", true);
+static IntParameter maxUpdateRequests("MaxUpdateRequests",
+                                      "Maximum number of update requests to "
+                                      "keep outstanding when the server "
+                                      "can't send updates continuously", 4);
 
 
 //
@@ -66,7 +81,19 @@ RegKey            CConn::userConfigKey;
 CConn::CConn() 
   : window(0), sock(0), sockEvent(CreateEvent(0, TRUE, FALSE, 0)), requestUpdate(false),
     sameMachine(false), encodingChange(false), formatChange(false),
-    reverseConnection(false), lastUsedEncoding_(encodingRaw), isClosed_(false) {
+    pendingFormat(false),
+    reverseConnection(false), serverSupportsFence(false),
+    supportsSyncFence(false), serverSupportsContinuousUpdates(false),
+    continuousUpdates(false), requestsInFlight(0), requestWindow(1),
+    inUpdate(false), haveReadyTime(false), busyTime(0),
+    lastUsedEncoding_(encodingRaw),
+    isClosed_(false) {
+  // The tile cache size can't change once the connection is running, since
+  // both ends would have to empty their caches at the same moment
+  cp.tileCacheSize = tileCacheSize;
+  cp.supportsFence = true;
+  cp.supportsContinuousUpdates = useContinuousUpdates;
+  Timer::getTime(&updateStartTime);
 }
 
 CConn::~CConn() {
@@ -183,8 +210,11 @@ CConn::sysCommand(WPARAM wParam, LPARAM lParam) {
     return true;
   case IDM_REQUEST_REFRESH:
     try {
-      writer()->writeFramebufferUpdateRequest(Rect(0,0,cp.width,cp.height), false);
-      requestUpdate = false;
+      // Asked for with the next request, so that the request is counted.
+      // That waits for the last to be answered if the server has no fences.
+      refreshRect = Rect(0, 0, cp.width, cp.height);
+      requestUpdate = true;
+      requestNewUpdate();
     } catch (rdr::Exception& e) {
       close(e.str());
     }
@@ -362,6 +392,10 @@ CConn::setDesktopSize(int w, int h) {
 
   // Tell the underlying CConnection
   CConnection::setDesktopSize(w, h);
+
+  // Continuous updates cover the whole desktop
+  if (continuousUpdates)
+    writer()->writeEnableContinuousUpdates(true, Rect(0, 0, w, h));
 }
 
 void
@@ -396,8 +430,48 @@ CConn::showOptionsDialog() {
 }
 
 
+void
+CConn::framebufferUpdateStart() {
+  inUpdate = true;
+  Timer::getTime(&updateStartTime);
+  if (continuousUpdates)
+    return;
+
+  // The server answers all the requests it has received in one update, so
+  // once several are outstanding requestsInFlight is only an upper bound.
+  // It is kept within the window so that it can't creep upwards; with fences
+  // nothing but the pacing of requests depends on it.
+  if (requestsInFlight > requestWindow)
+    requestsInFlight = requestWindow;
+  if (requestsInFlight > 0)
+    requestsInFlight--;
+
+  // Without fences this update answers the only request outstanding, so ask
+  // for the next one now, to arrive while this one is decoded and painted
+  if (!supportsSyncFence) {
+    requestUpdate = true;
+    requestNewUpdate();
+    return;
+  }
+
+  // If we sat idle for longer than the last update took to decode and
+  // paint then another request in flight would have hidden the wait.  Only
+  // a server with fences can be sent more than one, since a pixel format
+  // change relies on them once a count of requests can't be trusted.
+  if (haveReadyTime) {
+    if (Timer::msSince(readyTime) > busyTime && supportsSyncFence &&
+        requestWindow < maxUpdateRequests) {
+      requestWindow++;
+      vlog.debug("update request window %d", requestWindow);
+    }
+    haveReadyTime = false;
+  }
+}
+
 void
 CConn::framebufferUpdateEnd() {
+  inUpdate = false;
+
   if (debugDelay != 0) {
     vlog.debug("debug delay %d",(int)debugDelay);
     UpdateWindow(window->getHandle());
@@ -408,9 +482,24 @@ CConn::framebufferUpdateEnd() {
     }
     debugRects.clear();
   }
+
+  // The next update will be in the format asked for at the start of this one
+  if (pendingFormat) {
+    setPF(pendingPF);
+    pendingFormat = false;
+  }
+
   if (options.autoSelect)
     autoSelectFormatAndEncoding();
 
+  // If the next update has already arrived then we're falling behind the
+  // server, so keep fewer requests outstanding
+  if (!continuousUpdates && requestWindow > 1 &&
+      sock->inStream().checkNoWait(1)) {
+    requestWindow--;
+    vlog.debug("update request window %d", requestWindow);
+  }
+
   // Always request the next update
   requestUpdate = true;
 
@@ -466,36 +555,49 @@ void
 CConn::requestNewUpdate() {
   if (!requestUpdate) return;
 
+  // Without fences only one request is ever outstanding, so it is known
+  // when the server has answered it.  Then the format can be changed and the
+  // next request sent, which happens as the answering update starts.
+  bool syncFormat = continuousUpdates || supportsSyncFence;
+  if (!syncFormat && requestsInFlight > 0)
+    return;
+
   if (formatChange) {
     // Select the required pixel format
+    PixelFormat pf;
     if (options.fullColour) {
-      window->setPF(fullColourPF);
+      pf = fullColourPF;
     } else {
       switch (options.lowColourLevel) {
       case 0:
-        window->setPF(PixelFormat(8,3,0,1,1,1,1,2,1,0));
+        pf = PixelFormat(8,3,0,1,1,1,1,2,1,0);
         break;
       case 1:
-        window->setPF(PixelFormat(8,6,0,1,3,3,3,4,2,0));
+        pf = PixelFormat(8,6,0,1,3,3,3,4,2,0);
         break;
       case 2:
-        window->setPF(PixelFormat(8,8,0,0,0,0,0,0,0,0));
+        pf = PixelFormat(8,8,0,0,0,0,0,0,0,0);
         break;
       }
     }
 
-    // Print the current pixel format
-    char str[256];
-    window->getPF().print(str, 256);
-    vlog.info("Using pixel format %s",str);
-
-    // Save the connection pixel format and tell server to use it
-    cp.setPF(window->getPF());
-    writer()->writeSetPixelFormat(cp.pf());
+    if (syncFormat) {
+      // Send the format in a fence which the server returns once it has
+      // switched, and switch when it comes back
+      rdr::MemOutStream memStream;
+      pf.write(&memStream);
+      writer()->writeFence(fenceFlagRequest | fenceFlagSyncNext,
+                           memStream.length(), (const char*)memStream.data());
+    } else if (inUpdate) {
+      // The update being decoded is still in the old format
+      pendingPF = pf;
+      pendingFormat = true;
+    } else {
+      setPF(pf);
+    }
 
-    // Correct the local window's palette
-    if (!window->getNativePF().trueColour)
-      window->refreshWindowPalette(0, 1 << cp.pf().depth);
+    // Tell the server to use the new format
+    writer()->writeSetPixelFormat(pf);
   }
 
   if (encodingChange) {
@@ -503,12 +605,59 @@ CConn::requestNewUpdate() {
     writer()->writeSetEncodings(options.preferredEncoding, true);
   }
 
-  writer()->writeFramebufferUpdateRequest(Rect(0, 0, cp.width, cp.height),
-                                          !formatChange);
+  // With continuous updates the server sends changes unasked, but a new
+  // format needs a full update.  Tiles which were missing from the tile
+  // cache are asked for in place of the usual incremental request, which
+  // the next one will make up for.
+  Rect fullRect(0, 0, cp.width, cp.height);
+  if (formatChange)
+    writeUpdateRequest(fullRect, false);
+  else if (!refreshRect.is_empty())
+    writeUpdateRequest(refreshRect, false);
+  else if (!continuousUpdates)
+    writeUpdateRequest(fullRect, true);
+  refreshRect = Rect();
+
+  // Otherwise keep the request window full, noting how long the last
+  // update took to decode and paint
+  if (!continuousUpdates) {
+    while (requestsInFlight < requestWindow)
+      writeUpdateRequest(fullRect, true);
+    if (!inUpdate) {
+      Timer::getTime(&readyTime);
+      busyTime = Timer::msSince(updateStartTime);
+      haveReadyTime = true;
+    }
+  }
 
   encodingChange = formatChange = requestUpdate = false;
 }
 
+void
+CConn::writeUpdateRequest(const Rect& r, bool incremental) {
+  writer()->writeFramebufferUpdateRequest(r, incremental);
+  if (!continuousUpdates)
+    requestsInFlight++;
+}
+
+
+void
+CConn::setPF(const PixelFormat& pf) {
+  window->setPF(pf);
+
+  // Print the current pixel format
+  char str[256];
+  window->getPF().print(str, 256);
+  vlog.info("Using pixel format %s",str);
+
+  // Save the connection pixel format
+  cp.setPF(window->getPF());
+
+  // Correct the local window's palette
+  if (!window->getNativePF().trueColour)
+    window->refreshWindowPalette(0, 1 << cp.pf().depth);
+}
+
 
 void
 CConn::calculateFullColourPF() {
@@ -604,6 +753,66 @@ void CConn::imageRect(const Rect& r, void* pixels) {
 void CConn::copyRect(const Rect& r, int srcX, int srcY) {
   window->copyRect(r, srcX, srcY);
 }
+void CConn::getImage(void* pixels, const Rect& r) {
+  window->getImage(pixels, r);
+}
+void CConn::cachedTileMissing(const Rect& r) {
+  // Request it with the next update, so that the request is counted
+  refreshRect = refreshRect.union_boundary(r);
+}
+
+void CConn::fence(rdr::U32 flags, int len, const char* data) {
+  // Return the server's own fences
+  if (flags & fenceFlagRequest) {
+    CConnection::fence(flags, len, data);
+
+    // The first one shows the server supports fences.  Check whether it
+    // honours fenceFlagSyncNext, which changing format with continuous
+    // updates relies on.
+    if (!serverSupportsFence) {
+      serverSupportsFence = true;
+      writer()->writeFence(fenceFlagRequest | fenceFlagSyncNext, 0, 0);
+    }
+    return;
+  }
+
+  if (len == 0) {
+    // Reply to the probe above
+    if (flags & fenceFlagSyncNext) {
+      supportsSyncFence = true;
+      checkContinuousUpdates();
+    }
+  } else {
+    // A pixel format change has taken effect
+    rdr::MemInStream memStream(data, len);
+    PixelFormat pf;
+    pf.read(&memStream);
+    setPF(pf);
+  }
+}
+
+void CConn::endOfContinuousUpdates() {
+  // The first one shows the server supports continuous updates, and any
+  // later one that it has stopped sending them
+  if (!serverSupportsContinuousUpdates) {
+    serverSupportsContinuousUpdates = true;
+    checkContinuousUpdates();
+  } else {
+    continuousUpdates = false;
+  }
+}
+
+// checkContinuousUpdates() enables continuous updates once the server has
+// shown that it supports them and the fences needed to change format safely.
+
+void CConn::checkContinuousUpdates() {
+  if (continuousUpdates || !supportsSyncFence ||
+      !serverSupportsContinuousUpdates || !cp.supportsContinuousUpdates)
+    return;
+  vlog.info("Enabling continuous updates");
+  continuousUpdates = true;
+  writer()->writeEnableContinuousUpdates(true, Rect(0, 0, cp.width, cp.height));
+}
 
 void CConn::getUserPasswd(char** user, char** password) {
   if (user && options.userName.buf)
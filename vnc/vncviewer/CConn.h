@@ -97,6 +97,7 @@ namespace rfb {
       CSecurity* getCSecurity(int secType);
       void setColourMapEntries(int firstColour, int nColours, rdr::U16* rgbs);
       void bell();
+      void framebufferUpdateStart();
       void framebufferUpdateEnd();
       void setDesktopSize(int w, int h);
       void setCursor(int w, int h, const Point& hotspot, void* data, void* mask);
@@ -108,6 +109,10 @@ namespace rfb {
       void fillRect(const Rect& r, Pixel pix);
       void imageRect(const Rect& r, void* pixels);
       void copyRect(const Rect& r, int srcX, int srcY);
+      void getImage(void* pixels, const Rect& r);
+      void cachedTileMissing(const Rect& r);
+      void fence(rdr::U32 flags, int len, const char* data);
+      void endOfContinuousUpdates();
 
       // rdr::FdInStreamBlockCallback interface
       void blockCallback();
@@ -119,7 +124,10 @@ namespace rfb {
       // CConn-specific internal interface
       void autoSelectFormatAndEncoding();
       void requestNewUpdate();
+      void writeUpdateRequest(const Rect& r, bool incremental);
       void calculateFullColourPF();
+      void setPF(const PixelFormat& pf);
+      void checkContinuousUpdates();
 
       // The desktop window
       DesktopWindow* window;
@@ -139,12 +147,42 @@ namespace rfb {
       bool formatChange;
       int lastUsedEncoding_;
 
+      // A format already asked of a server without fences, which is switched
+      // to once the update being decoded, still in the old one, is done
+      bool pendingFormat;
+      PixelFormat pendingPF;
+
       // Networking and RFB protocol
       network::Socket* sock;
       Handle sockEvent;
       bool reverseConnection;
       bool requestUpdate;
 
+      // Server-side support for fences and continuous updates
+      bool serverSupportsFence;
+      bool supportsSyncFence;
+      bool serverSupportsContinuousUpdates;
+      bool continuousUpdates;
+
+      // Pipelining of update requests, for servers which can't send updates
+      // continuously.  Up to requestWindow requests are kept outstanding, the
+      // window growing while we sit idle waiting for updates and shrinking
+      // when they arrive faster than we can decode and paint them.  A server
+      // without fences may answer any number of requests with one update, so
+      // only one is kept outstanding, but it is sent as soon as an update
+      // starts to arrive rather than once it has been painted.
+      int requestsInFlight;
+      int requestWindow;
+      bool inUpdate;
+      bool haveReadyTime;
+      int busyTime;
+      timeval updateStartTime;
+      timeval readyTime;
+
+      // Part of the framebuffer to request again, since its cached tiles
+      // were missing
+      Rect refreshRect;
+
       // Debugging/logging
       std::list<Rect> debugRects;
       CharArray closeReason_;
@@ -933,6 +933,10 @@ void DesktopWindow::copyRect(const Rect& r, int srcX, int srcY) {
   buffer->copyRect(r, Point(r.tl.x-srcX, r.tl.y-srcY));
   invalidateDesktopRect(r);
 }
+void DesktopWindow::getImage(void* pixels, const Rect& r) {
+  if (cursorBackingRect.overlaps(r)) hideLocalCursor();
+  buffer->getImage(pixels, r);
+}
 
 void DesktopWindow::invertRect(const Rect& r) {
   int stride;
@@ -99,6 +99,9 @@ namespace rfb {
       void imageRect(const Rect& r, void* pixels);
       void copyRect(const Rect& r, int srcX, int srcY);
 
+      // - Read back from the desktop buffer
+      void getImage(void* pixels, const Rect& r);
+
       void invertRect(const Rect& r);
 
       // - Update the window palette if the display is palette-based.